@@ -23,6 +23,12 @@ func swift_log_bridge(msg: UnsafePointer<CChar>?) {
 class ADFService {
     private var adfDevice: UnsafeMutablePointer<AdfDevice>?
     private var adfVolume: UnsafeMutablePointer<AdfVolume>?
+    private var bitmapCommit: OpaquePointer?
+    private var dirIndex: OpaquePointer?
+    private var bitmapIndex: OpaquePointer?
+    private var bitmapIndexStale = false
+    private var salvageIndex: OpaquePointer?
+    private var batchDepth = 0
     private var adflibInitialized = false
 
     var currentVolumeName: String?
@@ -51,6 +57,12 @@ class ADFService {
             if register_dump_driver_helper() != ADF_RC_OK {
                 log("ADFService: Warning - Failed to add dump device driver via helper.")
             }
+            if register_track_driver_helper() != ADF_RC_OK {
+                log("ADFService: Warning - Failed to add track device driver via helper.")
+            }
+            if register_mmap_driver_helper() != ADF_RC_OK {
+                log("ADFService: Warning - Failed to add mmap device driver via helper.")
+            }
         } else {
             log("ADFService: Error - Failed to initialize ADFLib.")
         }
@@ -81,6 +93,12 @@ class ADFService {
             if register_dump_driver_helper() != ADF_RC_OK {
                 log("ADFService: Warning - Failed to re-add dump device driver.")
             }
+            if register_track_driver_helper() != ADF_RC_OK {
+                log("ADFService: Warning - Failed to re-add track device driver.")
+            }
+            if register_mmap_driver_helper() != ADF_RC_OK {
+                log("ADFService: Warning - Failed to re-add mmap device driver.")
+            }
         } else {
             adflibInitialized = false
             log("ADFService: CRITICAL - Failed to re-initialize ADFLib.")
@@ -118,14 +136,20 @@ class ADFService {
 
         log("ADFService.openADF: -> Calling adfDevOpenWithDriver...")
         self.adfDevice = filePath.withCString { cFilePath -> UnsafeMutablePointer<AdfDevice>? in
-            return adfDevOpenWithDriver("dump", cFilePath, AdfAccessMode(rawValue: UInt32(ACCESS_MODE_READWRITE_SWIFT)))
+            let mode = AdfAccessMode(rawValue: UInt32(ACCESS_MODE_READWRITE_SWIFT))
+            if let mapped = adfDevOpenWithDriver(ADF_MMAP_DRIVER_NAME, cFilePath, mode) {
+                return mapped
+            }
+            // Could not map the file (e.g. not enough address space): go through the track driver.
+            log("ADFService.openADF: mmap driver unavailable, falling back to the track driver.")
+            return adfDevOpenWithDriver(ADF_TRACK_DRIVER_NAME, cFilePath, mode)
         }
 
         if self.adfDevice == nil {
             log("ADFService.openADF: <- adfDevOpenWithDriver FAILED. Returned nil.")
             return false
         }
-        log("ADFService.openADF: <- adfDevOpenWithDriver SUCCESS.")
+        log("ADFService.openADF: <- adfDevOpenWithDriver SUCCESS (\(String(cString: self.adfDevice!.pointee.drv.pointee.name))).")
 
         log("ADFService.openADF: -> Calling adfDevMount...")
         let devMountResult = adfDevMount(self.adfDevice)
@@ -147,6 +171,17 @@ class ADFService {
             return false
         }
         log("ADFService.openADF: <- adfVolMount SUCCESS.")
+
+        // Our own allocations leave the bitmap in memory; it is written after
+        // each operation, or once per batch, data first and bmFlag last.
+        var commitOptions = adf_bitmap_commit_options(max_dirty_blocks: 16, ordered: true)
+        self.bitmapCommit = adf_bitmap_commit_begin(self.adfVolume, &commitOptions)
+        if self.bitmapCommit == nil {
+            log("ADFService.openADF: Warning - No deferred bitmap commit, writing the bitmap after every change.")
+        }
+        self.dirIndex = adf_dir_index_create(self.adfVolume)
+        self.bitmapIndex = adf_bitmap_index_create(self.adfVolume)
+        self.bitmapIndexStale = false
         
         currentPath = []
         log("ADFService.openADF: -> Populating disk info...")
@@ -220,7 +255,7 @@ class ADFService {
         }
 
         let totalBlocks = Int64(adfVolGetSizeInBlocks(vol))
-        let freeBlocks = Int64(adfCountFreeBlocks(vol))
+        let freeBlocks = Int64(adf_bitmap_count_free(vol))
         let usedBlocks = totalBlocks - freeBlocks
         let blockSize = Int64(vol.pointee.blockSize)
 
@@ -246,7 +281,135 @@ class ADFService {
     }
 
 
+    // The track driver holds back runs of adjacent block writes and the mmap
+    // driver leaves dirty pages to the kernel; push both to the image file once
+    // an operation is done, so saving or dumping the ADF reads what ADFlib wrote.
+    // Inside performBatch only the bitmap commit is told about the change.
+    // The salvage index only follows its own restores; any other write drops it.
+    // The bitmap index only follows allocations made through it; after any
+    // other write it is recounted before its next use.
+    // Returns what could not be written; the drivers keep those blocks dirty,
+    // so the next flush tries them again.
+    @discardableResult
+    private func flushPendingWrites(keepingSalvageIndex: Bool = false, keepingBitmapIndex: Bool = false) -> String? {
+        if !keepingSalvageIndex {
+            adf_salvage_index_free(self.salvageIndex)
+            self.salvageIndex = nil
+        }
+        if !keepingBitmapIndex {
+            self.bitmapIndexStale = true
+        }
+        guard let dev = self.adfDevice else { return nil }
+        let bitmapResult: ADF_RETCODE
+        if let commit = self.bitmapCommit {
+            bitmapResult = batchDepth > 0 ? adf_bitmap_commit_changed(commit) : adf_bitmap_commit_sync(commit)
+        } else if let vol = self.adfVolume {
+            bitmapResult = adfUpdateBitmap(vol)
+        } else {
+            bitmapResult = ADF_RC_OK
+        }
+        var error: String? = nil
+        if bitmapResult != ADF_RC_OK {
+            log("ADFService: Failed to write the volume bitmap.")
+            error = "The volume bitmap could not be written to the ADF file."
+        }
+        guard batchDepth == 0 else { return error }
+        if adf_track_device_flush(dev) != ADF_RC_OK || adf_mmap_device_flush(dev) != ADF_RC_OK {
+            log("ADFService: Failed to flush pending writes to the ADF file.")
+            error = "Changes could not be written to the ADF file. They are kept and will be retried on the next change."
+        }
+        return error
+    }
+
+    // Runs one mutating call and writes its changes back. A failed write-back
+    // is reported as that call's error, unless it already failed.
+    private func writingBack(keepingSalvageIndex: Bool = false, keepingBitmapIndex: Bool = false,
+                             _ body: () -> String?) -> String? {
+        let error = body()
+        let writeBackError = flushPendingWrites(keepingSalvageIndex: keepingSalvageIndex,
+                                                keepingBitmapIndex: keepingBitmapIndex)
+        return error ?? writeBackError
+    }
+
+    // Clears bmFlag on disk before new blocks are linked in, so an import cut
+    // short leaves a volume AmigaDOS revalidates.
+    private func prepareBitmapChange() {
+        if let commit = self.bitmapCommit, adf_bitmap_commit_prepare(commit) != ADF_RC_OK {
+            log("ADFService: Warning - Failed to mark the volume bitmap for update.")
+        }
+    }
+
+    // The volume's bitmap index, recounted first if ADFlib changed the bitmap
+    // since it was last used. It lives as long as the volume is mounted, so
+    // each allocation starts looking where the previous one ended.
+    private func currentBitmapIndex() -> OpaquePointer? {
+        if self.bitmapIndexStale, let index = self.bitmapIndex {
+            adf_bitmap_index_rebuild(index)
+            self.bitmapIndexStale = false
+        }
+        return self.bitmapIndex
+    }
+
+    // Name lookups and directory changes go through the directory index, which
+    // reads each directory once; the ADFlib calls are the fallback without one.
+    private func lookupEntry(_ vol: UnsafeMutablePointer<AdfVolume>, _ parent: ADF_SECTNUM, _ cName: UnsafePointer<CChar>) -> ADF_SECTNUM {
+        if let index = self.dirIndex {
+            return adf_dir_index_lookup(index, parent, cName, nil)
+        }
+        return adfGetEntryBlockNum(vol, parent, cName)
+    }
+
+    private func changeDir(_ vol: UnsafeMutablePointer<AdfVolume>, _ cName: UnsafePointer<CChar>) -> ADF_RETCODE {
+        if let index = self.dirIndex {
+            return adf_dir_index_change_dir(index, cName)
+        }
+        return adfChangeDir(vol, cName)
+    }
+
+    private func createDir(_ vol: UnsafeMutablePointer<AdfVolume>, _ parent: ADF_SECTNUM, _ cName: UnsafePointer<CChar>) -> ADF_RETCODE {
+        if let index = self.dirIndex {
+            return adf_dir_index_create_dir(index, parent, cName)
+        }
+        return adfCreateDir(vol, parent, cName)
+    }
+
+    private func removeEntry(_ vol: UnsafeMutablePointer<AdfVolume>, _ parent: ADF_SECTNUM, _ cName: UnsafePointer<CChar>) -> ADF_RETCODE {
+        if let index = self.dirIndex {
+            return adf_dir_index_remove_entry(index, parent, cName)
+        }
+        return adfRemoveEntry(vol, parent, cName)
+    }
+
+    private func renameEntry(_ vol: UnsafeMutablePointer<AdfVolume>, _ oldParent: ADF_SECTNUM, _ cOldName: UnsafePointer<CChar>,
+                             _ newParent: ADF_SECTNUM, _ cNewName: UnsafePointer<CChar>) -> ADF_RETCODE {
+        if let index = self.dirIndex {
+            return adf_dir_index_rename_entry(index, oldParent, cOldName, newParent, cNewName)
+        }
+        return adfRenameEntry(vol, oldParent, cOldName, newParent, cNewName)
+    }
+
+    // Runs several mutating calls with one bitmap write and one flush at the
+    // end, and returns the error of that flush.
+    func performBatch(_ body: () -> Void) -> String? {
+        batchDepth += 1
+        body()
+        batchDepth -= 1
+        return flushPendingWrites()
+    }
+
     func closeADF() {
+        if let commit = self.bitmapCommit {
+            if adf_bitmap_commit_end(commit) != ADF_RC_OK {
+                log("ADFService: Warning - Failed to write the volume bitmap on close.")
+            }
+            self.bitmapCommit = nil
+        }
+        adf_dir_index_free(self.dirIndex)
+        self.dirIndex = nil
+        adf_bitmap_index_free(self.bitmapIndex)
+        self.bitmapIndex = nil
+        adf_salvage_index_free(self.salvageIndex)
+        self.salvageIndex = nil
         if let vol = self.adfVolume {
             adfVolUnMount(vol)
             self.adfVolume = nil
@@ -255,12 +418,26 @@ class ADFService {
             adfDevUnMount(dev)
             adfDevClose(dev)
             self.adfDevice = nil
+            logBlockCacheCounters()
         }
         resetDiskInfo()
         currentPath = []
         log("ADFService: ADF closed.")
     }
 
+    // Only the track driver, the fallback for images that could not be
+    // mapped, has a block cache; the counters start again for the next image.
+    private func logBlockCacheCounters() {
+        let properties = [ADF_CACHE_PR_HITS, ADF_CACHE_PR_MISSES, ADF_CACHE_PR_EVICTIONS, ADF_CACHE_PR_BLOCKS_WRITTEN_BACK]
+        let counts = properties.map { adf_block_cache_env_get_property($0) }
+        if counts[0] + counts[1] > 0 {
+            log("ADFService: Block cache - \(counts[0]) hits, \(counts[1]) misses, \(counts[2]) evictions, \(counts[3]) blocks written back.")
+        }
+        for property in properties {
+            adf_block_cache_env_set_property(property, 0)
+        }
+    }
+
     private func navigateToInternalPath() -> Bool {
         guard let vol = self.adfVolume else { return false }
         if adfToRootDir(vol) != ADF_RC_OK {
@@ -268,7 +445,7 @@ class ADFService {
             return false
         }
         for dirName in currentPath {
-            if !dirName.withCString({ cDirName -> Bool in adfChangeDir(vol, cDirName) == ADF_RC_OK }) {
+            if !dirName.withCString({ cDirName -> Bool in changeDir(vol, cDirName) == ADF_RC_OK }) {
                 _ = getADFLibError(context: "adfChangeDir to \(dirName)")
                 adfToRootDir(vol)
                 return false
@@ -277,73 +454,82 @@ class ADFService {
         return true
     }
     
+    // Turns one record of a flat directory listing into an AmigaEntry.
+    private func amigaEntry(from record: adf_dir_record, names: UnsafeMutablePointer<CChar>) -> AmigaEntry {
+        var commentStr: String? = nil
+        if record.comment != ADF_DIR_NO_COMMENT {
+            commentStr = String(cString: names + Int(record.comment))
+        }
+        return amigaEntry(from: record, name: String(cString: names + Int(record.name)), comment: commentStr)
+    }
+
+    private func amigaEntry(from record: adf_dir_record, name: String, comment: String?) -> AmigaEntry {
+        let type: EntryType
+        switch record.type {
+            case ST_FILE_SWIFT: type = .file
+            case ST_DIR_SWIFT: type = .directory
+            case ST_LFILE_SWIFT: type = .softLinkFile
+            case ST_LDIR_SWIFT: type = .softLinkDir
+            default: type = .unknown
+        }
+
+        var date: Date? = nil
+        let year = Int(record.year)
+        let month = Int(record.month)
+        let day = Int(record.day)
+        if year >= 1900 && (month >= 1 && month <= 12) && (day >= 1 && day <= 31) {
+            var components = DateComponents()
+            components.year = year
+            components.month = month
+            components.day = day
+            components.hour = Int(record.hour)
+            components.minute = Int(record.mins)
+            components.second = Int(record.secs)
+            date = Calendar.current.date(from: components)
+        }
+
+        return AmigaEntry(name: name, type: type, size: Int32(bitPattern: record.size),
+                          protectionBits: UInt32(bitPattern: record.access), date: date, comment: comment)
+    }
+
+    private final class WalkContext {
+        let visit: (UnsafePointer<adf_walk_entry>) -> adf_walk_action
+        init(visit: @escaping (UnsafePointer<adf_walk_entry>) -> adf_walk_action) {
+            self.visit = visit
+        }
+    }
+
+    // Walks the tree below dir with adf_dir_walk, calling visit for each entry.
+    private func walkTree(_ vol: UnsafeMutablePointer<AdfVolume>, from dir: ADF_SECTNUM, order: adf_walk_order,
+                          sort: adf_walk_sort, _ visit: (UnsafePointer<adf_walk_entry>) -> adf_walk_action) -> ADF_RETCODE {
+        return withoutActuallyEscaping(visit) { escapableVisit in
+            let context = WalkContext(visit: escapableVisit)
+            var options = adf_walk_options(order: order, sort: sort, prefetch: true)
+            return withExtendedLifetime(context) {
+                adf_dir_walk(vol, dir, &options, { entry, ctx in
+                    let context = Unmanaged<WalkContext>.fromOpaque(ctx!).takeUnretainedValue()
+                    return context.visit(entry!)
+                }, Unmanaged.passUnretained(context).toOpaque())
+            }
+        }
+    }
+
     func listCurrentDirectory() -> [AmigaEntry] {
         guard let vol = self.adfVolume else { return [] }
         if !navigateToInternalPath() { return [] }
-        
-        let dirSector = vol.pointee.curDirPtr
-        var entries: [AmigaEntry] = []
-        
-        let adfListHead: UnsafeMutablePointer<AdfList>? = adfGetDirEnt(vol, dirSector)
-        
-        if adfListHead == nil {
-            // This is normal for an empty directory.
-        }
 
-        var currentAdfListNode = adfListHead
-        while let currentNodePtr = currentAdfListNode {
-            let currentNode = currentNodePtr.pointee
-            if let entryDataVoidPtr = currentNode.content {
-                let adfEntryOpaquePtr = entryDataVoidPtr.assumingMemoryBound(to: AdfEntry.self)
-                
-                let entryNamePtr = get_AdfEntry_name_ptr(adfEntryOpaquePtr)
-                let name = entryNamePtr != nil ? String(cString: entryNamePtr!) : "Invalid Name"
-                
-                let entryTypeCInt = get_AdfEntry_type(adfEntryOpaquePtr)
-                let type: EntryType
-                switch entryTypeCInt {
-                    case ST_FILE_SWIFT: type = .file
-                    case ST_DIR_SWIFT: type = .directory
-                    case ST_LFILE_SWIFT: type = .softLinkFile
-                    case ST_LDIR_SWIFT: type = .softLinkDir
-                    default: type = .unknown
-                }
-                
-                var date: Date? = nil
-                let year = Int(get_AdfEntry_year(adfEntryOpaquePtr))
-                let month = Int(get_AdfEntry_month(adfEntryOpaquePtr))
-                let day = Int(get_AdfEntry_days(adfEntryOpaquePtr))
-                let hour = Int(get_AdfEntry_hour(adfEntryOpaquePtr))
-                let minute = Int(get_AdfEntry_mins(adfEntryOpaquePtr))
-                let second = Int(get_AdfEntry_secs(adfEntryOpaquePtr))
-
-                if year >= 1900 && (month >= 1 && month <= 12) && (day >= 1 && day <= 31) {
-                    var components = DateComponents()
-                    components.year = year
-                    components.month = month
-                    components.day = day
-                    components.hour = hour
-                    components.minute = minute
-                    components.second = second
-                    date = Calendar.current.date(from: components)
-                }
+        var page = adf_dir_page()
+        defer { adf_dir_page_free(&page) }
+        if adf_dir_list_all(vol, vol.pointee.curDirPtr, false, &page) != ADF_RC_OK {
+            _ = getADFLibError(context: "adf_dir_list_all")
+        }
 
-                var commentStr: String? = nil
-                if let commentCStringPtr = get_AdfEntry_comment_ptr(adfEntryOpaquePtr) {
-                     commentStr = String(cString: commentCStringPtr)
-                }
-                
-                let entrySize = get_AdfEntry_size(adfEntryOpaquePtr)
-                let entryAccess = get_AdfEntry_access(adfEntryOpaquePtr)
-                
-                entries.append(AmigaEntry(name: name, type: type, size: Int32(entrySize),
-                                          protectionBits: entryAccess, date: date, comment: commentStr))
-            }
-            if currentNode.next == nil { break }
-            currentAdfListNode = currentNode.next
+        var entries: [AmigaEntry] = []
+        entries.reserveCapacity(Int(page.count))
+        for i in 0..<Int(page.count) {
+            entries.append(amigaEntry(from: page.records[i], names: page.names))
         }
-        if adfListHead != nil { adfFreeDirList(adfListHead) }
-        
+
         return entries.sorted {
             if $0.type == .directory && $1.type != .directory { return true }
             if $0.type != .directory && $1.type == .directory { return false }
@@ -436,27 +622,18 @@ class ADFService {
     }
     
     func generateDirectoryListing() -> (String?, URL?) {
-        guard self.adfVolume != nil else {
+        guard let vol = self.adfVolume else {
             return ("Volume not mounted.", nil)
         }
 
-        let originalPath = self.currentPath
-        self.currentPath = []
-        _ = navigateToInternalPath()
-        
         var output = "Contents of \(self.volumeLabel)\n"
         output += String(repeating: "-", count: 79) + "\n"
         output += " PERMSSN    UID  GID    PACKED    SIZE RATIO     CRC-STAMP         NAME\n"
         output += String(repeating: "-", count: 79) + "\n"
 
-        let listing = _recursiveList(pathPrefix: "")
+        let listing = _recursiveList(vol: vol)
         output += listing
 
-        self.currentPath = originalPath
-        if !navigateToInternalPath() {
-            log("ADFService: CRITICAL - Failed to restore path after directory listing.")
-        }
-
         var downloadURL: URL?
         var needsToStopAccessing = false
         if let resolvedURL = getDownloadURL() {
@@ -503,45 +680,33 @@ class ADFService {
         return string
     }
 
-    // AI_REVIEW: This function is now state-safe. It saves the current path, navigates, recurses,
-    // and then explicitly restores the original path, preventing the stack overflow crash. #END_REVIEW
-    private func _recursiveList(pathPrefix: String) -> String {
-            var resultString = ""
-            let entries = self.listCurrentDirectory()
-
-            let sortedEntries = entries.sorted {
-                if $0.type == .directory && $1.type != .directory { return true }
-                if $0.type != .directory && $1.type == .directory { return false }
-                return $0.name.localizedCaseInsensitiveCompare($1.name) == .orderedAscending
+    // One depth-first walk, directories first and by name at every level;
+    // only the directories on the current path are held in memory.
+    private func _recursiveList(vol: UnsafeMutablePointer<AdfVolume>) -> String {
+        var resultString = ""
+        let dateFormatter = DateFormatter()
+        dateFormatter.dateFormat = "dd-MMM-yyyy"
+
+        let result = walkTree(vol, from: vol.pointee.rootBlock, order: ADF_WALK_DEPTH_FIRST, sort: ADF_WALK_SORT_DIRS_FIRST) { walkEntry in
+            let entry = amigaEntry(from: walkEntry.pointee.record.pointee, name: String(cString: walkEntry.pointee.name), comment: nil)
+            let fullPath = String(cString: walkEntry.pointee.path)
+
+            if entry.type == .directory {
+                let perms = protectionBitsToString(entry.protectionBits).padding(toLength: 10, withPad: " ", startingAt: 0)
+                resultString += "\(perms)    0    0         -       - ---       ---- -------- \(fullPath)/\n"
+            } else if entry.type == .file {
+                let perms = protectionBitsToString(entry.protectionBits).padding(toLength: 10, withPad: " ", startingAt: 0)
+                let sizeStr = String(entry.size).padding(toLength: 8, withPad: " ", startingAt: 0)
+                let dateStr = (entry.date != nil ? dateFormatter.string(from: entry.date!) : "-----------").padding(toLength: 12, withPad: " ", startingAt: 0)
+                resultString += "\(perms)    0    0 \(sizeStr) \(sizeStr) 100.0%%    ---- \(dateStr) \(fullPath)\n"
             }
-
-            for entry in sortedEntries {
-                let fullPath = pathPrefix + entry.name
-                
-                if entry.type == .directory {
-                    let perms = protectionBitsToString(entry.protectionBits).padding(toLength: 10, withPad: " ", startingAt: 0)
-                    let line = "\(perms)    0    0         -       - ---       ---- -------- \(fullPath)/\n"
-                    resultString += line
-                    
-                    let parentPath = self.currentPath
-                    if navigateToDirectory(entry.name) {
-                        resultString += _recursiveList(pathPrefix: fullPath + "/")
-                        self.currentPath = parentPath
-                        _ = self.navigateToInternalPath()
-                    }
-                } else if entry.type == .file {
-                    let perms = protectionBitsToString(entry.protectionBits).padding(toLength: 10, withPad: " ", startingAt: 0)
-                    let sizeStr = String(entry.size).padding(toLength: 8, withPad: " ", startingAt: 0)
-                    let dateFormatter = DateFormatter()
-                    dateFormatter.dateFormat = "dd-MMM-yyyy"
-                    let dateStr = (entry.date != nil ? dateFormatter.string(from: entry.date!) : "-----------").padding(toLength: 12, withPad: " ", startingAt: 0)
-
-                    let line = "\(perms)    0    0 \(sizeStr) \(sizeStr) 100.0%%    ---- \(dateStr) \(fullPath)\n"
-                    resultString += line
-                }
-            }
-            return resultString
+            return ADF_WALK_CONTINUE
         }
+        if result != ADF_RC_OK {
+            _ = getADFLibError(context: "adf_dir_walk (recursive list)")
+        }
+        return resultString
+    }
 
     func navigateToDirectory(_ name: String) -> Bool {
         guard self.adfVolume != nil, !name.isEmpty, name != "." else { return false }
@@ -577,166 +742,198 @@ class ADFService {
             _ = getADFLibError(context: "navigateToInternalPath for \(entry.name) before readFileContent")
             return nil
         }
-        var fileData = Data()
-        let bufferSize: UInt32 = 4096
-        var buffer = [UInt8](repeating: 0, count: Int(bufferSize))
+        return entry.name.withCString { cFileName in
+            readFile(vol, inDirectory: vol.pointee.curDirPtr, name: cFileName)
+        }
+    }
 
-        let adfFilePtr = entry.name.withCString { cFileName -> UnsafeMutablePointer<AdfFile>? in
-            return adfFileOpen(vol, cFileName, AdfFileMode(rawValue: UInt32(ADF_FILE_MODE_READ_SWIFT)))
+    // Reads a file of the given directory in one go, straight from its blocks.
+    private func readFile(_ vol: UnsafeMutablePointer<AdfVolume>, inDirectory dir: ADF_SECTNUM, name cFileName: UnsafePointer<CChar>) -> Data? {
+        var dataPtr: UnsafeMutablePointer<UInt8>? = nil
+        var size: UInt32 = 0
+        let rc = adf_file_read_all(vol, dir, cFileName, &dataPtr, &size)
+        if rc.rawValue == ADF_RC_OK_SWIFT, let dataPtr = dataPtr {
+            return Data(bytesNoCopy: dataPtr, count: Int(size), deallocator: .free)
         }
+        log("ADFService: Whole-file read of '\(String(cString: cFileName))' failed (rc \(rc.rawValue)), reading it through an AdfFile.")
+        return readFileBuffered(vol, inDirectory: dir, name: cFileName)
+    }
+
+    // ADFlib's reader stops at a bad block but keeps what came before it, which is
+    // still worth showing. The current directory is put back afterwards.
+    private func readFileBuffered(_ vol: UnsafeMutablePointer<AdfVolume>, inDirectory dir: ADF_SECTNUM, name cFileName: UnsafePointer<CChar>) -> Data? {
+        let savedDir = vol.pointee.curDirPtr
+        vol.pointee.curDirPtr = dir
+        defer { vol.pointee.curDirPtr = savedDir }
 
-        if adfFilePtr == nil {
-            _ = getADFLibError(context: "adfFileOpen for \(entry.name)")
+        guard let adfFilePtr = adfFileOpen(vol, cFileName, AdfFileMode(rawValue: UInt32(ADF_FILE_MODE_READ_SWIFT))) else {
+            _ = getADFLibError(context: "adfFileOpen for \(String(cString: cFileName))")
             return nil
         }
         defer { adfFileClose(adfFilePtr) }
 
-        while true {
-            let bytesRead = adfFileRead(adfFilePtr, bufferSize, &buffer)
-            if bytesRead == 0 {
-                break
-            }
-            fileData.append(buffer, count: Int(bytesRead))
+        // One call for the whole file, so its blocks are read in disk order.
+        let fileSize = adfFilePtr.pointee.fileHdr.pointee.byteSize
+        var fileData = Data(count: Int(fileSize))
+        let bytesRead = fileData.withUnsafeMutableBytes { (bufferPtr: UnsafeMutableRawBufferPointer) -> UInt32 in
+            guard let baseAddress = bufferPtr.baseAddress else { return 0 }
+            return adf_file_read_sorted(adfFilePtr, fileSize, baseAddress.assumingMemoryBound(to: UInt8.self))
+        }
+        if bytesRead < fileSize {
+            log("ADFService: Short read of '\(String(cString: cFileName))' (\(bytesRead) of \(fileSize) bytes).")
+            fileData.count = Int(bytesRead)
         }
         return fileData
     }
     
     func writeTextFile(entry: AmigaEntry, content: String) -> String? {
-        guard let vol = self.adfVolume, entry.type == .file else { return "Invalid entry or volume." }
-        if !navigateToInternalPath() {
-            return getADFLibError(context: "navigateToInternalPath for \(entry.name) before writeTextFile")
-        }
+        return writingBack(keepingBitmapIndex: true) {
+            guard let vol = self.adfVolume, entry.type == .file else { return "Invalid entry or volume." }
+            if !navigateToInternalPath() {
+                return getADFLibError(context: "navigateToInternalPath for \(entry.name) before writeTextFile")
+            }
 
-        var processedContent = content
-            .replacingOccurrences(of: "“", with: "\"")
-            .replacingOccurrences(of: "”", with: "\"")
-            .replacingOccurrences(of: "‘", with: "'")
-            .replacingOccurrences(of: "’", with: "'")
-            .replacingOccurrences(of: "…", with: "...")
-            .replacingOccurrences(of: "—", with: "--")
+            var processedContent = content
+                .replacingOccurrences(of: "“", with: "\"")
+                .replacingOccurrences(of: "”", with: "\"")
+                .replacingOccurrences(of: "‘", with: "'")
+                .replacingOccurrences(of: "’", with: "'")
+                .replacingOccurrences(of: "…", with: "...")
+                .replacingOccurrences(of: "—", with: "--")
         
-        processedContent = processedContent.replacingOccurrences(of: "\r\n", with: "\n")
+            processedContent = processedContent.replacingOccurrences(of: "\r\n", with: "\n")
         
-        guard let data = processedContent.data(using: .isoLatin1) else {
-            return "Failed to encode string to Amiga-compatible format."
-        }
+            guard let data = processedContent.data(using: .isoLatin1) else {
+                return "Failed to encode string to Amiga-compatible format."
+            }
         
-        let result = data.withUnsafeBytes { (bufferPtr: UnsafeRawBufferPointer) -> ADF_RETCODE in
-            let unsafePointer = bufferPtr.baseAddress?.assumingMemoryBound(to: UInt8.self)
+            prepareBitmapChange()
+            let result = data.withUnsafeBytes { (bufferPtr: UnsafeRawBufferPointer) -> ADF_RETCODE in
+                let unsafePointer = bufferPtr.baseAddress?.assumingMemoryBound(to: UInt8.self)
             
-            return entry.name.withCString { cAmigaPath in
-                return add_file_to_adf_c(vol, cAmigaPath, unsafePointer, UInt32(data.count))
+                return entry.name.withCString { cAmigaPath in
+                    return add_file_to_adf_c(vol, self.currentBitmapIndex(), cAmigaPath, unsafePointer, UInt32(data.count))
+                }
             }
-        }
         
-        if result.rawValue == ADF_RC_OK_SWIFT {
-            log("ADFService: Successfully wrote to '\(entry.name)'.")
-            populateDiskInfo()
-            return nil
-        } else {
-            log("ADFService: add_file_to_adf_c failed for '\(entry.name)'. Check C-Log for details.")
-            return "ADFlib failed to write the file. The disk may be full."
+            if result.rawValue == ADF_RC_OK_SWIFT {
+                log("ADFService: Successfully wrote to '\(entry.name)'.")
+                populateDiskInfo()
+                return nil
+            } else {
+                log("ADFService: add_file_to_adf_c failed for '\(entry.name)'. Check C-Log for details.")
+                return "ADFlib failed to write the file. The disk may be full."
+            }
         }
     }
     
     func addFile(from url: URL) -> String? {
-        guard let vol = self.adfVolume else { return "Volume not mounted." }
+        return writingBack(keepingBitmapIndex: true) {
+            guard let vol = self.adfVolume else { return "Volume not mounted." }
         
-        if !navigateToInternalPath() {
-            return "Failed to navigate to current ADF directory."
-        }
+            if !navigateToInternalPath() {
+                return "Failed to navigate to current ADF directory."
+            }
         
-        let amigaPath = url.lastPathComponent
+            let amigaPath = url.lastPathComponent
         
-        if let existingEntry = self.listCurrentDirectory().first(where: { $0.name.lowercased() == amigaPath.lowercased() }) {
-            if existingEntry.type == .directory {
-                return "An entry named '\(amigaPath)' already exists and it is a directory. Cannot overwrite."
-            }
+            if let existingEntry = self.listCurrentDirectory().first(where: { $0.name.lowercased() == amigaPath.lowercased() }) {
+                if existingEntry.type == .directory {
+                    return "An entry named '\(amigaPath)' already exists and it is a directory. Cannot overwrite."
+                }
             
-            log("ADFService: File '\(amigaPath)' exists. Deleting it before overwrite.")
-            if let deleteError = self.deleteEntryRecursively(entry: existingEntry, force: true) {
-                return "Failed to delete existing file to overwrite: \(deleteError)"
+                log("ADFService: File '\(amigaPath)' exists. Deleting it before overwrite.")
+                if let deleteError = self.deleteEntryRecursively(entry: existingEntry, force: true) {
+                    return "Failed to delete existing file to overwrite: \(deleteError)"
+                }
             }
-        }
 
-        let didStartAccessing = url.startAccessingSecurityScopedResource()
-        defer {
-            if didStartAccessing {
-                url.stopAccessingSecurityScopedResource()
+            let didStartAccessing = url.startAccessingSecurityScopedResource()
+            defer {
+                if didStartAccessing {
+                    url.stopAccessingSecurityScopedResource()
+                }
             }
-        }
 
-        let data: Data
-        do {
-            data = try Data(contentsOf: url)
-        } catch {
-            let errorMessage = "Could not read data from local file. Reason: \(error.localizedDescription)"
-            log("ADFService Error: \(errorMessage)")
-            return errorMessage
-        }
+            let data: Data
+            do {
+                data = try Data(contentsOf: url)
+            } catch {
+                let errorMessage = "Could not read data from local file. Reason: \(error.localizedDescription)"
+                log("ADFService Error: \(errorMessage)")
+                return errorMessage
+            }
         
-        let result = data.withUnsafeBytes { (bufferPtr: UnsafeRawBufferPointer) -> ADF_RETCODE in
-            let unsafePointer = bufferPtr.baseAddress?.assumingMemoryBound(to: UInt8.self)
+            prepareBitmapChange()
+            let result = data.withUnsafeBytes { (bufferPtr: UnsafeRawBufferPointer) -> ADF_RETCODE in
+                let unsafePointer = bufferPtr.baseAddress?.assumingMemoryBound(to: UInt8.self)
             
-            return amigaPath.withCString { cAmigaPath in
-                return add_file_to_adf_c(vol, cAmigaPath, unsafePointer, UInt32(data.count))
+                return amigaPath.withCString { cAmigaPath in
+                    let rc = add_file_to_adf_c(vol, self.currentBitmapIndex(), cAmigaPath, unsafePointer, UInt32(data.count))
+                    adf_dir_index_refresh_entry(self.dirIndex, vol.pointee.curDirPtr, cAmigaPath)
+                    return rc
+                }
             }
-        }
         
-        if result.rawValue == ADF_RC_OK_SWIFT {
-            log("ADFService: Successfully added '\(amigaPath)'.")
-            populateDiskInfo()
-            return nil
-        } else {
-            log("ADFService: add_file_to_adf_c failed for '\(amigaPath)'. Check C-Log for details.")
-            return "ADFlib failed to write the file. The disk may be full."
+            if result.rawValue == ADF_RC_OK_SWIFT {
+                log("ADFService: Successfully added '\(amigaPath)'.")
+                populateDiskInfo()
+                return nil
+            } else {
+                log("ADFService: add_file_to_adf_c failed for '\(amigaPath)'. Check C-Log for details.")
+                return "ADFlib failed to write the file. The disk may be full."
+            }
         }
     }
 
     func createDirectory(name: String, force: Bool) -> String? {
-        guard let vol = self.adfVolume else {
-            return "Cannot create directory, volume is nil."
-        }
-        if !navigateToInternalPath() {
-            return "Cannot create directory, failed to navigate to current path."
-        }
+        return writingBack {
+            guard let vol = self.adfVolume else {
+                return "Cannot create directory, volume is nil."
+            }
+            if !navigateToInternalPath() {
+                return "Cannot create directory, failed to navigate to current path."
+            }
         
-        let parentSector = vol.pointee.curDirPtr
+            let parentSector = vol.pointee.curDirPtr
         
-        if !force {
-            var parentBlock = AdfEntryBlock()
-            if adfReadEntryBlock(vol, parentSector, &parentBlock).rawValue != ADF_RC_OK_SWIFT {
-                return "Could not read parent directory information to check permissions."
-            }
-            if (UInt32(parentBlock.access) & ACCMASK_W_SWIFT) != 0 {
-                return "Parent directory is write-protected. (Use 'Force Operations' to override)."
+            if !force {
+                var parentBlock = AdfEntryBlock()
+                if adfReadEntryBlock(vol, parentSector, &parentBlock).rawValue != ADF_RC_OK_SWIFT {
+                    return "Could not read parent directory information to check permissions."
+                }
+                if (UInt32(parentBlock.access) & ACCMASK_W_SWIFT) != 0 {
+                    return "Parent directory is write-protected. (Use 'Force Operations' to override)."
+                }
             }
-        }
         
-        let success = name.withCString { cName -> Bool in
-            return adfCreateDir(vol, parentSector, cName).rawValue == ADF_RC_OK_SWIFT
-        }
+            let success = name.withCString { cName -> Bool in
+                return createDir(vol, parentSector, cName).rawValue == ADF_RC_OK_SWIFT
+            }
         
-        if success {
-            populateDiskInfo()
-            return nil
-        } else {
-            log("ADFService: adfCreateDir failed. Check C-Log for details.")
-            return "ADFLib failed to create the directory."
+            if success {
+                populateDiskInfo()
+                return nil
+            } else {
+                log("ADFService: adfCreateDir failed. Check C-Log for details.")
+                return "ADFLib failed to create the directory."
+            }
         }
     }
     
     func deleteEntryRecursively(entry: AmigaEntry, force: Bool) -> String? {
-        let originalPath = self.currentPath
-        let result = _deleteRecursively(entryToDelete: entry, force: force)
-        self.currentPath = originalPath
-        if !navigateToInternalPath() {
-            log("ADFService: CRITICAL - Failed to restore path to \(originalPath.joined(separator: "/")) after deletion operation.")
-        }
-        if result == nil {
-            populateDiskInfo()
+        return writingBack {
+            let originalPath = self.currentPath
+            let result = _deleteRecursively(entryToDelete: entry, force: force)
+            self.currentPath = originalPath
+            if !navigateToInternalPath() {
+                log("ADFService: CRITICAL - Failed to restore path to \(originalPath.joined(separator: "/")) after deletion operation.")
+            }
+            if result == nil {
+                populateDiskInfo()
+            }
+            return result
         }
-        return result
     }
 
     private func _deleteRecursively(entryToDelete: AmigaEntry, force: Bool) -> String? {
@@ -766,7 +963,7 @@ class ADFService {
         
         let parentSector = vol.pointee.curDirPtr
         let success = entryToDelete.name.withCString { cName -> Bool in
-            return adfRemoveEntry(vol, parentSector, cName).rawValue == ADF_RC_OK_SWIFT
+            return removeEntry(vol, parentSector, cName).rawValue == ADF_RC_OK_SWIFT
         }
         
         if success {
@@ -779,132 +976,166 @@ class ADFService {
     }
 
     func moveEntry(entryNameToMove: String, toDestinationDirName: String) -> String? {
-        guard let vol = self.adfVolume else { return "Volume not mounted." }
+        return writingBack {
+            guard let vol = self.adfVolume else { return "Volume not mounted." }
 
-        let parentSector = vol.pointee.curDirPtr
+            let parentSector = vol.pointee.curDirPtr
 
-        let destDirSector = toDestinationDirName.withCString { cDestName in
-            return adfGetEntryBlockNum(vol, parentSector, cDestName)
-        }
+            let destDirSector = toDestinationDirName.withCString { cDestName in
+                return lookupEntry(vol, parentSector, cDestName)
+            }
         
-        if destDirSector <= 0 {
-            return "Destination directory '\(toDestinationDirName)' not found."
-        }
+            if destDirSector <= 0 {
+                return "Destination directory '\(toDestinationDirName)' not found."
+            }
         
-        var destBlock = AdfEntryBlock()
-        guard adfReadEntryBlock(vol, destDirSector, &destBlock) == ADF_RC_OK, destBlock.secType == ST_DIR_SWIFT else {
-            return "'\(toDestinationDirName)' is not a directory."
-        }
+            var destBlock = AdfEntryBlock()
+            guard adfReadEntryBlock(vol, destDirSector, &destBlock) == ADF_RC_OK, destBlock.secType == ST_DIR_SWIFT else {
+                return "'\(toDestinationDirName)' is not a directory."
+            }
         
-        let success = entryNameToMove.withCString { cEntryNameToMove -> Bool in
-            return adfRenameEntry(vol, parentSector, cEntryNameToMove, destDirSector, cEntryNameToMove).rawValue == ADF_RC_OK_SWIFT
-        }
+            let success = entryNameToMove.withCString { cEntryNameToMove -> Bool in
+                return renameEntry(vol, parentSector, cEntryNameToMove, destDirSector, cEntryNameToMove).rawValue == ADF_RC_OK_SWIFT
+            }
 
-        if success {
-            log("ADFService: Moved '\(entryNameToMove)' to '\(toDestinationDirName)'.")
-            populateDiskInfo()
-            return nil
-        } else {
-            log("ADFService: adfRenameEntry (for move) failed. Check C-Log for details.")
-            return "ADFLib failed to move the entry. An entry with the same name may already exist in the destination."
+            if success {
+                log("ADFService: Moved '\(entryNameToMove)' to '\(toDestinationDirName)'.")
+                populateDiskInfo()
+                return nil
+            } else {
+                log("ADFService: adfRenameEntry (for move) failed. Check C-Log for details.")
+                return "ADFLib failed to move the entry. An entry with the same name may already exist in the destination."
+            }
         }
     }
     
     func moveEntryToParent(entryNameToMove: String) -> String? {
-        guard let vol = self.adfVolume else { return "Volume not mounted." }
+        return writingBack {
+            guard let vol = self.adfVolume else { return "Volume not mounted." }
         
-        if currentPath.isEmpty {
-            return "Cannot move item up from the root directory."
-        }
+            if currentPath.isEmpty {
+                return "Cannot move item up from the root directory."
+            }
 
-        let sourceDirSector = vol.pointee.curDirPtr
+            let sourceDirSector = vol.pointee.curDirPtr
         
-        if adfParentDir(vol) != ADF_RC_OK {
-            _ = navigateToInternalPath()
-            return "Could not navigate to parent directory to perform move."
-        }
-        let destDirSector = vol.pointee.curDirPtr
+            if adfParentDir(vol) != ADF_RC_OK {
+                _ = navigateToInternalPath()
+                return "Could not navigate to parent directory to perform move."
+            }
+            let destDirSector = vol.pointee.curDirPtr
         
-        let success = entryNameToMove.withCString { cEntryName -> Bool in
-            return adfRenameEntry(vol, sourceDirSector, cEntryName, destDirSector, cEntryName).rawValue == ADF_RC_OK_SWIFT
-        }
+            let success = entryNameToMove.withCString { cEntryName -> Bool in
+                return renameEntry(vol, sourceDirSector, cEntryName, destDirSector, cEntryName).rawValue == ADF_RC_OK_SWIFT
+            }
 
-        if success {
-            log("ADFService: Moved '\(entryNameToMove)' up to parent directory.")
-            populateDiskInfo()
-            return nil
-        } else {
-            _ = navigateToInternalPath()
-            log("ADFService: moveEntryToParent failed. Check C-Log.")
-            return "ADFLib failed to move the entry up."
+            if success {
+                log("ADFService: Moved '\(entryNameToMove)' up to parent directory.")
+                populateDiskInfo()
+                return nil
+            } else {
+                _ = navigateToInternalPath()
+                log("ADFService: moveEntryToParent failed. Check C-Log.")
+                return "ADFLib failed to move the entry up."
+            }
         }
     }
 
     func renameEntry(oldName: String, newName: String) -> String? {
-        guard let vol = self.adfVolume else { return "Volume is not open." }
-        if newName.isEmpty { return "New name cannot be empty." }
+        return writingBack {
+            guard let vol = self.adfVolume else { return "Volume is not open." }
+            if newName.isEmpty { return "New name cannot be empty." }
         
-        if !navigateToInternalPath() {
-            return "Failed to navigate to current path."
-        }
+            if !navigateToInternalPath() {
+                return "Failed to navigate to current path."
+            }
         
-        let parentSector = vol.pointee.curDirPtr
-        let success = oldName.withCString { cOldName -> Bool in
-            return newName.withCString { cNewName -> Bool in
-                return adfRenameEntry(vol, parentSector, cOldName, parentSector, cNewName).rawValue == ADF_RC_OK_SWIFT
+            let parentSector = vol.pointee.curDirPtr
+            let success = oldName.withCString { cOldName -> Bool in
+                return newName.withCString { cNewName -> Bool in
+                    return renameEntry(vol, parentSector, cOldName, parentSector, cNewName).rawValue == ADF_RC_OK_SWIFT
+                }
             }
-        }
         
-        if success {
-            log("ADFService: Renamed '\(oldName)' to '\(newName)'.")
-            return nil
-        } else {
-            log("ADFService: adfRenameEntry failed. Check C-Log for details.")
-            return "ADFLib failed to rename the entry. A file with the new name may already exist."
+            if success {
+                log("ADFService: Renamed '\(oldName)' to '\(newName)'.")
+                return nil
+            } else {
+                log("ADFService: adfRenameEntry failed. Check C-Log for details.")
+                return "ADFLib failed to rename the entry. A file with the new name may already exist."
+            }
         }
     }
     
     func renameVolume(newName: String) -> String? {
-        guard let vol = self.adfVolume else { return "Volume not mounted." }
+        return writingBack {
+            guard let vol = self.adfVolume else { return "Volume not mounted." }
 
-        let maxLen = Int(ADF_MAX_NAME_LEN)
-        var finalName = newName
-        if newName.count > maxLen {
-            finalName = String(newName.prefix(maxLen))
-        }
-        if finalName.contains(":") || finalName.contains("/") {
-            return "Volume name cannot contain ':' or '/'."
-        }
+            let maxLen = Int(ADF_MAX_NAME_LEN)
+            var finalName = newName
+            if newName.count > maxLen {
+                finalName = String(newName.prefix(maxLen))
+            }
+            if finalName.contains(":") || finalName.contains("/") {
+                return "Volume name cannot contain ':' or '/'."
+            }
 
-        let rootBlockSector = adfVolCalcRootBlk(vol)
-        var rootBlock = AdfRootBlock()
-        guard adfReadRootBlock(vol, UInt32(rootBlockSector), &rootBlock) == ADF_RC_OK else {
-            return "Failed to read the volume's root block."
-        }
+            let rootBlockSector = adfVolCalcRootBlk(vol)
+            var rootBlock = AdfRootBlock()
+            guard adfReadRootBlock(vol, UInt32(rootBlockSector), &rootBlock) == ADF_RC_OK else {
+                return "Failed to read the volume's root block."
+            }
 
-        rootBlock.nameLen = UInt8(finalName.count)
-        let cName = finalName.cString(using: .utf8)!
-        withUnsafeMutableBytes(of: &rootBlock.diskName) { buffer in
-            buffer.baseAddress?.initializeMemory(as: UInt8.self, repeating: 0, count: buffer.count)
+            rootBlock.nameLen = UInt8(finalName.count)
+            let cName = finalName.cString(using: .utf8)!
+            withUnsafeMutableBytes(of: &rootBlock.diskName) { buffer in
+                buffer.baseAddress?.initializeMemory(as: UInt8.self, repeating: 0, count: buffer.count)
             
-            cName.withUnsafeBytes { cNameBuffer in
-                let count = min(buffer.count - 1, cNameBuffer.count)
-                buffer.baseAddress!.copyMemory(from: cNameBuffer.baseAddress!, byteCount: count)
+                cName.withUnsafeBytes { cNameBuffer in
+                    let count = min(buffer.count - 1, cNameBuffer.count)
+                    buffer.baseAddress!.copyMemory(from: cNameBuffer.baseAddress!, byteCount: count)
+                }
             }
-        }
         
-        guard adfWriteRootBlock(vol, UInt32(rootBlockSector), &rootBlock) == ADF_RC_OK else {
-            return "Failed to write the updated root block."
-        }
+            guard adfWriteRootBlock(vol, UInt32(rootBlockSector), &rootBlock) == ADF_RC_OK else {
+                return "Failed to write the updated root block."
+            }
 
-        finalName.withCString { cFinalName in
-            adf_set_vol_name(vol, cFinalName)
-        }
+            finalName.withCString { cFinalName in
+                adf_set_vol_name(vol, cFinalName)
+            }
 
-        populateDiskInfo()
-        return nil
+            populateDiskInfo()
+            return nil
+        }
     }
     
+    // Rewrites the DIRCACHE blocks of every directory from the hash tables,
+    // turning DIRCACHE on first for a volume that does not have it yet.
+    func rebuildDirectoryCache() -> String? {
+        return writingBack(keepingBitmapIndex: true) {
+            guard let vol = self.adfVolume else { return "Volume not mounted." }
+            guard adfVolIsDosFS(vol) else { return "Not an AmigaDOS volume." }
+
+            let enabling = !adfVolHasDIRCACHE(vol)
+            if enabling && !adf_dir_cache_can_enable(vol) {
+                return "DIRCACHE needs international name hashing, and this volume has names with accented letters that would no longer be found."
+            }
+            prepareBitmapChange()
+            let index = self.currentBitmapIndex()
+            let result = enabling ? adf_dir_cache_enable(vol, index)
+                                  : adf_dir_cache_rebuild(vol, index, vol.pointee.rootBlock, true)
+            guard result == ADF_RC_OK else {
+                log("ADFService: Directory cache rebuild failed with code \(result).")
+                return result == ADF_RC_VOLFULL ? "Not enough free blocks for the directory cache."
+                                                : "Failed to rebuild the directory cache. Check C-Log for details."
+            }
+            log("ADFService: Directory cache \(enabling ? "enabled" : "rebuilt").")
+            populateDiskInfo()
+            return nil
+        }
+    }
+
     func exportEntry(entry: AmigaEntry, toDirectory destinationURL: URL) -> String? {
         let originalPath = self.currentPath
         let result = _exportRecursively(entry: entry, toDirectory: destinationURL)
@@ -917,7 +1148,14 @@ class ADFService {
         return result
     }
 
+    // A directory goes out through adf_extract_tree: one walk, data read in
+    // block order, host files written by a few threads.
     private func _exportRecursively(entry: AmigaEntry, toDirectory destinationURL: URL) -> String? {
+        guard let vol = self.adfVolume else { return "Volume not mounted." }
+        // Names come from the image as they are; "." or ".." would leave the destination.
+        guard !entry.name.isEmpty, entry.name != ".", entry.name != "..", !entry.name.contains("/") else {
+            return "'\(entry.name)' cannot be used as a file name here."
+        }
         let exportPath = destinationURL.appendingPathComponent(entry.name)
         
         if entry.type == .file {
@@ -930,32 +1168,225 @@ class ADFService {
                 return "Failed to write file '\(entry.name)' to local disk: \(error.localizedDescription)"
             }
         } else if entry.type == .directory {
-            do {
-                try FileManager.default.createDirectory(at: exportPath, withIntermediateDirectories: true, attributes: nil)
-            } catch {
-                return "Failed to create local directory for '\(entry.name)': \(error.localizedDescription)"
+            if !navigateToInternalPath() {
+                return "Failed to navigate to the current ADF directory."
             }
-            
-            if !navigateToDirectory(entry.name) {
-                return "Failed to navigate into ADF directory '\(entry.name)'."
+            let dirSector = entry.name.withCString { lookupEntry(vol, vol.pointee.curDirPtr, $0) }
+            if dirSector <= 0 {
+                return "Failed to find ADF directory '\(entry.name)'."
             }
-            
-            let children = listCurrentDirectory()
-            for child in children {
-                if let error = _exportRecursively(entry: child, toDirectory: exportPath) {
-                    _ = goUpDirectory()
-                    return error
-                }
+            let (error, stats) = extractTree(vol, from: dirSector, to: exportPath, writeMetadata: false)
+            if let error = error {
+                return error
             }
-            
-            if !goUpDirectory() {
-                 return "Failed to navigate out of directory '\(entry.name)' after emptying it. Cannot complete deletion."
+            if stats.failed > 0 {
+                return "\(stats.failed) item(s) of '\(entry.name)' could not be exported."
             }
         }
         
         return nil
     }
 
+    private func extractTree(_ vol: UnsafeMutablePointer<AdfVolume>, from dir: ADF_SECTNUM, to hostURL: URL,
+                             writeMetadata: Bool) -> (String?, adf_extract_stats) {
+        let writers = UInt32(max(1, min(4, ProcessInfo.processInfo.activeProcessorCount / 2)))
+        var options = adf_extract_options(num_writers: writers, max_pending_bytes: 0, set_times: true,
+                                          set_permissions: false, write_metadata: writeMetadata)
+        var stats = adf_extract_stats()
+        let result = hostURL.path.withCString { cHostPath in
+            adf_extract_tree(vol, dir, cHostPath, &options, &stats)
+        }
+        if result != ADF_RC_OK {
+            return (getADFLibError(context: "adf_extract_tree to \(hostURL.path)"), stats)
+        }
+        log("ADFService: Extracted \(stats.files) file(s), \(stats.directories) folder(s), \(stats.bytes) bytes; \(stats.skipped) link(s) skipped, \(stats.failed) failed.")
+        return (nil, stats)
+    }
+
+    // Extracts the whole volume into a folder named after it, with a .uaem
+    // file per entry carrying protection bits, date and comment.
+    func extractVolume(toDirectory destinationURL: URL) -> (String?, String?) {
+        guard let vol = self.adfVolume else { return ("Volume not mounted.", nil) }
+        let baseName = self.volumeLabel.isEmpty ? "UntitledDisk" : self.volumeLabel
+        let invalidChars = CharacterSet(charactersIn: ":/\\?%*|\"<>")
+        var cleanName = baseName.components(separatedBy: invalidChars).joined(separator: "_")
+        if cleanName == "." || cleanName == ".." {
+            cleanName = "UntitledDisk"
+        }
+        let volumeURL = destinationURL.appendingPathComponent(cleanName)
+
+        let (error, stats) = extractTree(vol, from: vol.pointee.rootBlock, to: volumeURL, writeMetadata: true)
+        if let error = error {
+            return (error, nil)
+        }
+        var summary = "Extracted \(stats.files) file(s) and \(stats.directories) folder(s) to:\n\(volumeURL.path)"
+        if stats.failed > 0 {
+            summary += "\n\(stats.failed) item(s) could not be extracted."
+        }
+        return (nil, summary)
+    }
+
+    // Checks the whole mounted volume with adf_verify_volume: every block read
+    // once and checked on all but one CPU, then the structure followed in memory.
+    func verifyVolume() -> (String?, String?) {
+        guard let vol = self.adfVolume else { return ("Volume not mounted.", nil) }
+        guard adfVolIsDosFS(vol) else { return ("Not an AmigaDOS volume.", nil) }
+
+        let checkers = UInt32(max(0, ProcessInfo.processInfo.activeProcessorCount - 1))
+        var options = adf_verify_options(num_threads: checkers, max_problems: 0)
+        var report = adf_verify_report()
+        let result = adf_verify_volume(vol, &options, &report)
+        defer { adf_verify_report_free(&report) }
+        guard result == ADF_RC_OK else {
+            return (getADFLibError(context: "adf_verify_volume"), nil)
+        }
+        log("ADFService: Verified \(report.blocks) blocks, \(report.total_problems) problem(s) found.")
+
+        var summary = "\(self.volumeLabel): \(report.directories) folder(s), \(report.files) file(s), "
+            + "\(report.used_blocks) blocks used, \(report.free_blocks) free."
+        guard report.total_problems > 0 else {
+            return (nil, summary + "\nNo problems found.")
+        }
+
+        summary += "\n\(report.total_problems) problem(s) found:"
+        let counts = withUnsafeBytes(of: report.problem_counts) { Array($0.bindMemory(to: UInt32.self)) }
+        for (kind, count) in counts.enumerated() where count > 0 {
+            let name = String(cString: adf_verify_problem_name(adf_verify_problem_kind(UInt32(kind))))
+            summary += "\n  \(name): \(count)"
+        }
+        let shown = min(Int(report.num_problems), 10)
+        if shown > 0, let problems = report.problems {
+            summary += "\nFirst blocks affected:"
+            for problem in UnsafeBufferPointer(start: problems, count: shown) {
+                let name = String(cString: adf_verify_problem_name(problem.kind))
+                summary += "\n  block \(problem.sector): \(name)"
+                if problem.referrer != 0 {
+                    summary += " (from block \(problem.referrer))"
+                }
+            }
+        }
+        return (nil, summary)
+    }
+
+    // Rebuilds the allocation bitmap from one sequential sweep of the volume
+    // (adf_bitmap_rebuild), then writes it out like any other bitmap change.
+    func rebuildBitmap() -> (String?, String?) {
+        var summary: String? = nil
+        let error = writingBack { () -> String? in
+            guard let vol = self.adfVolume else { return "Volume not mounted." }
+            guard adfVolIsDosFS(vol) else { return "Not an AmigaDOS volume." }
+
+            prepareBitmapChange()
+            var stats = adf_bitmap_rebuild_stats()
+            guard adf_bitmap_rebuild(vol, &stats) == ADF_RC_OK else {
+                return getADFLibError(context: "adf_bitmap_rebuild")
+            }
+            log("ADFService: Bitmap rebuilt: \(stats.allocated) block(s) allocated, \(stats.freed) freed, \(stats.disputed) decided by the tree, \(stats.kept_damaged) damaged kept, \(stats.kept_unreached) unreached kept.")
+            populateDiskInfo()
+
+            guard stats.allocated > 0 || stats.freed > 0 else {
+                summary = "The bitmap of \(self.volumeLabel) was already correct."
+                return nil
+            }
+            summary = "Bitmap of \(self.volumeLabel) rebuilt: \(stats.allocated) block(s) marked used, \(stats.freed) marked free."
+            if stats.kept_damaged > 0 {
+                summary! += "\n\(stats.kept_damaged) unreadable or damaged block(s) were left allocated."
+            }
+            if stats.kept_unreached > 0 {
+                summary! += "\n\(stats.kept_unreached) block(s) cut off from the file tree by damage were left allocated."
+            }
+            return nil
+        }
+        return error == nil ? (nil, summary) : (error, nil)
+    }
+
+    // Deleted entries come from a salvage index built in one pass over the
+    // volume the first time they are asked for, and kept until the volume
+    // is written to other than by a restore.
+    func listDeletedEntries() -> [DeletedEntry]? {
+        guard let vol = self.adfVolume else { return nil }
+        if self.salvageIndex == nil {
+            self.salvageIndex = adf_salvage_index_create(vol)
+            guard self.salvageIndex != nil else {
+                log("ADFService: Failed to build the salvage index.")
+                return nil
+            }
+            log("ADFService: Salvage index built, \(adf_salvage_index_count(self.salvageIndex)) deleted entries.")
+        }
+        let count = adf_salvage_index_count(self.salvageIndex)
+        return (0..<count).compactMap { i in
+            adf_salvage_index_entry(self.salvageIndex, i).map { deletedEntry(from: $0.pointee) }
+        }
+    }
+
+    private func deletedEntry(from entry: adf_salvage_entry) -> DeletedEntry {
+        let name = withUnsafeBytes(of: entry.name) { String(cString: $0.bindMemory(to: CChar.self).baseAddress!) }
+        let type: EntryType
+        switch entry.sec_type {
+            case ST_FILE_SWIFT: type = .file
+            case ST_DIR_SWIFT: type = .directory
+            case ST_LFILE_SWIFT: type = .softLinkFile
+            case ST_LDIR_SWIFT: type = .softLinkDir
+            default: type = .unknown
+        }
+        let status: DeletedEntryStatus
+        switch entry.state {
+            case ADF_SALVAGE_RECOVERABLE: status = .recoverable
+            case ADF_SALVAGE_PARENT_DELETED: status = .parentDeleted
+            case ADF_SALVAGE_PARENT_GONE: status = .parentGone
+            case ADF_SALVAGE_UNSUPPORTED: status = .unsupported
+            default: status = .blocksReused
+        }
+        var date: Date? = nil
+        var components = DateComponents()
+        components.year = 1978
+        components.month = 1
+        components.day = 1
+        if let amigaEpoch = Calendar.current.date(from: components) {
+            var totalSeconds = TimeInterval(entry.days) * 24 * 60 * 60
+            totalSeconds += TimeInterval(entry.mins) * 60
+            totalSeconds += TimeInterval(entry.ticks) / 50.0
+            date = amigaEpoch.addingTimeInterval(totalSeconds)
+        }
+        return DeletedEntry(id: entry.header, parent: entry.parent, name: name, type: type,
+                            size: entry.size, date: date, status: status)
+    }
+
+    // Restores in passes, so a folder restored in one makes the entries
+    // deleted with it restorable in the next.
+    func restoreDeletedEntries(_ entries: [DeletedEntry]) -> String? {
+        return writingBack(keepingSalvageIndex: true) {
+            guard self.adfVolume != nil else { return "Volume not mounted." }
+            // Dropped by a write since the entries were listed; they may be stale.
+            guard let index = self.salvageIndex else {
+                return "The volume changed since the deleted entries were listed. Open Undelete again."
+            }
+
+            prepareBitmapChange()
+            var pending = entries
+            var restored = 0
+            while !pending.isEmpty {
+                let before = pending.count
+                pending = pending.filter { entry in
+                    guard adf_salvage_index_restore(index, entry.id) == ADF_RC_OK else { return true }
+                    if let dirIndex = self.dirIndex {
+                        entry.name.withCString { adf_dir_index_refresh_entry(dirIndex, entry.parent, $0) }
+                    }
+                    restored += 1
+                    return false
+                }
+                if pending.count == before { break }
+            }
+            log("ADFService: Restored \(restored) deleted entries, \(pending.count) failed.")
+            populateDiskInfo()
+
+            guard pending.isEmpty else {
+                return "Could not restore: " + pending.map { $0.name }.joined(separator: ", ")
+            }
+            return nil
+        }
+    }
+
     func createNewBlankADF(volumeName: String, fsType: UInt8) -> URL? {
         let tempDir = FileManager.default.temporaryDirectory
         let fileName = "blank_\(UUID().uuidString).adf"
@@ -985,23 +1416,25 @@ class ADFService {
     }
     
     func setProtectionBits(for entry: AmigaEntry, newBits: UInt32) -> String? {
-        guard let vol = self.adfVolume else { return "Volume is not open." }
+        return writingBack {
+            guard let vol = self.adfVolume else { return "Volume is not open." }
 
-        if !navigateToInternalPath() {
-            return "Failed to navigate to the entry's directory."
-        }
+            if !navigateToInternalPath() {
+                return "Failed to navigate to the entry's directory."
+            }
         
-        let parentSector = vol.pointee.curDirPtr
-        let result = entry.name.withCString { cName in
-            return adfSetEntryAccess(vol, parentSector, cName, Int32(bitPattern: newBits))
-        }
+            let parentSector = vol.pointee.curDirPtr
+            let result = entry.name.withCString { cName in
+                return adfSetEntryAccess(vol, parentSector, cName, Int32(bitPattern: newBits))
+            }
         
-        if result.rawValue == ADF_RC_OK_SWIFT {
-            log("ADFService: Successfully set protection bits for '\(entry.name)'.")
-            return nil
-        } else {
-            log("ADFService: adfSetEntryAccess failed for '\(entry.name)'. Check C-Log for details.")
-            return "ADFLib failed to set permissions for the entry."
+            if result.rawValue == ADF_RC_OK_SWIFT {
+                log("ADFService: Successfully set protection bits for '\(entry.name)'.")
+                return nil
+            } else {
+                log("ADFService: adfSetEntryAccess failed for '\(entry.name)'. Check C-Log for details.")
+                return "ADFLib failed to set permissions for the entry."
+            }
         }
     }
 }
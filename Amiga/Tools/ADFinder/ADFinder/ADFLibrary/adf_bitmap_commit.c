@@ -0,0 +1,132 @@
+//
+//  adf_bitmap_commit.c
+//  ADFinder
+//
+
+#include "adf_bitmap_commit.h"
+#include "adf_bitm.h"
+#include "adf_blk.h"
+#include "adf_raw.h"
+#include "adf_track_driver.h"
+#include "adf_mmap_driver.h"
+#include <stdlib.h>
+
+struct adf_bitmap_commit {
+    struct AdfVolume* vol;
+    struct adf_bitmap_commit_options options;
+    bool marked_invalid;    // bmFlag cleared on disk by us
+};
+
+// Pushes whatever the driver still holds back to the image file, so the
+// writes that follow cannot overtake it.
+static ADF_RETCODE flush_device(const struct AdfVolume* vol) {
+    ADF_RETCODE rc = adf_track_device_flush(vol->dev);
+    if (rc == ADF_RC_OK) {
+        rc = adf_mmap_device_flush(vol->dev);
+    }
+    return rc;
+}
+
+static ADF_RETCODE write_bm_flag(struct AdfVolume* vol, int32_t flag) {
+    struct AdfRootBlock root;
+    ADF_RETCODE rc = adfReadRootBlock(vol, (uint32_t)vol->rootBlock, &root);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    root.bmFlag = flag;
+    rc = adfWriteRootBlock(vol, (uint32_t)vol->rootBlock, &root);
+    if (rc == ADF_RC_OK) {
+        rc = flush_device(vol);
+    }
+    return rc;
+}
+
+static uint32_t count_dirty(const struct AdfVolume* vol) {
+    uint32_t dirty = 0;
+    for (uint32_t i = 0; i < vol->bitmap.size; i++) {
+        dirty += vol->bitmap.blocksChg[i] ? 1 : 0;
+    }
+    return dirty;
+}
+
+struct adf_bitmap_commit* adf_bitmap_commit_begin(struct AdfVolume* vol,
+                                                  const struct adf_bitmap_commit_options* options) {
+    if (!vol || !vol->bitmap.table || !vol->bitmap.blocksChg || !options) {
+        return NULL;
+    }
+    struct adf_bitmap_commit* commit = calloc(1, sizeof(*commit));
+    if (!commit) {
+        return NULL;
+    }
+    commit->vol = vol;
+    commit->options = *options;
+    return commit;
+}
+
+uint32_t adf_bitmap_commit_dirty_blocks(const struct adf_bitmap_commit* commit) {
+    return count_dirty(commit->vol);
+}
+
+ADF_RETCODE adf_bitmap_commit_prepare(struct adf_bitmap_commit* commit) {
+    if (!commit->options.ordered || commit->marked_invalid) {
+        return ADF_RC_OK;
+    }
+    ADF_RETCODE rc = write_bm_flag(commit->vol, ADF_BM_INVALID);
+    if (rc == ADF_RC_OK) {
+        commit->marked_invalid = true;
+    }
+    return rc;
+}
+
+ADF_RETCODE adf_bitmap_commit_changed(struct adf_bitmap_commit* commit) {
+    const uint32_t dirty = count_dirty(commit->vol);
+    if (dirty == 0) {
+        // Nothing pending: adfUpdateBitmap() ran and left bmFlag valid.
+        commit->marked_invalid = false;
+        return ADF_RC_OK;
+    }
+    if (commit->options.max_dirty_blocks > 0 && dirty >= commit->options.max_dirty_blocks) {
+        return adf_bitmap_commit_sync(commit);
+    }
+    return adf_bitmap_commit_prepare(commit);
+}
+
+ADF_RETCODE adf_bitmap_commit_sync(struct adf_bitmap_commit* commit) {
+    struct AdfVolume* vol = commit->vol;
+    if (count_dirty(vol) == 0 && !commit->marked_invalid) {
+        return ADF_RC_OK;
+    }
+    if (!commit->options.ordered) {
+        // adfUpdateBitmap() writes the changed blocks and marks the root valid.
+        return adfUpdateBitmap(vol);
+    }
+
+    ADF_RETCODE rc = flush_device(vol);
+    for (uint32_t i = 0; i < vol->bitmap.size && rc == ADF_RC_OK; i++) {
+        if (vol->bitmap.blocksChg[i]) {
+            rc = adfWriteBitmapBlock(vol, vol->bitmap.blocks[i], vol->bitmap.table[i]);
+            if (rc == ADF_RC_OK) {
+                vol->bitmap.blocksChg[i] = false;
+            }
+        }
+    }
+    if (rc == ADF_RC_OK) {
+        rc = flush_device(vol);
+    }
+    if (rc == ADF_RC_OK) {
+        rc = write_bm_flag(vol, ADF_BM_VALID);
+    }
+    if (rc == ADF_RC_OK) {
+        commit->marked_invalid = false;
+    }
+    return rc;
+}
+
+ADF_RETCODE adf_bitmap_commit_end(struct adf_bitmap_commit* commit) {
+    if (!commit) {
+        return ADF_RC_OK;
+    }
+    ADF_RETCODE rc = adf_bitmap_commit_sync(commit);
+    free(commit);
+    return rc;
+}
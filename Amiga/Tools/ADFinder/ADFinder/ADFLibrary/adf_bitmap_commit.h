@@ -0,0 +1,56 @@
+//
+//  adf_bitmap_commit.h
+//  ADFinder
+//
+
+#ifndef ADF_BITMAP_COMMIT_H
+#define ADF_BITMAP_COMMIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "adf_err.h"
+#include "adf_vol.h"
+
+// Deferred writing of a mounted volume's bitmap. adfUpdateBitmap() writes
+// every changed bitmap block and the root block each time it is called;
+// with a commit, allocations only change vol->bitmap in memory and the
+// bitmap goes out on adf_bitmap_commit_sync(), at the end, or once
+// max_dirty_blocks bitmap blocks have changed.
+//
+// In ordered mode the root block's bmFlag is cleared on disk before the
+// first deferred change, and a sync writes the data first, then the bitmap
+// blocks, then bmFlag back to valid. A volume left behind half way is
+// flagged for revalidation instead of showing allocated blocks as free.
+//
+// ADFlib's own file and directory calls still run adfUpdateBitmap()
+// themselves; call adf_bitmap_commit_changed() after them as after our own
+// allocations, so the commit sees what is already on disk.
+
+struct adf_bitmap_commit_options {
+    uint32_t max_dirty_blocks;  // 0: only on sync and end
+    bool ordered;
+};
+
+struct adf_bitmap_commit;
+
+struct adf_bitmap_commit* adf_bitmap_commit_begin(struct AdfVolume* vol,
+                                                  const struct adf_bitmap_commit_options* options);
+
+// Syncs and frees the commit.
+ADF_RETCODE adf_bitmap_commit_end(struct adf_bitmap_commit* commit);
+
+// In ordered mode, clears bmFlag on disk ahead of a change that links new
+// blocks into the tree. No-op otherwise.
+ADF_RETCODE adf_bitmap_commit_prepare(struct adf_bitmap_commit* commit);
+
+// Call after anything that changed the in-memory bitmap. Syncs when the
+// dirty block limit is reached.
+ADF_RETCODE adf_bitmap_commit_changed(struct adf_bitmap_commit* commit);
+
+// Writes the changed bitmap blocks now.
+ADF_RETCODE adf_bitmap_commit_sync(struct adf_bitmap_commit* commit);
+
+// Bitmap blocks changed in memory and not yet written.
+uint32_t adf_bitmap_commit_dirty_blocks(const struct adf_bitmap_commit* commit);
+
+#endif /* ADF_BITMAP_COMMIT_H */
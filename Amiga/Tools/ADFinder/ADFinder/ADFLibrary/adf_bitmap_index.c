@@ -0,0 +1,284 @@
+//
+//  adf_bitmap_index.c
+//  ADFinder
+//
+
+#include "adf_bitmap_index.h"
+#include "adf_bitm.h"
+#include "adf_blk.h"
+#include <stdlib.h>
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Bit i of the bitmap stands for block i + 2; a set bit means free.
+#define BITS_PER_PAGE (ADF_BM_MAP_SIZE * 32)
+
+struct adf_bitmap_index {
+    struct AdfVolume* vol;
+    uint32_t num_bits;
+    uint32_t num_pages;
+    uint32_t* page_free;    // free blocks per bitmap block
+    uint32_t total_free;
+    ADF_SECTNUM hint;       // where the next allocation starts looking
+};
+
+static uint32_t bitmap_bits(const struct AdfVolume* vol) {
+    return adfVolGetSizeInBlocks(vol) - 2;
+}
+
+static uint32_t bitmap_pages(const struct AdfVolume* vol, uint32_t num_bits) {
+    const uint32_t needed = (num_bits + BITS_PER_PAGE - 1) / BITS_PER_PAGE;
+    return needed < vol->bitmap.size ? needed : vol->bitmap.size;
+}
+
+// Bits past the end of the volume are not blocks, whatever the disk says.
+static uint32_t valid_mask(uint32_t num_bits, uint32_t word_index) {
+    const uint32_t first = word_index * 32;
+    if (first + 32 <= num_bits) return UINT32_MAX;
+    if (first >= num_bits) return 0;
+    return (1u << (num_bits - first)) - 1;
+}
+
+static uint32_t popcount_words(const uint32_t* words, uint32_t count) {
+    uint32_t total = 0;
+    uint32_t i = 0;
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    // Four words per step: per-byte counts, then one horizontal add (at most 128).
+    for (; i + 4 <= count; i += 4) {
+        total += vaddvq_u8(vcntq_u8(vreinterpretq_u8_u32(vld1q_u32(words + i))));
+    }
+#endif
+    for (; i < count; i++) {
+        total += (uint32_t)__builtin_popcount(words[i]);
+    }
+    return total;
+}
+
+static uint32_t count_page(const struct AdfVolume* vol, uint32_t num_bits, uint32_t page) {
+    const uint32_t* map = vol->bitmap.table[page]->map;
+    const uint32_t first_word = page * ADF_BM_MAP_SIZE;
+    const uint32_t valid_words = num_bits / 32 > first_word ? num_bits / 32 - first_word : 0;
+    const uint32_t full_words = valid_words < ADF_BM_MAP_SIZE ? valid_words : ADF_BM_MAP_SIZE;
+
+    uint32_t free_blocks = popcount_words(map, full_words);
+    for (uint32_t word = full_words; word < ADF_BM_MAP_SIZE; word++) {
+        free_blocks += (uint32_t)__builtin_popcount(map[word] & valid_mask(num_bits, first_word + word));
+    }
+    return free_blocks;
+}
+
+uint32_t adf_bitmap_count_free(const struct AdfVolume* vol) {
+    if (!vol || !vol->bitmap.table) {
+        return 0;
+    }
+    const uint32_t num_bits = bitmap_bits(vol);
+    const uint32_t num_pages = bitmap_pages(vol, num_bits);
+    uint32_t total = 0;
+    for (uint32_t page = 0; page < num_pages; page++) {
+        total += count_page(vol, num_bits, page);
+    }
+    return total;
+}
+
+struct adf_bitmap_index* adf_bitmap_index_create(struct AdfVolume* vol) {
+    if (!vol || !vol->bitmap.table) {
+        return NULL;
+    }
+    struct adf_bitmap_index* index = calloc(1, sizeof(*index));
+    if (!index) {
+        return NULL;
+    }
+    index->vol = vol;
+    index->num_bits = bitmap_bits(vol);
+    index->num_pages = bitmap_pages(vol, index->num_bits);
+    index->page_free = calloc(index->num_pages ? index->num_pages : 1, sizeof(*index->page_free));
+    if (!index->page_free) {
+        free(index);
+        return NULL;
+    }
+    index->hint = vol->rootBlock; // ADFlib also allocates outwards from the root block
+    adf_bitmap_index_rebuild(index);
+    return index;
+}
+
+void adf_bitmap_index_free(struct adf_bitmap_index* index) {
+    if (index) {
+        free(index->page_free);
+        free(index);
+    }
+}
+
+void adf_bitmap_index_rebuild(struct adf_bitmap_index* index) {
+    index->total_free = 0;
+    for (uint32_t page = 0; page < index->num_pages; page++) {
+        index->page_free[page] = count_page(index->vol, index->num_bits, page);
+        index->total_free += index->page_free[page];
+    }
+}
+
+uint32_t adf_bitmap_index_free_blocks(const struct adf_bitmap_index* index) {
+    return index->total_free;
+}
+
+static bool bit_is_free(const struct adf_bitmap_index* index, uint32_t bit) {
+    const uint32_t page = bit / BITS_PER_PAGE;
+    const uint32_t word = (bit / 32) % ADF_BM_MAP_SIZE;
+    return (index->vol->bitmap.table[page]->map[word] >> (bit % 32)) & 1;
+}
+
+// First free bit in [lo, hi), or -1.
+static int64_t find_free_bit(const struct adf_bitmap_index* index, uint32_t lo, uint32_t hi) {
+    uint32_t bit = lo;
+    while (bit < hi) {
+        const uint32_t page = bit / BITS_PER_PAGE;
+        if (page >= index->num_pages) {
+            break;
+        }
+        if (index->page_free[page] == 0) {
+            bit = (page + 1) * BITS_PER_PAGE;
+            continue;
+        }
+        const uint32_t word_index = bit / 32;
+        const uint32_t word = index->vol->bitmap.table[page]->map[word_index % ADF_BM_MAP_SIZE] &
+                              valid_mask(index->num_bits, word_index) & (UINT32_MAX << (bit % 32));
+        if (word != 0) {
+            const uint32_t found = word_index * 32 + (uint32_t)__builtin_ctz(word);
+            return found < hi ? (int64_t)found : -1;
+        }
+        bit = (word_index + 1) * 32;
+    }
+    return -1;
+}
+
+// First used bit in [lo, hi), or hi. Bits past the volume count as used.
+static uint32_t find_used_bit(const struct adf_bitmap_index* index, uint32_t lo, uint32_t hi) {
+    uint32_t bit = lo;
+    while (bit < hi) {
+        const uint32_t page = bit / BITS_PER_PAGE;
+        if (page >= index->num_pages) {
+            return bit;
+        }
+        if (index->page_free[page] == BITS_PER_PAGE && bit % BITS_PER_PAGE == 0) {
+            bit += BITS_PER_PAGE;
+            continue;
+        }
+        const uint32_t word_index = bit / 32;
+        const uint32_t free_bits = index->vol->bitmap.table[page]->map[word_index % ADF_BM_MAP_SIZE] &
+                                   valid_mask(index->num_bits, word_index);
+        const uint32_t used_bits = ~free_bits & (UINT32_MAX << (bit % 32));
+        if (used_bits != 0) {
+            const uint32_t found = word_index * 32 + (uint32_t)__builtin_ctz(used_bits);
+            return found < hi ? found : hi;
+        }
+        bit = (word_index + 1) * 32;
+    }
+    return hi;
+}
+
+// Walks the free runs of [lo, hi) and updates the best candidate so far.
+// Returns true once first-fit has its run.
+static bool scan_runs(const struct adf_bitmap_index* index, uint32_t lo, uint32_t hi, uint32_t wanted,
+                      enum adf_extent_policy policy, uint32_t* best_start, uint32_t* best_length,
+                      uint32_t* longest_start, uint32_t* longest_length) {
+    uint32_t bit = lo;
+    while (bit < hi) {
+        const int64_t start = find_free_bit(index, bit, hi);
+        if (start < 0) {
+            break;
+        }
+        const uint32_t end = find_used_bit(index, (uint32_t)start, hi);
+        const uint32_t length = end - (uint32_t)start;
+        if (length >= wanted && (*best_length == 0 || length < *best_length)) {
+            *best_start = (uint32_t)start;
+            *best_length = length;
+            if (policy == ADF_EXTENT_FIRST_FIT || length == wanted) {
+                return true;
+            }
+        }
+        if (length > *longest_length) {
+            *longest_start = (uint32_t)start;
+            *longest_length = length;
+        }
+        bit = end;
+    }
+    return false;
+}
+
+bool adf_bitmap_index_alloc_extent(struct adf_bitmap_index* index, uint32_t max_blocks,
+                                   enum adf_extent_policy policy, struct adf_extent* extent) {
+    if (index->total_free == 0 || max_blocks == 0) {
+        return false;
+    }
+    const uint32_t wanted = max_blocks < index->total_free ? max_blocks : index->total_free;
+    const uint32_t cursor = (index->hint >= 2 && (uint32_t)(index->hint - 2) < index->num_bits)
+                                ? (uint32_t)(index->hint - 2) : 0;
+
+    uint32_t best_start = 0, best_length = 0, longest_start = 0, longest_length = 0;
+    if (!scan_runs(index, cursor, index->num_bits, wanted, policy, &best_start, &best_length, &longest_start, &longest_length)) {
+        scan_runs(index, 0, cursor, wanted, policy, &best_start, &best_length, &longest_start, &longest_length);
+    }
+    const uint32_t start = best_length ? best_start : longest_start;
+    const uint32_t length = best_length ? wanted : longest_length;
+    if (length == 0) {
+        return false;
+    }
+
+    extent->start = (ADF_SECTNUM)(start + 2);
+    extent->length = length;
+    for (uint32_t i = 0; i < length; i++) {
+        adf_bitmap_index_set_used(index, extent->start + (ADF_SECTNUM)i);
+    }
+    index->hint = extent->start + (ADF_SECTNUM)length;
+    return true;
+}
+
+ADF_SECTNUM adf_bitmap_index_find_free(const struct adf_bitmap_index* index, ADF_SECTNUM from) {
+    if (index->total_free == 0) {
+        return -1;
+    }
+    uint32_t start = (from >= 2 && (uint32_t)(from - 2) < index->num_bits) ? (uint32_t)(from - 2) : 0;
+    int64_t bit = find_free_bit(index, start, index->num_bits);
+    if (bit < 0) {
+        bit = find_free_bit(index, 0, start);
+    }
+    return bit < 0 ? -1 : (ADF_SECTNUM)(bit + 2);
+}
+
+void adf_bitmap_index_set_used(struct adf_bitmap_index* index, ADF_SECTNUM block) {
+    if (block < 2 || (uint32_t)(block - 2) >= index->num_bits || !bit_is_free(index, (uint32_t)(block - 2))) {
+        return;
+    }
+    adfSetBlockUsed(index->vol, block);
+    index->page_free[(uint32_t)(block - 2) / BITS_PER_PAGE]--;
+    index->total_free--;
+}
+
+void adf_bitmap_index_set_free(struct adf_bitmap_index* index, ADF_SECTNUM block) {
+    if (block < 2 || (uint32_t)(block - 2) >= index->num_bits || bit_is_free(index, (uint32_t)(block - 2))) {
+        return;
+    }
+    adfSetBlockFree(index->vol, block);
+    index->page_free[(uint32_t)(block - 2) / BITS_PER_PAGE]++;
+    index->total_free++;
+}
+
+ADF_SECTNUM adf_bitmap_index_alloc1(struct adf_bitmap_index* index) {
+    const ADF_SECTNUM block = adf_bitmap_index_find_free(index, index->hint);
+    if (block < 0) {
+        return -1;
+    }
+    adf_bitmap_index_set_used(index, block);
+    index->hint = block + 1;
+    return block;
+}
+
+bool adf_bitmap_index_alloc(struct adf_bitmap_index* index, int num_blocks, ADF_SECTNUM* blocks) {
+    if (num_blocks < 0 || (uint32_t)num_blocks > index->total_free) {
+        return false;
+    }
+    for (int i = 0; i < num_blocks; i++) {
+        blocks[i] = adf_bitmap_index_alloc1(index);
+    }
+    return true;
+}
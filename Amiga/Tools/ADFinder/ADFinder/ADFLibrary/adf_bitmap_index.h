@@ -0,0 +1,66 @@
+//
+//  adf_bitmap_index.h
+//  ADFinder
+//
+
+#ifndef ADF_BITMAP_INDEX_H
+#define ADF_BITMAP_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "adf_types.h"
+#include "adf_vol.h"
+
+// Free-space queries and block allocation over a mounted volume's bitmap
+// (vol->bitmap.table), a 32-bit word at a time instead of one
+// adfIsBlockFree() call per block. The index keeps a free count per bitmap
+// block, so full stretches of a large hardfile are skipped whole, and a
+// cursor just past the last allocation.
+//
+// Blocks allocated or freed through the index go through adfSetBlockUsed() /
+// adfSetBlockFree(), so the volume bitmap stays authoritative and is written
+// by adfUpdateBitmap() as usual. Rebuild the index after anything else
+// (ADFlib's own file and directory calls) has changed the bitmap.
+
+struct adf_bitmap_index;
+
+struct adf_bitmap_index* adf_bitmap_index_create(struct AdfVolume* vol);
+void adf_bitmap_index_free(struct adf_bitmap_index* index);
+
+// Re-reads the bitmap, e.g. after ADFlib allocated blocks on its own.
+void adf_bitmap_index_rebuild(struct adf_bitmap_index* index);
+
+uint32_t adf_bitmap_index_free_blocks(const struct adf_bitmap_index* index);
+
+// First free block at or after from, wrapping around; -1 if the volume is full.
+ADF_SECTNUM adf_bitmap_index_find_free(const struct adf_bitmap_index* index, ADF_SECTNUM from);
+
+// Same allocation contracts as adfGet1FreeBlock() / adfGetFreeBlocks():
+// a block number or -1, and all-or-nothing for a list.
+ADF_SECTNUM adf_bitmap_index_alloc1(struct adf_bitmap_index* index);
+bool adf_bitmap_index_alloc(struct adf_bitmap_index* index, int num_blocks, ADF_SECTNUM* blocks);
+
+// A run of consecutive blocks.
+struct adf_extent {
+    ADF_SECTNUM start;
+    uint32_t length;
+};
+
+enum adf_extent_policy {
+    ADF_EXTENT_FIRST_FIT,   // first run from the cursor that is long enough
+    ADF_EXTENT_BEST_FIT     // shortest run that is long enough
+};
+
+// Allocates one run of at most max_blocks free blocks. When no free run is
+// that long, the longest one is taken and the caller asks again for the
+// rest. False only when nothing is free.
+bool adf_bitmap_index_alloc_extent(struct adf_bitmap_index* index, uint32_t max_blocks,
+                                   enum adf_extent_policy policy, struct adf_extent* extent);
+
+void adf_bitmap_index_set_used(struct adf_bitmap_index* index, ADF_SECTNUM block);
+void adf_bitmap_index_set_free(struct adf_bitmap_index* index, ADF_SECTNUM block);
+
+// Drop-in for adfCountFreeBlocks(): a popcount over the bitmap, no index needed.
+uint32_t adf_bitmap_count_free(const struct AdfVolume* vol);
+
+#endif /* ADF_BITMAP_INDEX_H */
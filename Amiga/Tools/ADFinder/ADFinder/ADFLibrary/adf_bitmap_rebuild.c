@@ -0,0 +1,600 @@
+//
+//  adf_bitmap_rebuild.c
+//  ADFinder
+//
+
+#include "adf_bitmap_rebuild.h"
+#include "adf_bitm.h"
+#include "adf_blk.h"
+#include "adf_byteorder.h"
+#include "adf_checksum.h"
+#include "adf_dev.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Blocks per device read (1 MB).
+#define REBUILD_CHUNK_BLOCKS 2048
+
+enum block_kind {
+    KIND_OTHER,                 // data, free space, anything without a type
+    KIND_ROOT,
+    KIND_DIR,
+    KIND_FILE,
+    KIND_LINK,
+    KIND_EXT,
+    KIND_DIRCACHE
+};
+
+#define FLAG_UNREADABLE 0x01
+#define FLAG_DAMAGED    0x02    // typed, but bad checksum or header key
+#define FLAG_FIXED      0x04    // boot, root and bitmap blocks: always in use
+#define FLAG_REACHED    0x08    // reached by the tree walk
+#define FLAG_CUT        0x10    // reached, but one of its chains ran into a bad block
+
+enum accept_state {
+    ACCEPT_UNKNOWN,
+    ACCEPT_PENDING,             // on the path being resolved; seeing it again is a loop
+    ACCEPT_YES,
+    ACCEPT_NO
+};
+
+struct block_info {
+    uint8_t kind;
+    uint8_t flags;
+    uint8_t accept;
+    uint32_t record;            // slot in records, for typed blocks
+    ADF_SECTNUM claim;          // first file header or extension block listing it as data
+};
+
+// What the rebuild needs of a typed block, in host order.
+struct record {
+    ADF_SECTNUM parent;
+    ADF_SECTNUM next_same_hash;
+    ADF_SECTNUM chain;          // extension block, or next directory cache block
+    uint32_t table;             // a directory's slot in the hash tables
+};
+
+struct claim {
+    ADF_SECTNUM block;
+    ADF_SECTNUM claimant;
+};
+
+struct rebuild {
+    struct AdfVolume* vol;
+    uint32_t num_blocks;
+    bool dircache;
+    struct block_info* blocks;
+
+    struct record* records;
+    uint32_t num_records;
+    uint32_t records_capacity;
+
+    int32_t (*tables)[ADF_HT_SIZE];
+    uint32_t num_tables;
+    uint32_t tables_capacity;
+
+    // Second and later claims on a block, sorted by block after the sweep.
+    struct claim* claims;
+    uint32_t num_claims;
+    uint32_t claims_capacity;
+
+    ADF_SECTNUM* path;          // scratch for resolving parent chains
+    uint32_t path_capacity;
+    bool walk_interrupted;      // a chain of the tree ran into a bad block
+};
+
+static bool grow(void** array, uint32_t* capacity, size_t size) {
+    const uint32_t grown = *capacity ? *capacity * 2 : 256;
+    void* p = realloc(*array, grown * size);
+    if (!p) {
+        return false;
+    }
+    *array = p;
+    *capacity = grown;
+    return true;
+}
+
+static bool in_volume(const struct rebuild* r, ADF_SECTNUM sector) {
+    return sector >= 2 && (uint32_t)sector < r->num_blocks;
+}
+
+static const struct record* record_of(const struct rebuild* r, ADF_SECTNUM sector) {
+    return &r->records[r->blocks[sector].record];
+}
+
+static bool add_claim(struct rebuild* r, ADF_SECTNUM block, ADF_SECTNUM claimant) {
+    if (!in_volume(r, block)) {
+        return true;
+    }
+    struct block_info* info = &r->blocks[block];
+    if (info->claim == 0) {
+        info->claim = claimant;
+        return true;
+    }
+    if (r->num_claims == r->claims_capacity &&
+        !grow((void**)&r->claims, &r->claims_capacity, sizeof(*r->claims))) {
+        return false;
+    }
+    r->claims[r->num_claims++] = (struct claim){ block, claimant };
+    return true;
+}
+
+static bool add_claims(struct rebuild* r, ADF_SECTNUM claimant, const int32_t* data_blocks, int32_t high_seq) {
+    if (high_seq < 0 || high_seq > ADF_MAX_DATABLK) {
+        high_seq = ADF_MAX_DATABLK;
+    }
+    for (int32_t i = 0; i < high_seq; i++) {
+        if (!add_claim(r, data_blocks[ADF_MAX_DATABLK - 1 - i], claimant)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Identifies one block by its type and secType and keeps what the rebuild
+// needs of it. Damaged blocks are kept too: their claims can hold blocks
+// allocated.
+static bool sweep_block(struct rebuild* r, ADF_SECTNUM sector, uint8_t* raw) {
+    struct block_info* info = &r->blocks[sector];
+    const int32_t type = (int32_t)get_be32(raw);
+    const int32_t sec_type = (int32_t)get_be32(raw + ADF_LOGICAL_BLOCK_SIZE - 4);
+    int swap;
+    if (type == ADF_T_HEADER) {
+        switch (sec_type) {
+        case ADF_ST_ROOT:
+            if (sector != r->vol->rootBlock) {
+                return true;
+            }
+            info->kind = KIND_ROOT; swap = ADF_SWBL_ROOT; break;
+        case ADF_ST_DIR: info->kind = KIND_DIR; swap = ADF_SWBL_DIR; break;
+        case ADF_ST_FILE: info->kind = KIND_FILE; swap = ADF_SWBL_FILE; break;
+        case ADF_ST_LFILE:
+        case ADF_ST_LDIR:
+        case ADF_ST_LSOFT: info->kind = KIND_LINK; swap = ADF_SWBL_LINK; break;
+        default: return true;
+        }
+    } else if (type == ADF_T_LIST && sec_type == ADF_ST_FILE) {
+        info->kind = KIND_EXT;
+        swap = ADF_SWBL_FEXT;
+    } else if (type == ADF_T_DIRC && r->dircache) {
+        info->kind = KIND_DIRCACHE;
+        swap = ADF_SWBL_CACHE;
+    } else {
+        return true;
+    }
+    if (adf_normal_sum(raw, 0x14, ADF_LOGICAL_BLOCK_SIZE) != get_be32(raw + 0x14) ||
+        (info->kind != KIND_ROOT && get_be32(raw + 4) != (uint32_t)sector)) {
+        info->flags |= FLAG_DAMAGED;
+    }
+    adf_swap_endian(raw, swap);
+
+    if (r->num_records == r->records_capacity &&
+        !grow((void**)&r->records, &r->records_capacity, sizeof(*r->records))) {
+        return false;
+    }
+    struct record* rec = &r->records[r->num_records];
+    memset(rec, 0, sizeof(*rec));
+    info->record = r->num_records++;
+
+    switch (info->kind) {
+    case KIND_ROOT:
+    case KIND_DIR: {
+        const struct AdfEntryBlock* entry = (const struct AdfEntryBlock*)raw;
+        if (r->num_tables == r->tables_capacity &&
+            !grow((void**)&r->tables, &r->tables_capacity, sizeof(*r->tables))) {
+            return false;
+        }
+        memcpy(r->tables[r->num_tables], entry->hashTable, sizeof(*r->tables));
+        rec->table = r->num_tables++;
+        rec->parent = entry->parent;
+        rec->next_same_hash = entry->nextSameHash;
+        rec->chain = entry->extension;
+        return true;
+    }
+    case KIND_FILE: {
+        const struct AdfFileHeaderBlock* fhdr = (const struct AdfFileHeaderBlock*)raw;
+        rec->parent = fhdr->parent;
+        rec->next_same_hash = fhdr->nextSameHash;
+        rec->chain = fhdr->extension;
+        return add_claims(r, sector, fhdr->dataBlocks, fhdr->highSeq);
+    }
+    case KIND_LINK: {
+        const struct AdfEntryBlock* entry = (const struct AdfEntryBlock*)raw;
+        rec->parent = entry->parent;
+        rec->next_same_hash = entry->nextSameHash;
+        return true;
+    }
+    case KIND_EXT: {
+        const struct AdfFileExtBlock* fext = (const struct AdfFileExtBlock*)raw;
+        rec->parent = fext->parent;
+        rec->chain = fext->extension;
+        return add_claims(r, sector, fext->dataBlocks, fext->highSeq);
+    }
+    default: {
+        const struct AdfDirCacheBlock* cache = (const struct AdfDirCacheBlock*)raw;
+        rec->parent = cache->parent;
+        rec->chain = cache->nextDirC;
+        return true;
+    }
+    }
+}
+
+// Reads a chunk in one call, or block by block when that fails so that
+// only the unreadable blocks are lost.
+static void read_chunk(struct rebuild* r, uint32_t first, uint32_t count, uint8_t* chunk) {
+    const struct AdfVolume* vol = r->vol;
+    const uint32_t device_sector = (uint32_t)vol->firstBlock + first;
+    if (adfDevReadBlock(vol->dev, device_sector, count * ADF_LOGICAL_BLOCK_SIZE, chunk) == ADF_RC_OK) {
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t* block = chunk + (size_t)i * ADF_LOGICAL_BLOCK_SIZE;
+        if (adfDevReadBlock(vol->dev, device_sector + i, ADF_LOGICAL_BLOCK_SIZE, block) != ADF_RC_OK) {
+            memset(block, 0, ADF_LOGICAL_BLOCK_SIZE);
+            r->blocks[first + i].flags |= FLAG_UNREADABLE;
+        }
+    }
+}
+
+static int compare_claims(const void* a, const void* b) {
+    const struct claim* x = a;
+    const struct claim* y = b;
+    return (x->block > y->block) - (x->block < y->block);
+}
+
+static ADF_RETCODE sweep_volume(struct rebuild* r) {
+    uint8_t* chunk = malloc((size_t)REBUILD_CHUNK_BLOCKS * ADF_LOGICAL_BLOCK_SIZE);
+    if (!chunk) {
+        return ADF_RC_MALLOC;
+    }
+    ADF_RETCODE rc = ADF_RC_OK;
+    for (uint32_t first = 0; first < r->num_blocks && rc == ADF_RC_OK; first += REBUILD_CHUNK_BLOCKS) {
+        const uint32_t count = r->num_blocks - first < REBUILD_CHUNK_BLOCKS ? r->num_blocks - first
+                                                                            : REBUILD_CHUNK_BLOCKS;
+        read_chunk(r, first, count, chunk);
+        for (uint32_t i = 0; i < count && rc == ADF_RC_OK; i++) {
+            const ADF_SECTNUM sector = (ADF_SECTNUM)(first + i);
+            if (sector < 2 || r->blocks[sector].flags & FLAG_UNREADABLE) {
+                continue;
+            }
+            if (!sweep_block(r, sector, chunk + (size_t)i * ADF_LOGICAL_BLOCK_SIZE)) {
+                rc = ADF_RC_MALLOC;
+            }
+        }
+    }
+    free(chunk);
+    if (rc == ADF_RC_OK && r->num_claims > 1) {
+        qsort(r->claims, r->num_claims, sizeof(*r->claims), compare_claims);
+    }
+    return rc;
+}
+
+// The bitmap extension blocks have no type to be told by; they are read
+// here along their chain from the root block.
+static void mark_bitmap_blocks(struct rebuild* r) {
+    const struct AdfVolume* vol = r->vol;
+    r->blocks[0].flags |= FLAG_FIXED;
+    r->blocks[1].flags |= FLAG_FIXED;
+    if (in_volume(r, vol->rootBlock)) {
+        r->blocks[vol->rootBlock].flags |= FLAG_FIXED;
+    }
+    for (uint32_t i = 0; i < vol->bitmap.size; i++) {
+        if (in_volume(r, vol->bitmap.blocks[i])) {
+            r->blocks[vol->bitmap.blocks[i]].flags |= FLAG_FIXED;
+        }
+    }
+    struct AdfRootBlock root;
+    if (adfReadRootBlock((struct AdfVolume*)vol, (uint32_t)vol->rootBlock, &root) != ADF_RC_OK) {
+        return;
+    }
+    uint8_t buf[ADF_LOGICAL_BLOCK_SIZE];
+    for (ADF_SECTNUM ext = root.bmExt; in_volume(r, ext) && !(r->blocks[ext].flags & FLAG_FIXED);) {
+        r->blocks[ext].flags |= FLAG_FIXED;
+        if (adfDevReadBlock(vol->dev, (uint32_t)(vol->firstBlock + ext), ADF_LOGICAL_BLOCK_SIZE, buf) != ADF_RC_OK) {
+            break;
+        }
+        ext = (ADF_SECTNUM)get_be32(buf + offsetof(struct AdfBitmapExtBlock, nextBlock));
+    }
+}
+
+static bool parent_kind_fits(uint8_t kind, uint8_t parent_kind) {
+    if (kind == KIND_EXT) {
+        return parent_kind == KIND_FILE;
+    }
+    return parent_kind == KIND_DIR || parent_kind == KIND_ROOT;
+}
+
+// Whether a typed block's parent pointers lead up to the root block through
+// undamaged blocks of the right kinds. Resolves the whole path at once.
+static bool accepted(struct rebuild* r, ADF_SECTNUM sector) {
+    uint32_t depth = 0;
+    uint8_t result;
+    for (ADF_SECTNUM cur = sector;;) {
+        struct block_info* info = &r->blocks[cur];
+        if (info->accept == ACCEPT_YES || info->accept == ACCEPT_NO) {
+            result = info->accept;
+            break;
+        }
+        if (info->accept == ACCEPT_PENDING || info->kind == KIND_OTHER || info->flags & FLAG_DAMAGED) {
+            result = ACCEPT_NO;
+            break;
+        }
+        if (depth == r->path_capacity &&
+            !grow((void**)&r->path, &r->path_capacity, sizeof(*r->path))) {
+            result = ACCEPT_NO; // too deep to tell; the tree decides if it matters
+            break;
+        }
+        r->path[depth++] = cur;
+        info->accept = ACCEPT_PENDING;
+        if (info->kind == KIND_ROOT) {
+            result = ACCEPT_YES;
+            break;
+        }
+        const ADF_SECTNUM parent = record_of(r, cur)->parent;
+        if (!in_volume(r, parent) || !parent_kind_fits(info->kind, r->blocks[parent].kind)) {
+            result = ACCEPT_NO;
+            break;
+        }
+        cur = parent;
+    }
+    for (uint32_t i = 0; i < depth; i++) {
+        r->blocks[r->path[i]].accept = result;
+    }
+    return result == ACCEPT_YES;
+}
+
+// The claims on a block after the one kept in its block_info.
+static const struct claim* more_claims(const struct rebuild* r, ADF_SECTNUM block, uint32_t* count) {
+    uint32_t lo = 0, hi = r->num_claims;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (r->claims[mid].block < block) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    uint32_t end = lo;
+    while (end < r->num_claims && r->claims[end].block == block) {
+        end++;
+    }
+    *count = end - lo;
+    return r->claims + lo;
+}
+
+// A damaged block, or an extension block of a damaged file header.
+static bool damaged_block(const struct rebuild* r, ADF_SECTNUM sector) {
+    const struct block_info* info = &r->blocks[sector];
+    if (info->flags & FLAG_DAMAGED) {
+        return true;
+    }
+    if (info->kind != KIND_EXT) {
+        return false;
+    }
+    const ADF_SECTNUM file = record_of(r, sector)->parent;
+    return in_volume(r, file) && r->blocks[file].kind == KIND_FILE && r->blocks[file].flags & FLAG_DAMAGED;
+}
+
+// A typed block the walk did not reach although the first reached block up
+// its parent chain had every chain walked to the end: it, or the entry it
+// hangs from, was taken out of that chain, as a deletion does.
+static bool unlinked(struct rebuild* r, ADF_SECTNUM sector) {
+    if (r->blocks[sector].kind == KIND_OTHER || r->blocks[sector].flags & FLAG_REACHED ||
+        !accepted(r, sector)) {
+        return false;
+    }
+    ADF_SECTNUM cur = sector;
+    while (!(r->blocks[cur].flags & FLAG_REACHED) && r->blocks[cur].kind != KIND_ROOT) {
+        cur = record_of(r, cur)->parent;
+    }
+    return (r->blocks[cur].flags & (FLAG_REACHED | FLAG_CUT)) == FLAG_REACHED;
+}
+
+enum claim_test { CLAIM_ACCEPTED, CLAIM_REACHED, CLAIM_DAMAGED, CLAIM_LINKED };
+
+static bool claimant_passes(struct rebuild* r, ADF_SECTNUM claimant, enum claim_test test) {
+    switch (test) {
+    case CLAIM_ACCEPTED: return accepted(r, claimant);
+    case CLAIM_REACHED: return r->blocks[claimant].flags & FLAG_REACHED;
+    case CLAIM_DAMAGED: return damaged_block(r, claimant);
+    default: return !unlinked(r, claimant);
+    }
+}
+
+static bool claimed(struct rebuild* r, ADF_SECTNUM block, enum claim_test test) {
+    const ADF_SECTNUM first = r->blocks[block].claim;
+    if (first == 0) {
+        return false;
+    }
+    if (claimant_passes(r, first, test)) {
+        return true;
+    }
+    uint32_t count;
+    const struct claim* more = more_claims(r, block, &count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (claimant_passes(r, more[i].claimant, test)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool sweep_used(struct rebuild* r, ADF_SECTNUM sector) {
+    const struct block_info* info = &r->blocks[sector];
+    if (info->flags & FLAG_FIXED) {
+        return true;
+    }
+    if (info->kind != KIND_OTHER && accepted(r, sector)) {
+        return true;
+    }
+    return claimed(r, sector, CLAIM_ACCEPTED);
+}
+
+static void cut(struct rebuild* r, ADF_SECTNUM owner) {
+    r->walk_interrupted = true;
+    if (owner != 0) {
+        r->blocks[owner].flags |= FLAG_CUT;
+    }
+}
+
+// Takes the next block of a chain of owner if it is an undamaged block of
+// the kind and not reached before. A chain cut short by anything else may
+// hide blocks behind it, so the owner is marked.
+static bool reach(struct rebuild* r, ADF_SECTNUM owner, ADF_SECTNUM sector, uint32_t kind_mask) {
+    if (sector == 0) {
+        return false;
+    }
+    if (!in_volume(r, sector)) {
+        cut(r, owner);
+        return false;
+    }
+    struct block_info* info = &r->blocks[sector];
+    if (info->flags & FLAG_REACHED) {
+        return false;
+    }
+    if (!(kind_mask & (1u << info->kind)) || info->flags & (FLAG_DAMAGED | FLAG_UNREADABLE)) {
+        cut(r, owner);
+        return false;
+    }
+    info->flags |= FLAG_REACHED;
+    return true;
+}
+
+#define MASK_ENTRY ((1u << KIND_DIR) | (1u << KIND_FILE) | (1u << KIND_LINK))
+
+// The tree walk, over the records of the sweep: hash chains from the root,
+// file extension chains and directory cache chains.
+static ADF_RETCODE walk_tree(struct rebuild* r) {
+    const ADF_SECTNUM root = r->vol->rootBlock;
+    if (!reach(r, 0, root, 1u << KIND_ROOT)) {
+        return ADF_RC_OK;
+    }
+    uint32_t depth = 0, capacity = 0;
+    ADF_SECTNUM* stack = NULL;
+    if (!grow((void**)&stack, &capacity, sizeof(*stack))) {
+        return ADF_RC_MALLOC;
+    }
+    stack[depth++] = root;
+    while (depth > 0) {
+        const ADF_SECTNUM dir = stack[--depth];
+        const struct record* dir_rec = record_of(r, dir);
+        if (r->dircache) {
+            for (ADF_SECTNUM dirc = dir_rec->chain; reach(r, dir, dirc, 1u << KIND_DIRCACHE);) {
+                dirc = record_of(r, dirc)->chain;
+            }
+        }
+        const int32_t* table = r->tables[dir_rec->table];
+        for (uint32_t slot = 0; slot < ADF_HT_SIZE; slot++) {
+            for (ADF_SECTNUM sector = table[slot]; reach(r, dir, sector, MASK_ENTRY);) {
+                const struct record* rec = record_of(r, sector);
+                if (r->blocks[sector].kind == KIND_DIR) {
+                    if (depth == capacity && !grow((void**)&stack, &capacity, sizeof(*stack))) {
+                        free(stack);
+                        return ADF_RC_MALLOC;
+                    }
+                    stack[depth++] = sector;
+                } else if (r->blocks[sector].kind == KIND_FILE) {
+                    for (ADF_SECTNUM ext = rec->chain; reach(r, sector, ext, 1u << KIND_EXT);) {
+                        ext = record_of(r, ext)->chain;
+                    }
+                }
+                sector = rec->next_same_hash;
+            }
+        }
+    }
+    free(stack);
+    return ADF_RC_OK;
+}
+
+static bool tree_used(struct rebuild* r, ADF_SECTNUM sector) {
+    return r->blocks[sector].flags & (FLAG_FIXED | FLAG_REACHED) || claimed(r, sector, CLAIM_REACHED);
+}
+
+// Blocks the tree does not reach but that may still hold something: better
+// a few blocks lost to allocation than a file overwritten.
+static bool damaged(struct rebuild* r, ADF_SECTNUM sector) {
+    return r->blocks[sector].flags & FLAG_UNREADABLE || damaged_block(r, sector) || claimed(r, sector, CLAIM_DAMAGED);
+}
+
+// Blocks the tree does not reach that are known to be deleted: unlinked
+// ones, and data blocks listed only by unlinked file blocks.
+static bool deleted(struct rebuild* r, ADF_SECTNUM sector) {
+    if (r->blocks[sector].kind == KIND_OTHER ? r->blocks[sector].claim == 0 : !unlinked(r, sector)) {
+        return false;
+    }
+    return !claimed(r, sector, CLAIM_LINKED);
+}
+
+// Where the sweep and the tree disagree: a block the tree reaches is in use
+// whatever its back-pointers say. One it does not reach, such as a deleted
+// file's, is free if the walk met no bad block. Otherwise anything below the
+// damage is out of the tree's sight too, and an allocated block is only
+// freed when it is known to be deleted.
+static void apply(struct rebuild* r, struct adf_bitmap_rebuild_stats* stats) {
+    for (uint32_t i = 2; i < r->num_blocks; i++) {
+        const ADF_SECTNUM sector = (ADF_SECTNUM)i;
+        const bool was_used = !adfIsBlockFree(r->vol, sector);
+        const bool in_tree = tree_used(r, sector);
+        bool used = sweep_used(r, sector);
+        if (used != in_tree) {
+            stats->disputed++;
+            used = in_tree;
+        } else if (!used && was_used && damaged(r, sector)) {
+            used = true;
+            stats->kept_damaged++;
+        }
+        if (!used && was_used && r->walk_interrupted && !deleted(r, sector)) {
+            used = true;
+            stats->kept_unreached++;
+        }
+        if (used && !was_used) {
+            adfSetBlockUsed(r->vol, sector);
+            stats->allocated++;
+        } else if (!used && was_used) {
+            adfSetBlockFree(r->vol, sector);
+            stats->freed++;
+        }
+        stats->used_blocks += used;
+    }
+}
+
+ADF_RETCODE adf_bitmap_rebuild(struct AdfVolume* vol, struct adf_bitmap_rebuild_stats* stats) {
+    struct adf_bitmap_rebuild_stats unused;
+    if (!stats) {
+        stats = &unused;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (!vol) {
+        return ADF_RC_NULLPTR;
+    }
+    if (!adfVolIsDosFS(vol) || !vol->bitmap.table || adfVolGetSizeInBlocks(vol) < 2) {
+        return ADF_RC_ERROR;
+    }
+    struct rebuild r;
+    memset(&r, 0, sizeof(r));
+    r.vol = vol;
+    r.num_blocks = adfVolGetSizeInBlocks(vol);
+    r.dircache = adfVolHasDIRCACHE(vol);
+    r.blocks = calloc(r.num_blocks, sizeof(*r.blocks));
+    if (!r.blocks) {
+        return ADF_RC_MALLOC;
+    }
+    stats->blocks = r.num_blocks;
+
+    mark_bitmap_blocks(&r);
+    ADF_RETCODE rc = sweep_volume(&r);
+    if (rc == ADF_RC_OK) {
+        rc = walk_tree(&r);
+    }
+    if (rc == ADF_RC_OK) {
+        apply(&r, stats);
+    }
+    free(r.path);
+    free(r.claims);
+    free(r.tables);
+    free(r.records);
+    free(r.blocks);
+    return rc;
+}
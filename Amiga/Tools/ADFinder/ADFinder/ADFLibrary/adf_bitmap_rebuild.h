@@ -0,0 +1,49 @@
+//
+//  adf_bitmap_rebuild.h
+//  ADFinder
+//
+
+#ifndef ADF_BITMAP_REBUILD_H
+#define ADF_BITMAP_REBUILD_H
+
+#include <stdint.h>
+#include "adf_err.h"
+#include "adf_vol.h"
+
+// Rebuilds the allocation bitmap of a mounted volume from one linear sweep
+// over all its blocks, instead of adfReconstructBitmap()'s walk of the file
+// tree with a device read per block.
+//
+// The sweep identifies header, file extension and directory cache blocks by
+// type, checksum and header key, and keeps them when their parent pointer
+// leads up to the root block through blocks kept the same way. Those blocks
+// are in use, along with the data blocks listed by the kept file headers and
+// extension blocks, the root block and the bitmap blocks.
+//
+// That result is checked against the file tree, walked in memory over the
+// blocks the sweep read, and only where the two disagree does the tree
+// decide: deleted files still point at their parent but are no longer in
+// its hash chain, and an entry with a bad parent pointer is still linked.
+// When the walk met damage, an allocated block it could not reach is only
+// freed if it is known to be deleted: its entry, or one above it, still
+// points into a directory whose hash chains were all walked and is not in
+// them. Unreadable or damaged blocks, or those listed by a damaged file
+// block, are never freed.
+//
+// Only the in-memory bitmap changes; write it with adfUpdateBitmap() or a
+// bitmap commit.
+
+struct adf_bitmap_rebuild_stats {
+    uint32_t blocks;
+    uint32_t used_blocks;       // allocated in the rebuilt bitmap, boot block excluded
+    uint32_t allocated;         // free before, in use now
+    uint32_t freed;             // allocated before, free now
+    uint32_t disputed;          // sweep and tree disagreed
+    uint32_t kept_damaged;      // left allocated as unreadable or damaged
+    uint32_t kept_unreached;    // left allocated as cut off from the tree by damage
+};
+
+// Stats may be NULL.
+ADF_RETCODE adf_bitmap_rebuild(struct AdfVolume* vol, struct adf_bitmap_rebuild_stats* stats);
+
+#endif /* ADF_BITMAP_REBUILD_H */
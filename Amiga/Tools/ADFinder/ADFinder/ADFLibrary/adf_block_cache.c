@@ -0,0 +1,333 @@
+//
+//  adf_block_cache.c
+//  ADFinder
+//
+
+#include "adf_block_cache.h"
+#include "adf_limits.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_ENTRY UINT32_MAX
+
+// Longest run handed to the writer in one call by adf_block_cache_flush (64 KB).
+#define FLUSH_RUN_MAX_BLOCKS 128
+
+struct cache_entry {
+    uint32_t block;
+    uint32_t lru_prev;   // towards the most recently used entry
+    uint32_t lru_next;   // towards the least recently used entry
+    uint32_t hash_next;
+    bool dirty;
+};
+
+struct dirty_ref {
+    uint32_t block;
+    uint32_t entry;
+};
+
+struct adf_block_cache {
+    uint32_t capacity;
+    uint32_t used;
+    enum adf_cache_policy policy;
+    adf_block_cache_writer writer;
+    void* writer_ctx;
+
+    struct cache_entry* entries;
+    uint8_t* data;          // capacity blocks, one per entry
+    uint32_t* buckets;
+    uint32_t bucket_mask;
+    uint32_t lru_head;
+    uint32_t lru_tail;
+
+    struct dirty_ref* dirty_refs;   // scratch for adf_block_cache_flush
+    uint8_t* run_buf;
+
+    uint32_t dirty_count;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t blocks_written_back;
+};
+
+// Totals over every cache, read through adf_block_cache_env_get_property().
+static uint64_t env_hits;
+static uint64_t env_misses;
+static uint64_t env_evictions;
+static uint64_t env_blocks_written_back;
+
+static uint32_t bucket_of(const struct adf_block_cache* cache, uint32_t block) {
+    return (block * 2654435761u) & cache->bucket_mask;
+}
+
+static uint8_t* entry_data(const struct adf_block_cache* cache, uint32_t entry) {
+    return cache->data + (size_t)entry * ADF_DEV_BLOCK_SIZE;
+}
+
+static uint32_t find_entry(const struct adf_block_cache* cache, uint32_t block) {
+    uint32_t entry = cache->buckets[bucket_of(cache, block)];
+    while (entry != NO_ENTRY && cache->entries[entry].block != block) {
+        entry = cache->entries[entry].hash_next;
+    }
+    return entry;
+}
+
+static void lru_unlink(struct adf_block_cache* cache, uint32_t entry) {
+    struct cache_entry* e = &cache->entries[entry];
+    if (e->lru_prev != NO_ENTRY) cache->entries[e->lru_prev].lru_next = e->lru_next;
+    else cache->lru_head = e->lru_next;
+    if (e->lru_next != NO_ENTRY) cache->entries[e->lru_next].lru_prev = e->lru_prev;
+    else cache->lru_tail = e->lru_prev;
+}
+
+static void lru_push_front(struct adf_block_cache* cache, uint32_t entry) {
+    struct cache_entry* e = &cache->entries[entry];
+    e->lru_prev = NO_ENTRY;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head != NO_ENTRY) cache->entries[cache->lru_head].lru_prev = entry;
+    cache->lru_head = entry;
+    if (cache->lru_tail == NO_ENTRY) cache->lru_tail = entry;
+}
+
+static void touch(struct adf_block_cache* cache, uint32_t entry) {
+    if (cache->lru_head != entry) {
+        lru_unlink(cache, entry);
+        lru_push_front(cache, entry);
+    }
+}
+
+static void hash_remove(struct adf_block_cache* cache, uint32_t entry) {
+    uint32_t* link = &cache->buckets[bucket_of(cache, cache->entries[entry].block)];
+    while (*link != entry) {
+        link = &cache->entries[*link].hash_next;
+    }
+    *link = cache->entries[entry].hash_next;
+}
+
+// Returns a free entry, evicting the least recently used one when the cache
+// is full. A dirty victim first sends every dirty block out, so the
+// neighbours of the evicted block still leave in one run.
+static ADF_RETCODE take_entry(struct adf_block_cache* cache, uint32_t* entry_out) {
+    if (cache->used < cache->capacity) {
+        *entry_out = cache->used++;
+        return ADF_RC_OK;
+    }
+    const uint32_t victim = cache->lru_tail;
+    if (cache->entries[victim].dirty) {
+        ADF_RETCODE rc = adf_block_cache_flush(cache);
+        if (rc != ADF_RC_OK) {
+            return rc;
+        }
+    }
+    hash_remove(cache, victim);
+    lru_unlink(cache, victim);
+    cache->evictions++;
+    env_evictions++;
+    *entry_out = victim;
+    return ADF_RC_OK;
+}
+
+static ADF_RETCODE insert_block(struct adf_block_cache* cache, uint32_t block, const uint8_t* buf, bool dirty) {
+    uint32_t entry;
+    ADF_RETCODE rc = take_entry(cache, &entry);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    struct cache_entry* e = &cache->entries[entry];
+    e->block = block;
+    e->dirty = dirty;
+    const uint32_t bucket = bucket_of(cache, block);
+    e->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    lru_push_front(cache, entry);
+    memcpy(entry_data(cache, entry), buf, ADF_DEV_BLOCK_SIZE);
+    if (dirty) {
+        cache->dirty_count++;
+    }
+    return ADF_RC_OK;
+}
+
+struct adf_block_cache* adf_block_cache_create(uint32_t capacity_blocks, enum adf_cache_policy policy,
+                                               adf_block_cache_writer writer, void* writer_ctx) {
+    if (capacity_blocks == 0 || capacity_blocks >= NO_ENTRY / 2 || !writer) {
+        return NULL;
+    }
+    struct adf_block_cache* cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    uint32_t num_buckets = 1;
+    while (num_buckets < capacity_blocks * 2) {
+        num_buckets <<= 1;
+    }
+
+    cache->capacity = capacity_blocks;
+    cache->policy = policy;
+    cache->writer = writer;
+    cache->writer_ctx = writer_ctx;
+    cache->entries = calloc(capacity_blocks, sizeof(*cache->entries));
+    cache->data = malloc((size_t)capacity_blocks * ADF_DEV_BLOCK_SIZE);
+    cache->buckets = malloc(num_buckets * sizeof(*cache->buckets));
+    cache->dirty_refs = malloc(capacity_blocks * sizeof(*cache->dirty_refs));
+    cache->run_buf = malloc((size_t)FLUSH_RUN_MAX_BLOCKS * ADF_DEV_BLOCK_SIZE);
+    if (!cache->entries || !cache->data || !cache->buckets || !cache->dirty_refs || !cache->run_buf) {
+        adf_block_cache_destroy(cache);
+        return NULL;
+    }
+    memset(cache->buckets, 0xff, num_buckets * sizeof(*cache->buckets)); // all NO_ENTRY
+    cache->bucket_mask = num_buckets - 1;
+    cache->lru_head = NO_ENTRY;
+    cache->lru_tail = NO_ENTRY;
+    return cache;
+}
+
+void adf_block_cache_destroy(struct adf_block_cache* cache) {
+    if (!cache) {
+        return;
+    }
+    free(cache->entries);
+    free(cache->data);
+    free(cache->buckets);
+    free(cache->dirty_refs);
+    free(cache->run_buf);
+    free(cache);
+}
+
+enum adf_cache_policy adf_block_cache_policy(const struct adf_block_cache* cache) {
+    return cache->policy;
+}
+
+bool adf_block_cache_read(struct adf_block_cache* cache, uint32_t block, uint8_t* buf) {
+    const uint32_t entry = find_entry(cache, block);
+    if (entry == NO_ENTRY) {
+        cache->misses++;
+        env_misses++;
+        return false;
+    }
+    cache->hits++;
+    env_hits++;
+    touch(cache, entry);
+    memcpy(buf, entry_data(cache, entry), ADF_DEV_BLOCK_SIZE);
+    return true;
+}
+
+bool adf_block_cache_peek(const struct adf_block_cache* cache, uint32_t block, uint8_t* buf) {
+    const uint32_t entry = find_entry(cache, block);
+    if (entry == NO_ENTRY) {
+        return false;
+    }
+    memcpy(buf, entry_data(cache, entry), ADF_DEV_BLOCK_SIZE);
+    return true;
+}
+
+ADF_RETCODE adf_block_cache_fill(struct adf_block_cache* cache, uint32_t block, const uint8_t* buf) {
+    if (find_entry(cache, block) != NO_ENTRY) {
+        return ADF_RC_OK;
+    }
+    return insert_block(cache, block, buf, false);
+}
+
+ADF_RETCODE adf_block_cache_write(struct adf_block_cache* cache, uint32_t block, const uint8_t* buf) {
+    const bool dirty = (cache->policy == ADF_CACHE_WRITE_BACK);
+    const uint32_t entry = find_entry(cache, block);
+    if (entry == NO_ENTRY) {
+        return insert_block(cache, block, buf, dirty);
+    }
+    touch(cache, entry);
+    memcpy(entry_data(cache, entry), buf, ADF_DEV_BLOCK_SIZE);
+    if (dirty && !cache->entries[entry].dirty) {
+        cache->entries[entry].dirty = true;
+        cache->dirty_count++;
+    }
+    return ADF_RC_OK;
+}
+
+static int compare_dirty_refs(const void* a, const void* b) {
+    const uint32_t block_a = ((const struct dirty_ref*)a)->block;
+    const uint32_t block_b = ((const struct dirty_ref*)b)->block;
+    return (block_a > block_b) - (block_a < block_b);
+}
+
+ADF_RETCODE adf_block_cache_flush(struct adf_block_cache* cache) {
+    if (cache->dirty_count == 0) {
+        return ADF_RC_OK;
+    }
+    uint32_t num_dirty = 0;
+    for (uint32_t i = 0; i < cache->used; i++) {
+        if (cache->entries[i].dirty) {
+            cache->dirty_refs[num_dirty++] = (struct dirty_ref){ cache->entries[i].block, i };
+        }
+    }
+    qsort(cache->dirty_refs, num_dirty, sizeof(*cache->dirty_refs), compare_dirty_refs);
+
+    uint32_t start = 0;
+    while (start < num_dirty) {
+        uint32_t len = 1;
+        while (start + len < num_dirty && len < FLUSH_RUN_MAX_BLOCKS &&
+               cache->dirty_refs[start + len].block == cache->dirty_refs[start].block + len) {
+            len++;
+        }
+        const uint8_t* run = entry_data(cache, cache->dirty_refs[start].entry);
+        if (len > 1) {
+            for (uint32_t i = 0; i < len; i++) {
+                memcpy(cache->run_buf + (size_t)i * ADF_DEV_BLOCK_SIZE,
+                       entry_data(cache, cache->dirty_refs[start + i].entry), ADF_DEV_BLOCK_SIZE);
+            }
+            run = cache->run_buf;
+        }
+        ADF_RETCODE rc = cache->writer(cache->writer_ctx, cache->dirty_refs[start].block, len, run);
+        if (rc != ADF_RC_OK) {
+            return rc;
+        }
+        for (uint32_t i = 0; i < len; i++) {
+            cache->entries[cache->dirty_refs[start + i].entry].dirty = false;
+        }
+        cache->dirty_count -= len;
+        cache->blocks_written_back += len;
+        env_blocks_written_back += len;
+        start += len;
+    }
+    return ADF_RC_OK;
+}
+
+void adf_block_cache_get_stats(const struct adf_block_cache* cache, struct adf_block_cache_stats* stats) {
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->blocks_written_back = cache->blocks_written_back;
+    stats->cached_blocks = cache->used;
+    stats->dirty_blocks = cache->dirty_count;
+}
+
+intptr_t adf_block_cache_env_get_property(const ADF_CACHE_ENV_PROPERTY property) {
+    switch (property) {
+    case ADF_CACHE_PR_HITS:
+        return (intptr_t)env_hits;
+    case ADF_CACHE_PR_MISSES:
+        return (intptr_t)env_misses;
+    case ADF_CACHE_PR_EVICTIONS:
+        return (intptr_t)env_evictions;
+    case ADF_CACHE_PR_BLOCKS_WRITTEN_BACK:
+        return (intptr_t)env_blocks_written_back;
+    }
+    return 0;
+}
+
+ADF_RETCODE adf_block_cache_env_set_property(const ADF_CACHE_ENV_PROPERTY property, const intptr_t new_value) {
+    const uint64_t value = (uint64_t)new_value;
+    switch (property) {
+    case ADF_CACHE_PR_HITS:
+        env_hits = value;
+        return ADF_RC_OK;
+    case ADF_CACHE_PR_MISSES:
+        env_misses = value;
+        return ADF_RC_OK;
+    case ADF_CACHE_PR_EVICTIONS:
+        env_evictions = value;
+        return ADF_RC_OK;
+    case ADF_CACHE_PR_BLOCKS_WRITTEN_BACK:
+        env_blocks_written_back = value;
+        return ADF_RC_OK;
+    }
+    return ADF_RC_ERROR;
+}
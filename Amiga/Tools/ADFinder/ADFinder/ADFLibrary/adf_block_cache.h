@@ -0,0 +1,88 @@
+//
+//  adf_block_cache.h
+//  ADFinder
+//
+
+#ifndef ADF_BLOCK_CACHE_H
+#define ADF_BLOCK_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "adf_err.h"
+
+// An LRU cache of 512-byte device blocks. Root, directory, hash-chain and
+// bitmap blocks are read over and over while walking paths; the cache keeps
+// the most recently used ones in memory.
+//
+// Write-through: writes update the cached copy and the caller writes the
+// block out itself. Write-back: writes only mark the cached block dirty;
+// dirty blocks go out, sorted and merged into runs, on flush or when one of
+// them has to be evicted.
+//
+// The cache sits in the track driver, in front of every read that goes to
+// the image file. The mmap driver has none: its reads are already a copy
+// out of the mapped pages, which a lookup and a second copy would only slow
+// down.
+
+enum adf_cache_policy {
+    ADF_CACHE_WRITE_THROUGH,
+    ADF_CACHE_WRITE_BACK
+};
+
+struct adf_block_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t blocks_written_back;
+    uint32_t cached_blocks;
+    uint32_t dirty_blocks;
+};
+
+// Writes len_blocks consecutive blocks starting at block.
+typedef ADF_RETCODE (*adf_block_cache_writer)(void* ctx, uint32_t block, uint32_t len_blocks, const uint8_t* buf);
+
+struct adf_block_cache;
+
+struct adf_block_cache* adf_block_cache_create(uint32_t capacity_blocks, enum adf_cache_policy policy,
+                                               adf_block_cache_writer writer, void* writer_ctx);
+
+// Frees the cache. Dirty blocks are dropped: flush first.
+void adf_block_cache_destroy(struct adf_block_cache* cache);
+
+enum adf_cache_policy adf_block_cache_policy(const struct adf_block_cache* cache);
+
+// Copies the block into buf and returns true on a hit. Counts hits and misses.
+bool adf_block_cache_read(struct adf_block_cache* cache, uint32_t block, uint8_t* buf);
+
+// Like adf_block_cache_read, without touching the counters or the LRU order.
+bool adf_block_cache_peek(const struct adf_block_cache* cache, uint32_t block, uint8_t* buf);
+
+// Adds a block just read from the device. Blocks already cached are newer
+// than the device copy and are left alone.
+ADF_RETCODE adf_block_cache_fill(struct adf_block_cache* cache, uint32_t block, const uint8_t* buf);
+
+// Stores a block being written; with write-back it is marked dirty.
+ADF_RETCODE adf_block_cache_write(struct adf_block_cache* cache, uint32_t block, const uint8_t* buf);
+
+// Writes every dirty block out through the writer, in block order, merging
+// adjacent blocks into one call.
+ADF_RETCODE adf_block_cache_flush(struct adf_block_cache* cache);
+
+void adf_block_cache_get_stats(const struct adf_block_cache* cache, struct adf_block_cache_stats* stats);
+
+// Counters summed over every cache, read and reset like ADFlib's environment
+// properties (adf_env.h). ADFlib's property list is fixed inside the
+// library, so these have their own pair of calls.
+typedef enum {
+    ADF_CACHE_PR_HITS                = 1,
+    ADF_CACHE_PR_MISSES              = 2,
+    ADF_CACHE_PR_EVICTIONS           = 3,
+    ADF_CACHE_PR_BLOCKS_WRITTEN_BACK = 4
+} ADF_CACHE_ENV_PROPERTY;
+
+intptr_t adf_block_cache_env_get_property(const ADF_CACHE_ENV_PROPERTY property);
+
+// Only 0, to start counting again, is of much use as a new value.
+ADF_RETCODE adf_block_cache_env_set_property(const ADF_CACHE_ENV_PROPERTY property, const intptr_t new_value);
+
+#endif /* ADF_BLOCK_CACHE_H */
@@ -0,0 +1,34 @@
+//
+//  adf_byteorder.h
+//  ADFinder
+//
+
+#ifndef ADF_BYTEORDER_H
+#define ADF_BYTEORDER_H
+
+#include <stdint.h>
+
+// Big-endian fields of on-disk blocks, read and written in place, whatever
+// the alignment and host byte order.
+
+static inline uint16_t get_be16(const uint8_t* p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t get_be32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void put_be16(uint8_t* p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+static inline void put_be32(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+#endif /* ADF_BYTEORDER_H */
@@ -0,0 +1,247 @@
+//
+//  adf_checksum.c
+//  ADFinder
+//
+
+#include "adf_checksum.h"
+#include "adf_byteorder.h"
+#include <pthread.h>
+#include <stdbool.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// The boot block is the longest block adfSwapEndian() handles.
+#define SWAP_MAX_BYTES 1024
+#define SWAP_TYPES (ADF_SWBL_LSEG + 1)
+
+// ADFlib's swap table (adf_raw.c): runs of (item count, item size), 1 for
+// bytes left as they are and 4 for longs to swap, closed by (0, bytes).
+static const int swap_layout[SWAP_TYPES][15] = {
+    { 4, 1, 2, 4, 1012, 1, 0, 1024 },                      // boot
+    { 108, 4, 40, 1, 10, 4, 0, 512 },                      // root
+    { 6, 4, 488, 1, 0, 512 },                              // data
+    { 82, 4, 92, 1, 3, 4, 36, 1, 11, 4, 0, 512 },          // file, dir, entry
+    { 6, 4, 0, 24 },                                       // dircache header
+    { 128, 4, 0, 512 },                                    // bitmap, file extension
+    { 6, 4, 64, 1, 86, 4, 32, 1, 12, 4, 0, 512 },          // link
+    { 4, 1, 39, 4, 56, 1, 10, 4, 0, 256 },                 // RDSK
+    { 4, 1, 127, 4, 0, 512 },                              // BADB
+    { 4, 1, 8, 4, 32, 1, 31, 4, 4, 1, 15, 4, 0, 256 },     // PART
+    { 4, 1, 7, 4, 4, 1, 55, 4, 0, 256 },                   // FSHD
+    { 4, 1, 4, 4, 492, 1, 0, 512 },                        // LSEG
+};
+
+// Per block type, for each byte the byte of its 16-byte lane that goes
+// there: the same byte, or its mirror within the long for swapped longs.
+struct swap_mask {
+    uint32_t size;
+    uint8_t shuffle[SWAP_MAX_BYTES];
+};
+
+struct checksum_kernels {
+    const char* name;
+    // Exact sum of count big-endian longs.
+    uint64_t (*sum)(const uint8_t* buf, uint32_t count);
+    void (*swap)(uint8_t* buf, const struct swap_mask* mask);
+};
+
+static struct swap_mask swap_masks[SWAP_TYPES];
+static struct checksum_kernels kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static bool is_swapped(const struct swap_mask* mask, uint32_t offset) {
+    return mask->shuffle[offset] != (offset & 15);
+}
+
+static void swap_tail(uint8_t* buf, const struct swap_mask* mask, uint32_t from) {
+    for (uint32_t i = from; i + 4 <= mask->size; i += 4) {
+        if (is_swapped(mask, i)) {
+            const uint8_t b0 = buf[i], b1 = buf[i + 1];
+            buf[i] = buf[i + 3];
+            buf[i + 1] = buf[i + 2];
+            buf[i + 2] = b1;
+            buf[i + 3] = b0;
+        }
+    }
+}
+
+static uint64_t sum_scalar(const uint8_t* buf, uint32_t count) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += get_be32(buf + i * 4);
+    }
+    return total;
+}
+
+static void swap_scalar(uint8_t* buf, const struct swap_mask* mask) {
+    swap_tail(buf, mask, 0);
+}
+
+#if defined(__x86_64__)
+
+// The sum of the longs is put together from the sums of their first,
+// second, third and fourth bytes, each taken with a mask and _sad_epu8, so
+// nothing is swapped.
+static uint64_t sum_sse2(const uint8_t* buf, uint32_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i m0 = _mm_set1_epi32(0x000000FF), m1 = _mm_set1_epi32(0x0000FF00);
+    const __m128i m2 = _mm_set1_epi32(0x00FF0000), m3 = _mm_set1_epi32((int)0xFF000000);
+    __m128i s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(buf + i * 4));
+        s0 = _mm_add_epi64(s0, _mm_sad_epu8(_mm_and_si128(v, m0), zero));
+        s1 = _mm_add_epi64(s1, _mm_sad_epu8(_mm_and_si128(v, m1), zero));
+        s2 = _mm_add_epi64(s2, _mm_sad_epu8(_mm_and_si128(v, m2), zero));
+        s3 = _mm_add_epi64(s3, _mm_sad_epu8(_mm_and_si128(v, m3), zero));
+    }
+    // Byte 0 of each long in memory is its most significant one.
+    const __m128i hi = _mm_add_epi64(_mm_slli_epi64(s0, 24), _mm_slli_epi64(s1, 16));
+    const __m128i lo = _mm_add_epi64(_mm_slli_epi64(s2, 8), s3);
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(hi, lo));
+    return lanes[0] + lanes[1] + sum_scalar(buf + i * 4, count - i);
+}
+
+static void swap_sse2(uint8_t* buf, const struct swap_mask* mask) {
+    const __m128i lane = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    uint32_t i = 0;
+    for (; i + 16 <= mask->size; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(buf + i));
+        const __m128i halves = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        const __m128i swapped = _mm_shufflehi_epi16(_mm_shufflelo_epi16(halves, 0xB1), 0xB1);
+        const __m128i keep = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(mask->shuffle + i)), lane);
+        _mm_storeu_si128((__m128i*)(buf + i), _mm_or_si128(_mm_and_si128(keep, v), _mm_andnot_si128(keep, swapped)));
+    }
+    swap_tail(buf, mask, i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t sum_avx2(const uint8_t* buf, uint32_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i m0 = _mm256_set1_epi32(0x000000FF), m1 = _mm256_set1_epi32(0x0000FF00);
+    const __m256i m2 = _mm256_set1_epi32(0x00FF0000), m3 = _mm256_set1_epi32((int)0xFF000000);
+    __m256i s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(buf + i * 4));
+        s0 = _mm256_add_epi64(s0, _mm256_sad_epu8(_mm256_and_si256(v, m0), zero));
+        s1 = _mm256_add_epi64(s1, _mm256_sad_epu8(_mm256_and_si256(v, m1), zero));
+        s2 = _mm256_add_epi64(s2, _mm256_sad_epu8(_mm256_and_si256(v, m2), zero));
+        s3 = _mm256_add_epi64(s3, _mm256_sad_epu8(_mm256_and_si256(v, m3), zero));
+    }
+    const __m256i hi = _mm256_add_epi64(_mm256_slli_epi64(s0, 24), _mm256_slli_epi64(s1, 16));
+    const __m256i lo = _mm256_add_epi64(_mm256_slli_epi64(s2, 8), s3);
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(hi, lo));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sum_scalar(buf + i * 4, count - i);
+}
+
+// vpshufb shuffles within 128-bit lanes, which is how the masks are laid out.
+__attribute__((target("avx2")))
+static void swap_avx2(uint8_t* buf, const struct swap_mask* mask) {
+    uint32_t i = 0;
+    for (; i + 32 <= mask->size; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(buf + i));
+        const __m256i shuffle = _mm256_loadu_si256((const __m256i*)(mask->shuffle + i));
+        _mm256_storeu_si256((__m256i*)(buf + i), _mm256_shuffle_epi8(v, shuffle));
+    }
+    swap_tail(buf, mask, i);
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+static uint64_t sum_neon(const uint8_t* buf, uint32_t count) {
+    uint64x2_t s0 = vdupq_n_u64(0), s1 = vdupq_n_u64(0);
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        s0 = vpadalq_u32(s0, vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buf + i * 4))));
+        s1 = vpadalq_u32(s1, vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buf + i * 4 + 16))));
+    }
+    return vaddvq_u64(vaddq_u64(s0, s1)) + sum_scalar(buf + i * 4, count - i);
+}
+
+static void swap_neon(uint8_t* buf, const struct swap_mask* mask) {
+    uint32_t i = 0;
+    for (; i + 16 <= mask->size; i += 16) {
+        vst1q_u8(buf + i, vqtbl1q_u8(vld1q_u8(buf + i), vld1q_u8(mask->shuffle + i)));
+    }
+    swap_tail(buf, mask, i);
+}
+
+#endif
+
+static void build_swap_masks(void) {
+    for (int type = 0; type < SWAP_TYPES; type++) {
+        struct swap_mask* mask = &swap_masks[type];
+        const int* layout = swap_layout[type];
+        uint32_t offset = 0;
+        for (; layout[0] != 0; layout += 2) {
+            for (int item = 0; item < layout[0]; item++) {
+                for (uint32_t b = 0; b < (uint32_t)layout[1]; b++) {
+                    const uint32_t source = layout[1] == 4 ? offset + 3 - b : offset + b;
+                    mask->shuffle[offset + b] = (uint8_t)(source & 15);
+                }
+                offset += (uint32_t)layout[1];
+            }
+        }
+        mask->size = offset;
+    }
+}
+
+static void init_kernels(void) {
+    build_swap_masks();
+    kernels = (struct checksum_kernels){ "scalar", sum_scalar, swap_scalar };
+#if defined(__x86_64__)
+    kernels = (struct checksum_kernels){ "sse2", sum_sse2, swap_sse2 };
+    if (__builtin_cpu_supports("avx2")) {
+        kernels = (struct checksum_kernels){ "avx2", sum_avx2, swap_avx2 };
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    kernels = (struct checksum_kernels){ "neon", sum_neon, swap_neon };
+#endif
+}
+
+static const struct checksum_kernels* get_kernels(void) {
+    pthread_once(&kernels_once, init_kernels);
+    return &kernels;
+}
+
+uint32_t adf_normal_sum(const uint8_t* buf, int offset, int len) {
+    const uint32_t count = len > 0 ? (uint32_t)len / 4 : 0;
+    uint64_t total = get_kernels()->sum(buf, count);
+    // The long holding the checksum does not count.
+    if (offset >= 0 && (uint32_t)offset / 4 < count) {
+        total -= get_be32(buf + (offset / 4) * 4);
+    }
+    return 0u - (uint32_t)total;
+}
+
+uint32_t adf_boot_sum(const uint8_t* buf) {
+    uint64_t total = get_kernels()->sum(buf, 256) - get_be32(buf + 4);
+    // Adding with the carry put back in, as adfBootSum() does long by long.
+    while (total >> 32) {
+        total = (total & 0xFFFFFFFF) + (total >> 32);
+    }
+    return ~(uint32_t)total;
+}
+
+void adf_swap_endian(uint8_t* buf, int type) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    (void)buf;
+    (void)type;
+#else
+    if (type < 0 || type >= SWAP_TYPES) {
+        return;
+    }
+    const struct checksum_kernels* k = get_kernels();
+    k->swap(buf, &swap_masks[type]);
+#endif
+}
+
+const char* adf_checksum_kernels(void) {
+    return get_kernels()->name;
+}
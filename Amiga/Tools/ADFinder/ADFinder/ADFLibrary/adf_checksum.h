@@ -0,0 +1,27 @@
+//
+//  adf_checksum.h
+//  ADFinder
+//
+
+#ifndef ADF_CHECKSUM_H
+#define ADF_CHECKSUM_H
+
+#include <stdint.h>
+#include "adf_raw.h"
+
+// Drop-ins for adfNormalSum(), adfBootSum() and adfSwapEndian() with SIMD
+// kernels picked once at run time: AVX2 or SSE2 on x86-64, NEON on ARM, a
+// portable loop elsewhere. The sums add the big-endian longs of a block
+// without swapping them one at a time; the swap applies a byte shuffle
+// precomputed per block type from ADFlib's field layout.
+
+uint32_t adf_normal_sum(const uint8_t* buf, int offset, int len);
+uint32_t adf_boot_sum(const uint8_t* buf);
+
+// type is one of the ADF_SWBL_ constants; a no-op on big-endian hosts.
+void adf_swap_endian(uint8_t* buf, int type);
+
+// Name of the kernels in use ("avx2", "sse2", "neon" or "scalar").
+const char* adf_checksum_kernels(void);
+
+#endif /* ADF_CHECKSUM_H */
@@ -0,0 +1,311 @@
+//
+//  adf_dir_cache.c
+//  ADFinder
+//
+
+#include "adf_dir_cache.h"
+#include "adf_bitmap_index.h"
+#include "adf_bitm.h"
+#include "adf_byteorder.h"
+#include "adf_dir.h"
+#include "adf_dir_walk.h"
+#include "adf_raw.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RECORDS_SIZE ((int)sizeof(((struct AdfDirCacheBlock*)0)->records))
+
+// header, size, protect, UID/GID, days, mins, ticks, type, name length
+#define RECORD_FIXED_SIZE 24
+
+int adf_dir_cache_read_record(const struct AdfDirCacheBlock* dirc, int pos, struct AdfCacheEntry* entry) {
+    if (pos < 0 || pos + RECORD_FIXED_SIZE + 1 > RECORDS_SIZE) {
+        return -1;
+    }
+    const uint8_t* r = dirc->records + pos;
+    const uint8_t name_len = r[23];
+    if (name_len == 0 || name_len > ADF_MAX_NAME_LEN || pos + RECORD_FIXED_SIZE + name_len + 1 > RECORDS_SIZE) {
+        return -1;
+    }
+    const uint8_t comm_len = r[RECORD_FIXED_SIZE + name_len];
+    const int end = pos + RECORD_FIXED_SIZE + name_len + 1 + comm_len;
+    if (comm_len > ADF_MAX_COMMENT_LEN || end > RECORDS_SIZE) {
+        return -1;
+    }
+    entry->header = get_be32(r);
+    entry->size = get_be32(r + 4);
+    entry->protect = get_be32(r + 8);
+    entry->days = get_be16(r + 16);
+    entry->mins = get_be16(r + 18);
+    entry->ticks = get_be16(r + 20);
+    entry->type = (signed char)r[22];
+    entry->nLen = name_len;
+    memcpy(entry->name, r + RECORD_FIXED_SIZE, name_len);
+    entry->name[name_len] = '\0';
+    entry->cLen = comm_len;
+    memcpy(entry->comm, r + RECORD_FIXED_SIZE + name_len + 1, comm_len);
+    entry->comm[comm_len] = '\0';
+    return end + (end & 1); // records start on even offsets
+}
+
+ADF_SECTNUM adf_dir_cache_first_block(struct AdfVolume* vol, ADF_SECTNUM dir) {
+    if (!adfVolHasDIRCACHE(vol)) {
+        return 0;
+    }
+    struct AdfEntryBlock dir_block;
+    if (adfReadEntryBlock(vol, dir, &dir_block) != ADF_RC_OK) {
+        return 0;
+    }
+    const uint32_t volume_blocks = adfVolGetSizeInBlocks(vol);
+    const ADF_SECTNUM first = dir_block.extension;
+    ADF_SECTNUM sector = first;
+    uint32_t hops = 0;
+    while (sector != 0) {
+        if (sector < 2 || (uint32_t)sector >= volume_blocks || ++hops > volume_blocks) {
+            return 0;
+        }
+        struct AdfDirCacheBlock dirc;
+        if (adfReadDirCBlock(vol, sector, &dirc) != ADF_RC_OK || dirc.type != ADF_T_DIRC ||
+            dirc.headerKey != sector || dirc.parent != dir || dirc.recordsNb < 0) {
+            return 0;
+        }
+        int pos = 0;
+        for (int i = 0; i < dirc.recordsNb; i++) {
+            struct AdfCacheEntry entry;
+            pos = adf_dir_cache_read_record(&dirc, pos, &entry);
+            if (pos < 0 || entry.header < 2 || entry.header >= volume_blocks) {
+                return 0;
+            }
+        }
+        sector = dirc.nextDirC;
+    }
+    return first;
+}
+
+// Packs one entry into records at pos; -1 when it does not fit.
+static int put_record(uint8_t* records, int pos, ADF_SECTNUM sector, const struct AdfEntryBlock* entry) {
+    const uint8_t name_len = entry->nameLen <= ADF_MAX_NAME_LEN ? entry->nameLen : ADF_MAX_NAME_LEN;
+    const uint8_t comm_len = entry->commLen <= ADF_MAX_COMMENT_LEN ? entry->commLen : ADF_MAX_COMMENT_LEN;
+    const int end = pos + RECORD_FIXED_SIZE + name_len + 1 + comm_len;
+    if (end > RECORDS_SIZE) {
+        return -1;
+    }
+    uint8_t* r = records + pos;
+    memset(r, 0, (size_t)(end - pos));
+    put_be32(r, (uint32_t)sector);
+    put_be32(r + 4, entry->secType == ADF_ST_FILE ? entry->byteSize : 0);
+    put_be32(r + 8, (uint32_t)entry->access);
+    put_be16(r + 16, (uint16_t)entry->days);
+    put_be16(r + 18, (uint16_t)entry->mins);
+    put_be16(r + 20, (uint16_t)entry->ticks);
+    r[22] = (uint8_t)(signed char)entry->secType;
+    r[23] = name_len;
+    memcpy(r + RECORD_FIXED_SIZE, entry->name, name_len);
+    r[RECORD_FIXED_SIZE + name_len] = comm_len;
+    memcpy(r + RECORD_FIXED_SIZE + name_len + 1, entry->comment, comm_len);
+    return end + (end & 1);
+}
+
+struct dir_stack {
+    ADF_SECTNUM* dirs;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+static bool stack_push(struct dir_stack* stack, ADF_SECTNUM dir) {
+    if (stack->count == stack->capacity) {
+        const uint32_t capacity = stack->capacity ? stack->capacity * 2 : 16;
+        ADF_SECTNUM* dirs = realloc(stack->dirs, capacity * sizeof(*dirs));
+        if (!dirs) {
+            return false;
+        }
+        stack->dirs = dirs;
+        stack->capacity = capacity;
+    }
+    stack->dirs[stack->count++] = dir;
+    return true;
+}
+
+// Frees the blocks of an existing cache chain, as far as it is sound.
+static void free_old_chain(struct AdfVolume* vol, struct adf_bitmap_index* index, ADF_SECTNUM dir, ADF_SECTNUM first) {
+    const uint32_t volume_blocks = adfVolGetSizeInBlocks(vol);
+    ADF_SECTNUM sector = first;
+    uint32_t hops = 0;
+    while (sector >= 2 && (uint32_t)sector < volume_blocks && ++hops <= volume_blocks) {
+        struct AdfDirCacheBlock dirc;
+        if (adfReadDirCBlock(vol, sector, &dirc) != ADF_RC_OK || dirc.type != ADF_T_DIRC || dirc.parent != dir) {
+            return;
+        }
+        adf_bitmap_index_set_free(index, sector);
+        sector = dirc.nextDirC;
+    }
+}
+
+// Points a directory (or the root) at its new cache chain.
+static ADF_RETCODE set_dir_extension(struct AdfVolume* vol, ADF_SECTNUM dir, ADF_SECTNUM first) {
+    ADF_RETCODE rc;
+    if (dir == vol->rootBlock) {
+        struct AdfRootBlock root;
+        rc = adfReadRootBlock(vol, (uint32_t)dir, &root);
+        if (rc == ADF_RC_OK) {
+            root.extension = first;
+            rc = adfWriteRootBlock(vol, (uint32_t)dir, &root);
+        }
+        return rc;
+    }
+    struct AdfEntryBlock dir_block;
+    rc = adfReadEntryBlock(vol, dir, &dir_block);
+    if (rc == ADF_RC_OK) {
+        dir_block.extension = first;
+        rc = adfWriteDirBlock(vol, dir, (struct AdfDirBlock*)&dir_block);
+    }
+    return rc;
+}
+
+static ADF_RETCODE rebuild_dir(struct AdfVolume* vol, struct adf_bitmap_index* index, ADF_SECTNUM dir,
+                               struct dir_stack* subdirs) {
+    struct AdfEntryBlock block;
+    ADF_RETCODE rc = adfReadEntryBlock(vol, dir, &block);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    const ADF_SECTNUM old_first = block.extension;
+    int32_t hash_table[ADF_HT_SIZE];
+    memcpy(hash_table, block.hashTable, sizeof(hash_table));
+
+    struct AdfDirCacheBlock* blocks = calloc(1, sizeof(*blocks));
+    uint32_t num_blocks = 1;
+    int pos = 0;
+    if (!blocks) {
+        return ADF_RC_MALLOC;
+    }
+    const uint32_t max_hops = adfVolGetSizeInBlocks(vol);
+    for (int slot = 0; slot < ADF_HT_SIZE && rc == ADF_RC_OK; slot++) {
+        ADF_SECTNUM sector = hash_table[slot];
+        uint32_t hops = 0;
+        while (sector != 0 && hops++ < max_hops) {
+            rc = adfReadEntryBlock(vol, sector, &block);
+            if (rc != ADF_RC_OK) {
+                break;
+            }
+            int next = put_record(blocks[num_blocks - 1].records, pos, sector, &block);
+            if (next < 0) {
+                struct AdfDirCacheBlock* grown = realloc(blocks, (num_blocks + 1) * sizeof(*blocks));
+                if (!grown) {
+                    rc = ADF_RC_MALLOC;
+                    break;
+                }
+                blocks = grown;
+                memset(&blocks[num_blocks++], 0, sizeof(*blocks));
+                next = put_record(blocks[num_blocks - 1].records, 0, sector, &block);
+            }
+            blocks[num_blocks - 1].recordsNb++;
+            pos = next;
+            if (block.secType == ADF_ST_DIR && subdirs && !stack_push(subdirs, sector)) {
+                rc = ADF_RC_MALLOC;
+                break;
+            }
+            sector = block.nextSameHash;
+        }
+    }
+
+    ADF_SECTNUM* sectors = NULL;
+    if (rc == ADF_RC_OK) {
+        sectors = malloc(num_blocks * sizeof(*sectors));
+        if (!sectors) {
+            rc = ADF_RC_MALLOC;
+        } else if (!adf_bitmap_index_alloc(index, (int)num_blocks, sectors)) {
+            rc = ADF_RC_VOLFULL;
+            free(sectors);
+            sectors = NULL;
+        }
+    }
+    // New chain first, then the directory's pointer to it, then the old chain goes.
+    for (uint32_t i = 0; i < num_blocks && rc == ADF_RC_OK; i++) {
+        blocks[i].type = ADF_T_DIRC;
+        blocks[i].headerKey = sectors[i];
+        blocks[i].parent = dir;
+        blocks[i].nextDirC = i + 1 < num_blocks ? sectors[i + 1] : 0;
+        rc = adfWriteDirCBlock(vol, sectors[i], &blocks[i]);
+    }
+    if (rc == ADF_RC_OK) {
+        rc = set_dir_extension(vol, dir, sectors[0]);
+    }
+    if (rc == ADF_RC_OK) {
+        free_old_chain(vol, index, dir, old_first);
+    } else if (sectors) {
+        for (uint32_t i = 0; i < num_blocks; i++) {
+            adf_bitmap_index_set_free(index, sectors[i]);
+        }
+    }
+    free(sectors);
+    free(blocks);
+    return rc;
+}
+
+ADF_RETCODE adf_dir_cache_rebuild(struct AdfVolume* vol, struct adf_bitmap_index* index, ADF_SECTNUM dir,
+                                  bool recursive) {
+    if (!vol) {
+        return ADF_RC_NULLPTR;
+    }
+    struct adf_bitmap_index* own_index = index ? NULL : (index = adf_bitmap_index_create(vol));
+    if (!index) {
+        return ADF_RC_MALLOC;
+    }
+    struct dir_stack stack = { 0 };
+    ADF_RETCODE rc = stack_push(&stack, dir) ? ADF_RC_OK : ADF_RC_MALLOC;
+    while (rc == ADF_RC_OK && stack.count > 0) {
+        const ADF_SECTNUM next = stack.dirs[--stack.count];
+        rc = rebuild_dir(vol, index, next, recursive ? &stack : NULL);
+    }
+    free(stack.dirs);
+    adf_bitmap_index_free(own_index);
+    return rc;
+}
+
+// Latin-1 letters are the only characters that hash differently with INTL.
+static enum adf_walk_action find_intl_name(const struct adf_walk_entry* entry, void* ctx) {
+    for (const unsigned char* c = (const unsigned char*)entry->name; *c; c++) {
+        if (*c >= 0xe0 && *c <= 0xfe && *c != 0xf7) {
+            *(bool*)ctx = true;
+            return ADF_WALK_STOP;
+        }
+    }
+    return ADF_WALK_CONTINUE;
+}
+
+bool adf_dir_cache_can_enable(struct AdfVolume* vol) {
+    if (!vol || !adfVolIsDosFS(vol)) {
+        return false;
+    }
+    if (adfVolHasINTL(vol) || adfVolHasDIRCACHE(vol)) {
+        return true;
+    }
+    bool found = false;
+    return adf_dir_walk(vol, vol->rootBlock, NULL, find_intl_name, &found) == ADF_RC_OK && !found;
+}
+
+ADF_RETCODE adf_dir_cache_enable(struct AdfVolume* vol, struct adf_bitmap_index* index) {
+    if (!vol) {
+        return ADF_RC_NULLPTR;
+    }
+    if (!adf_dir_cache_can_enable(vol)) {
+        return ADF_RC_ERROR;
+    }
+    // The caches have to be complete before anything treats them as valid.
+    ADF_RETCODE rc = adf_dir_cache_rebuild(vol, index, vol->rootBlock, true);
+    if (rc != ADF_RC_OK || adfVolHasDIRCACHE(vol)) {
+        return rc;
+    }
+    struct AdfBootBlock boot;
+    rc = adfReadBootBlock(vol, &boot);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    boot.dosType[3] = (char)(boot.dosType[3] | ADF_DOSFS_DIRCACHE);
+    rc = adfWriteBootBlock(vol, &boot);
+    if (rc == ADF_RC_OK) {
+        vol->fs.type = (uint8_t)(vol->fs.type | ADF_DOSFS_DIRCACHE);
+    }
+    return rc;
+}
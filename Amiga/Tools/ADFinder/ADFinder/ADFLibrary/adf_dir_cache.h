@@ -0,0 +1,50 @@
+//
+//  adf_dir_cache.h
+//  ADFinder
+//
+
+#ifndef ADF_DIR_CACHE_H
+#define ADF_DIR_CACHE_H
+
+#include <stdbool.h>
+#include "adf_bitmap_index.h"
+#include "adf_blk.h"
+#include "adf_cache.h"
+#include "adf_err.h"
+#include "adf_vol.h"
+
+// FFS directory cache (DIRCACHE) blocks: a chain, starting at a directory's
+// extension field, of packed records with each entry's name, size, date and
+// protection. Listing a directory from them costs one read per ~20 entries
+// instead of one read per entry.
+
+// First cache block of a directory when the volume has DIRCACHE and the
+// whole chain looks sound (block types, parent, records inside the block,
+// no loops); 0 when the listing has to walk the hash chains instead.
+ADF_SECTNUM adf_dir_cache_first_block(struct AdfVolume* vol, ADF_SECTNUM dir);
+
+// Reads the record at byte offset pos of a cache block's records. Returns
+// the offset of the next record, or -1 if this one overruns the block.
+int adf_dir_cache_read_record(const struct AdfDirCacheBlock* dirc, int pos, struct AdfCacheEntry* entry);
+
+// Writes fresh cache blocks for dir (and, with recursive, every directory
+// below it) from the entry blocks, freeing the old chain. Blocks come from
+// index, or from one built for this call when it is NULL. Only the
+// in-memory bitmap changes; write it with adfUpdateBitmap() or through an
+// adf_bitmap_commit.
+ADF_RETCODE adf_dir_cache_rebuild(struct AdfVolume* vol, struct adf_bitmap_index* index, ADF_SECTNUM dir,
+                                  bool recursive);
+
+// DIRCACHE implies international name hashing. A volume without INTL can
+// only take it when none of its names has a Latin-1 letter (0xE0-0xFE),
+// as those would then hash to another chain and no longer be found.
+// Walks the whole tree on such volumes.
+bool adf_dir_cache_can_enable(struct AdfVolume* vol);
+
+// Turns DIRCACHE on for a volume without it: builds the cache of every
+// directory, then sets the flag in the boot block's DOS type. ADF_RC_ERROR
+// when adf_dir_cache_can_enable() says no. The bitmap is left as with
+// adf_dir_cache_rebuild().
+ADF_RETCODE adf_dir_cache_enable(struct AdfVolume* vol, struct adf_bitmap_index* index);
+
+#endif /* ADF_DIR_CACHE_H */
@@ -0,0 +1,313 @@
+//
+//  adf_dir_index.c
+//  ADFinder
+//
+
+#include "adf_dir_index.h"
+#include "adf_blk.h"
+#include "adf_dir.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_BUCKETS 256
+
+// A directory that has been read is marked by an entry with an empty name
+// (real names are never empty) under its own block number.
+struct index_entry {
+    struct index_entry* next;
+    ADF_SECTNUM parent;
+    ADF_SECTNUM sector;
+    int32_t sec_type;
+    uint8_t name_len;
+    char name[ADF_MAX_NAME_LEN + 1];    // folded
+};
+
+struct adf_dir_index {
+    struct AdfVolume* vol;
+    bool intl;
+    struct index_entry** buckets;
+    uint32_t bucket_mask;
+    uint32_t count;
+};
+
+// AmigaDOS name comparison: ASCII letters only, or also the Latin-1
+// letters on INTL and DIRCACHE volumes (adfIntlToUpper() in ADFlib).
+static char fold_char(bool intl, unsigned char c) {
+    if (c >= 'a' && c <= 'z') {
+        return (char)(c - ('a' - 'A'));
+    }
+    if (intl && c >= 0xe0 && c <= 0xfe && c != 0xf7) {
+        return (char)(c - ('a' - 'A'));
+    }
+    return (char)c;
+}
+
+// False when the name cannot be on the volume (too long).
+static bool fold_name(const struct adf_dir_index* index, const char* name, size_t len, char* out) {
+    if (len > ADF_MAX_NAME_LEN) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        out[i] = fold_char(index->intl, (unsigned char)name[i]);
+    }
+    out[len] = '\0';
+    return true;
+}
+
+static uint32_t hash_key(ADF_SECTNUM parent, const char* folded, size_t len) {
+    uint32_t h = 2166136261u ^ (uint32_t)parent;
+    h *= 16777619u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)folded[i]) * 16777619u;
+    }
+    return h;
+}
+
+static struct index_entry** find_link(struct adf_dir_index* index, ADF_SECTNUM parent, const char* folded, size_t len) {
+    struct index_entry** link = &index->buckets[hash_key(parent, folded, len) & index->bucket_mask];
+    while (*link) {
+        const struct index_entry* e = *link;
+        if (e->parent == parent && e->name_len == len && memcmp(e->name, folded, len) == 0) {
+            break;
+        }
+        link = &(*link)->next;
+    }
+    return link;
+}
+
+static void grow(struct adf_dir_index* index) {
+    const uint32_t old_size = index->bucket_mask + 1;
+    struct index_entry** buckets = calloc((size_t)old_size * 2, sizeof(*buckets));
+    if (!buckets) {
+        return; // keep the longer chains
+    }
+    for (uint32_t b = 0; b < old_size; b++) {
+        struct index_entry* e = index->buckets[b];
+        while (e) {
+            struct index_entry* next = e->next;
+            const uint32_t slot = hash_key(e->parent, e->name, e->name_len) & (old_size * 2 - 1);
+            e->next = buckets[slot];
+            buckets[slot] = e;
+            e = next;
+        }
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->bucket_mask = old_size * 2 - 1;
+}
+
+// Adds or replaces an entry; the name is already folded.
+static void put_folded(struct adf_dir_index* index, ADF_SECTNUM parent, const char* folded, size_t len,
+                       ADF_SECTNUM sector, int32_t sec_type) {
+    struct index_entry** link = find_link(index, parent, folded, len);
+    if (*link) {
+        (*link)->sector = sector;
+        (*link)->sec_type = sec_type;
+        return;
+    }
+    struct index_entry* e = calloc(1, sizeof(*e));
+    if (!e) {
+        return; // a missing entry only costs a directory read later
+    }
+    e->parent = parent;
+    e->sector = sector;
+    e->sec_type = sec_type;
+    e->name_len = (uint8_t)len;
+    memcpy(e->name, folded, len);
+    e->next = *link;
+    *link = e;
+    if (++index->count > index->bucket_mask + 1) {
+        grow(index);
+    }
+}
+
+static void put(struct adf_dir_index* index, ADF_SECTNUM parent, const char* name, size_t len,
+                ADF_SECTNUM sector, int32_t sec_type) {
+    char folded[ADF_MAX_NAME_LEN + 1];
+    if (fold_name(index, name, len, folded)) {
+        put_folded(index, parent, folded, len, sector, sec_type);
+    }
+}
+
+static void drop(struct adf_dir_index* index, ADF_SECTNUM parent, const char* name) {
+    char folded[ADF_MAX_NAME_LEN + 1];
+    const size_t len = strlen(name);
+    if (!fold_name(index, name, len, folded)) {
+        return;
+    }
+    struct index_entry** link = find_link(index, parent, folded, len);
+    if (*link) {
+        struct index_entry* e = *link;
+        *link = e->next;
+        free(e);
+        index->count--;
+    }
+}
+
+static bool dir_loaded(struct adf_dir_index* index, ADF_SECTNUM dir) {
+    return *find_link(index, dir, "", 0) != NULL;
+}
+
+// Reads every entry of a directory: its hash table, then each hash chain.
+static ADF_RETCODE load_dir(struct adf_dir_index* index, ADF_SECTNUM dir) {
+    struct AdfEntryBlock block;
+    ADF_RETCODE rc = adfReadEntryBlock(index->vol, dir, &block);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    int32_t hash_table[ADF_HT_SIZE];
+    memcpy(hash_table, block.hashTable, sizeof(hash_table));
+
+    const uint32_t max_hops = adfVolGetSizeInBlocks(index->vol);
+    for (int slot = 0; slot < ADF_HT_SIZE; slot++) {
+        ADF_SECTNUM sector = hash_table[slot];
+        uint32_t hops = 0;
+        while (sector != 0 && hops++ < max_hops) {
+            rc = adfReadEntryBlock(index->vol, sector, &block);
+            if (rc != ADF_RC_OK) {
+                return rc;
+            }
+            const size_t len = block.nameLen <= ADF_MAX_NAME_LEN ? block.nameLen : ADF_MAX_NAME_LEN;
+            put(index, dir, block.name, len, sector, block.secType);
+            sector = block.nextSameHash;
+        }
+    }
+    put_folded(index, dir, "", 0, dir, ADF_ST_DIR);
+    return ADF_RC_OK;
+}
+
+struct adf_dir_index* adf_dir_index_create(struct AdfVolume* vol) {
+    if (!vol) {
+        return NULL;
+    }
+    struct adf_dir_index* index = calloc(1, sizeof(*index));
+    if (!index) {
+        return NULL;
+    }
+    index->buckets = calloc(INITIAL_BUCKETS, sizeof(*index->buckets));
+    if (!index->buckets) {
+        free(index);
+        return NULL;
+    }
+    index->vol = vol;
+    index->intl = adfVolHasINTL(vol) || adfVolHasDIRCACHE(vol);    // DIRCACHE implies INTL
+    index->bucket_mask = INITIAL_BUCKETS - 1;
+    return index;
+}
+
+void adf_dir_index_free(struct adf_dir_index* index) {
+    if (!index) {
+        return;
+    }
+    for (uint32_t b = 0; b <= index->bucket_mask; b++) {
+        struct index_entry* e = index->buckets[b];
+        while (e) {
+            struct index_entry* next = e->next;
+            free(e);
+            e = next;
+        }
+    }
+    free(index->buckets);
+    free(index);
+}
+
+ADF_SECTNUM adf_dir_index_lookup(struct adf_dir_index* index, ADF_SECTNUM parent, const char* name,
+                                 int32_t* sec_type) {
+    if (!index || !name || name[0] == '\0') {
+        return -1;
+    }
+    if (!dir_loaded(index, parent) && load_dir(index, parent) != ADF_RC_OK) {
+        adf_dir_index_forget_dir(index, parent);
+        return adfGetEntryBlockNum(index->vol, parent, name);
+    }
+    char folded[ADF_MAX_NAME_LEN + 1];
+    const size_t len = strlen(name);
+    if (!fold_name(index, name, len, folded)) {
+        return -1;
+    }
+    const struct index_entry* e = *find_link(index, parent, folded, len);
+    if (!e) {
+        return -1;
+    }
+    if (sec_type) {
+        *sec_type = e->sec_type;
+    }
+    return e->sector;
+}
+
+ADF_RETCODE adf_dir_index_change_dir(struct adf_dir_index* index, const char* name) {
+    int32_t sec_type = 0;
+    const ADF_SECTNUM sector = adf_dir_index_lookup(index, index->vol->curDirPtr, name, &sec_type);
+    if (sector > 0 && sec_type == ADF_ST_LDIR) {
+        return adfChangeDir(index->vol, name); // ADFlib resolves the link
+    }
+    if (sector <= 0 || sec_type != ADF_ST_DIR) {
+        return ADF_RC_ERROR;
+    }
+    index->vol->curDirPtr = sector;
+    return ADF_RC_OK;
+}
+
+ADF_RETCODE adf_dir_index_create_dir(struct adf_dir_index* index, ADF_SECTNUM parent, const char* name) {
+    ADF_RETCODE rc = adfCreateDir(index->vol, parent, name);
+    if (rc == ADF_RC_OK) {
+        adf_dir_index_refresh_entry(index, parent, name);
+    }
+    return rc;
+}
+
+ADF_RETCODE adf_dir_index_remove_entry(struct adf_dir_index* index, ADF_SECTNUM parent, const char* name) {
+    int32_t sec_type = 0;
+    const ADF_SECTNUM sector = adf_dir_index_lookup(index, parent, name, &sec_type);
+    ADF_RETCODE rc = adfRemoveEntry(index->vol, parent, name);
+    if (rc == ADF_RC_OK) {
+        drop(index, parent, name);
+        if (sector > 0 && sec_type == ADF_ST_DIR) {
+            adf_dir_index_forget_dir(index, sector); // ADFlib only removes empty directories
+        }
+    }
+    return rc;
+}
+
+ADF_RETCODE adf_dir_index_rename_entry(struct adf_dir_index* index, ADF_SECTNUM old_parent, const char* old_name,
+                                       ADF_SECTNUM new_parent, const char* new_name) {
+    ADF_RETCODE rc = adfRenameEntry(index->vol, old_parent, old_name, new_parent, new_name);
+    if (rc == ADF_RC_OK) {
+        drop(index, old_parent, old_name);
+        adf_dir_index_refresh_entry(index, new_parent, new_name);
+    }
+    return rc;
+}
+
+void adf_dir_index_refresh_entry(struct adf_dir_index* index, ADF_SECTNUM parent, const char* name) {
+    if (!index || !dir_loaded(index, parent)) {
+        return; // read in full on the next lookup anyway
+    }
+    struct AdfEntryBlock block;
+    const ADF_SECTNUM sector = adfGetEntryBlock(index->vol, parent, name, &block);
+    if (sector > 0) {
+        put(index, parent, name, strlen(name), sector, block.secType);
+    } else {
+        drop(index, parent, name);
+    }
+}
+
+void adf_dir_index_forget_dir(struct adf_dir_index* index, ADF_SECTNUM parent) {
+    if (!index) {
+        return;
+    }
+    for (uint32_t b = 0; b <= index->bucket_mask; b++) {
+        struct index_entry** link = &index->buckets[b];
+        while (*link) {
+            struct index_entry* e = *link;
+            if (e->parent == parent) {
+                *link = e->next;
+                free(e);
+                index->count--;
+            } else {
+                link = &e->next;
+            }
+        }
+    }
+}
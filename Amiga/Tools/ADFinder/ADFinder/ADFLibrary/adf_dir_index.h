@@ -0,0 +1,48 @@
+//
+//  adf_dir_index.h
+//  ADFinder
+//
+
+#ifndef ADF_DIR_INDEX_H
+#define ADF_DIR_INDEX_H
+
+#include <stdint.h>
+#include "adf_err.h"
+#include "adf_types.h"
+#include "adf_vol.h"
+
+// An in-memory name index of a mounted volume, keyed by (parent block,
+// name folded the way the volume compares names: INTL or plain ASCII).
+// adfGetEntryBlockNum() and adfChangeDir() read one entry block per hash
+// chain hop on every call; here a directory is read once, on the first
+// lookup in it, and later lookups in it need no device reads.
+//
+// The create/remove/rename calls below run the ADFlib call and update the
+// index. Anything that changes a directory some other way must call
+// adf_dir_index_refresh_entry() or adf_dir_index_forget_dir().
+
+struct adf_dir_index;
+
+struct adf_dir_index* adf_dir_index_create(struct AdfVolume* vol);
+void adf_dir_index_free(struct adf_dir_index* index);
+
+// Header block of name in directory parent, or -1. sec_type (optional)
+// receives the entry's ADF_ST_* type.
+ADF_SECTNUM adf_dir_index_lookup(struct adf_dir_index* index, ADF_SECTNUM parent, const char* name,
+                                 int32_t* sec_type);
+
+// adfChangeDir() through the index: enters a subdirectory of vol->curDirPtr.
+ADF_RETCODE adf_dir_index_change_dir(struct adf_dir_index* index, const char* name);
+
+ADF_RETCODE adf_dir_index_create_dir(struct adf_dir_index* index, ADF_SECTNUM parent, const char* name);
+ADF_RETCODE adf_dir_index_remove_entry(struct adf_dir_index* index, ADF_SECTNUM parent, const char* name);
+ADF_RETCODE adf_dir_index_rename_entry(struct adf_dir_index* index, ADF_SECTNUM old_parent, const char* old_name,
+                                       ADF_SECTNUM new_parent, const char* new_name);
+
+// Re-reads one name from disk, e.g. after a file was written into parent.
+void adf_dir_index_refresh_entry(struct adf_dir_index* index, ADF_SECTNUM parent, const char* name);
+
+// Drops what is known about a directory; it is read again on the next lookup.
+void adf_dir_index_forget_dir(struct adf_dir_index* index, ADF_SECTNUM parent);
+
+#endif /* ADF_DIR_INDEX_H */
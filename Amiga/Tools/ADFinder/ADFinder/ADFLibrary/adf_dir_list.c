@@ -0,0 +1,299 @@
+//
+//  adf_dir_list.c
+//  ADFinder
+//
+
+#include "adf_dir_list.h"
+#include "adf_dir_cache.h"
+#include "adf_blk.h"
+#include "adf_dir.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Days from 1970-01-01 to the Amiga epoch, 1978-01-01.
+#define AMIGA_EPOCH_DAYS 2922
+
+struct dir_frame {
+    ADF_SECTNUM dir;
+    bool cached;            // listed from the DIRCACHE chain, not the hash table
+    int32_t hash_table[ADF_HT_SIZE];
+    int slot;               // next hash table slot to start a chain from
+    ADF_SECTNUM next;       // next entry in the current chain, 0 at its end
+    uint32_t hops;
+    ADF_SECTNUM dirc;       // cache block being listed, 0 at the end of the chain
+    bool dirc_loaded;
+    int dirc_pos;           // byte offset of the next record
+    int dirc_index;         // its number within the block
+    struct AdfDirCacheBlock dirc_block;
+};
+
+struct adf_dir_cursor {
+    struct AdfVolume* vol;
+    bool recursive;
+    struct dir_frame* frames;
+    uint32_t depth;
+    uint32_t frames_capacity;
+    uint32_t max_hops;      // guards against hash chains that loop
+    struct AdfEntryBlock block;
+};
+
+// Amiga days to a calendar date (days since 1970 to civil, H. Hinnant).
+static void amiga_days_to_date(int32_t days, uint16_t* year, uint8_t* month, uint8_t* day) {
+    const int64_t z = (int64_t)days + AMIGA_EPOCH_DAYS + 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const uint32_t doe = (uint32_t)(z - era * 146097);
+    const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const uint32_t mp = (5 * doy + 2) / 153;
+    const uint32_t d = doy - (153 * mp + 2) / 5 + 1;
+    const uint32_t m = mp < 10 ? mp + 3 : mp - 9;
+    *year = (uint16_t)(era * 400 + yoe + (m <= 2));
+    *month = (uint8_t)m;
+    *day = (uint8_t)d;
+}
+
+static ADF_RETCODE push_dir(struct adf_dir_cursor* cursor, ADF_SECTNUM dir) {
+    if (cursor->depth == cursor->frames_capacity) {
+        const uint32_t capacity = cursor->frames_capacity ? cursor->frames_capacity * 2 : 8;
+        struct dir_frame* frames = realloc(cursor->frames, capacity * sizeof(*frames));
+        if (!frames) {
+            return ADF_RC_MALLOC;
+        }
+        cursor->frames = frames;
+        cursor->frames_capacity = capacity;
+    }
+    ADF_RETCODE rc = adfReadEntryBlock(cursor->vol, dir, &cursor->block);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    struct dir_frame* frame = &cursor->frames[cursor->depth++];
+    frame->dir = dir;
+    // A sound cache chain lists the directory without one read per entry.
+    frame->dirc = adf_dir_cache_first_block(cursor->vol, dir);
+    frame->cached = frame->dirc != 0;
+    frame->dirc_loaded = false;
+    frame->dirc_pos = 0;
+    frame->dirc_index = 0;
+    memcpy(frame->hash_table, cursor->block.hashTable, sizeof(frame->hash_table));
+    frame->slot = 0;
+    frame->next = 0;
+    frame->hops = 0;
+    return ADF_RC_OK;
+}
+
+struct adf_dir_cursor* adf_dir_cursor_open(struct AdfVolume* vol, ADF_SECTNUM dir, bool recursive) {
+    if (!vol) {
+        return NULL;
+    }
+    struct adf_dir_cursor* cursor = calloc(1, sizeof(*cursor));
+    if (!cursor) {
+        return NULL;
+    }
+    cursor->vol = vol;
+    cursor->recursive = recursive;
+    cursor->max_hops = adfVolGetSizeInBlocks(vol);
+    if (push_dir(cursor, dir) != ADF_RC_OK) {
+        adf_dir_cursor_close(cursor);
+        return NULL;
+    }
+    return cursor;
+}
+
+void adf_dir_cursor_close(struct adf_dir_cursor* cursor) {
+    if (cursor) {
+        free(cursor->frames);
+        free(cursor);
+    }
+}
+
+bool adf_dir_cursor_done(const struct adf_dir_cursor* cursor) {
+    return cursor->depth == 0;
+}
+
+static uint32_t add_string(struct adf_dir_page* page, const char* s, uint8_t len) {
+    const uint32_t offset = page->names_used;
+    memcpy(page->names + offset, s, len);
+    page->names[offset + len] = '\0';
+    page->names_used += (uint32_t)len + 1;
+    return offset;
+}
+
+static bool page_has_room(const struct adf_dir_page* page, uint8_t name_len, uint8_t comm_len) {
+    const uint32_t strings = (uint32_t)name_len + 1 + (comm_len ? (uint32_t)comm_len + 1 : 0);
+    return page->count < page->capacity && page->names_capacity - page->names_used >= strings;
+}
+
+static void add_record(const struct adf_dir_cursor* cursor, const struct dir_frame* frame, struct adf_dir_page* page,
+                       ADF_SECTNUM sector, ADF_SECTNUM real, int32_t type, uint32_t size, int32_t access,
+                       const char* name, uint8_t name_len, const char* comment, uint8_t comm_len,
+                       int32_t days, int32_t mins, int32_t ticks) {
+    struct adf_dir_record* record = &page->records[page->count++];
+    record->sector = sector;
+    record->parent = frame->dir;
+    record->real = real;
+    record->type = type;
+    record->size = size;
+    record->access = access;
+    record->name = add_string(page, name, name_len);
+    record->comment = comm_len ? add_string(page, comment, comm_len) : ADF_DIR_NO_COMMENT;
+    amiga_days_to_date(days, &record->year, &record->month, &record->day);
+    record->hour = (uint8_t)(mins / 60);
+    record->mins = (uint8_t)(mins % 60);
+    record->secs = (uint8_t)(ticks / 50);
+    record->depth = (uint8_t)(cursor->depth - 1 < UINT8_MAX ? cursor->depth - 1 : UINT8_MAX);
+}
+
+// One entry from the hash chains. *full is set when it does not fit the page.
+static ADF_RETCODE next_from_hash(struct adf_dir_cursor* cursor, struct dir_frame* frame,
+                                  struct adf_dir_page* page, bool* full) {
+    if (frame->next == 0) {
+        while (frame->slot < ADF_HT_SIZE && frame->hash_table[frame->slot] == 0) {
+            frame->slot++;
+        }
+        if (frame->slot == ADF_HT_SIZE) {
+            cursor->depth--;
+            return ADF_RC_OK;
+        }
+        frame->next = frame->hash_table[frame->slot++];
+    }
+    if (++frame->hops > cursor->max_hops) {
+        return ADF_RC_ERROR;
+    }
+
+    const ADF_SECTNUM sector = frame->next;
+    struct AdfEntryBlock* entry = &cursor->block;
+    ADF_RETCODE rc = adfReadEntryBlock(cursor->vol, sector, entry);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    const uint8_t name_len = entry->nameLen <= ADF_MAX_NAME_LEN ? entry->nameLen : ADF_MAX_NAME_LEN;
+    const uint8_t comm_len = entry->commLen <= ADF_MAX_COMMENT_LEN ? entry->commLen : ADF_MAX_COMMENT_LEN;
+    if (!page_has_room(page, name_len, comm_len)) {
+        frame->hops--;
+        *full = true; // this entry comes first next time
+        return ADF_RC_OK;
+    }
+    add_record(cursor, frame, page, sector, entry->realEntry, entry->secType,
+               entry->secType == ADF_ST_FILE ? entry->byteSize : 0, entry->access,
+               entry->name, name_len, entry->comment, comm_len, entry->days, entry->mins, entry->ticks);
+
+    frame->next = entry->nextSameHash;
+    if (cursor->recursive && entry->secType == ADF_ST_DIR) {
+        return push_dir(cursor, sector);
+    }
+    return ADF_RC_OK;
+}
+
+// One entry from the DIRCACHE chain, checked when the directory was pushed.
+static ADF_RETCODE next_from_cache(struct adf_dir_cursor* cursor, struct dir_frame* frame,
+                                   struct adf_dir_page* page, bool* full) {
+    if (!frame->dirc_loaded) {
+        if (frame->dirc == 0) {
+            cursor->depth--;
+            return ADF_RC_OK;
+        }
+        if (++frame->hops > cursor->max_hops) {
+            return ADF_RC_ERROR;
+        }
+        ADF_RETCODE rc = adfReadDirCBlock(cursor->vol, frame->dirc, &frame->dirc_block);
+        if (rc != ADF_RC_OK) {
+            return rc;
+        }
+        frame->dirc_loaded = true;
+        frame->dirc_pos = 0;
+        frame->dirc_index = 0;
+    }
+    if (frame->dirc_index >= frame->dirc_block.recordsNb) {
+        frame->dirc = frame->dirc_block.nextDirC;
+        frame->dirc_loaded = false;
+        return ADF_RC_OK;
+    }
+
+    struct AdfCacheEntry entry;
+    const int next_pos = adf_dir_cache_read_record(&frame->dirc_block, frame->dirc_pos, &entry);
+    if (next_pos < 0) {
+        return ADF_RC_ERROR;
+    }
+    if (!page_has_room(page, (uint8_t)entry.nLen, (uint8_t)entry.cLen)) {
+        *full = true;
+        return ADF_RC_OK;
+    }
+    // Cache records do not carry a link's target; links are rare enough to read.
+    ADF_SECTNUM real = 0;
+    if (entry.type == ADF_ST_LFILE || entry.type == ADF_ST_LDIR) {
+        ADF_RETCODE rc = adfReadEntryBlock(cursor->vol, entry.header, &cursor->block);
+        if (rc != ADF_RC_OK) {
+            return rc;
+        }
+        real = cursor->block.realEntry;
+    }
+    add_record(cursor, frame, page, entry.header, real, entry.type, entry.type == ADF_ST_FILE ? entry.size : 0,
+               entry.protect, entry.name, (uint8_t)entry.nLen, entry.comm, (uint8_t)entry.cLen,
+               entry.days, entry.mins, entry.ticks);
+
+    frame->dirc_pos = next_pos;
+    frame->dirc_index++;
+    if (cursor->recursive && entry.type == ADF_ST_DIR) {
+        return push_dir(cursor, entry.header);
+    }
+    return ADF_RC_OK;
+}
+
+ADF_RETCODE adf_dir_cursor_next(struct adf_dir_cursor* cursor, struct adf_dir_page* page) {
+    bool full = false;
+    while (cursor->depth > 0 && !full) {
+        struct dir_frame* frame = &cursor->frames[cursor->depth - 1];
+        ADF_RETCODE rc = frame->cached ? next_from_cache(cursor, frame, page, &full)
+                                       : next_from_hash(cursor, frame, page, &full);
+        if (rc != ADF_RC_OK) {
+            return rc;
+        }
+    }
+    return ADF_RC_OK;
+}
+
+static bool grow_page(struct adf_dir_page* page) {
+    const uint32_t capacity = page->capacity ? page->capacity * 2 : 64;
+    uint32_t names_capacity = page->names_capacity ? page->names_capacity * 2 : 64 * 16;
+    if (names_capacity < ADF_DIR_MAX_ENTRY_STRINGS) {
+        names_capacity = ADF_DIR_MAX_ENTRY_STRINGS;
+    }
+    struct adf_dir_record* records = realloc(page->records, capacity * sizeof(*records));
+    if (!records) {
+        return false;
+    }
+    page->records = records;
+    page->capacity = capacity;
+    char* names = realloc(page->names, names_capacity);
+    if (!names) {
+        return false;
+    }
+    page->names = names;
+    page->names_capacity = names_capacity;
+    return true;
+}
+
+ADF_RETCODE adf_dir_list_all(struct AdfVolume* vol, ADF_SECTNUM dir, bool recursive, struct adf_dir_page* page) {
+    struct adf_dir_cursor* cursor = adf_dir_cursor_open(vol, dir, recursive);
+    if (!cursor) {
+        return ADF_RC_ERROR;
+    }
+    ADF_RETCODE rc = ADF_RC_OK;
+    while (rc == ADF_RC_OK) {
+        rc = adf_dir_cursor_next(cursor, page);
+        if (rc != ADF_RC_OK || adf_dir_cursor_done(cursor)) {
+            break;
+        }
+        if (!grow_page(page)) {
+            rc = ADF_RC_MALLOC;
+        }
+    }
+    adf_dir_cursor_close(cursor);
+    return rc;
+}
+
+void adf_dir_page_free(struct adf_dir_page* page) {
+    free(page->records);
+    free(page->names);
+    memset(page, 0, sizeof(*page));
+}
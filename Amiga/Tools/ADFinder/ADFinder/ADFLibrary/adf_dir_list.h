@@ -0,0 +1,69 @@
+//
+//  adf_dir_list.h
+//  ADFinder
+//
+
+#ifndef ADF_DIR_LIST_H
+#define ADF_DIR_LIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "adf_blk.h"
+#include "adf_err.h"
+#include "adf_types.h"
+#include "adf_vol.h"
+
+// Directory listings as one array of fixed-size records, with the names
+// and comments in a single string arena, instead of adfGetDirEnt()'s
+// AdfList cells with a malloc per cell and per string. A cursor lists a
+// directory, or a whole tree depth-first, a page at a time into buffers
+// the caller owns; adf_dir_list_all() does it in one go into growing ones.
+// On a DIRCACHE volume a directory whose cache chain checks out is listed
+// from its packed cache records; any other is read entry by entry.
+
+#define ADF_DIR_NO_COMMENT 0xFFFFFFFFu
+
+// A page's name arena never needs more than this for a single entry.
+#define ADF_DIR_MAX_ENTRY_STRINGS (ADF_MAX_NAME_LEN + 1 + ADF_MAX_COMMENT_LEN + 1)
+
+struct adf_dir_record {
+    ADF_SECTNUM sector;
+    ADF_SECTNUM parent;
+    ADF_SECTNUM real;       // hard link target, 0 otherwise
+    int32_t type;           // ADF_ST_*
+    uint32_t size;
+    int32_t access;
+    uint32_t name;          // offset into the page's names
+    uint32_t comment;       // offset into the page's names, or ADF_DIR_NO_COMMENT
+    uint16_t year;
+    uint8_t month, day;
+    uint8_t hour, mins, secs;
+    uint8_t depth;          // 0 for entries of the listed directory itself
+};
+
+struct adf_dir_page {
+    struct adf_dir_record* records;
+    uint32_t capacity;
+    uint32_t count;
+    char* names;            // NUL-terminated strings
+    uint32_t names_capacity;
+    uint32_t names_used;
+};
+
+struct adf_dir_cursor;
+
+struct adf_dir_cursor* adf_dir_cursor_open(struct AdfVolume* vol, ADF_SECTNUM dir, bool recursive);
+void adf_dir_cursor_close(struct adf_dir_cursor* cursor);
+bool adf_dir_cursor_done(const struct adf_dir_cursor* cursor);
+
+// Appends entries to the page until it is full or the listing is done. An
+// entry that does not fit is left for the next call; set count and
+// names_used back to 0 to reuse the buffers for the next page.
+ADF_RETCODE adf_dir_cursor_next(struct adf_dir_cursor* cursor, struct adf_dir_page* page);
+
+// Lists everything into a zeroed page, allocating and growing its buffers.
+// Free them with adf_dir_page_free().
+ADF_RETCODE adf_dir_list_all(struct AdfVolume* vol, ADF_SECTNUM dir, bool recursive, struct adf_dir_page* page);
+void adf_dir_page_free(struct adf_dir_page* page);
+
+#endif /* ADF_DIR_LIST_H */
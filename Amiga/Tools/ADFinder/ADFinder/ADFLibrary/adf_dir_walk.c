@@ -0,0 +1,333 @@
+//
+//  adf_dir_walk.c
+//  ADFinder
+//
+
+#include "adf_dir_walk.h"
+#include "adf_blk.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One listed directory and how far the walk has got through it.
+struct walk_dir {
+    struct adf_dir_page page;
+    uint32_t* order;            // record indices in visiting order
+    uint32_t order_capacity;
+    uint32_t next;
+    uint32_t path_len;          // its path prefix, trailing '/' included
+    uint32_t depth;
+};
+
+// A directory the breadth-first walk has yet to list.
+struct pending_dir {
+    ADF_SECTNUM dir;
+    char* path;                 // prefix for its entries, trailing '/' included
+    uint32_t depth;
+};
+
+struct walk {
+    struct AdfVolume* vol;
+    struct adf_walk_options options;
+    adf_walk_visitor visitor;
+    void* ctx;
+    char* path;
+    uint32_t path_capacity;
+};
+
+struct sort_key {
+    const char* name;
+    uint32_t index;
+    bool dir;
+    bool dirs_first;
+};
+
+static int compare_names(const char* a, const char* b) {
+    for (;; a++, b++) {
+        const int ca = tolower((unsigned char)*a);
+        const int cb = tolower((unsigned char)*b);
+        if (ca != cb || ca == 0) {
+            return ca - cb;
+        }
+    }
+}
+
+static int compare_keys(const void* pa, const void* pb) {
+    const struct sort_key* a = pa;
+    const struct sort_key* b = pb;
+    if (a->dirs_first && a->dir != b->dir) {
+        return a->dir ? -1 : 1;
+    }
+    return compare_names(a->name, b->name);
+}
+
+static bool sort_dir(struct walk_dir* wd, enum adf_walk_sort sort) {
+    const uint32_t count = wd->page.count;
+    if (count > wd->order_capacity) {
+        uint32_t* order = realloc(wd->order, count * sizeof(*order));
+        if (!order) {
+            return false;
+        }
+        wd->order = order;
+        wd->order_capacity = count;
+    }
+    if (sort == ADF_WALK_UNSORTED || count < 2) {
+        for (uint32_t i = 0; i < count; i++) {
+            wd->order[i] = i;
+        }
+        return true;
+    }
+    struct sort_key* keys = malloc(count * sizeof(*keys));
+    if (!keys) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        keys[i].name = wd->page.names + wd->page.records[i].name;
+        keys[i].index = i;
+        keys[i].dir = wd->page.records[i].type == ADF_ST_DIR;
+        keys[i].dirs_first = sort == ADF_WALK_SORT_DIRS_FIRST;
+    }
+    qsort(keys, count, sizeof(*keys), compare_keys);
+    for (uint32_t i = 0; i < count; i++) {
+        wd->order[i] = keys[i].index;
+    }
+    free(keys);
+    return true;
+}
+
+static int compare_sectors(const void* pa, const void* pb) {
+    const ADF_SECTNUM a = *(const ADF_SECTNUM*)pa;
+    const ADF_SECTNUM b = *(const ADF_SECTNUM*)pb;
+    return (a > b) - (a < b);
+}
+
+// Reads the header blocks of the subdirectories just listed in ascending
+// block order, so a track-caching driver has them before they are listed.
+static void prefetch_subdirs(const struct walk* walk, const struct adf_dir_page* page) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < page->count; i++) {
+        count += page->records[i].type == ADF_ST_DIR;
+    }
+    if (count == 0) {
+        return;
+    }
+    ADF_SECTNUM* sectors = malloc(count * sizeof(*sectors));
+    if (!sectors) {
+        return; // only a hint
+    }
+    count = 0;
+    for (uint32_t i = 0; i < page->count; i++) {
+        if (page->records[i].type == ADF_ST_DIR) {
+            sectors[count++] = page->records[i].sector;
+        }
+    }
+    qsort(sectors, count, sizeof(*sectors), compare_sectors);
+    uint8_t buf[512];
+    for (uint32_t i = 0; i < count; i++) {
+        adfVolReadBlock(walk->vol, (uint32_t)sectors[i], buf);
+    }
+    free(sectors);
+}
+
+static ADF_RETCODE list_dir(const struct walk* walk, struct walk_dir* wd, ADF_SECTNUM dir) {
+    wd->page.count = 0;
+    wd->page.names_used = 0;
+    wd->next = 0;
+    ADF_RETCODE rc = adf_dir_list_all(walk->vol, dir, false, &wd->page);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    if (!sort_dir(wd, walk->options.sort)) {
+        return ADF_RC_MALLOC;
+    }
+    if (walk->options.prefetch) {
+        prefetch_subdirs(walk, &wd->page);
+    }
+    return ADF_RC_OK;
+}
+
+static bool reserve_path(struct walk* walk, uint32_t needed) {
+    if (needed <= walk->path_capacity) {
+        return true;
+    }
+    uint32_t capacity = walk->path_capacity ? walk->path_capacity : 256;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    char* path = realloc(walk->path, capacity);
+    if (!path) {
+        return false;
+    }
+    walk->path = path;
+    walk->path_capacity = capacity;
+    return true;
+}
+
+// Visits the next entry of wd with the path built on top of wd's prefix.
+// The path of a directory to descend into is left with its trailing '/'.
+static ADF_RETCODE visit_next(struct walk* walk, struct walk_dir* wd, enum adf_walk_action* action,
+                              const struct adf_dir_record** visited) {
+    const struct adf_dir_record* record = &wd->page.records[wd->order[wd->next++]];
+    const char* name = wd->page.names + record->name;
+    const uint32_t name_len = (uint32_t)strlen(name);
+    if (!reserve_path(walk, wd->path_len + name_len + 2)) {
+        return ADF_RC_MALLOC;
+    }
+    memcpy(walk->path + wd->path_len, name, name_len + 1);
+
+    const struct adf_walk_entry entry = {
+        .record = record,
+        .name = name,
+        .comment = record->comment != ADF_DIR_NO_COMMENT ? wd->page.names + record->comment : NULL,
+        .path = walk->path,
+        .depth = wd->depth,
+    };
+    *action = walk->visitor(&entry, walk->ctx);
+    *visited = record;
+    if (*action == ADF_WALK_CONTINUE && record->type == ADF_ST_DIR) {
+        walk->path[wd->path_len + name_len] = '/';
+        walk->path[wd->path_len + name_len + 1] = '\0';
+    }
+    return ADF_RC_OK;
+}
+
+static void free_walk_dir(struct walk_dir* wd) {
+    adf_dir_page_free(&wd->page);
+    free(wd->order);
+}
+
+static ADF_RETCODE walk_depth_first(struct walk* walk, ADF_SECTNUM dir) {
+    struct walk_dir* stack = calloc(8, sizeof(*stack));
+    uint32_t capacity = 8;
+    if (!stack) {
+        return ADF_RC_MALLOC;
+    }
+    uint32_t depth = 1;
+    ADF_RETCODE rc = list_dir(walk, &stack[0], dir);
+
+    while (rc == ADF_RC_OK && depth > 0) {
+        struct walk_dir* wd = &stack[depth - 1];
+        if (wd->next == wd->page.count) {
+            depth--;
+            continue;
+        }
+        enum adf_walk_action action;
+        const struct adf_dir_record* record;
+        rc = visit_next(walk, wd, &action, &record);
+        if (rc != ADF_RC_OK || action == ADF_WALK_STOP) {
+            break;
+        }
+        if (action != ADF_WALK_CONTINUE || record->type != ADF_ST_DIR) {
+            continue;
+        }
+        if (depth == capacity) {
+            struct walk_dir* grown = realloc(stack, capacity * 2 * sizeof(*grown));
+            if (!grown) {
+                rc = ADF_RC_MALLOC;
+                break;
+            }
+            memset(grown + capacity, 0, capacity * sizeof(*grown));
+            stack = grown;
+            capacity *= 2;
+            wd = &stack[depth - 1];
+        }
+        const ADF_SECTNUM subdir = record->sector;
+        struct walk_dir* child = &stack[depth++];
+        child->path_len = wd->path_len + (uint32_t)strlen(walk->path + wd->path_len);
+        child->depth = wd->depth + 1;
+        rc = list_dir(walk, child, subdir);
+    }
+    for (uint32_t i = 0; i < capacity; i++) {
+        free_walk_dir(&stack[i]);
+    }
+    free(stack);
+    return rc;
+}
+
+static ADF_RETCODE walk_breadth_first(struct walk* walk, ADF_SECTNUM dir) {
+    struct pending_dir* queue = malloc(16 * sizeof(*queue));
+    uint32_t head = 0, tail = 0, capacity = 16;
+    char* root_path = calloc(1, 1);
+    if (!queue || !root_path) {
+        free(queue);
+        free(root_path);
+        return ADF_RC_MALLOC;
+    }
+    queue[tail++] = (struct pending_dir){ dir, root_path, 0 };
+
+    struct walk_dir wd = { 0 };
+    ADF_RETCODE rc = ADF_RC_OK;
+    bool stopped = false;
+    while (rc == ADF_RC_OK && !stopped && head < tail) {
+        struct pending_dir current = queue[head++];
+        wd.path_len = (uint32_t)strlen(current.path);
+        wd.depth = current.depth;
+        rc = list_dir(walk, &wd, current.dir);
+        if (rc == ADF_RC_OK) {
+            rc = reserve_path(walk, wd.path_len + 1) ? ADF_RC_OK : ADF_RC_MALLOC;
+        }
+        if (rc == ADF_RC_OK) {
+            memcpy(walk->path, current.path, wd.path_len);
+        }
+        free(current.path);
+
+        while (rc == ADF_RC_OK && wd.next < wd.page.count) {
+            enum adf_walk_action action;
+            const struct adf_dir_record* record;
+            rc = visit_next(walk, &wd, &action, &record);
+            if (rc != ADF_RC_OK || action == ADF_WALK_STOP) {
+                stopped = true;
+                break;
+            }
+            if (action != ADF_WALK_CONTINUE || record->type != ADF_ST_DIR) {
+                continue;
+            }
+            if (head > 0 && tail == capacity) {
+                // Reuse the slots already taken off the front.
+                memmove(queue, queue + head, (tail - head) * sizeof(*queue));
+                tail -= head;
+                head = 0;
+            }
+            if (tail == capacity) {
+                struct pending_dir* grown = realloc(queue, capacity * 2 * sizeof(*grown));
+                if (!grown) {
+                    rc = ADF_RC_MALLOC;
+                    break;
+                }
+                queue = grown;
+                capacity *= 2;
+            }
+            char* path = strdup(walk->path);
+            if (!path) {
+                rc = ADF_RC_MALLOC;
+                break;
+            }
+            queue[tail++] = (struct pending_dir){ record->sector, path, wd.depth + 1 };
+        }
+    }
+    while (head < tail) {
+        free(queue[head++].path);
+    }
+    free(queue);
+    free_walk_dir(&wd);
+    return rc;
+}
+
+ADF_RETCODE adf_dir_walk(struct AdfVolume* vol, ADF_SECTNUM dir, const struct adf_walk_options* options,
+                         adf_walk_visitor visitor, void* ctx) {
+    if (!vol || !visitor) {
+        return ADF_RC_NULLPTR;
+    }
+    struct walk walk = { .vol = vol, .visitor = visitor, .ctx = ctx };
+    if (options) {
+        walk.options = *options;
+    }
+    if (!reserve_path(&walk, 256)) {
+        return ADF_RC_MALLOC;
+    }
+    walk.path[0] = '\0';
+    const ADF_RETCODE rc = walk.options.order == ADF_WALK_BREADTH_FIRST ? walk_breadth_first(&walk, dir)
+                                                                        : walk_depth_first(&walk, dir);
+    free(walk.path);
+    return rc;
+}
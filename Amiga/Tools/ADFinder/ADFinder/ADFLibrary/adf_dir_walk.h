@@ -0,0 +1,60 @@
+//
+//  adf_dir_walk.h
+//  ADFinder
+//
+
+#ifndef ADF_DIR_WALK_H
+#define ADF_DIR_WALK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "adf_dir_list.h"
+#include "adf_err.h"
+#include "adf_types.h"
+#include "adf_vol.h"
+
+// Walks a directory tree and calls a visitor for each entry, without
+// adfGetRDirEnt()'s whole-tree AdfList and without changing the volume's
+// current directory. Only the directories on the way down (depth-first) or
+// the ones waiting their turn (breadth-first) are held, each as a flat
+// adf_dir_page listing.
+
+enum adf_walk_order {
+    ADF_WALK_DEPTH_FIRST,       // a directory's subtree right after its entry
+    ADF_WALK_BREADTH_FIRST      // all of one level before the next
+};
+
+enum adf_walk_sort {
+    ADF_WALK_UNSORTED,          // hash table order, as listed
+    ADF_WALK_SORT_NAME,         // case-insensitive by name
+    ADF_WALK_SORT_DIRS_FIRST    // directories, then the rest, each by name
+};
+
+enum adf_walk_action {
+    ADF_WALK_CONTINUE,
+    ADF_WALK_PRUNE,             // do not descend into this directory
+    ADF_WALK_STOP
+};
+
+struct adf_walk_options {
+    enum adf_walk_order order;
+    enum adf_walk_sort sort;
+    bool prefetch;              // read the next directories' blocks in disk order
+};
+
+struct adf_walk_entry {
+    const struct adf_dir_record* record;
+    const char* name;
+    const char* comment;        // NULL without one
+    const char* path;           // from the walk's start, '/'-separated, no leading '/'
+    uint32_t depth;             // 0 for entries of the start directory
+};
+
+typedef enum adf_walk_action (*adf_walk_visitor)(const struct adf_walk_entry* entry, void* ctx);
+
+// Strings in entry only live until the visitor returns. ADF_RC_OK also when
+// the visitor stopped the walk. Options may be NULL: depth-first, unsorted.
+ADF_RETCODE adf_dir_walk(struct AdfVolume* vol, ADF_SECTNUM dir, const struct adf_walk_options* options,
+                         adf_walk_visitor visitor, void* ctx);
+
+#endif /* ADF_DIR_WALK_H */
@@ -0,0 +1,374 @@
+//
+//  adf_extent_file.c
+//  ADFinder
+//
+
+#include "adf_extent_file.h"
+#include "adf_blk.h"
+#include "adf_byteorder.h"
+#include "adf_cache.h"
+#include "adf_checksum.h"
+#include "adf_dev.h"
+#include "adf_dir.h"
+#include "adf_file_block.h"
+#include "adf_file_util.h"
+#include "adf_raw.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Seconds from 1970-01-01 to the Amiga epoch, 1978-01-01.
+#define AMIGA_EPOCH_OFFSET 252460800
+
+// Longest run of data blocks sent to the device in one call (36 KB).
+#define WRITE_RUN_MAX_BLOCKS ADF_MAX_DATABLK
+
+struct extent_file {
+    ADF_SECTNUM header;
+    ADF_SECTNUM* data_blocks;
+    ADF_SECTNUM* ext_blocks;
+    uint32_t num_data_blocks;
+    uint32_t num_ext_blocks;
+};
+
+// The Amiga keeps local time, like adfFileOpen() does for new files.
+static void current_amiga_time(int32_t* days, int32_t* mins, int32_t* ticks) {
+    const time_t now = time(NULL);
+    struct tm local;
+    long long secs = 0;
+    if (localtime_r(&now, &local)) {
+        secs = (long long)timegm(&local) - AMIGA_EPOCH_OFFSET;
+    }
+    if (secs < 0) secs = 0;
+    *days = (int32_t)(secs / 86400);
+    *mins = (int32_t)((secs % 86400) / 60);
+    *ticks = (int32_t)(secs % 60) * 50;
+}
+
+// Takes total blocks as extents and hands them out in on-disk order: header
+// (unless the file keeps the one it has), then data blocks, with an
+// extension block before every further 72.
+static ADF_RETCODE place_file(struct adf_bitmap_index* index, enum adf_extent_policy policy,
+                              uint32_t total, bool new_header, struct extent_file* f) {
+    ADF_SECTNUM* run = malloc(total * sizeof(*run));
+    if (!run) {
+        return ADF_RC_MALLOC;
+    }
+    uint32_t placed = 0;
+    struct adf_extent extent;
+    while (placed < total && adf_bitmap_index_alloc_extent(index, total - placed, policy, &extent)) {
+        for (uint32_t i = 0; i < extent.length; i++) {
+            run[placed++] = extent.start + (ADF_SECTNUM)i;
+        }
+    }
+    if (placed < total) {
+        for (uint32_t i = 0; i < placed; i++) {
+            adf_bitmap_index_set_free(index, run[i]);
+        }
+        free(run);
+        return ADF_RC_VOLFULL;
+    }
+
+    uint32_t pos = 0;
+    if (new_header) {
+        f->header = run[pos++];
+    }
+    for (uint32_t i = 0; i < f->num_data_blocks; i++) {
+        if (i > 0 && i % ADF_MAX_DATABLK == 0) {
+            f->ext_blocks[i / ADF_MAX_DATABLK - 1] = run[pos++];
+        }
+        f->data_blocks[i] = run[pos++];
+    }
+    free(run);
+    return ADF_RC_OK;
+}
+
+static void release_blocks(struct adf_bitmap_index* index, const struct extent_file* f) {
+    for (uint32_t i = 0; i < f->num_ext_blocks; i++) {
+        adf_bitmap_index_set_free(index, f->ext_blocks[i]);
+    }
+    for (uint32_t i = 0; i < f->num_data_blocks; i++) {
+        adf_bitmap_index_set_free(index, f->data_blocks[i]);
+    }
+}
+
+static void release_file(struct adf_bitmap_index* index, const struct extent_file* f) {
+    adf_bitmap_index_set_free(index, f->header);
+    release_blocks(index, f);
+}
+
+// Builds data block i in on-disk format. FFS data blocks are plain payload;
+// OFS ones carry a header with the sequence number and a checksum.
+static void assemble_data_block(const struct AdfVolume* vol, const struct extent_file* f, uint32_t i,
+                                const uint8_t* payload, uint32_t length, uint8_t* out) {
+    memset(out, 0, ADF_LOGICAL_BLOCK_SIZE);
+    if (!adfVolIsOFS(vol)) {
+        memcpy(out, payload, length);
+        return;
+    }
+    put_be32(out + 0x00, ADF_T_DATA);
+    put_be32(out + 0x04, (uint32_t)f->header);
+    put_be32(out + 0x08, i + 1);
+    put_be32(out + 0x0c, length);
+    put_be32(out + 0x10, i + 1 < f->num_data_blocks ? (uint32_t)f->data_blocks[i + 1] : 0);
+    memcpy(out + 0x18, payload, length);
+    put_be32(out + 0x14, adf_normal_sum(out, 0x14, ADF_LOGICAL_BLOCK_SIZE));
+}
+
+// Adjacent data blocks go out in one adfDevWriteBlock() call. Full FFS
+// blocks are written straight from the caller's buffer.
+static ADF_RETCODE write_data_blocks(struct AdfVolume* vol, const struct extent_file* f,
+                                     const uint8_t* data, uint32_t size, uint8_t* staging) {
+    const uint32_t payload = vol->datablockSize;
+    uint32_t i = 0;
+    while (i < f->num_data_blocks) {
+        uint32_t run = 1;
+        while (i + run < f->num_data_blocks && run < WRITE_RUN_MAX_BLOCKS &&
+               f->data_blocks[i + run] == f->data_blocks[i] + (ADF_SECTNUM)run) {
+            run++;
+        }
+        const uint8_t* blocks = staging;
+        if (!adfVolIsOFS(vol) && (uint64_t)(i + run) * payload <= size) {
+            blocks = data + (size_t)i * payload;
+        } else {
+            for (uint32_t j = 0; j < run; j++) {
+                const uint32_t offset = (i + j) * payload;
+                const uint32_t length = size - offset < payload ? size - offset : payload;
+                assemble_data_block(vol, f, i + j, data + offset, length, staging + (size_t)j * ADF_LOGICAL_BLOCK_SIZE);
+            }
+        }
+        ADF_RETCODE rc = adfDevWriteBlock(vol->dev, (uint32_t)(vol->firstBlock + f->data_blocks[i]),
+                                          run * ADF_LOGICAL_BLOCK_SIZE, blocks);
+        if (rc != ADF_RC_OK) {
+            return rc;
+        }
+        i += run;
+    }
+    return ADF_RC_OK;
+}
+
+static ADF_RETCODE write_ext_blocks(struct AdfVolume* vol, const struct extent_file* f) {
+    for (uint32_t k = 0; k < f->num_ext_blocks; k++) {
+        struct AdfFileExtBlock fext;
+        memset(&fext, 0, sizeof(fext));
+        const uint32_t first = (k + 1) * ADF_MAX_DATABLK;
+        const uint32_t count = f->num_data_blocks - first < ADF_MAX_DATABLK ? f->num_data_blocks - first : ADF_MAX_DATABLK;
+        fext.type = ADF_T_LIST;
+        fext.headerKey = f->ext_blocks[k];
+        fext.highSeq = (int32_t)count;
+        for (uint32_t j = 0; j < count; j++) {
+            fext.dataBlocks[ADF_MAX_DATABLK - 1 - j] = f->data_blocks[first + j];
+        }
+        fext.parent = f->header;
+        fext.extension = k + 1 < f->num_ext_blocks ? f->ext_blocks[k + 1] : 0;
+        fext.secType = ADF_ST_FILE;
+        ADF_RETCODE rc = adfWriteFileExtBlock(vol, f->ext_blocks[k], &fext);
+        if (rc != ADF_RC_OK) {
+            return rc;
+        }
+    }
+    return ADF_RC_OK;
+}
+
+// Points a header at f's blocks and stamps it with the size and time.
+static void set_header_blocks(struct AdfFileHeaderBlock* fhdr, uint32_t size, const struct extent_file* f) {
+    const uint32_t in_header = f->num_data_blocks < ADF_MAX_DATABLK ? f->num_data_blocks : ADF_MAX_DATABLK;
+    memset(fhdr->dataBlocks, 0, sizeof(fhdr->dataBlocks));
+    fhdr->highSeq = (int32_t)in_header;
+    fhdr->firstData = f->num_data_blocks ? f->data_blocks[0] : 0;
+    for (uint32_t j = 0; j < in_header; j++) {
+        fhdr->dataBlocks[ADF_MAX_DATABLK - 1 - j] = f->data_blocks[j];
+    }
+    fhdr->byteSize = size;
+    current_amiga_time(&fhdr->days, &fhdr->mins, &fhdr->ticks);
+    fhdr->extension = f->num_ext_blocks ? f->ext_blocks[0] : 0;
+}
+
+// Sets linked once the entry is in its directory: from then on the file is
+// on the volume, complete, and its blocks must stay allocated even if the
+// directory cache cannot be updated.
+static ADF_RETCODE write_header_and_link(struct AdfVolume* vol, ADF_SECTNUM parent, const char* name,
+                                         uint32_t size, const struct extent_file* f, bool* linked) {
+    struct AdfFileHeaderBlock fhdr;
+    memset(&fhdr, 0, sizeof(fhdr));
+    fhdr.type = ADF_T_HEADER;
+    fhdr.headerKey = f->header;
+    set_header_blocks(&fhdr, size, f);
+    fhdr.nameLen = (uint8_t)strlen(name);
+    memcpy(fhdr.fileName, name, fhdr.nameLen);
+    fhdr.parent = parent;
+    fhdr.secType = ADF_ST_FILE;
+    ADF_RETCODE rc = adfWriteFileHdrBlock(vol, f->header, &fhdr);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+
+    struct AdfEntryBlock parent_block;
+    rc = adfReadEntryBlock(vol, parent, &parent_block);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    if (adfCreateEntry(vol, &parent_block, name, f->header) != f->header) {
+        return ADF_RC_ERROR;
+    }
+    *linked = true;
+    if (adfVolHasDIRCACHE(vol)) {
+        return adfAddInCache(vol, &parent_block, (struct AdfEntryBlock*)&fhdr);
+    }
+    return ADF_RC_OK;
+}
+
+ADF_RETCODE adf_write_file_extents(struct AdfVolume* vol, struct adf_bitmap_index* index, ADF_SECTNUM parent,
+                                   const char* name, const uint8_t* data, uint32_t size,
+                                   enum adf_extent_policy policy) {
+    if (!vol || !name || (!data && size > 0)) {
+        return ADF_RC_NULLPTR;
+    }
+    const size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > ADF_MAX_NAME_LEN || strchr(name, '/') || strchr(name, ':')) {
+        return ADF_RC_ERROR;
+    }
+
+    struct extent_file f;
+    memset(&f, 0, sizeof(f));
+    f.num_data_blocks = adfFileSize2Datablocks(size, vol->datablockSize);
+    f.num_ext_blocks = adfFileDatablocks2Extblocks(f.num_data_blocks);
+    const uint32_t total = adfFileSize2Blocks(size, vol->datablockSize);
+
+    struct adf_bitmap_index* own_index = index ? NULL : (index = adf_bitmap_index_create(vol));
+    f.data_blocks = malloc((f.num_data_blocks + 1) * sizeof(*f.data_blocks));
+    f.ext_blocks = malloc((f.num_ext_blocks + 1) * sizeof(*f.ext_blocks));
+    uint8_t* staging = malloc((size_t)WRITE_RUN_MAX_BLOCKS * ADF_LOGICAL_BLOCK_SIZE);
+    ADF_RETCODE rc = ADF_RC_MALLOC;
+    if (!index || !f.data_blocks || !f.ext_blocks || !staging) {
+        goto done;
+    }
+    if (adf_bitmap_index_free_blocks(index) < total) {
+        rc = ADF_RC_VOLFULL;
+        goto done;
+    }
+
+    rc = place_file(index, policy, total, true, &f);
+    if (rc != ADF_RC_OK) {
+        goto done;
+    }
+    rc = write_data_blocks(vol, &f, data, size, staging);
+    if (rc == ADF_RC_OK) {
+        rc = write_ext_blocks(vol, &f);
+    }
+    bool linked = false;
+    if (rc == ADF_RC_OK) {
+        rc = write_header_and_link(vol, parent, name, size, &f, &linked);
+    }
+    if (rc != ADF_RC_OK && !linked) {
+        release_file(index, &f);
+    }
+    if (linked && adfVolHasDIRCACHE(vol)) {
+        adf_bitmap_index_rebuild(index);    // adfAddInCache() may have taken a block
+    }
+
+done:
+    adf_bitmap_index_free(own_index);
+    free(f.data_blocks);
+    free(f.ext_blocks);
+    free(staging);
+    return rc;
+}
+
+// Gives an existing file a new set of data and extension blocks, then
+// rewrites its header in place and frees the old ones.
+static ADF_RETCODE replace_file_extents(struct AdfVolume* vol, struct adf_bitmap_index* index, ADF_SECTNUM header,
+                                        const uint8_t* data, uint32_t size, enum adf_extent_policy policy) {
+    struct AdfFileHeaderBlock fhdr;
+    ADF_RETCODE rc = adfReadEntryBlock(vol, header, (struct AdfEntryBlock*)&fhdr);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    if (fhdr.secType != ADF_ST_FILE) {
+        return ADF_RC_ERROR;
+    }
+    struct AdfFileBlocks old_blocks;
+    memset(&old_blocks, 0, sizeof(old_blocks));
+    rc = adfGetFileBlocks(vol, &fhdr, &old_blocks);
+
+    struct extent_file f;
+    memset(&f, 0, sizeof(f));
+    f.header = header;
+    f.num_data_blocks = adfFileSize2Datablocks(size, vol->datablockSize);
+    f.num_ext_blocks = adfFileDatablocks2Extblocks(f.num_data_blocks);
+    const uint32_t total = adfFileSize2Blocks(size, vol->datablockSize) - 1;
+
+    struct adf_bitmap_index* own_index = index ? NULL : (index = adf_bitmap_index_create(vol));
+    f.data_blocks = malloc((f.num_data_blocks + 1) * sizeof(*f.data_blocks));
+    f.ext_blocks = malloc((f.num_ext_blocks + 1) * sizeof(*f.ext_blocks));
+    uint8_t* staging = malloc((size_t)WRITE_RUN_MAX_BLOCKS * ADF_LOGICAL_BLOCK_SIZE);
+    if (rc != ADF_RC_OK) {
+        goto done;
+    }
+    rc = ADF_RC_MALLOC;
+    if (!index || !f.data_blocks || !f.ext_blocks || !staging) {
+        goto done;
+    }
+    if (adf_bitmap_index_free_blocks(index) < total) {
+        rc = ADF_RC_VOLFULL;
+        goto done;
+    }
+
+    rc = place_file(index, policy, total, false, &f);
+    if (rc != ADF_RC_OK) {
+        goto done;
+    }
+    rc = write_data_blocks(vol, &f, data, size, staging);
+    if (rc == ADF_RC_OK) {
+        rc = write_ext_blocks(vol, &f);
+    }
+    if (rc == ADF_RC_OK) {
+        set_header_blocks(&fhdr, size, &f);
+        rc = adfWriteFileHdrBlock(vol, header, &fhdr);
+    }
+    if (rc != ADF_RC_OK) {
+        release_blocks(index, &f);
+        goto done;
+    }
+    for (unsigned i = 0; i < old_blocks.data.nItems; i++) {
+        adf_bitmap_index_set_free(index, old_blocks.data.sectors[i]);
+    }
+    for (unsigned i = 0; i < old_blocks.extens.nItems; i++) {
+        adf_bitmap_index_set_free(index, old_blocks.extens.sectors[i]);
+    }
+    if (adfVolHasDIRCACHE(vol)) {
+        struct AdfEntryBlock parent_block;
+        rc = adfReadEntryBlock(vol, fhdr.parent, &parent_block);
+        if (rc == ADF_RC_OK) {
+            rc = adfUpdateCache(vol, &parent_block, (struct AdfEntryBlock*)&fhdr, false);
+        }
+        adf_bitmap_index_rebuild(index);    // adfUpdateCache() may have taken a block
+    }
+
+done:
+    if (old_blocks.data.destroy) {
+        old_blocks.data.destroy(&old_blocks.data);
+    }
+    if (old_blocks.extens.destroy) {
+        old_blocks.extens.destroy(&old_blocks.extens);
+    }
+    adf_bitmap_index_free(own_index);
+    free(f.data_blocks);
+    free(f.ext_blocks);
+    free(staging);
+    return rc;
+}
+
+ADF_RETCODE adf_file_write_all(struct AdfVolume* vol, struct adf_bitmap_index* index, ADF_SECTNUM parent,
+                               const char* name, const uint8_t* data, uint32_t size,
+                               enum adf_extent_policy policy) {
+    if (!vol || !name || (!data && size > 0)) {
+        return ADF_RC_NULLPTR;
+    }
+    const ADF_SECTNUM existing = strlen(name) <= ADF_MAX_NAME_LEN ? adfGetEntryBlockNum(vol, parent, name) : -1;
+    if (existing > 0) {
+        return replace_file_extents(vol, index, existing, data, size, policy);
+    }
+    return adf_write_file_extents(vol, index, parent, name, data, size, policy);
+}
@@ -0,0 +1,45 @@
+//
+//  adf_extent_file.h
+//  ADFinder
+//
+
+#ifndef ADF_EXTENT_FILE_H
+#define ADF_EXTENT_FILE_H
+
+#include <stdint.h>
+#include "adf_err.h"
+#include "adf_vol.h"
+#include "adf_bitmap_index.h"
+
+// Writes a new file in one go. adfFileWrite() takes one free block at a time
+// for every data and extension block; here the header, extension and data
+// blocks are taken as a few extents sized to what is still left to place, so
+// the data blocks usually sit in one run and go out in a handful of
+// multi-block writes. The file is linked into its directory only after all
+// of its blocks are written.
+//
+// name must not exist yet in parent (a directory or the root block). Returns
+// ADF_RC_VOLFULL, with nothing allocated, when the file does not fit. A
+// failure to add the file to a DIRCACHE block comes after it is linked: the
+// error is returned, but the file stays on the volume, whole.
+//
+// Blocks are taken from index, the volume's bitmap index kept across calls
+// so its cursor carries on where the last file ended; NULL builds one for
+// this call. Only the in-memory bitmap changes; write it with
+// adfUpdateBitmap() or through an adf_bitmap_commit.
+ADF_RETCODE adf_write_file_extents(struct AdfVolume* vol, struct adf_bitmap_index* index, ADF_SECTNUM parent,
+                                   const char* name, const uint8_t* data, uint32_t size,
+                                   enum adf_extent_policy policy);
+
+// Writes name in parent so that it holds exactly data, whether or not it
+// exists. An existing file keeps its header block, and with it its name,
+// protection bits and comment: the new data and extension blocks are
+// written first, then the header is pointed at them and the old blocks are
+// freed, so a shorter write leaves no old tail and a failed one leaves the
+// file as it was. Needs room for the new blocks next to the old ones.
+// Same bitmap rules as above.
+ADF_RETCODE adf_file_write_all(struct AdfVolume* vol, struct adf_bitmap_index* index, ADF_SECTNUM parent,
+                               const char* name, const uint8_t* data, uint32_t size,
+                               enum adf_extent_policy policy);
+
+#endif /* ADF_EXTENT_FILE_H */
@@ -0,0 +1,603 @@
+//
+//  adf_extract.c
+//  ADFinder
+//
+
+#include "adf_extract.h"
+#include "adf_dir_walk.h"
+#include "adf_blk.h"
+#include "adf_dev.h"
+#include "adf_dir.h"
+#include "adf_file_block.h"
+#include "adf_limits.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_MAX_PENDING_BYTES ((size_t)32 * 1024 * 1024)
+
+// Longest run of adjacent blocks read in one call (64 KB).
+#define READ_RUN_MAX_BLOCKS 128
+
+struct extract_item {
+    struct adf_dir_record record;
+    uint32_t path;              // offset into the path arena
+    uint32_t comment;           // offset into the path arena, or ADF_DIR_NO_COMMENT
+    time_t mtime;
+};
+
+struct extract_file {
+    uint32_t item;
+    uint32_t first_ref;         // its data blocks are refs[first_ref, first_ref + num_blocks)
+    uint32_t num_blocks;
+    ADF_SECTNUM first_sector;   // of its data, 0 without any
+    uint8_t* data;
+    bool failed;
+};
+
+// One data block of one file.
+struct block_ref {
+    ADF_SECTNUM sector;
+    uint32_t file;
+    uint32_t seq;
+};
+
+struct extract {
+    struct AdfVolume* vol;
+    struct adf_extract_options options;
+    const char* host_dir;
+
+    struct extract_item* items;
+    uint32_t num_items;
+    uint32_t items_capacity;
+    char* arena;
+    uint32_t arena_used;
+    uint32_t arena_capacity;
+
+    struct extract_file* files;
+    uint32_t num_files;
+    struct block_ref* refs;
+    uint32_t num_refs;
+    uint32_t refs_capacity;
+
+    // Writer queue: files[queue[head..tail)] are read and waiting.
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint32_t* queue;
+    uint32_t head;
+    uint32_t tail;
+    bool closed;
+    size_t pending_bytes;
+
+    struct adf_extract_stats stats;
+    ADF_RETCODE walk_rc;
+};
+
+static uint32_t arena_add(struct extract* ex, const char* s) {
+    const uint32_t len = (uint32_t)strlen(s) + 1;
+    if (ex->arena_used + len > ex->arena_capacity) {
+        uint32_t capacity = ex->arena_capacity ? ex->arena_capacity : 4096;
+        while (capacity < ex->arena_used + len) {
+            capacity *= 2;
+        }
+        char* arena = realloc(ex->arena, capacity);
+        if (!arena) {
+            return UINT32_MAX;
+        }
+        ex->arena = arena;
+        ex->arena_capacity = capacity;
+    }
+    const uint32_t offset = ex->arena_used;
+    memcpy(ex->arena + offset, s, len);
+    ex->arena_used += len;
+    return offset;
+}
+
+// host_dir + '/' + path + suffix, malloc'd.
+static char* host_path(const struct extract* ex, const char* path, const char* suffix) {
+    const size_t size = strlen(ex->host_dir) + 1 + strlen(path) + strlen(suffix) + 1;
+    char* full = malloc(size);
+    if (full) {
+        snprintf(full, size, "%s/%s%s", ex->host_dir, path, suffix);
+    }
+    return full;
+}
+
+static time_t record_time(const struct adf_dir_record* record) {
+    struct tm tm = { 0 };
+    tm.tm_year = record->year - 1900;
+    tm.tm_mon = record->month - 1;
+    tm.tm_mday = record->day;
+    tm.tm_hour = record->hour;
+    tm.tm_min = record->mins;
+    tm.tm_sec = record->secs;
+    tm.tm_isdst = -1; // Amiga dates are local time
+    return mktime(&tm);
+}
+
+// Only well-behaved writers keep '/' out of Amiga names, and nothing stops
+// a crafted image from naming an entry "." or "..": such a name would put
+// it, and everything below it, outside host_dir. A NUL ends a name early
+// when it is read, so what is checked is what would be used.
+static bool is_safe_host_name(const char* name) {
+    return name[0] != '\0' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0 && !strchr(name, '/');
+}
+
+static enum adf_walk_action collect_entry(const struct adf_walk_entry* entry, void* ctx) {
+    struct extract* ex = ctx;
+    const int32_t type = entry->record->type;
+    if (type != ADF_ST_FILE && type != ADF_ST_DIR) {
+        ex->stats.skipped++;
+        return ADF_WALK_CONTINUE;
+    }
+    if (!is_safe_host_name(entry->name)) {
+        ex->stats.failed++;
+        return ADF_WALK_PRUNE;
+    }
+    if (type == ADF_ST_DIR) {
+        char* full = host_path(ex, entry->path, "");
+        const bool made = full && (mkdir(full, 0755) == 0 || errno == EEXIST);
+        free(full);
+        if (!made) {
+            ex->stats.failed++;
+            return ADF_WALK_PRUNE;
+        }
+    }
+    if (ex->num_items == ex->items_capacity) {
+        const uint32_t capacity = ex->items_capacity ? ex->items_capacity * 2 : 256;
+        struct extract_item* items = realloc(ex->items, capacity * sizeof(*items));
+        if (!items) {
+            ex->walk_rc = ADF_RC_MALLOC;
+            return ADF_WALK_STOP;
+        }
+        ex->items = items;
+        ex->items_capacity = capacity;
+    }
+    struct extract_item* item = &ex->items[ex->num_items];
+    item->record = *entry->record;
+    item->path = arena_add(ex, entry->path);
+    item->comment = ADF_DIR_NO_COMMENT;
+    if (item->path != UINT32_MAX && entry->comment) {
+        item->comment = arena_add(ex, entry->comment);
+    }
+    if (item->path == UINT32_MAX || (entry->comment && item->comment == UINT32_MAX)) {
+        ex->walk_rc = ADF_RC_MALLOC;
+        return ADF_WALK_STOP;
+    }
+    item->mtime = record_time(entry->record);
+    ex->num_items++;
+    return ADF_WALK_CONTINUE;
+}
+
+static bool add_ref(struct extract* ex, ADF_SECTNUM sector, uint32_t file, uint32_t seq) {
+    if (ex->num_refs == ex->refs_capacity) {
+        const uint32_t capacity = ex->refs_capacity ? ex->refs_capacity * 2 : 1024;
+        struct block_ref* refs = realloc(ex->refs, capacity * sizeof(*refs));
+        if (!refs) {
+            return false;
+        }
+        ex->refs = refs;
+        ex->refs_capacity = capacity;
+    }
+    ex->refs[ex->num_refs++] = (struct block_ref){ sector, file, seq };
+    return true;
+}
+
+// Collects a file's data block numbers from its header and extension
+// blocks. False with rc OK when the file's own blocks are unsound or cannot
+// be read; rc is only set for errors that end the extraction.
+static bool resolve_file(struct extract* ex, uint32_t file_index, ADF_RETCODE* rc) {
+    struct extract_file* file = &ex->files[file_index];
+    const struct extract_item* item = &ex->items[file->item];
+    const uint32_t volume_blocks = adfVolGetSizeInBlocks(ex->vol);
+    const uint32_t block_size = (uint32_t)ex->vol->datablockSize;
+    const uint32_t needed = (item->record.size + block_size - 1) / block_size;
+
+    file->first_ref = ex->num_refs;
+    file->num_blocks = needed;
+    if (needed == 0) {
+        return true;
+    }
+
+    struct AdfFileHeaderBlock fhdr;
+    if (adfReadEntryBlock(ex->vol, item->record.sector, (struct AdfEntryBlock*)&fhdr) != ADF_RC_OK) {
+        return false;
+    }
+    const int32_t* blocks = fhdr.dataBlocks;
+    int32_t high_seq = fhdr.highSeq;
+    ADF_SECTNUM next_ext = fhdr.extension;
+    struct AdfFileExtBlock fext;
+    uint32_t seq = 0;
+    uint32_t hops = 0;
+    for (;;) {
+        if (high_seq < 0 || high_seq > ADF_MAX_DATABLK) {
+            return false;
+        }
+        // Data block numbers are stored from the end of the table backwards.
+        for (int32_t i = 0; i < high_seq && seq < needed; i++, seq++) {
+            const ADF_SECTNUM sector = blocks[ADF_MAX_DATABLK - 1 - i];
+            if (sector < 2 || (uint32_t)sector >= volume_blocks) {
+                return false;
+            }
+            if (!add_ref(ex, sector, file_index, seq)) {
+                *rc = ADF_RC_MALLOC;
+                return false;
+            }
+        }
+        if (seq == needed) {
+            file->first_sector = ex->refs[file->first_ref].sector;
+            return true;
+        }
+        if (next_ext < 2 || (uint32_t)next_ext >= volume_blocks || ++hops > volume_blocks) {
+            return false;
+        }
+        if (adfReadFileExtBlock(ex->vol, next_ext, &fext) != ADF_RC_OK) {
+            return false;
+        }
+        blocks = fext.dataBlocks;
+        high_seq = fext.highSeq;
+        next_ext = fext.extension;
+    }
+}
+
+static int compare_refs(const void* pa, const void* pb) {
+    const struct block_ref* a = pa;
+    const struct block_ref* b = pb;
+    return (a->sector > b->sector) - (a->sector < b->sector);
+}
+
+static int compare_files(const void* pa, const void* pb) {
+    const ADF_SECTNUM a = ((const struct extract_file*)pa)->first_sector;
+    const ADF_SECTNUM b = ((const struct extract_file*)pb)->first_sector;
+    return (a > b) - (a < b);
+}
+
+static void set_metadata_file(const struct extract* ex, const struct extract_item* item, const char* full) {
+    const int32_t access = item->record.access;
+    const char* comment = item->comment != ADF_DIR_NO_COMMENT ? ex->arena + item->comment : "";
+    const size_t size = strlen(full) + sizeof(".uaem");
+    char* sidecar = malloc(size);
+    if (!sidecar) {
+        return;
+    }
+    snprintf(sidecar, size, "%s.uaem", full);
+    FILE* f = fopen(sidecar, "w");
+    if (f) {
+        // hspa are shown when set, rwed when allowed (their bits deny).
+        fprintf(f, "%c%c%c%c%c%c%c%c %04u-%02u-%02u %02u:%02u:%02u.00 %s\n",
+                adfAccHasH(access) ? 'h' : '-', adfAccHasS(access) ? 's' : '-',
+                adfAccHasP(access) ? 'p' : '-', adfAccHasA(access) ? 'a' : '-',
+                adfAccHasR(access) ? '-' : 'r', adfAccHasW(access) ? '-' : 'w',
+                adfAccHasE(access) ? '-' : 'e', adfAccHasD(access) ? '-' : 'd',
+                item->record.year, item->record.month, item->record.day,
+                item->record.hour, item->record.mins, item->record.secs, comment);
+        fclose(f);
+    }
+    free(sidecar);
+}
+
+static bool write_all(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        const ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+static bool write_file(const struct extract* ex, const struct extract_file* file) {
+    const struct extract_item* item = &ex->items[file->item];
+    char* full = host_path(ex, ex->arena + item->path, "");
+    if (!full) {
+        return false;
+    }
+    const int fd = open(full, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, file->data, item->record.size);
+    if (fd >= 0) {
+        if (ok && ex->options.set_permissions) {
+            // R and W are set when reading and writing are denied.
+            const int32_t access = item->record.access;
+            fchmod(fd, (mode_t)((adfAccHasR(access) ? 0 : 0444) | (adfAccHasW(access) ? 0 : 0200)));
+        }
+        if (ok && ex->options.set_times) {
+            const struct timespec times[2] = { { item->mtime, 0 }, { item->mtime, 0 } };
+            futimens(fd, times);
+        }
+        ok = close(fd) == 0 && ok;
+    }
+    if (ok && ex->options.write_metadata) {
+        set_metadata_file(ex, item, full);
+    }
+    free(full);
+    return ok;
+}
+
+static void finish_file(struct extract* ex, struct extract_file* file) {
+    const uint32_t size = ex->items[file->item].record.size;
+    const bool ok = !file->failed && write_file(ex, file);
+    free(file->data);
+    file->data = NULL;
+
+    pthread_mutex_lock(&ex->lock);
+    if (ok) {
+        ex->stats.files++;
+        ex->stats.bytes += size;
+    } else {
+        ex->stats.failed++;
+    }
+    ex->pending_bytes -= size;
+    pthread_cond_broadcast(&ex->changed);
+    pthread_mutex_unlock(&ex->lock);
+}
+
+static void* writer_thread(void* arg) {
+    struct extract* ex = arg;
+    for (;;) {
+        pthread_mutex_lock(&ex->lock);
+        while (ex->head == ex->tail && !ex->closed) {
+            pthread_cond_wait(&ex->changed, &ex->lock);
+        }
+        if (ex->head == ex->tail) {
+            pthread_mutex_unlock(&ex->lock);
+            break;
+        }
+        const uint32_t file_index = ex->queue[ex->head++];
+        pthread_mutex_unlock(&ex->lock);
+        finish_file(ex, &ex->files[file_index]);
+    }
+    return NULL;
+}
+
+// Copies one data block into its file's buffer.
+static void place_block(struct extract* ex, const struct block_ref* ref, const uint8_t* block) {
+    const uint32_t block_size = (uint32_t)ex->vol->datablockSize;
+    const uint32_t header_size = ADF_DEV_BLOCK_SIZE - block_size; // OFS data block header
+    struct extract_file* file = &ex->files[ref->file];
+    const uint32_t size = ex->items[file->item].record.size;
+    const uint32_t offset = ref->seq * block_size;
+    const uint32_t bytes = size - offset < block_size ? size - offset : block_size;
+    memcpy(file->data + offset, block + header_size, bytes);
+}
+
+// Reads the data of files[first, last) in block order and scatters it into
+// their buffers. When a run cannot be read, its blocks are read one by one
+// and the files of those that still fail are marked failed.
+static ADF_RETCODE read_batch(struct extract* ex, uint32_t first, uint32_t last, uint8_t* run_buf) {
+    uint32_t count = 0;
+    for (uint32_t f = first; f < last; f++) {
+        struct extract_file* file = &ex->files[f];
+        const uint32_t size = ex->items[file->item].record.size;
+        file->data = malloc(size ? size : 1);
+        if (!file->data) {
+            return ADF_RC_MALLOC;
+        }
+        count += file->failed ? 0 : file->num_blocks;
+    }
+    struct block_ref* batch = malloc((count ? count : 1) * sizeof(*batch));
+    if (!batch) {
+        return ADF_RC_MALLOC;
+    }
+    count = 0;
+    for (uint32_t f = first; f < last; f++) {
+        const struct extract_file* file = &ex->files[f];
+        if (!file->failed) {
+            memcpy(batch + count, ex->refs + file->first_ref, file->num_blocks * sizeof(*batch));
+            count += file->num_blocks;
+        }
+    }
+    qsort(batch, count, sizeof(*batch), compare_refs);
+
+    uint32_t start = 0;
+    while (start < count) {
+        uint32_t len = 1;
+        while (start + len < count && len < READ_RUN_MAX_BLOCKS &&
+               batch[start + len].sector == batch[start].sector + (ADF_SECTNUM)len) {
+            len++;
+        }
+        const uint32_t first_block = (uint32_t)(ex->vol->firstBlock + batch[start].sector);
+        if (adfDevReadBlock(ex->vol->dev, first_block, len * ADF_DEV_BLOCK_SIZE, run_buf) == ADF_RC_OK) {
+            for (uint32_t i = 0; i < len; i++) {
+                place_block(ex, &batch[start + i], run_buf + (size_t)i * ADF_DEV_BLOCK_SIZE);
+            }
+        } else {
+            for (uint32_t i = 0; i < len; i++) {
+                const struct block_ref* ref = &batch[start + i];
+                if (adfDevReadBlock(ex->vol->dev, first_block + i, ADF_DEV_BLOCK_SIZE, run_buf) == ADF_RC_OK) {
+                    place_block(ex, ref, run_buf);
+                } else {
+                    ex->files[ref->file].failed = true;
+                }
+            }
+        }
+        start += len;
+    }
+    free(batch);
+    return ADF_RC_OK;
+}
+
+static void set_metadata_dirs(const struct extract* ex) {
+    for (uint32_t i = 0; i < ex->num_items; i++) {
+        const struct extract_item* item = &ex->items[i];
+        if (item->record.type != ADF_ST_DIR) {
+            continue;
+        }
+        char* full = host_path(ex, ex->arena + item->path, "");
+        if (!full) {
+            continue;
+        }
+        if (ex->options.write_metadata) {
+            set_metadata_file(ex, item, full);
+        }
+        if (ex->options.set_times) {
+            const struct timespec times[2] = { { item->mtime, 0 }, { item->mtime, 0 } };
+            utimensat(AT_FDCWD, full, times, 0);
+        }
+        free(full);
+    }
+}
+
+static ADF_RETCODE extract_files(struct extract* ex, pthread_t* writers, uint32_t num_writers) {
+    ADF_RETCODE rc = ADF_RC_OK;
+    uint8_t* run_buf = malloc((size_t)READ_RUN_MAX_BLOCKS * ADF_DEV_BLOCK_SIZE);
+    if (!run_buf) {
+        return ADF_RC_MALLOC;
+    }
+    const size_t max_pending = ex->options.max_pending_bytes;
+    uint32_t first = 0;
+    while (first < ex->num_files && rc == ADF_RC_OK) {
+        // A batch is up to half the pending limit, and at least one file.
+        size_t batch_bytes = ex->items[ex->files[first].item].record.size;
+        uint32_t last = first + 1;
+        while (last < ex->num_files &&
+               batch_bytes + ex->items[ex->files[last].item].record.size <= max_pending / 2) {
+            batch_bytes += ex->items[ex->files[last++].item].record.size;
+        }
+
+        pthread_mutex_lock(&ex->lock);
+        while (ex->pending_bytes > 0 && ex->pending_bytes + batch_bytes > max_pending) {
+            pthread_cond_wait(&ex->changed, &ex->lock);
+        }
+        ex->pending_bytes += batch_bytes;
+        pthread_mutex_unlock(&ex->lock);
+
+        rc = read_batch(ex, first, last, run_buf);
+        if (rc != ADF_RC_OK) {
+            for (uint32_t f = first; f < last; f++) {
+                free(ex->files[f].data);
+                ex->files[f].data = NULL;
+            }
+            break;
+        }
+        if (num_writers == 0) {
+            for (uint32_t f = first; f < last; f++) {
+                finish_file(ex, &ex->files[f]);
+            }
+        } else {
+            pthread_mutex_lock(&ex->lock);
+            for (uint32_t f = first; f < last; f++) {
+                ex->queue[ex->tail++] = f;
+            }
+            pthread_cond_broadcast(&ex->changed);
+            pthread_mutex_unlock(&ex->lock);
+        }
+        first = last;
+    }
+
+    pthread_mutex_lock(&ex->lock);
+    ex->closed = true;
+    pthread_cond_broadcast(&ex->changed);
+    pthread_mutex_unlock(&ex->lock);
+    for (uint32_t i = 0; i < num_writers; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    free(run_buf);
+    return rc;
+}
+
+static uint32_t default_writers(void) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const long writers = cpus / 2;
+    return writers < 1 ? 1 : writers > 4 ? 4 : (uint32_t)writers;
+}
+
+ADF_RETCODE adf_extract_tree(struct AdfVolume* vol, ADF_SECTNUM dir, const char* host_dir,
+                             const struct adf_extract_options* options, struct adf_extract_stats* stats) {
+    if (!vol || !host_dir) {
+        return ADF_RC_NULLPTR;
+    }
+    struct extract ex = { .vol = vol, .host_dir = host_dir };
+    if (options) {
+        ex.options = *options;
+    } else {
+        ex.options.num_writers = default_writers();
+        ex.options.set_times = true;
+    }
+    if (ex.options.max_pending_bytes == 0) {
+        ex.options.max_pending_bytes = DEFAULT_MAX_PENDING_BYTES;
+    }
+    if (mkdir(host_dir, 0755) != 0 && errno != EEXIST) {
+        return ADF_RC_ERROR;
+    }
+
+    // 1. One walk for every entry, creating the host directories on the way.
+    ADF_RETCODE rc = adf_dir_walk(vol, dir, NULL, collect_entry, &ex);
+    if (rc == ADF_RC_OK) {
+        rc = ex.walk_rc;
+    }
+
+    // 2. The data blocks of every file, headers read in directory order.
+    uint32_t num_files = 0;
+    for (uint32_t i = 0; i < ex.num_items && rc == ADF_RC_OK; i++) {
+        num_files += ex.items[i].record.type == ADF_ST_FILE;
+    }
+    if (rc == ADF_RC_OK && num_files > 0) {
+        ex.files = calloc(num_files, sizeof(*ex.files));
+        ex.queue = malloc(num_files * sizeof(*ex.queue));
+        rc = ex.files && ex.queue ? ADF_RC_OK : ADF_RC_MALLOC;
+    }
+    for (uint32_t i = 0; i < ex.num_items && rc == ADF_RC_OK; i++) {
+        if (ex.items[i].record.type == ADF_ST_FILE) {
+            ex.files[ex.num_files++].item = i;
+        }
+    }
+    for (uint32_t f = 0; f < ex.num_files && rc == ADF_RC_OK; f++) {
+        if (!resolve_file(&ex, f, &rc) && rc == ADF_RC_OK) {
+            ex.files[f].failed = true;
+            ex.num_refs = ex.files[f].first_ref;
+        }
+    }
+
+    // 3. Files in the order of their first data block; data read in batches,
+    //    each sorted by block.
+    if (rc == ADF_RC_OK && ex.num_files > 0) {
+        qsort(ex.files, ex.num_files, sizeof(*ex.files), compare_files);
+        for (uint32_t f = 0; f < ex.num_files; f++) {
+            for (uint32_t i = 0; i < ex.files[f].num_blocks; i++) {
+                ex.refs[ex.files[f].first_ref + i].file = f;
+            }
+        }
+
+        pthread_mutex_init(&ex.lock, NULL);
+        pthread_cond_init(&ex.changed, NULL);
+        pthread_t* writers = calloc(ex.options.num_writers ? ex.options.num_writers : 1, sizeof(*writers));
+        uint32_t started = 0;
+        while (writers && started < ex.options.num_writers &&
+               pthread_create(&writers[started], NULL, writer_thread, &ex) == 0) {
+            started++;
+        }
+        // No threads available: the calling thread writes as it goes.
+        rc = extract_files(&ex, writers, started);
+        free(writers);
+        pthread_cond_destroy(&ex.changed);
+        pthread_mutex_destroy(&ex.lock);
+    }
+
+    // 4. Directory dates last, since writing their files changed them.
+    if (rc == ADF_RC_OK) {
+        set_metadata_dirs(&ex);
+    }
+    for (uint32_t i = 0; i < ex.num_items; i++) {
+        ex.stats.directories += ex.items[i].record.type == ADF_ST_DIR;
+    }
+    if (stats) {
+        *stats = ex.stats;
+    }
+    free(ex.items);
+    free(ex.arena);
+    free(ex.files);
+    free(ex.refs);
+    free(ex.queue);
+    return rc;
+}
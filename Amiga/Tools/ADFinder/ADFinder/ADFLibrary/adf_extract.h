@@ -0,0 +1,47 @@
+//
+//  adf_extract.h
+//  ADFinder
+//
+
+#ifndef ADF_EXTRACT_H
+#define ADF_EXTRACT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "adf_err.h"
+#include "adf_types.h"
+#include "adf_vol.h"
+
+// Copies a directory tree of a mounted volume to a host directory in one
+// pass: one walk for the entries, then the file data read in batches in
+// block order, contiguous blocks in a single device read, with the host
+// files written whole by a pool of writer threads. The volume and device
+// are only touched from the calling thread.
+
+struct adf_extract_options {
+    uint32_t num_writers;       // writer threads; 0 writes on the calling thread
+    size_t max_pending_bytes;   // file data read but not yet written; 0 for 32 MB
+    bool set_times;             // host modification times from the Amiga dates
+    bool set_permissions;       // host read/write bits from the Amiga R and W bits
+    bool write_metadata;        // a UAE-style <name>.uaem next to each entry
+};
+
+struct adf_extract_stats {
+    uint32_t files;
+    uint32_t directories;
+    uint32_t skipped;           // links, which have no data of their own
+    uint32_t failed;            // files that could not be read or written, and entries
+                                // whose names cannot be used on the host ("", ".", "..", '/')
+    uint64_t bytes;
+};
+
+// Extracts everything below dir into host_dir, which is created if needed.
+// Per-file failures, including blocks of a file that cannot be read, are
+// counted in stats and do not stop the extraction; the return code is for
+// errors that do (reading the directories, memory, host_dir).
+// Options may be NULL: one writer thread per two CPUs up to 4, times set.
+ADF_RETCODE adf_extract_tree(struct AdfVolume* vol, ADF_SECTNUM dir, const char* host_dir,
+                             const struct adf_extract_options* options, struct adf_extract_stats* stats);
+
+#endif /* ADF_EXTRACT_H */
@@ -0,0 +1,217 @@
+//
+//  adf_file_read.c
+//  ADFinder
+//
+
+#include "adf_file_read.h"
+#include "adf_blk.h"
+#include "adf_byteorder.h"
+#include "adf_checksum.h"
+#include "adf_dev.h"
+#include "adf_dir.h"
+#include "adf_file_block.h"
+#include "adf_limits.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Below this many data blocks the sort is not worth the block list.
+#define SORTED_READ_MIN_BLOCKS 4
+
+// Longest run of adjacent blocks read in one call (64 KB).
+#define SORTED_READ_RUN_MAX_BLOCKS 128
+
+struct read_ref {
+    ADF_SECTNUM sector;
+    uint32_t seq;               // data block index within the file
+};
+
+struct read_plan {
+    struct AdfVolume* vol;
+    uint8_t* buffer;
+    uint32_t pos;               // file offset of buffer[0]
+    uint32_t n;
+    uint32_t block_size;        // data bytes per block
+    uint32_t header_size;       // OFS data block header, 0 on FFS
+    ADF_SECTNUM header_key;     // the file's header block, named by each OFS data block
+};
+
+static int compare_refs(const void* pa, const void* pb) {
+    const struct read_ref* a = pa;
+    const struct read_ref* b = pb;
+    return (a->sector > b->sector) - (a->sector < b->sector);
+}
+
+// True when the data of block seq lies entirely inside the read and can be
+// read in place: FFS only, as OFS blocks carry a header.
+static bool is_direct(const struct read_plan* plan, uint32_t seq) {
+    const uint64_t start = (uint64_t)seq * plan->block_size;
+    return plan->header_size == 0 && start >= plan->pos &&
+           start + plan->block_size <= (uint64_t)plan->pos + plan->n;
+}
+
+// The checks adfFileRead() makes on an OFS data block before using it: its
+// type, its checksum, and that it belongs to this file.
+static bool is_ofs_data_block(const struct read_plan* plan, const uint8_t* block) {
+    return get_be32(block) == ADF_T_DATA && (ADF_SECTNUM)get_be32(block + 4) == plan->header_key &&
+           get_be32(block + 20) == adf_normal_sum(block, 20, ADF_DEV_BLOCK_SIZE);
+}
+
+// Copies the wanted part of one data block's payload into the buffer.
+static void scatter_block(const struct read_plan* plan, uint32_t seq, const uint8_t* payload) {
+    const uint64_t start = (uint64_t)seq * plan->block_size;
+    const uint64_t end = start + plan->block_size;
+    const uint64_t from = start > plan->pos ? start : plan->pos;
+    const uint64_t to = end < (uint64_t)plan->pos + plan->n ? end : (uint64_t)plan->pos + plan->n;
+    memcpy(plan->buffer + (from - plan->pos), payload + (from - start), (size_t)(to - from));
+}
+
+static ADF_RETCODE read_runs(const struct read_plan* plan, const struct read_ref* refs, uint32_t count) {
+    const struct AdfVolume* vol = plan->vol;
+    uint8_t* bounce = NULL;
+    ADF_RETCODE rc = ADF_RC_OK;
+    uint32_t start = 0;
+    while (start < count && rc == ADF_RC_OK) {
+        // A run is adjacent sectors that are either all read in place, in
+        // file order, or all read through the bounce buffer.
+        const bool direct = is_direct(plan, refs[start].seq);
+        uint32_t len = 1;
+        while (start + len < count && len < SORTED_READ_RUN_MAX_BLOCKS &&
+               refs[start + len].sector == refs[start].sector + (ADF_SECTNUM)len &&
+               is_direct(plan, refs[start + len].seq) == direct &&
+               (!direct || refs[start + len].seq == refs[start].seq + len)) {
+            len++;
+        }
+        const uint32_t device_sector = (uint32_t)(vol->firstBlock + refs[start].sector);
+        if (direct) {
+            uint8_t* dst = plan->buffer + ((size_t)refs[start].seq * plan->block_size - plan->pos);
+            rc = adfDevReadBlock(vol->dev, device_sector, len * ADF_DEV_BLOCK_SIZE, dst);
+        } else {
+            if (!bounce) {
+                bounce = malloc((size_t)SORTED_READ_RUN_MAX_BLOCKS * ADF_DEV_BLOCK_SIZE);
+                if (!bounce) {
+                    return ADF_RC_MALLOC;
+                }
+            }
+            rc = adfDevReadBlock(vol->dev, device_sector, len * ADF_DEV_BLOCK_SIZE, bounce);
+            for (uint32_t i = 0; i < len && rc == ADF_RC_OK; i++) {
+                const uint8_t* block = bounce + (size_t)i * ADF_DEV_BLOCK_SIZE;
+                if (plan->header_size > 0 && !is_ofs_data_block(plan, block)) {
+                    rc = ADF_RC_ERROR;
+                    break;
+                }
+                scatter_block(plan, refs[start + i].seq, block + plan->header_size);
+            }
+        }
+        start += len;
+    }
+    free(bounce);
+    return rc;
+}
+
+static void free_blocks(struct AdfFileBlocks* blocks) {
+    if (blocks->data.destroy) {
+        blocks->data.destroy(&blocks->data);
+    }
+    if (blocks->extens.destroy) {
+        blocks->extens.destroy(&blocks->extens);
+    }
+}
+
+// Fills buffer with file bytes [pos, pos + n), n > 0. False when the
+// sorted read cannot be used.
+static bool read_sorted(struct AdfVolume* vol, struct AdfFileHeaderBlock* fhdr, uint32_t pos, uint32_t n,
+                        uint8_t* buffer) {
+    const struct read_plan plan = {
+        .vol = vol,
+        .buffer = buffer,
+        .pos = pos,
+        .n = n,
+        .block_size = (uint32_t)vol->datablockSize,
+        .header_size = ADF_DEV_BLOCK_SIZE - (uint32_t)vol->datablockSize,
+        .header_key = fhdr->headerKey,
+    };
+    const uint32_t first = pos / plan.block_size;
+    const uint32_t last = (pos + n - 1) / plan.block_size;
+    const uint32_t count = last - first + 1;
+
+    struct AdfFileBlocks blocks = { 0 };
+    if (adfGetFileBlocks(vol, fhdr, &blocks) != ADF_RC_OK) {
+        free_blocks(&blocks);
+        return false;
+    }
+    bool ok = blocks.data.nItems > last;
+    struct read_ref* refs = ok ? malloc(count * sizeof(*refs)) : NULL;
+    ok = refs != NULL;
+    const uint32_t volume_blocks = adfVolGetSizeInBlocks(vol);
+    for (uint32_t i = 0; ok && i < count; i++) {
+        const ADF_SECTNUM sector = blocks.data.sectors[first + i];
+        ok = sector >= 2 && (uint32_t)sector < volume_blocks;
+        refs[i] = (struct read_ref){ sector, first + i };
+    }
+    free_blocks(&blocks);
+    if (ok) {
+        qsort(refs, count, sizeof(*refs), compare_refs);
+        ok = read_runs(&plan, refs, count) == ADF_RC_OK;
+    }
+    free(refs);
+    return ok;
+}
+
+uint32_t adf_file_read_sorted(struct AdfFile* file, uint32_t n, uint8_t* buffer) {
+    if (!file || !buffer || !file->modeRead || file->pos >= adfFileGetSize(file)) {
+        return 0;
+    }
+    const uint32_t pos = file->pos;
+    if (n > adfFileGetSize(file) - pos) {
+        n = adfFileGetSize(file) - pos;
+    }
+    const uint32_t block_size = (uint32_t)file->volume->datablockSize;
+    const uint32_t blocks = (pos + n - 1) / block_size - pos / block_size + 1;
+    if (blocks < SORTED_READ_MIN_BLOCKS || !read_sorted(file->volume, file->fileHdr, pos, n, buffer)) {
+        // adfFileRead() stops at a bad block, so a failed sorted read still
+        // returns everything in front of it.
+        return adfFileRead(file, n, buffer);
+    }
+    // Leaves the file's current block where adfFileRead() would have.
+    if (adfFileSeek(file, pos + n) != ADF_RC_OK) {
+        return 0;
+    }
+    return n;
+}
+
+ADF_RETCODE adf_file_read_all(struct AdfVolume* vol, ADF_SECTNUM dir, const char* name, uint8_t** data,
+                              uint32_t* size) {
+    if (!vol || !name || !data || !size) {
+        return ADF_RC_NULLPTR;
+    }
+    *data = NULL;
+    *size = 0;
+    const ADF_SECTNUM sector = adfGetEntryBlockNum(vol, dir, name);
+    if (sector <= 0) {
+        return ADF_RC_ERROR;
+    }
+    struct AdfFileHeaderBlock fhdr;
+    struct AdfEntryBlock* entry = (struct AdfEntryBlock*)&fhdr;
+    ADF_RETCODE rc = adfReadEntryBlock(vol, sector, entry);
+    if (rc == ADF_RC_OK && entry->secType == ADF_ST_LFILE) {
+        rc = adfReadEntryBlock(vol, entry->realEntry, entry);
+    }
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    if (fhdr.secType != ADF_ST_FILE) {
+        return ADF_RC_ERROR;
+    }
+    uint8_t* buffer = malloc(fhdr.byteSize ? fhdr.byteSize : 1);
+    if (!buffer) {
+        return ADF_RC_MALLOC;
+    }
+    if (fhdr.byteSize > 0 && !read_sorted(vol, &fhdr, 0, fhdr.byteSize, buffer)) {
+        free(buffer);
+        return ADF_RC_ERROR;
+    }
+    *data = buffer;
+    *size = fhdr.byteSize;
+    return ADF_RC_OK;
+}
@@ -0,0 +1,37 @@
+//
+//  adf_file_read.h
+//  ADFinder
+//
+
+#ifndef ADF_FILE_READ_H
+#define ADF_FILE_READ_H
+
+#include <stdint.h>
+#include "adf_err.h"
+#include "adf_file.h"
+#include "adf_types.h"
+#include "adf_vol.h"
+
+// Reads like adfFileRead(), from the file's position, which it advances.
+// adfFileRead() reads the data blocks one at a time in file order; here the
+// file's block list is resolved once with adfGetFileBlocks(), the blocks
+// covering the read are sorted by sector, and each run of adjacent sectors
+// is one device read. On FFS the whole blocks of a run in file order are
+// read straight into buffer; otherwise the run goes through a bounce buffer
+// and OFS data block headers are checked (type, checksum, header key) and
+// stripped on the way.
+//
+// Reads of a few blocks, and files whose block list does not add up, go
+// through adfFileRead() unchanged. Returns the number of bytes read, short
+// only at the end of the file or on a read error.
+uint32_t adf_file_read_sorted(struct AdfFile* file, uint32_t n, uint8_t* buffer);
+
+// Reads all of file name in dir (a hard link is followed) into a malloc'd
+// buffer for the caller to free, without opening an AdfFile: the header
+// block, the extension blocks, then the data in sorted runs as above.
+// ADF_RC_ERROR, with nothing returned, when any of it cannot be read; the
+// bytes in front of a bad block are still there through adfFileRead().
+ADF_RETCODE adf_file_read_all(struct AdfVolume* vol, ADF_SECTNUM dir, const char* name, uint8_t** data,
+                              uint32_t* size);
+
+#endif /* ADF_FILE_READ_H */
@@ -0,0 +1,187 @@
+//
+//  adf_mmap_driver.c
+//  ADFinder
+//
+
+#include "adf_mmap_driver.h"
+#include "adf_dev.h"
+#include "adf_dev_drivers.h"
+#include "adf_dev_type.h"
+#include "adf_limits.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct mmap_device {
+    uint8_t* image;
+    size_t size;
+};
+
+static struct AdfDevice* mmap_device_new(const char* const name, int fd, size_t size,
+                                         struct AdfDevGeometry geometry, bool read_only) {
+    struct AdfDevice* dev = calloc(1, sizeof(*dev));
+    struct mmap_device* map = calloc(1, sizeof(*map));
+    char* dev_name = strdup(name);
+    if (!dev || !map || !dev_name) {
+        free(dev);
+        free(map);
+        free(dev_name);
+        return NULL;
+    }
+
+    void* image = mmap(NULL, size, read_only ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        free(dev);
+        free(map);
+        free(dev_name);
+        return NULL;
+    }
+    // The mapping keeps the file referenced; the descriptor is not needed.
+    close(fd);
+    map->image = image;
+    map->size = size;
+
+    dev->name = dev_name;
+    dev->sizeBlocks = (uint32_t)(size / ADF_DEV_BLOCK_SIZE);
+    dev->geometry = geometry;
+    dev->geometry.blockSize = ADF_DEV_BLOCK_SIZE;
+    dev->type = adfDevGetTypeByGeometry(&dev->geometry);
+    dev->class = adfDevGetClassBySizeBlocks(dev->sizeBlocks);
+    dev->readOnly = read_only;
+    dev->mounted = false;
+    dev->drv = &adfMmapDeviceDriver;
+    dev->drvData = map;
+    return dev;
+}
+
+static struct AdfDevice* mmap_device_create(const char* const name, const uint32_t cylinders,
+                                            const uint32_t heads, const uint32_t sectors) {
+    const uint64_t size = (uint64_t)cylinders * heads * sectors * ADF_DEV_BLOCK_SIZE;
+    if (size == 0 || size / ADF_DEV_BLOCK_SIZE > UINT32_MAX || size > SIZE_MAX) {
+        return NULL;
+    }
+    int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)size) == -1) { // zero-filled, like the dump driver
+        close(fd);
+        return NULL;
+    }
+    struct AdfDevGeometry geometry = { .cylinders = cylinders, .heads = heads, .sectors = sectors };
+    struct AdfDevice* dev = mmap_device_new(name, fd, (size_t)size, geometry, false);
+    if (!dev) {
+        close(fd);
+    }
+    return dev;
+}
+
+static struct AdfDevice* mmap_device_open(const char* const name, const AdfAccessMode mode) {
+    const bool read_only = (mode != ADF_ACCESS_MODE_READWRITE);
+    int fd = open(name, read_only ? O_RDONLY : O_RDWR);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat image_stat;
+    if (fstat(fd, &image_stat) == -1 || image_stat.st_size <= 0 ||
+        image_stat.st_size % ADF_DEV_BLOCK_SIZE != 0 ||
+        (uint64_t)image_stat.st_size / ADF_DEV_BLOCK_SIZE > UINT32_MAX ||
+        (uint64_t)image_stat.st_size > SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+
+    const uint32_t size_blocks = (uint32_t)(image_stat.st_size / ADF_DEV_BLOCK_SIZE);
+    struct AdfDevGeometry geometry = adfDevTypeGetGeometry(adfDevGetTypeBySizeBlocks(size_blocks));
+    if (!adfDevIsGeometryValid(&geometry, size_blocks)) {
+        geometry.cylinders = size_blocks; // unknown type: one track per block, like ADFlib does
+        geometry.heads = 1;
+        geometry.sectors = 1;
+    }
+    struct AdfDevice* dev = mmap_device_new(name, fd, (size_t)image_stat.st_size, geometry, read_only);
+    if (!dev) {
+        close(fd);
+    }
+    return dev;
+}
+
+static ADF_RETCODE mmap_device_sync(const struct AdfDevice* const dev) {
+    const struct mmap_device* map = dev->drvData;
+    if (dev->readOnly) {
+        return ADF_RC_OK;
+    }
+    return msync(map->image, map->size, MS_SYNC) == 0 ? ADF_RC_OK : ADF_RC_ERROR;
+}
+
+static ADF_RETCODE mmap_device_close(struct AdfDevice* const dev) {
+    struct mmap_device* map = dev->drvData;
+    ADF_RETCODE rc = ADF_RC_OK;
+    if (map) {
+        rc = mmap_device_sync(dev);
+        munmap(map->image, map->size);
+        free(map);
+    }
+    free(dev->name);
+    free(dev);
+    return rc;
+}
+
+static ADF_RETCODE mmap_device_read_sectors(const struct AdfDevice* const dev, const uint32_t block,
+                                            const uint32_t len_blocks, uint8_t* const buf) {
+    const struct mmap_device* map = dev->drvData;
+    if ((uint64_t)block + len_blocks > dev->sizeBlocks) {
+        return ADF_RC_BLOCKOUTOFRANGE;
+    }
+    memcpy(buf, map->image + (size_t)block * ADF_DEV_BLOCK_SIZE, (size_t)len_blocks * ADF_DEV_BLOCK_SIZE);
+    return ADF_RC_OK;
+}
+
+static ADF_RETCODE mmap_device_write_sectors(const struct AdfDevice* const dev, const uint32_t block,
+                                             const uint32_t len_blocks, const uint8_t* const buf) {
+    struct mmap_device* map = dev->drvData;
+    if (dev->readOnly) {
+        return ADF_RC_ERROR;
+    }
+    if ((uint64_t)block + len_blocks > dev->sizeBlocks) {
+        return ADF_RC_BLOCKOUTOFRANGE;
+    }
+    memcpy(map->image + (size_t)block * ADF_DEV_BLOCK_SIZE, buf, (size_t)len_blocks * ADF_DEV_BLOCK_SIZE);
+    return ADF_RC_OK;
+}
+
+static bool mmap_device_is_native(void) {
+    return false;
+}
+
+static bool mmap_device_is_device(const char* const name) {
+    (void)name;
+    return false; // only ever selected by name, through adfDevOpenWithDriver
+}
+
+const struct AdfDeviceDriver adfMmapDeviceDriver = {
+    .name         = ADF_MMAP_DRIVER_NAME,
+    .data         = NULL,
+    .createDev    = mmap_device_create,
+    .openDev      = mmap_device_open,
+    .closeDev     = mmap_device_close,
+    .readSectors  = mmap_device_read_sectors,
+    .writeSectors = mmap_device_write_sectors,
+    .isNative     = mmap_device_is_native,
+    .isDevice     = mmap_device_is_device
+};
+
+ADF_RETCODE register_mmap_driver_helper(void) {
+    return adfAddDeviceDriver(&adfMmapDeviceDriver);
+}
+
+ADF_RETCODE adf_mmap_device_flush(const struct AdfDevice* dev) {
+    if (!dev || dev->drv != &adfMmapDeviceDriver) {
+        return ADF_RC_OK;
+    }
+    return mmap_device_sync(dev);
+}
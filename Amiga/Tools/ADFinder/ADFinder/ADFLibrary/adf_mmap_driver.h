@@ -0,0 +1,26 @@
+//
+//  adf_mmap_driver.h
+//  ADFinder
+//
+
+#ifndef ADF_MMAP_DRIVER_H
+#define ADF_MMAP_DRIVER_H
+
+#include "adf_dev_driver.h"
+#include "adf_err.h"
+
+// A device driver that maps the whole image file (ADF or HDF) into memory.
+// Block reads and writes become memcpy() on the mapping, and the image size
+// is only limited by the address space, not by the stdio offsets the dump
+// driver uses.
+#define ADF_MMAP_DRIVER_NAME "adfinder-mmap"
+
+extern const struct AdfDeviceDriver adfMmapDeviceDriver;
+
+ADF_RETCODE register_mmap_driver_helper(void);
+
+// msync()s the mapping so the changes are on disk. Closing the device does
+// the same.
+ADF_RETCODE adf_mmap_device_flush(const struct AdfDevice* dev);
+
+#endif /* ADF_MMAP_DRIVER_H */
@@ -0,0 +1,469 @@
+//
+//  adf_salvage_index.c
+//  ADFinder
+//
+
+#include "adf_salvage_index.h"
+#include "adf_bitm.h"
+#include "adf_byteorder.h"
+#include "adf_cache.h"
+#include "adf_checksum.h"
+#include "adf_dev.h"
+#include "adf_dir.h"
+#include "adf_dir_cache.h"
+#include "adf_file_util.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Blocks per device read (1 MB).
+#define SALVAGE_CHUNK_BLOCKS 2048
+
+enum orphan_kind {
+    ORPHAN_HEADER,
+    ORPHAN_EXT,
+    ORPHAN_DATA                 // OFS data
+};
+
+struct orphan {
+    ADF_SECTNUM sector;
+    ADF_SECTNUM parent;         // directory, file header, or an OFS data block's header key
+    ADF_SECTNUM next;           // first or next extension block
+    int32_t seq;                // OFS data: sequence number; otherwise data blocks listed
+    uint32_t table;             // data block list, for file headers and extension blocks
+    uint8_t kind;
+};
+
+struct adf_salvage_index {
+    struct AdfVolume* vol;
+    uint32_t num_blocks;
+    bool ofs;
+    uint8_t* live_dirs;         // 1 for allocated directory and root blocks
+
+    struct orphan* orphans;     // in block order
+    uint32_t num_orphans;
+    uint32_t orphans_capacity;
+
+    int32_t (*tables)[ADF_MAX_DATABLK];
+    uint32_t num_tables;
+    uint32_t tables_capacity;
+
+    struct adf_salvage_entry* entries;  // in block order
+    uint32_t num_entries;
+    uint32_t entries_capacity;
+};
+
+static bool grow(void** array, uint32_t* capacity, size_t size) {
+    const uint32_t grown = *capacity ? *capacity * 2 : 256;
+    void* p = realloc(*array, grown * size);
+    if (!p) {
+        return false;
+    }
+    *array = p;
+    *capacity = grown;
+    return true;
+}
+
+static bool in_volume(const struct adf_salvage_index* index, ADF_SECTNUM sector) {
+    return sector >= 2 && (uint32_t)sector < index->num_blocks;
+}
+
+static bool is_free(const struct adf_salvage_index* index, ADF_SECTNUM sector) {
+    return in_volume(index, sector) && adfIsBlockFree(index->vol, sector);
+}
+
+static const struct orphan* find_orphan(const struct adf_salvage_index* index, ADF_SECTNUM sector, uint8_t kind) {
+    uint32_t lo = 0, hi = index->num_orphans;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (index->orphans[mid].sector < sector) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < index->num_orphans && index->orphans[lo].sector == sector && index->orphans[lo].kind == kind) {
+        return &index->orphans[lo];
+    }
+    return NULL;
+}
+
+static struct orphan* add_orphan(struct adf_salvage_index* index, ADF_SECTNUM sector, uint8_t kind) {
+    if (index->num_orphans == index->orphans_capacity &&
+        !grow((void**)&index->orphans, &index->orphans_capacity, sizeof(*index->orphans))) {
+        return NULL;
+    }
+    struct orphan* orphan = &index->orphans[index->num_orphans++];
+    memset(orphan, 0, sizeof(*orphan));
+    orphan->sector = sector;
+    orphan->kind = kind;
+    return orphan;
+}
+
+static bool add_table(struct adf_salvage_index* index, struct orphan* orphan, const int32_t* data_blocks,
+                      int32_t high_seq) {
+    if (index->num_tables == index->tables_capacity &&
+        !grow((void**)&index->tables, &index->tables_capacity, sizeof(*index->tables))) {
+        return false;
+    }
+    memcpy(index->tables[index->num_tables], data_blocks, sizeof(*index->tables));
+    orphan->table = index->num_tables++;
+    orphan->seq = high_seq < 0 ? 0 : high_seq > ADF_MAX_DATABLK ? ADF_MAX_DATABLK : high_seq;
+    return true;
+}
+
+static bool add_entry(struct adf_salvage_index* index, ADF_SECTNUM sector, const struct AdfEntryBlock* block) {
+    if (index->num_entries == index->entries_capacity &&
+        !grow((void**)&index->entries, &index->entries_capacity, sizeof(*index->entries))) {
+        return false;
+    }
+    struct adf_salvage_entry* entry = &index->entries[index->num_entries++];
+    memset(entry, 0, sizeof(*entry));
+    entry->header = sector;
+    entry->parent = block->parent;
+    entry->sec_type = block->secType;
+    entry->size = block->secType == ADF_ST_FILE ? ((const struct AdfFileHeaderBlock*)block)->byteSize : 0;
+    entry->days = block->days;
+    entry->mins = block->mins;
+    entry->ticks = block->ticks;
+    const uint8_t len = block->nameLen <= ADF_MAX_NAME_LEN ? block->nameLen : ADF_MAX_NAME_LEN;
+    memcpy(entry->name, block->name, len);
+    entry->name[len] = '\0';
+    return true;
+}
+
+// Records one block of the pass: allocated directories, and the free
+// blocks with a type, a good checksum and their own block number.
+static bool scan_block(struct adf_salvage_index* index, ADF_SECTNUM sector, uint8_t* raw) {
+    const int32_t type = (int32_t)get_be32(raw);
+    const int32_t sec_type = (int32_t)get_be32(raw + ADF_LOGICAL_BLOCK_SIZE - 4);
+    const bool header = type == ADF_T_HEADER;
+    const bool ext = type == ADF_T_LIST && sec_type == ADF_ST_FILE;
+    const bool data = type == ADF_T_DATA && index->ofs;
+    if (!header && !ext && !data) {
+        return true;
+    }
+    if (adf_normal_sum(raw, 0x14, ADF_LOGICAL_BLOCK_SIZE) != get_be32(raw + 0x14)) {
+        return true;
+    }
+    const bool own_key = get_be32(raw + 4) == (uint32_t)sector;
+    if (!adfIsBlockFree(index->vol, sector)) {
+        if (header && (sec_type == ADF_ST_ROOT || (sec_type == ADF_ST_DIR && own_key))) {
+            index->live_dirs[sector] = 1;
+        }
+        return true;
+    }
+
+    if (data) {
+        struct orphan* orphan = add_orphan(index, sector, ORPHAN_DATA);
+        if (!orphan) {
+            return false;
+        }
+        orphan->parent = (ADF_SECTNUM)get_be32(raw + offsetof(struct AdfOFSDataBlock, headerKey));
+        orphan->seq = (int32_t)get_be32(raw + offsetof(struct AdfOFSDataBlock, seqNum));
+        return true;
+    }
+    if (!own_key) {
+        return true;
+    }
+    if (ext) {
+        adf_swap_endian(raw, ADF_SWBL_FEXT);
+        const struct AdfFileExtBlock* block = (const struct AdfFileExtBlock*)raw;
+        struct orphan* orphan = add_orphan(index, sector, ORPHAN_EXT);
+        if (!orphan) {
+            return false;
+        }
+        orphan->parent = block->parent;
+        orphan->next = block->extension;
+        return add_table(index, orphan, block->dataBlocks, block->highSeq);
+    }
+
+    switch (sec_type) {
+    case ADF_ST_FILE:
+        adf_swap_endian(raw, ADF_SWBL_FILE);
+        break;
+    case ADF_ST_DIR:
+        adf_swap_endian(raw, ADF_SWBL_DIR);
+        break;
+    case ADF_ST_LFILE:
+    case ADF_ST_LDIR:
+    case ADF_ST_LSOFT:
+        adf_swap_endian(raw, ADF_SWBL_LINK);
+        break;
+    default:
+        return true;
+    }
+    const struct AdfEntryBlock* block = (const struct AdfEntryBlock*)raw;
+    struct orphan* orphan = add_orphan(index, sector, ORPHAN_HEADER);
+    if (!orphan || !add_entry(index, sector, block)) {
+        return false;
+    }
+    orphan->parent = block->parent;
+    if (sec_type == ADF_ST_FILE) {
+        const struct AdfFileHeaderBlock* fhdr = (const struct AdfFileHeaderBlock*)raw;
+        orphan->next = fhdr->extension;
+        return add_table(index, orphan, fhdr->dataBlocks, fhdr->highSeq);
+    }
+    return true;
+}
+
+// Reads a chunk in one call, or block by block when that fails; unreadable
+// blocks are left out of the index.
+static void read_chunk(const struct AdfVolume* vol, uint32_t first, uint32_t count, uint8_t* chunk) {
+    const uint32_t device_sector = (uint32_t)vol->firstBlock + first;
+    if (adfDevReadBlock(vol->dev, device_sector, count * ADF_LOGICAL_BLOCK_SIZE, chunk) == ADF_RC_OK) {
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t* block = chunk + (size_t)i * ADF_LOGICAL_BLOCK_SIZE;
+        if (adfDevReadBlock(vol->dev, device_sector + i, ADF_LOGICAL_BLOCK_SIZE, block) != ADF_RC_OK) {
+            memset(block, 0, ADF_LOGICAL_BLOCK_SIZE);
+        }
+    }
+}
+
+static bool scan_volume(struct adf_salvage_index* index) {
+    uint8_t* chunk = malloc((size_t)SALVAGE_CHUNK_BLOCKS * ADF_LOGICAL_BLOCK_SIZE);
+    if (!chunk) {
+        return false;
+    }
+    bool ok = true;
+    for (uint32_t first = 0; first < index->num_blocks && ok; first += SALVAGE_CHUNK_BLOCKS) {
+        const uint32_t count = index->num_blocks - first < SALVAGE_CHUNK_BLOCKS ? index->num_blocks - first
+                                                                                : SALVAGE_CHUNK_BLOCKS;
+        read_chunk(index->vol, first, count, chunk);
+        for (uint32_t i = 0; i < count && ok; i++) {
+            if (first + i >= 2) {
+                ok = scan_block(index, (ADF_SECTNUM)(first + i), chunk + (size_t)i * ADF_LOGICAL_BLOCK_SIZE);
+            }
+        }
+    }
+    free(chunk);
+    return ok;
+}
+
+// A data block of a deleted file, if it is still free and, on OFS, still
+// carries the file's header key and its place in the file.
+static bool data_in_place(const struct adf_salvage_index* index, ADF_SECTNUM sector, ADF_SECTNUM header, int32_t seq) {
+    if (!is_free(index, sector)) {
+        return false;
+    }
+    if (index->ofs) {
+        const struct orphan* data = find_orphan(index, sector, ORPHAN_DATA);
+        return data && data->parent == header && data->seq == seq;
+    }
+    return !find_orphan(index, sector, ORPHAN_HEADER) && !find_orphan(index, sector, ORPHAN_EXT);
+}
+
+// Follows a deleted entry's blocks through the index and returns how many
+// are in place, stopping at the first one missing. With out, collects them.
+static uint32_t entry_blocks(const struct adf_salvage_index* index, const struct adf_salvage_entry* entry,
+                             ADF_SECTNUM* out) {
+    const struct orphan* header = find_orphan(index, entry->header, ORPHAN_HEADER);
+    if (!header || !is_free(index, entry->header)) {
+        return 0;
+    }
+    uint32_t found = 0;
+    if (out) {
+        out[found] = entry->header;
+    }
+    found++;
+    if (entry->sec_type != ADF_ST_FILE) {
+        return found;
+    }
+    const uint32_t data_needed = adfFileSize2Datablocks(entry->size, index->vol->datablockSize);
+    const uint32_t ext_needed = adfFileDatablocks2Extblocks(data_needed);
+    uint32_t data_found = 0, ext_found = 0;
+    for (const struct orphan* block = header;;) {
+        const int32_t* table = index->tables[block->table];
+        for (int32_t i = 0; i < block->seq && data_found < data_needed; i++) {
+            const ADF_SECTNUM data = table[ADF_MAX_DATABLK - 1 - i];
+            if (!data_in_place(index, data, entry->header, (int32_t)data_found + 1)) {
+                return found;
+            }
+            if (out) {
+                out[found] = data;
+            }
+            found++;
+            data_found++;
+        }
+        if (block->next == 0 || ext_found == ext_needed) {
+            return found;
+        }
+        const struct orphan* ext = find_orphan(index, block->next, ORPHAN_EXT);
+        if (!ext || ext->parent != entry->header || !is_free(index, block->next)) {
+            return found;
+        }
+        if (out) {
+            out[found] = block->next;
+        }
+        found++;
+        ext_found++;
+        block = ext;
+    }
+}
+
+static const struct adf_salvage_entry* find_entry(const struct adf_salvage_index* index, ADF_SECTNUM header) {
+    uint32_t lo = 0, hi = index->num_entries;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (index->entries[mid].header < header) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < index->num_entries && index->entries[lo].header == header ? &index->entries[lo] : NULL;
+}
+
+static void evaluate(const struct adf_salvage_index* index, struct adf_salvage_entry* entry) {
+    entry->num_blocks = 1;
+    if (entry->sec_type == ADF_ST_FILE) {
+        entry->num_blocks = adfFileSize2Blocks(entry->size, index->vol->datablockSize);
+    }
+    entry->found_blocks = entry_blocks(index, entry, NULL);
+
+    const ADF_SECTNUM parent = entry->parent;
+    const struct adf_salvage_entry* deleted_parent = find_entry(index, parent);
+    if (entry->sec_type == ADF_ST_LFILE || entry->sec_type == ADF_ST_LDIR) {
+        entry->state = ADF_SALVAGE_UNSUPPORTED;
+    } else if (entry->found_blocks < entry->num_blocks) {
+        entry->state = ADF_SALVAGE_BLOCKS_REUSED;
+    } else if (in_volume(index, parent) && index->live_dirs[parent] && !adfIsBlockFree(index->vol, parent)) {
+        entry->state = ADF_SALVAGE_RECOVERABLE;
+    } else if (deleted_parent && deleted_parent->sec_type == ADF_ST_DIR && is_free(index, parent)) {
+        entry->state = ADF_SALVAGE_PARENT_DELETED;
+    } else {
+        entry->state = ADF_SALVAGE_PARENT_GONE;
+    }
+}
+
+static void evaluate_all(struct adf_salvage_index* index) {
+    for (uint32_t i = 0; i < index->num_entries; i++) {
+        evaluate(index, &index->entries[i]);
+    }
+}
+
+struct adf_salvage_index* adf_salvage_index_create(struct AdfVolume* vol) {
+    if (!vol || !adfVolIsDosFS(vol) || adfVolGetSizeInBlocks(vol) < 2) {
+        return NULL;
+    }
+    struct adf_salvage_index* index = calloc(1, sizeof(*index));
+    if (!index) {
+        return NULL;
+    }
+    index->vol = vol;
+    index->num_blocks = adfVolGetSizeInBlocks(vol);
+    index->ofs = adfVolIsOFS(vol);
+    index->live_dirs = calloc(index->num_blocks, 1);
+    if (!index->live_dirs || !scan_volume(index)) {
+        adf_salvage_index_free(index);
+        return NULL;
+    }
+    evaluate_all(index);
+    return index;
+}
+
+void adf_salvage_index_free(struct adf_salvage_index* index) {
+    if (!index) {
+        return;
+    }
+    free(index->entries);
+    free(index->tables);
+    free(index->orphans);
+    free(index->live_dirs);
+    free(index);
+}
+
+uint32_t adf_salvage_index_count(const struct adf_salvage_index* index) {
+    return index ? index->num_entries : 0;
+}
+
+const struct adf_salvage_entry* adf_salvage_index_entry(const struct adf_salvage_index* index, uint32_t i) {
+    return index && i < index->num_entries ? &index->entries[i] : NULL;
+}
+
+// Writes the header back for its new place at the end of a hash chain and
+// links it there. A directory comes back empty and without its cache chain,
+// whose blocks were freed with it.
+static ADF_RETCODE relink(struct AdfVolume* vol, const struct adf_salvage_entry* entry, struct AdfEntryBlock* block,
+                          struct AdfEntryBlock* parent_block) {
+    if (entry->sec_type != ADF_ST_FILE && entry->sec_type != ADF_ST_DIR && entry->sec_type != ADF_ST_LSOFT) {
+        return ADF_RC_ERROR;
+    }
+    ADF_RETCODE rc = adfReadEntryBlock(vol, entry->header, block);
+    if (rc == ADF_RC_OK) {
+        rc = adfReadEntryBlock(vol, entry->parent, parent_block);
+    }
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    block->nextSameHash = 0;
+    if (entry->sec_type == ADF_ST_DIR) {
+        memset(block->hashTable, 0, sizeof(block->hashTable));
+        block->extension = 0;
+    }
+    rc = adfWriteEntryBlock(vol, entry->header, block);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    if (adfCreateEntry(vol, parent_block, entry->name, entry->header) != entry->header) {
+        return ADF_RC_ERROR; // a live entry has the name now
+    }
+    return ADF_RC_OK;
+}
+
+ADF_RETCODE adf_salvage_index_restore(struct adf_salvage_index* index, ADF_SECTNUM header) {
+    if (!index) {
+        return ADF_RC_NULLPTR;
+    }
+    struct adf_salvage_entry* entry = (struct adf_salvage_entry*)find_entry(index, header);
+    if (!entry) {
+        return ADF_RC_ERROR;
+    }
+    evaluate(index, entry);
+    if (entry->state != ADF_SALVAGE_RECOVERABLE) {
+        return ADF_RC_ERROR;
+    }
+    ADF_SECTNUM* blocks = malloc(entry->num_blocks * sizeof(*blocks));
+    if (!blocks) {
+        return ADF_RC_MALLOC;
+    }
+    const uint32_t count = entry_blocks(index, entry, blocks);
+    for (uint32_t i = 0; i < count; i++) {
+        if (adfIsBlockFree(index->vol, blocks[i])) {
+            adfSetBlockUsed(index->vol, blocks[i]);
+        }
+    }
+    struct AdfEntryBlock block, parent_block;
+    ADF_RETCODE rc = relink(index->vol, entry, &block, &parent_block);
+    if (rc != ADF_RC_OK) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (!adfIsBlockFree(index->vol, blocks[i])) {
+                adfSetBlockFree(index->vol, blocks[i]);
+            }
+        }
+        free(blocks);
+        return rc;
+    }
+    free(blocks);
+    // The entry is linked in from here on; the cache follows as it can.
+    if (adfVolHasDIRCACHE(index->vol)) {
+        if (adfAddInCache(index->vol, &parent_block, &block) != ADF_RC_OK) {
+            adf_dir_cache_rebuild(index->vol, NULL, entry->parent, false);
+        }
+        if (entry->sec_type == ADF_ST_DIR) {
+            adf_dir_cache_rebuild(index->vol, NULL, header, false);
+        }
+    }
+
+    if (entry->sec_type == ADF_ST_DIR) {
+        index->live_dirs[header] = 1;
+    }
+    const uint32_t i = (uint32_t)(entry - index->entries);
+    memmove(entry, entry + 1, (index->num_entries - i - 1) * sizeof(*entry));
+    index->num_entries--;
+    evaluate_all(index);
+    return ADF_RC_OK;
+}
@@ -0,0 +1,65 @@
+//
+//  adf_salvage_index.h
+//  ADFinder
+//
+
+#ifndef ADF_SALVAGE_INDEX_H
+#define ADF_SALVAGE_INDEX_H
+
+#include <stdint.h>
+#include "adf_blk.h"
+#include "adf_err.h"
+#include "adf_types.h"
+#include "adf_vol.h"
+
+// Deleted entries of a mounted volume, found in one sequential pass over
+// its blocks. adfGetDelEnt() scans the volume again on every call and
+// adfUndelEntry() reads each candidate's block chain once more; here every
+// orphaned header, file extension and OFS data block (free in the bitmap,
+// type and checksum intact) is recorded during the pass with its parent,
+// next extension, data block list and sequence number, so listing deleted
+// entries and checking or restoring them need no further scans.
+//
+// Whether an entry can be restored is worked out from the index and the
+// volume's current bitmap. The index follows its own restores; rebuild it
+// after anything else writes to the volume.
+
+enum adf_salvage_state {
+    ADF_SALVAGE_RECOVERABLE,        // every block still free and where it belongs
+    ADF_SALVAGE_PARENT_DELETED,     // its directory is deleted too; restore that first
+    ADF_SALVAGE_PARENT_GONE,        // its directory block no longer holds a directory
+    ADF_SALVAGE_BLOCKS_REUSED,      // some of its blocks are allocated or overwritten
+    ADF_SALVAGE_UNSUPPORTED         // a hard link: its target's link chain would need mending
+};
+
+struct adf_salvage_entry {
+    ADF_SECTNUM header;
+    ADF_SECTNUM parent;
+    int32_t sec_type;               // ADF_ST_FILE, ADF_ST_DIR or a link type
+    uint32_t size;
+    int32_t days, mins, ticks;
+    uint32_t num_blocks;            // header, extension and data blocks
+    uint32_t found_blocks;          // of those, still free and in place
+    enum adf_salvage_state state;
+    char name[ADF_MAX_NAME_LEN + 1];
+};
+
+struct adf_salvage_index;
+
+struct adf_salvage_index* adf_salvage_index_create(struct AdfVolume* vol);
+void adf_salvage_index_free(struct adf_salvage_index* index);
+
+// Deleted entries in block order.
+uint32_t adf_salvage_index_count(const struct adf_salvage_index* index);
+const struct adf_salvage_entry* adf_salvage_index_entry(const struct adf_salvage_index* index, uint32_t i);
+
+// Links a recoverable entry back into its directory and marks its blocks
+// used. Files, directories and soft links only. The entry leaves the index;
+// entries that were inside a restored directory become recoverable. On
+// DIRCACHE volumes the cache is updated as well as it can be: a failure
+// there does not undo the restore, and rebuilding the directory's cache
+// brings it back in line. Only the in-memory bitmap changes; write it with
+// adfUpdateBitmap() or a bitmap commit.
+ADF_RETCODE adf_salvage_index_restore(struct adf_salvage_index* index, ADF_SECTNUM header);
+
+#endif /* ADF_SALVAGE_INDEX_H */
@@ -0,0 +1,280 @@
+//
+//  adf_sector_diff.c
+//  ADFinder
+//
+
+#include "adf_sector_diff.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define SECTOR_SIZE 512
+
+struct diff_kernels {
+    const char* name;
+    // How many of the first count sectors in a and b, in a row, are equal
+    // (or different, when equal is false).
+    uint64_t (*span)(const uint8_t* a, const uint8_t* b, uint64_t count, bool equal);
+};
+
+static struct diff_kernels kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static uint64_t span_scalar(const uint8_t* a, const uint8_t* b, uint64_t count, bool equal) {
+    uint64_t i = 0;
+    while (i < count && (memcmp(a + i * SECTOR_SIZE, b + i * SECTOR_SIZE, SECTOR_SIZE) == 0) == equal) {
+        i++;
+    }
+    return i;
+}
+
+#if defined(__x86_64__)
+
+// Both kernels OR together the XOR of the whole sector and test the result
+// once: no branch per vector, and a sector is always read in full.
+static inline bool sector_equal_sse2(const uint8_t* a, const uint8_t* b) {
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < SECTOR_SIZE; i += 16) {
+        acc = _mm_or_si128(acc, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)),
+                                              _mm_loadu_si128((const __m128i*)(b + i))));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) == 0xFFFF;
+}
+
+static uint64_t span_sse2(const uint8_t* a, const uint8_t* b, uint64_t count, bool equal) {
+    uint64_t i = 0;
+    while (i < count && sector_equal_sse2(a + i * SECTOR_SIZE, b + i * SECTOR_SIZE) == equal) {
+        i++;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static inline bool sector_equal_avx2(const uint8_t* a, const uint8_t* b) {
+    __m256i acc = _mm256_setzero_si256();
+    for (int i = 0; i < SECTOR_SIZE; i += 32) {
+        acc = _mm256_or_si256(acc, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                                    _mm256_loadu_si256((const __m256i*)(b + i))));
+    }
+    return _mm256_testz_si256(acc, acc);
+}
+
+__attribute__((target("avx2")))
+static uint64_t span_avx2(const uint8_t* a, const uint8_t* b, uint64_t count, bool equal) {
+    uint64_t i = 0;
+    while (i < count && sector_equal_avx2(a + i * SECTOR_SIZE, b + i * SECTOR_SIZE) == equal) {
+        i++;
+    }
+    return i;
+}
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+static inline bool sector_equal_neon(const uint8_t* a, const uint8_t* b) {
+    uint8x16_t acc = vdupq_n_u8(0);
+    for (int i = 0; i < SECTOR_SIZE; i += 16) {
+        acc = vorrq_u8(acc, veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+    return vmaxvq_u8(acc) == 0;
+}
+
+static uint64_t span_neon(const uint8_t* a, const uint8_t* b, uint64_t count, bool equal) {
+    uint64_t i = 0;
+    while (i < count && sector_equal_neon(a + i * SECTOR_SIZE, b + i * SECTOR_SIZE) == equal) {
+        i++;
+    }
+    return i;
+}
+
+#endif
+
+static void init_kernels(void) {
+    kernels = (struct diff_kernels){ "scalar", span_scalar };
+#if defined(__x86_64__)
+    kernels = (struct diff_kernels){ "sse2", span_sse2 };
+    if (__builtin_cpu_supports("avx2")) {
+        kernels = (struct diff_kernels){ "avx2", span_avx2 };
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    kernels = (struct diff_kernels){ "neon", span_neon };
+#endif
+}
+
+static const struct diff_kernels* get_kernels(void) {
+    pthread_once(&kernels_once, init_kernels);
+    return &kernels;
+}
+
+static bool grow(void** array, uint64_t* capacity, size_t size) {
+    const uint64_t grown = *capacity ? *capacity * 2 : 256;
+    void* p = realloc(*array, grown * size);
+    if (!p) {
+        return false;
+    }
+    *array = p;
+    *capacity = grown;
+    return true;
+}
+
+struct diff {
+    const struct adf_sector_diff_options* options;
+    struct adf_sector_diff_report* report;
+    uint64_t runs_capacity;
+    uint64_t byte_runs_capacity;
+};
+
+static bool add_run(struct diff* d, uint64_t first, uint64_t count, enum adf_sector_state state) {
+    struct adf_sector_diff_report* report = d->report;
+    if (report->num_runs == d->runs_capacity &&
+        !grow((void**)&report->runs, &d->runs_capacity, sizeof(*report->runs))) {
+        return false;
+    }
+    report->runs[report->num_runs++] = (struct adf_sector_run){ first, count, state };
+    return true;
+}
+
+static bool add_byte_run(struct diff* d, uint64_t offset, uint32_t length) {
+    struct adf_sector_diff_report* report = d->report;
+    if (d->options->max_byte_runs && report->num_byte_runs == d->options->max_byte_runs) {
+        report->byte_runs_truncated = true;
+        return true;
+    }
+    if (report->num_byte_runs == d->byte_runs_capacity &&
+        !grow((void**)&report->byte_runs, &d->byte_runs_capacity, sizeof(*report->byte_runs))) {
+        return false;
+    }
+    report->byte_runs[report->num_byte_runs++] = (struct adf_byte_run){ offset, length };
+    report->different_bytes += length;
+    return true;
+}
+
+// Differing bytes of one sector; equal 8-byte words are skipped whole. Stops
+// as soon as max_byte_runs is reached.
+static bool diff_bytes(struct diff* d, const uint8_t* a, const uint8_t* b, uint64_t offset) {
+    uint32_t start = 0;
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < SECTOR_SIZE && !d->report->byte_runs_truncated; i += 8) {
+        uint64_t wa, wb;
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+        if (wa == wb) {
+            if (length > 0 && !add_byte_run(d, offset + start, length)) {
+                return false;
+            }
+            length = 0;
+            continue;
+        }
+        for (uint32_t j = i; j < i + 8; j++) {
+            if (a[j] != b[j]) {
+                if (length == 0) {
+                    start = j;
+                }
+                length++;
+            } else if (length > 0) {
+                if (!add_byte_run(d, offset + start, length)) {
+                    return false;
+                }
+                length = 0;
+            }
+        }
+    }
+    return length == 0 || d->report->byte_runs_truncated || add_byte_run(d, offset + start, length);
+}
+
+// Asks the kernel to read ahead; a no-op for memory that is not mapped.
+static void advise_sequential(const uint8_t* p, uint64_t size) {
+    const long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0 || size == 0) {
+        return;
+    }
+    const uintptr_t start = (uintptr_t)p & ~((uintptr_t)page - 1);
+    posix_madvise((void*)start, (size_t)((uintptr_t)p + size - start), POSIX_MADV_SEQUENTIAL);
+}
+
+ADF_RETCODE adf_sector_diff(const uint8_t* source, uint64_t source_size,
+                            const uint8_t* dest, uint64_t dest_size,
+                            const struct adf_sector_diff_options* options,
+                            struct adf_sector_diff_report* report) {
+    if (!report || (!source && source_size) || (!dest && dest_size)) {
+        return ADF_RC_NULLPTR;
+    }
+    memset(report, 0, sizeof(*report));
+    const struct adf_sector_diff_options no_options = { 0 };
+    struct diff d = { options ? options : &no_options, report, 0, 0 };
+    const struct diff_kernels* k = get_kernels();
+
+    report->source_sectors = source_size / SECTOR_SIZE;
+    report->dest_sectors = dest_size / SECTOR_SIZE;
+    const uint64_t common = report->source_sectors < report->dest_sectors ? report->source_sectors : report->dest_sectors;
+    advise_sequential(source, common * SECTOR_SIZE);
+    advise_sequential(dest, common * SECTOR_SIZE);
+
+    uint64_t sector = 0;
+    while (sector < common) {
+        const uint8_t* a = source + sector * SECTOR_SIZE;
+        const uint8_t* b = dest + sector * SECTOR_SIZE;
+        const uint64_t same = k->span(a, b, common - sector, true);
+        if (same > 0) {
+            if (!add_run(&d, sector, same, ADF_SECTOR_IDENTICAL)) {
+                goto fail;
+            }
+            report->identical_sectors += same;
+            sector += same;
+            continue;
+        }
+        const uint64_t different = k->span(a, b, common - sector, false);
+        if (!add_run(&d, sector, different, ADF_SECTOR_DIFFERENT)) {
+            goto fail;
+        }
+        if (d.options->byte_runs) {
+            for (uint64_t i = 0; i < different && !report->byte_runs_truncated; i++) {
+                if (!diff_bytes(&d, a + i * SECTOR_SIZE, b + i * SECTOR_SIZE, (sector + i) * SECTOR_SIZE)) {
+                    goto fail;
+                }
+            }
+        }
+        report->different_sectors += different;
+        sector += different;
+    }
+
+    if (report->source_sectors > common) {
+        report->source_only_sectors = report->source_sectors - common;
+        if (!add_run(&d, common, report->source_only_sectors, ADF_SECTOR_SOURCE_ONLY)) {
+            goto fail;
+        }
+    } else if (report->dest_sectors > common) {
+        report->dest_only_sectors = report->dest_sectors - common;
+        if (!add_run(&d, common, report->dest_only_sectors, ADF_SECTOR_DEST_ONLY)) {
+            goto fail;
+        }
+    }
+    return ADF_RC_OK;
+
+fail:
+    adf_sector_diff_report_free(report);
+    return ADF_RC_MALLOC;
+}
+
+void adf_sector_diff_report_free(struct adf_sector_diff_report* report) {
+    if (!report) {
+        return;
+    }
+    free(report->runs);
+    free(report->byte_runs);
+    report->runs = NULL;
+    report->byte_runs = NULL;
+    report->num_runs = 0;
+    report->num_byte_runs = 0;
+}
+
+const char* adf_sector_diff_kernel(void) {
+    return get_kernels()->name;
+}
@@ -0,0 +1,72 @@
+//
+//  adf_sector_diff.h
+//  ADFinder
+//
+
+#ifndef ADF_SECTOR_DIFF_H
+#define ADF_SECTOR_DIFF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "adf_err.h"
+
+// Sector by sector comparison of two disk images, usually memory-mapped
+// files. Sectors are compared 512 bytes at a time with SIMD kernels picked
+// once at run time (AVX2 or SSE2 on x86-64, NEON on ARM, memcmp
+// elsewhere), and the result is a list of runs of sectors in the same
+// state, so comparing multi-GB hard disk images needs memory only for the
+// places where they change. A trailing partial sector is not compared.
+
+enum adf_sector_state {
+    ADF_SECTOR_IDENTICAL,
+    ADF_SECTOR_DIFFERENT,
+    ADF_SECTOR_SOURCE_ONLY,         // past the end of the destination
+    ADF_SECTOR_DEST_ONLY            // past the end of the source
+};
+
+struct adf_sector_run {
+    uint64_t first;
+    uint64_t count;
+    enum adf_sector_state state;
+};
+
+// Differing bytes, by offset in the images; a run never spans two sectors.
+struct adf_byte_run {
+    uint64_t offset;
+    uint32_t length;
+};
+
+struct adf_sector_diff_options {
+    bool byte_runs;                 // also list the differing bytes of different sectors
+    uint64_t max_byte_runs;         // byte runs listed in the report; 0 for no limit
+};
+
+struct adf_sector_diff_report {
+    uint64_t source_sectors;
+    uint64_t dest_sectors;
+    uint64_t identical_sectors;
+    uint64_t different_sectors;
+    uint64_t source_only_sectors;
+    uint64_t dest_only_sectors;
+    struct adf_sector_run* runs;    // in sector order, covering both images
+    uint64_t num_runs;
+    uint64_t different_bytes;       // with byte_runs, the bytes in the listed runs
+    struct adf_byte_run* byte_runs;
+    uint64_t num_byte_runs;
+    bool byte_runs_truncated;       // max_byte_runs was reached and the byte scan
+                                    // stopped there: different_bytes is a lower bound
+};
+
+// Free the report with adf_sector_diff_report_free(). Options may be NULL:
+// sectors only.
+ADF_RETCODE adf_sector_diff(const uint8_t* source, uint64_t source_size,
+                            const uint8_t* dest, uint64_t dest_size,
+                            const struct adf_sector_diff_options* options,
+                            struct adf_sector_diff_report* report);
+
+void adf_sector_diff_report_free(struct adf_sector_diff_report* report);
+
+// Name of the compare kernel in use ("avx2", "sse2", "neon" or "scalar").
+const char* adf_sector_diff_kernel(void);
+
+#endif /* ADF_SECTOR_DIFF_H */
@@ -12,6 +12,8 @@
 #include "adf_err.h"
 #include "adf_file.h"
 #include "adf_raw.h"
+#include "adf_extent_file.h"
+#include "adf_checksum.h"
 #include <stddef.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -82,6 +84,7 @@ ADF_RETCODE create_blank_adf_c(const char* path, const char* volName, uint8_t fs
 
 ADF_RETCODE add_file_to_adf_c(
     struct AdfVolume* vol,
+    struct adf_bitmap_index* index,
     const char* amigaPath,
     const uint8_t* buffer,
     uint32_t bufferSize
@@ -90,6 +93,13 @@ ADF_RETCODE add_file_to_adf_c(
         return ADF_RC_NULLPTR;
     }
 
+    // Files in the current directory, new or overwritten, are written whole
+    // as extents, leaving the bitmap for the caller to commit; paths go
+    // through ADFlib's block-at-a-time writer.
+    if (strchr(amigaPath, '/') == NULL && strlen(amigaPath) <= ADF_MAX_NAME_LEN) {
+        return adf_file_write_all(vol, index, vol->curDirPtr, amigaPath, buffer, bufferSize, ADF_EXTENT_FIRST_FIT);
+    }
+
     struct AdfFile* file = adfFileOpen(vol, amigaPath, ADF_FILE_MODE_WRITE);
     if (!file) {
         return ADF_RC_ERROR;
@@ -98,6 +108,9 @@ ADF_RETCODE add_file_to_adf_c(
     uint32_t bytesWritten = adfFileWrite(file, bufferSize, buffer);
     
     adfFileClose(file);
+    if (index) {
+        adf_bitmap_index_rebuild(index);    // ADFlib allocated on its own
+    }
     
     if (bytesWritten != bufferSize) {
         return ADF_RC_VOLFULL;
@@ -131,13 +144,13 @@ ADF_RETCODE parse_boot_block(const uint8_t* data, struct AdfBootBlock* boot) {
     if (!data || !boot) return ADF_RC_NULLPTR;
     
     // 1. Calculate the checksum from the original big-endian data buffer.
-    uint32_t calculated_sum = adfBootSum(data);
+    uint32_t calculated_sum = adf_boot_sum(data);
     
     // 2. Copy the raw bytes into the struct.
     memcpy(boot, data, sizeof(struct AdfBootBlock));
     
     // 3. Swap the entire struct to host byte order (little-endian).
-    adfSwapEndian((uint8_t*)boot, ADF_SWBL_BOOT);
+    adf_swap_endian((uint8_t*)boot, ADF_SWBL_BOOT);
     
     // 4. Compare the now host-ordered checksum from the struct with the
     //    checksum calculated from the original big-endian buffer.
@@ -154,13 +167,13 @@ ADF_RETCODE parse_root_block(const uint8_t* adf_data, uint32_t block_size, uint3
     const uint8_t* root_block_ptr = adf_data + (root_block_sector * block_size);
     
     // 1. Calculate checksum from the original big-endian data block.
-    uint32_t calculated_sum = adfNormalSum(root_block_ptr, offsetof(struct AdfRootBlock, checkSum), sizeof(struct AdfRootBlock));
+    uint32_t calculated_sum = adf_normal_sum(root_block_ptr, offsetof(struct AdfRootBlock, checkSum), sizeof(struct AdfRootBlock));
     
     // 2. Copy the data into the root struct.
     memcpy(root, root_block_ptr, sizeof(struct AdfRootBlock));
     
     // 3. Swap the struct to host byte order.
-    adfSwapEndian((uint8_t*)root, ADF_SWBL_ROOT);
+    adf_swap_endian((uint8_t*)root, ADF_SWBL_ROOT);
     
     // 4. Compare the now host-ordered checksum with the calculated one.
     if (root->checkSum != calculated_sum) {
@@ -13,6 +13,7 @@
 #include "adf_env.h"   // For AdfLogFct type
 #include "adf_vol.h"   // For struct AdfVolume
 #include "adf_blk.h"   // For struct AdfBootBlock, AdfRootBlock
+#include "adf_bitmap_index.h"
 
 // For register_dump_driver_helper()
 #include "adf_dev_drivers.h"
@@ -40,8 +41,10 @@ void adf_set_vol_name(struct AdfVolume* vol, const char* newName);
 // accepts a filesystem type parameter (OFS or FFS).
 ADF_RETCODE create_blank_adf_c(const char* path, const char* volName, uint8_t fsType);
 
+// index: the volume's bitmap index, or NULL.
 ADF_RETCODE add_file_to_adf_c(
     struct AdfVolume* vol,
+    struct adf_bitmap_index* index,
     const char* amigaPath,
     const uint8_t* buffer,
     uint32_t bufferSize
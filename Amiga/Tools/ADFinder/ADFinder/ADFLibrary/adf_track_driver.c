@@ -0,0 +1,341 @@
+//
+//  adf_track_driver.c
+//  ADFinder
+//
+
+#include "adf_track_driver.h"
+#include "adf_block_cache.h"
+#include "adf_dev.h"
+#include "adf_dev_drivers.h"
+#include "adf_dev_type.h"
+#include "adf_limits.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-ahead unit when the geometry does not give a usable track size
+// (hardfiles opened with the one-block-per-track fallback).
+#define TRACK_FALLBACK_BLOCKS 22
+#define TRACK_MAX_BLOCKS      64
+
+// Longest run of adjacent writes held back before it goes out (64 KB).
+#define WRITE_RUN_MAX_BLOCKS  128
+
+// Cache settings for devices opened from now on; see adf_track_driver_set_cache().
+static uint32_t cache_capacity_blocks = ADF_TRACK_CACHE_DEFAULT_BLOCKS;
+static enum adf_cache_policy cache_policy = ADF_CACHE_WRITE_BACK;
+
+struct track_device {
+    int fd;
+
+    // Every block read or written recently, whole tracks at a time on reads.
+    struct adf_block_cache* cache;
+    uint8_t* track;         // scratch buffer for one track read
+    uint32_t track_blocks;
+
+    // Write-through only: blocks [run_first, run_first + run_count) not yet
+    // written. With write-back the cache holds them instead.
+    uint8_t* run;
+    uint32_t run_first;
+    uint32_t run_count;
+};
+
+static ADF_RETCODE pread_all(int fd, uint8_t* buf, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, buf, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return ADF_RC_ERROR;
+        buf += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return ADF_RC_OK;
+}
+
+static ADF_RETCODE pwrite_all(int fd, const uint8_t* buf, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, buf, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return ADF_RC_ERROR;
+        buf += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return ADF_RC_OK;
+}
+
+static off_t block_offset(uint32_t block) {
+    return (off_t)block * ADF_DEV_BLOCK_SIZE;
+}
+
+static bool ranges_overlap(uint32_t first_a, uint32_t count_a, uint32_t first_b, uint32_t count_b) {
+    return count_a > 0 && count_b > 0 &&
+           (uint64_t)first_a < (uint64_t)first_b + count_b &&
+           (uint64_t)first_b < (uint64_t)first_a + count_a;
+}
+
+static ADF_RETCODE flush_run(struct track_device* trk) {
+    if (trk->run_count == 0) {
+        return ADF_RC_OK;
+    }
+    ADF_RETCODE rc = pwrite_all(trk->fd, trk->run, (size_t)trk->run_count * ADF_DEV_BLOCK_SIZE,
+                                block_offset(trk->run_first));
+    if (rc == ADF_RC_OK) {
+        trk->run_count = 0; // a failed run is kept, so the next flush retries it
+    }
+    return rc;
+}
+
+static ADF_RETCODE write_back_blocks(void* ctx, uint32_t block, uint32_t len_blocks, const uint8_t* buf) {
+    const struct track_device* trk = ctx;
+    return pwrite_all(trk->fd, buf, (size_t)len_blocks * ADF_DEV_BLOCK_SIZE, block_offset(block));
+}
+
+static ADF_RETCODE flush_all(struct track_device* trk) {
+    ADF_RETCODE rc = flush_run(trk);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    return adf_block_cache_flush(trk->cache);
+}
+
+static struct AdfDevice* track_device_new(const char* const name, int fd, uint32_t size_blocks,
+                                          struct AdfDevGeometry geometry, bool read_only) {
+    struct AdfDevice* dev = calloc(1, sizeof(*dev));
+    struct track_device* trk = calloc(1, sizeof(*trk));
+    if (!dev || !trk) {
+        free(dev);
+        free(trk);
+        return NULL;
+    }
+
+    trk->fd = fd;
+    trk->track_blocks = (geometry.sectors >= 11 && geometry.sectors <= TRACK_MAX_BLOCKS)
+                            ? geometry.sectors : TRACK_FALLBACK_BLOCKS;
+    trk->track = malloc((size_t)trk->track_blocks * ADF_DEV_BLOCK_SIZE);
+    trk->run = malloc((size_t)WRITE_RUN_MAX_BLOCKS * ADF_DEV_BLOCK_SIZE);
+    const uint32_t capacity = cache_capacity_blocks > trk->track_blocks ? cache_capacity_blocks : trk->track_blocks;
+    trk->cache = adf_block_cache_create(capacity, read_only ? ADF_CACHE_WRITE_THROUGH : cache_policy,
+                                        write_back_blocks, trk);
+    dev->name = strdup(name);
+    if (!trk->track || !trk->run || !trk->cache || !dev->name) {
+        adf_block_cache_destroy(trk->cache);
+        free(trk->track);
+        free(trk->run);
+        free(trk);
+        free(dev->name);
+        free(dev);
+        return NULL;
+    }
+
+    dev->sizeBlocks = size_blocks;
+    dev->geometry = geometry;
+    dev->geometry.blockSize = ADF_DEV_BLOCK_SIZE;
+    dev->type = adfDevGetTypeByGeometry(&dev->geometry);
+    dev->class = adfDevGetClassBySizeBlocks(size_blocks);
+    dev->readOnly = read_only;
+    dev->mounted = false;
+    dev->drv = &adfTrackDeviceDriver;
+    dev->drvData = trk;
+    return dev;
+}
+
+static struct AdfDevice* track_device_create(const char* const name, const uint32_t cylinders,
+                                             const uint32_t heads, const uint32_t sectors) {
+    int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return NULL;
+    }
+    const uint32_t size_blocks = cylinders * heads * sectors;
+    if (ftruncate(fd, block_offset(size_blocks)) == -1) { // zero-filled, like the dump driver
+        close(fd);
+        return NULL;
+    }
+    struct AdfDevGeometry geometry = { .cylinders = cylinders, .heads = heads, .sectors = sectors };
+    struct AdfDevice* dev = track_device_new(name, fd, size_blocks, geometry, false);
+    if (!dev) {
+        close(fd);
+    }
+    return dev;
+}
+
+static struct AdfDevice* track_device_open(const char* const name, const AdfAccessMode mode) {
+    const bool read_only = (mode != ADF_ACCESS_MODE_READWRITE);
+    int fd = open(name, read_only ? O_RDONLY : O_RDWR);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat image_stat;
+    if (fstat(fd, &image_stat) == -1 || image_stat.st_size <= 0 || image_stat.st_size % ADF_DEV_BLOCK_SIZE != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    const uint32_t size_blocks = (uint32_t)(image_stat.st_size / ADF_DEV_BLOCK_SIZE);
+    struct AdfDevGeometry geometry = adfDevTypeGetGeometry(adfDevGetTypeBySizeBlocks(size_blocks));
+    if (!adfDevIsGeometryValid(&geometry, size_blocks)) {
+        geometry.cylinders = size_blocks; // unknown type: one track per block, like ADFlib does
+        geometry.heads = 1;
+        geometry.sectors = 1;
+    }
+    struct AdfDevice* dev = track_device_new(name, fd, size_blocks, geometry, read_only);
+    if (!dev) {
+        close(fd);
+    }
+    return dev;
+}
+
+static ADF_RETCODE track_device_close(struct AdfDevice* const dev) {
+    struct track_device* trk = dev->drvData;
+    ADF_RETCODE rc = ADF_RC_OK;
+    if (trk) {
+        rc = flush_all(trk);
+        close(trk->fd);
+        adf_block_cache_destroy(trk->cache);
+        free(trk->track);
+        free(trk->run);
+        free(trk);
+    }
+    free(dev->name);
+    free(dev);
+    return rc;
+}
+
+static ADF_RETCODE track_device_read_sectors(const struct AdfDevice* const dev, const uint32_t block,
+                                             const uint32_t len_blocks, uint8_t* const buf) {
+    struct track_device* trk = dev->drvData;
+    if ((uint64_t)block + len_blocks > dev->sizeBlocks) {
+        return ADF_RC_BLOCKOUTOFRANGE;
+    }
+
+    if (len_blocks == 1 && adf_block_cache_read(trk->cache, block, buf)) {
+        return ADF_RC_OK;
+    }
+
+    // Not cached: larger reads go straight to the file, smaller ones pull in
+    // their whole track. Held-back writes in the way go out first.
+    uint32_t first = block;
+    uint32_t count = len_blocks;
+    uint8_t* target = buf;
+    if (block % trk->track_blocks + len_blocks <= trk->track_blocks) {
+        first = block - block % trk->track_blocks;
+        count = trk->track_blocks;
+        if ((uint64_t)first + count > dev->sizeBlocks) {
+            count = dev->sizeBlocks - first;
+        }
+        target = trk->track;
+    }
+    if (ranges_overlap(trk->run_first, trk->run_count, first, count)) {
+        ADF_RETCODE rc = flush_run(trk);
+        if (rc != ADF_RC_OK) {
+            return rc;
+        }
+    }
+    ADF_RETCODE rc = pread_all(trk->fd, target, (size_t)count * ADF_DEV_BLOCK_SIZE, block_offset(first));
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+
+    // Cached blocks may be dirty and are never older than the file: they win.
+    // Blocks of a track read are then kept for later. Filling can evict and
+    // write back dirty blocks, so it only starts once the track is current.
+    for (uint32_t i = 0; i < count; i++) {
+        adf_block_cache_peek(trk->cache, first + i, target + (size_t)i * ADF_DEV_BLOCK_SIZE);
+    }
+    for (uint32_t i = 0; target == trk->track && i < count; i++) {
+        rc = adf_block_cache_fill(trk->cache, first + i, target + (size_t)i * ADF_DEV_BLOCK_SIZE);
+        if (rc != ADF_RC_OK) {
+            return rc;
+        }
+    }
+    if (target != buf) {
+        memcpy(buf, target + (size_t)(block - first) * ADF_DEV_BLOCK_SIZE, (size_t)len_blocks * ADF_DEV_BLOCK_SIZE);
+    }
+    return ADF_RC_OK;
+}
+
+static ADF_RETCODE track_device_write_sectors(const struct AdfDevice* const dev, const uint32_t block,
+                                              const uint32_t len_blocks, const uint8_t* const buf) {
+    struct track_device* trk = dev->drvData;
+    if ((uint64_t)block + len_blocks > dev->sizeBlocks) {
+        return ADF_RC_BLOCKOUTOFRANGE;
+    }
+    for (uint32_t i = 0; i < len_blocks; i++) {
+        ADF_RETCODE rc = adf_block_cache_write(trk->cache, block + i, buf + (size_t)i * ADF_DEV_BLOCK_SIZE);
+        if (rc != ADF_RC_OK) {
+            return rc;
+        }
+    }
+    if (adf_block_cache_policy(trk->cache) == ADF_CACHE_WRITE_BACK) {
+        return ADF_RC_OK;
+    }
+
+    const size_t size = (size_t)len_blocks * ADF_DEV_BLOCK_SIZE;
+    if (trk->run_count > 0 && block >= trk->run_first &&
+        (uint64_t)block + len_blocks <= (uint64_t)trk->run_first + trk->run_count) {
+        // rewrite of a block still held back (bitmap, directory, file header)
+        memcpy(trk->run + (size_t)(block - trk->run_first) * ADF_DEV_BLOCK_SIZE, buf, size);
+        return ADF_RC_OK;
+    }
+    if (trk->run_count > 0 && block == trk->run_first + trk->run_count &&
+        trk->run_count + len_blocks <= WRITE_RUN_MAX_BLOCKS) {
+        memcpy(trk->run + (size_t)trk->run_count * ADF_DEV_BLOCK_SIZE, buf, size);
+        trk->run_count += len_blocks;
+        return ADF_RC_OK;
+    }
+
+    ADF_RETCODE rc = flush_run(trk);
+    if (rc != ADF_RC_OK) {
+        return rc;
+    }
+    if (len_blocks >= WRITE_RUN_MAX_BLOCKS) {
+        return pwrite_all(trk->fd, buf, size, block_offset(block));
+    }
+    memcpy(trk->run, buf, size);
+    trk->run_first = block;
+    trk->run_count = len_blocks;
+    return ADF_RC_OK;
+}
+
+static bool track_device_is_native(void) {
+    return false;
+}
+
+static bool track_device_is_device(const char* const name) {
+    (void)name;
+    return false; // only ever selected by name, through adfDevOpenWithDriver
+}
+
+const struct AdfDeviceDriver adfTrackDeviceDriver = {
+    .name         = ADF_TRACK_DRIVER_NAME,
+    .data         = NULL,
+    .createDev    = track_device_create,
+    .openDev      = track_device_open,
+    .closeDev     = track_device_close,
+    .readSectors  = track_device_read_sectors,
+    .writeSectors = track_device_write_sectors,
+    .isNative     = track_device_is_native,
+    .isDevice     = track_device_is_device
+};
+
+ADF_RETCODE register_track_driver_helper(void) {
+    return adfAddDeviceDriver(&adfTrackDeviceDriver);
+}
+
+ADF_RETCODE adf_track_device_flush(const struct AdfDevice* dev) {
+    if (!dev || dev->drv != &adfTrackDeviceDriver) {
+        return ADF_RC_OK; // other drivers write through
+    }
+    return flush_all(dev->drvData);
+}
+
+void adf_track_driver_set_cache(uint32_t capacity_blocks, enum adf_cache_policy policy) {
+    cache_capacity_blocks = capacity_blocks;
+    cache_policy = policy;
+}
+
@@ -0,0 +1,39 @@
+//
+//  adf_track_driver.h
+//  ADFinder
+//
+
+#ifndef ADF_TRACK_DRIVER_H
+#define ADF_TRACK_DRIVER_H
+
+#include "adf_dev_driver.h"
+#include "adf_err.h"
+#include "adf_block_cache.h"
+
+// A dump-file driver that sits between the volume layer and the image file.
+// ADFlib asks for one 512-byte block at a time; this driver reads a whole
+// track (11 sectors on DD, 22 on HD) per miss into an LRU block cache, so
+// the root, directory and bitmap blocks of repeated path lookups are served
+// from memory. Writes are collected and go out as runs of adjacent blocks.
+//
+// ADFinder opens images with the mmap driver, where every block already is
+// memory; this driver, and with it the block cache, is only the fallback for
+// images that cannot be mapped.
+#define ADF_TRACK_DRIVER_NAME "adfinder-track"
+
+// 2048 blocks (1 MB): a whole DD floppy fits.
+#define ADF_TRACK_CACHE_DEFAULT_BLOCKS 2048
+
+extern const struct AdfDeviceDriver adfTrackDeviceDriver;
+
+ADF_RETCODE register_track_driver_helper(void);
+
+// Writes out any blocks still held back, dirty cached blocks included. Call
+// it once an operation is complete, before anything else reads the image file.
+ADF_RETCODE adf_track_device_flush(const struct AdfDevice* dev);
+
+// Cache size and write policy for devices opened afterwards. The default is
+// ADF_TRACK_CACHE_DEFAULT_BLOCKS, write-back. Read-only devices always write through.
+void adf_track_driver_set_cache(uint32_t capacity_blocks, enum adf_cache_policy policy);
+
+#endif /* ADF_TRACK_DRIVER_H */
@@ -0,0 +1,593 @@
+//
+//  adf_verify.c
+//  ADFinder
+//
+
+#include "adf_verify.h"
+#include "adf_bitm.h"
+#include "adf_blk.h"
+#include "adf_byteorder.h"
+#include "adf_checksum.h"
+#include "adf_dev.h"
+#include "adf_file_util.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Blocks per device read (1 MB), checked together by the pool.
+#define VERIFY_CHUNK_BLOCKS 2048
+
+#define VERIFY_DEFAULT_MAX_PROBLEMS 256
+
+enum block_kind {
+    KIND_OTHER,                 // FFS data, free space, anything without a type
+    KIND_BOOT,
+    KIND_ROOT,
+    KIND_DIR,
+    KIND_FILE,
+    KIND_LINK,
+    KIND_EXT,
+    KIND_DATA,                  // OFS data
+    KIND_DIRCACHE,
+    KIND_BITMAP
+};
+
+#define KINDS_ANY     0xFFFFu
+#define KINDS_ENTRY   ((1u << KIND_DIR) | (1u << KIND_FILE) | (1u << KIND_LINK))
+
+#define FLAG_READ_ERROR 0x01
+#define FLAG_BAD_SUM    0x02
+#define FLAG_BAD_KEY    0x04
+
+struct block_info {
+    uint8_t kind;
+    uint8_t flags;
+    uint8_t refs;               // times reached from the root, up to 255
+    uint32_t value;             // slot in the metadata copies, or an OFS data block's file
+};
+
+struct verify;
+
+struct checker {
+    struct verify* v;
+    uint32_t part;
+};
+
+struct verify {
+    struct AdfVolume* vol;
+    uint32_t num_blocks;
+    bool ofs;
+    bool intl;
+    struct block_info* blocks;
+    uint8_t* meta;              // host-order copies of the typed blocks
+    uint32_t num_meta;
+    uint32_t meta_capacity;
+    struct adf_verify_report* report;
+    uint32_t max_problems;
+
+    // The chunk being checked.
+    uint8_t* chunk;
+    uint32_t chunk_first;
+    uint32_t chunk_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint32_t generation;
+    uint32_t busy;
+    bool quit;
+    pthread_t* threads;
+    struct checker* checkers;
+    uint32_t num_threads;
+};
+
+static void add_problem(struct verify* v, enum adf_verify_problem_kind kind, ADF_SECTNUM sector,
+                        ADF_SECTNUM referrer) {
+    struct adf_verify_report* report = v->report;
+    report->problem_counts[kind]++;
+    report->total_problems++;
+    if (report->num_problems < v->max_problems) {
+        report->problems[report->num_problems++] = (struct adf_verify_problem){ kind, sector, referrer };
+    }
+}
+
+// Same as ADFlib's name hash for directory hash tables.
+static uint32_t name_hash(const uint8_t* name, uint32_t len, bool intl) {
+    uint32_t hash = len;
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t c = name[i];
+        if ((c >= 'a' && c <= 'z') || (intl && c >= 224 && c <= 254 && c != 247)) {
+            c -= 'a' - 'A';
+        }
+        hash = (hash * 13 + c) & 0x7ff;
+    }
+    return hash % ADF_HT_SIZE;
+}
+
+// Classifies one block by its type and secType, checks its checksum and
+// header key, and turns a typed block into host order for the walk.
+static void check_block(const struct verify* v, uint32_t sector, uint8_t* raw, struct block_info* info) {
+    if (info->flags & FLAG_READ_ERROR || info->kind == KIND_BOOT) {
+        return;
+    }
+    if (info->kind == KIND_BITMAP) {
+        if (adf_normal_sum(raw, 0, ADF_LOGICAL_BLOCK_SIZE) != get_be32(raw)) {
+            info->flags |= FLAG_BAD_SUM;
+        }
+        return;
+    }
+    const int32_t type = (int32_t)get_be32(raw);
+    const int32_t sec_type = (int32_t)get_be32(raw + ADF_LOGICAL_BLOCK_SIZE - 4);
+    int swap = -1;
+    if (type == ADF_T_HEADER) {
+        switch (sec_type) {
+        case ADF_ST_ROOT: info->kind = KIND_ROOT; swap = ADF_SWBL_ROOT; break;
+        case ADF_ST_DIR: info->kind = KIND_DIR; swap = ADF_SWBL_DIR; break;
+        case ADF_ST_FILE: info->kind = KIND_FILE; swap = ADF_SWBL_FILE; break;
+        case ADF_ST_LFILE:
+        case ADF_ST_LDIR:
+        case ADF_ST_LSOFT: info->kind = KIND_LINK; swap = ADF_SWBL_LINK; break;
+        default: return;
+        }
+    } else if (type == ADF_T_LIST && sec_type == ADF_ST_FILE) {
+        info->kind = KIND_EXT;
+        swap = ADF_SWBL_FEXT;
+    } else if (type == ADF_T_DIRC) {
+        info->kind = KIND_DIRCACHE;
+        swap = ADF_SWBL_CACHE;
+    } else if (type == ADF_T_DATA && v->ofs) {
+        info->kind = KIND_DATA;
+    } else {
+        return;
+    }
+    if (adf_normal_sum(raw, 0x14, ADF_LOGICAL_BLOCK_SIZE) != get_be32(raw + 0x14)) {
+        info->flags |= FLAG_BAD_SUM;
+    }
+    const uint32_t key = get_be32(raw + 4);
+    if (info->kind == KIND_DATA) {
+        info->value = key;
+    } else if (info->kind != KIND_ROOT && key != sector) {
+        info->flags |= FLAG_BAD_KEY;
+    }
+    if (swap >= 0) {
+        adf_swap_endian(raw, swap);
+    }
+}
+
+static void check_part(struct verify* v, uint32_t part) {
+    const uint32_t parts = v->num_threads + 1;
+    const uint32_t from = (uint32_t)((uint64_t)v->chunk_count * part / parts);
+    const uint32_t to = (uint32_t)((uint64_t)v->chunk_count * (part + 1) / parts);
+    for (uint32_t i = from; i < to; i++) {
+        const uint32_t sector = v->chunk_first + i;
+        check_block(v, sector, v->chunk + (size_t)i * ADF_LOGICAL_BLOCK_SIZE, &v->blocks[sector]);
+    }
+}
+
+static void* checker_main(void* arg) {
+    const struct checker* checker = arg;
+    struct verify* v = checker->v;
+    uint32_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&v->lock);
+        while (v->generation == seen && !v->quit) {
+            pthread_cond_wait(&v->start, &v->lock);
+        }
+        if (v->quit) {
+            pthread_mutex_unlock(&v->lock);
+            break;
+        }
+        seen = v->generation;
+        pthread_mutex_unlock(&v->lock);
+
+        check_part(v, checker->part);
+
+        pthread_mutex_lock(&v->lock);
+        if (--v->busy == 0) {
+            pthread_cond_signal(&v->done);
+        }
+        pthread_mutex_unlock(&v->lock);
+    }
+    return NULL;
+}
+
+static void check_chunk(struct verify* v) {
+    if (v->num_threads == 0) {
+        check_part(v, 0);
+        return;
+    }
+    pthread_mutex_lock(&v->lock);
+    v->busy = v->num_threads;
+    v->generation++;
+    pthread_cond_broadcast(&v->start);
+    pthread_mutex_unlock(&v->lock);
+
+    check_part(v, 0);
+
+    pthread_mutex_lock(&v->lock);
+    while (v->busy > 0) {
+        pthread_cond_wait(&v->done, &v->lock);
+    }
+    pthread_mutex_unlock(&v->lock);
+}
+
+static void start_checkers(struct verify* v, uint32_t wanted) {
+    v->threads = malloc(wanted * sizeof(*v->threads));
+    v->checkers = malloc(wanted * sizeof(*v->checkers));
+    if (!v->threads || !v->checkers) {
+        return; // checked on the calling thread alone
+    }
+    for (uint32_t i = 0; i < wanted; i++) {
+        v->checkers[i] = (struct checker){ v, i + 1 };
+        if (pthread_create(&v->threads[i], NULL, checker_main, &v->checkers[i]) != 0) {
+            break;
+        }
+        v->num_threads++;
+    }
+}
+
+static void stop_checkers(struct verify* v) {
+    pthread_mutex_lock(&v->lock);
+    v->quit = true;
+    pthread_cond_broadcast(&v->start);
+    pthread_mutex_unlock(&v->lock);
+    for (uint32_t i = 0; i < v->num_threads; i++) {
+        pthread_join(v->threads[i], NULL);
+    }
+    free(v->threads);
+    free(v->checkers);
+}
+
+// Reads a chunk in one call, or block by block when that fails so that
+// only the unreadable blocks are lost.
+static void read_chunk(struct verify* v) {
+    const struct AdfVolume* vol = v->vol;
+    const uint32_t device_sector = (uint32_t)vol->firstBlock + v->chunk_first;
+    if (adfDevReadBlock(vol->dev, device_sector, v->chunk_count * ADF_LOGICAL_BLOCK_SIZE, v->chunk) == ADF_RC_OK) {
+        return;
+    }
+    for (uint32_t i = 0; i < v->chunk_count; i++) {
+        uint8_t* block = v->chunk + (size_t)i * ADF_LOGICAL_BLOCK_SIZE;
+        if (adfDevReadBlock(vol->dev, device_sector + i, ADF_LOGICAL_BLOCK_SIZE, block) != ADF_RC_OK) {
+            memset(block, 0, ADF_LOGICAL_BLOCK_SIZE);
+            v->blocks[v->chunk_first + i].flags |= FLAG_READ_ERROR;
+            add_problem(v, ADF_VERIFY_READ_ERROR, (ADF_SECTNUM)(v->chunk_first + i), 0);
+        }
+    }
+}
+
+// Keeps a copy of every typed block of the chunk for the walk.
+static bool keep_chunk(struct verify* v) {
+    for (uint32_t i = 0; i < v->chunk_count; i++) {
+        struct block_info* info = &v->blocks[v->chunk_first + i];
+        if (info->kind < KIND_ROOT || info->kind == KIND_DATA || info->kind == KIND_BITMAP) {
+            continue;
+        }
+        if (v->num_meta == v->meta_capacity) {
+            const uint32_t capacity = v->meta_capacity ? v->meta_capacity * 2 : 256;
+            uint8_t* meta = realloc(v->meta, (size_t)capacity * ADF_LOGICAL_BLOCK_SIZE);
+            if (!meta) {
+                return false;
+            }
+            v->meta = meta;
+            v->meta_capacity = capacity;
+        }
+        memcpy(v->meta + (size_t)v->num_meta * ADF_LOGICAL_BLOCK_SIZE,
+               v->chunk + (size_t)i * ADF_LOGICAL_BLOCK_SIZE, ADF_LOGICAL_BLOCK_SIZE);
+        info->value = v->num_meta++;
+    }
+    return true;
+}
+
+static ADF_RETCODE scan_volume(struct verify* v) {
+    v->chunk = malloc((size_t)VERIFY_CHUNK_BLOCKS * ADF_LOGICAL_BLOCK_SIZE);
+    if (!v->chunk) {
+        return ADF_RC_MALLOC;
+    }
+    ADF_RETCODE rc = ADF_RC_OK;
+    for (uint32_t first = 0; first < v->num_blocks && rc == ADF_RC_OK; first += VERIFY_CHUNK_BLOCKS) {
+        v->chunk_first = first;
+        v->chunk_count = v->num_blocks - first < VERIFY_CHUNK_BLOCKS ? v->num_blocks - first : VERIFY_CHUNK_BLOCKS;
+        read_chunk(v);
+        if (first == 0 && v->vol->bootCode && !(v->blocks[0].flags & FLAG_READ_ERROR) &&
+            !(v->blocks[1].flags & FLAG_READ_ERROR) && adf_boot_sum(v->chunk) != get_be32(v->chunk + 4)) {
+            add_problem(v, ADF_VERIFY_BAD_CHECKSUM, 0, 0);
+        }
+        check_chunk(v);
+        rc = keep_chunk(v) ? ADF_RC_OK : ADF_RC_MALLOC;
+    }
+    free(v->chunk);
+    v->chunk = NULL;
+    return rc;
+}
+
+// Counts a block as in use, reached from referrer, and says whether it can
+// be followed: in range, read, not reached before, of one of the expected
+// kinds and, for typed blocks, with a good checksum.
+static bool mark(struct verify* v, ADF_SECTNUM sector, ADF_SECTNUM referrer, uint32_t kinds) {
+    if (sector < 2 || (uint32_t)sector >= v->num_blocks) {
+        add_problem(v, ADF_VERIFY_BAD_POINTER, sector, referrer);
+        return false;
+    }
+    struct block_info* info = &v->blocks[sector];
+    if (info->refs < UINT8_MAX) {
+        info->refs++;
+    }
+    if (info->refs > 1) {
+        add_problem(v, ADF_VERIFY_CROSS_LINKED, sector, referrer);
+        return false;
+    }
+    if (info->flags & FLAG_READ_ERROR) {
+        return false;
+    }
+    if (kinds == KINDS_ANY) {
+        return true;
+    }
+    if (!(kinds & (1u << info->kind))) {
+        add_problem(v, ADF_VERIFY_BAD_TYPE, sector, referrer);
+        return false;
+    }
+    if (info->flags & FLAG_BAD_SUM) {
+        add_problem(v, ADF_VERIFY_BAD_CHECKSUM, sector, referrer);
+        return false;
+    }
+    if (info->flags & FLAG_BAD_KEY) {
+        add_problem(v, ADF_VERIFY_BAD_HEADER_KEY, sector, referrer);
+    }
+    return true;
+}
+
+static const void* meta_block(const struct verify* v, ADF_SECTNUM sector) {
+    return v->meta + (size_t)v->blocks[sector].value * ADF_LOGICAL_BLOCK_SIZE;
+}
+
+static void follow_file(struct verify* v, ADF_SECTNUM header) {
+    const struct AdfFileHeaderBlock* fhdr = meta_block(v, header);
+    const uint32_t needed = adfFileSize2Datablocks(fhdr->byteSize, v->vol->datablockSize);
+    const int32_t* data_blocks = fhdr->dataBlocks;
+    int32_t high_seq = fhdr->highSeq;
+    ADF_SECTNUM next_ext = fhdr->extension;
+    ADF_SECTNUM from = header;
+    uint32_t found = 0;
+    for (;;) {
+        if (high_seq < 0 || high_seq > ADF_MAX_DATABLK) {
+            add_problem(v, ADF_VERIFY_BAD_BLOCK_LIST, from, header);
+            return;
+        }
+        for (int32_t i = 0; i < high_seq; i++, found++) {
+            const ADF_SECTNUM data = data_blocks[ADF_MAX_DATABLK - 1 - i];
+            if (!v->ofs) {
+                mark(v, data, from, KINDS_ANY);
+            } else if (mark(v, data, from, 1u << KIND_DATA) && v->blocks[data].value != (uint32_t)header) {
+                add_problem(v, ADF_VERIFY_BAD_HEADER_KEY, data, from);
+            }
+        }
+        if (next_ext == 0) {
+            break;
+        }
+        if (!mark(v, next_ext, from, 1u << KIND_EXT)) {
+            return;
+        }
+        const struct AdfFileExtBlock* fext = meta_block(v, next_ext);
+        if (fext->parent != header) {
+            add_problem(v, ADF_VERIFY_BAD_PARENT, next_ext, from);
+        }
+        from = next_ext;
+        data_blocks = fext->dataBlocks;
+        high_seq = fext->highSeq;
+        next_ext = fext->extension;
+    }
+    if (found != needed) {
+        add_problem(v, ADF_VERIFY_BAD_BLOCK_LIST, header, 0);
+    }
+}
+
+// Follows the hash chains and the cache blocks of one directory; the
+// subdirectories found are pushed for the caller.
+static bool follow_dir(struct verify* v, ADF_SECTNUM dir, ADF_SECTNUM** stack, uint32_t* depth,
+                       uint32_t* capacity) {
+    const struct AdfEntryBlock* block = meta_block(v, dir);
+    int32_t hash_table[ADF_HT_SIZE];
+    memcpy(hash_table, block->hashTable, sizeof(hash_table));
+
+    if (adfVolHasDIRCACHE(v->vol)) {
+        ADF_SECTNUM from = dir;
+        for (ADF_SECTNUM dirc = block->extension; dirc != 0;) {
+            if (!mark(v, dirc, from, 1u << KIND_DIRCACHE)) {
+                break;
+            }
+            const struct AdfDirCacheBlock* cache = meta_block(v, dirc);
+            if (cache->parent != dir) {
+                add_problem(v, ADF_VERIFY_BAD_PARENT, dirc, from);
+            }
+            from = dirc;
+            dirc = cache->nextDirC;
+        }
+    }
+
+    for (uint32_t slot = 0; slot < ADF_HT_SIZE; slot++) {
+        ADF_SECTNUM from = dir;
+        for (ADF_SECTNUM sector = hash_table[slot]; sector != 0;) {
+            if (!mark(v, sector, from, KINDS_ENTRY)) {
+                break;
+            }
+            const struct AdfEntryBlock* entry = meta_block(v, sector);
+            if (entry->parent != dir) {
+                add_problem(v, ADF_VERIFY_BAD_PARENT, sector, from);
+            }
+            const uint32_t name_len = entry->nameLen <= ADF_MAX_NAME_LEN ? entry->nameLen : ADF_MAX_NAME_LEN;
+            if (name_hash((const uint8_t*)entry->name, name_len, v->intl) != slot) {
+                add_problem(v, ADF_VERIFY_BAD_HASH_CHAIN, sector, from);
+            }
+            switch (v->blocks[sector].kind) {
+            case KIND_DIR:
+                v->report->directories++;
+                if (*depth == *capacity) {
+                    ADF_SECTNUM* grown = realloc(*stack, *capacity * 2 * sizeof(*grown));
+                    if (!grown) {
+                        return false;
+                    }
+                    *stack = grown;
+                    *capacity *= 2;
+                }
+                (*stack)[(*depth)++] = sector;
+                break;
+            case KIND_FILE:
+                v->report->files++;
+                follow_file(v, sector);
+                break;
+            default:
+                v->report->links++;
+                break;
+            }
+            from = sector;
+            sector = entry->nextSameHash;
+        }
+    }
+    return true;
+}
+
+static void follow_bitmap(struct verify* v, ADF_SECTNUM root) {
+    const struct AdfVolume* vol = v->vol;
+    for (uint32_t i = 0; i < vol->bitmap.size; i++) {
+        mark(v, vol->bitmap.blocks[i], root, 1u << KIND_BITMAP);
+    }
+    // The extension blocks have no type to be told by, so they are read
+    // here along their chain.
+    const struct AdfRootBlock* root_block = meta_block(v, root);
+    ADF_SECTNUM from = root;
+    uint8_t buf[ADF_LOGICAL_BLOCK_SIZE];
+    for (ADF_SECTNUM ext = root_block->bmExt; ext != 0;) {
+        if (!mark(v, ext, from, KINDS_ANY) ||
+            adfDevReadBlock(vol->dev, (uint32_t)(vol->firstBlock + ext), ADF_LOGICAL_BLOCK_SIZE, buf) != ADF_RC_OK) {
+            break;
+        }
+        from = ext;
+        ext = (ADF_SECTNUM)get_be32(buf + offsetof(struct AdfBitmapExtBlock, nextBlock));
+    }
+}
+
+static ADF_RETCODE follow_root(struct verify* v) {
+    const ADF_SECTNUM root = v->vol->rootBlock;
+    if (!mark(v, root, 0, 1u << KIND_ROOT)) {
+        return ADF_RC_OK; // nothing more can be reached
+    }
+    follow_bitmap(v, root);
+
+    uint32_t capacity = 64, depth = 0;
+    ADF_SECTNUM* stack = malloc(capacity * sizeof(*stack));
+    if (!stack) {
+        return ADF_RC_MALLOC;
+    }
+    stack[depth++] = root;
+    ADF_RETCODE rc = ADF_RC_OK;
+    while (depth > 0 && rc == ADF_RC_OK) {
+        const ADF_SECTNUM dir = stack[--depth];
+        rc = follow_dir(v, dir, &stack, &depth, &capacity) ? ADF_RC_OK : ADF_RC_MALLOC;
+    }
+    free(stack);
+    return rc;
+}
+
+static void check_bitmap(struct verify* v) {
+    struct adf_verify_report* report = v->report;
+    report->used_blocks = 2; // the boot block
+    for (uint32_t sector = 2; sector < v->num_blocks; sector++) {
+        const bool reached = v->blocks[sector].refs > 0;
+        const bool free_in_bitmap = adfIsBlockFree(v->vol, (ADF_SECTNUM)sector);
+        report->used_blocks += reached;
+        report->free_blocks += free_in_bitmap;
+        if (reached && free_in_bitmap) {
+            add_problem(v, ADF_VERIFY_USED_MARKED_FREE, (ADF_SECTNUM)sector, 0);
+        } else if (!reached && !free_in_bitmap) {
+            add_problem(v, ADF_VERIFY_FREE_MARKED_USED, (ADF_SECTNUM)sector, 0);
+        }
+    }
+}
+
+ADF_RETCODE adf_verify_volume(struct AdfVolume* vol, const struct adf_verify_options* options,
+                              struct adf_verify_report* report) {
+    if (!vol || !report) {
+        return ADF_RC_NULLPTR;
+    }
+    memset(report, 0, sizeof(*report));
+    if (!adfVolIsDosFS(vol) || adfVolGetSizeInBlocks(vol) < 2) {
+        return ADF_RC_ERROR;
+    }
+    struct verify v;
+    memset(&v, 0, sizeof(v));
+    v.vol = vol;
+    v.num_blocks = adfVolGetSizeInBlocks(vol);
+    v.ofs = adfVolIsOFS(vol);
+    v.intl = adfVolHasINTL(vol) || adfVolHasDIRCACHE(vol);
+    v.report = report;
+    v.max_problems = options && options->max_problems ? options->max_problems : VERIFY_DEFAULT_MAX_PROBLEMS;
+    report->blocks = v.num_blocks;
+    report->problems = malloc(v.max_problems * sizeof(*report->problems));
+    v.blocks = calloc(v.num_blocks, sizeof(*v.blocks));
+    if (!report->problems || !v.blocks) {
+        free(v.blocks);
+        adf_verify_report_free(report);
+        return ADF_RC_MALLOC;
+    }
+    v.blocks[0].kind = KIND_BOOT;
+    v.blocks[1].kind = KIND_BOOT;
+    for (uint32_t i = 0; i < vol->bitmap.size; i++) {
+        const ADF_SECTNUM sector = vol->bitmap.blocks[i];
+        if (sector >= 2 && (uint32_t)sector < v.num_blocks) {
+            v.blocks[sector].kind = KIND_BITMAP;
+        }
+    }
+
+    pthread_mutex_init(&v.lock, NULL);
+    pthread_cond_init(&v.start, NULL);
+    pthread_cond_init(&v.done, NULL);
+    if (options && options->num_threads > 0) {
+        start_checkers(&v, options->num_threads);
+    }
+    ADF_RETCODE rc = scan_volume(&v);
+    stop_checkers(&v);
+    pthread_cond_destroy(&v.done);
+    pthread_cond_destroy(&v.start);
+    pthread_mutex_destroy(&v.lock);
+
+    if (rc == ADF_RC_OK) {
+        rc = follow_root(&v);
+    }
+    if (rc == ADF_RC_OK) {
+        check_bitmap(&v);
+    }
+    free(v.meta);
+    free(v.blocks);
+    if (rc != ADF_RC_OK) {
+        adf_verify_report_free(report);
+    }
+    return rc;
+}
+
+void adf_verify_report_free(struct adf_verify_report* report) {
+    if (report) {
+        free(report->problems);
+        report->problems = NULL;
+        report->num_problems = 0;
+    }
+}
+
+const char* adf_verify_problem_name(enum adf_verify_problem_kind kind) {
+    switch (kind) {
+    case ADF_VERIFY_READ_ERROR: return "read error";
+    case ADF_VERIFY_BAD_CHECKSUM: return "bad checksum";
+    case ADF_VERIFY_BAD_TYPE: return "wrong block type";
+    case ADF_VERIFY_BAD_HEADER_KEY: return "bad header key";
+    case ADF_VERIFY_BAD_POINTER: return "block number out of range";
+    case ADF_VERIFY_BAD_PARENT: return "wrong parent";
+    case ADF_VERIFY_BAD_HASH_CHAIN: return "wrong hash chain";
+    case ADF_VERIFY_BAD_BLOCK_LIST: return "bad data block list";
+    case ADF_VERIFY_CROSS_LINKED: return "cross-linked block";
+    case ADF_VERIFY_USED_MARKED_FREE: return "used block free in bitmap";
+    case ADF_VERIFY_FREE_MARKED_USED: return "unused block allocated in bitmap";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,74 @@
+//
+//  adf_verify.h
+//  ADFinder
+//
+
+#ifndef ADF_VERIFY_H
+#define ADF_VERIFY_H
+
+#include <stdint.h>
+#include "adf_err.h"
+#include "adf_types.h"
+#include "adf_vol.h"
+
+// Checks a whole DOS volume. Every block is read once, in sector order and
+// in large device reads; the blocks of each read are classified by type and
+// secType, checksummed and checked for their header key by a pool of worker
+// threads. The file system structure is then followed in memory from the
+// root block: hash chains (parent, name hash, loops), file extension and
+// OFS data blocks, directory cache blocks and the bitmap blocks, and the
+// blocks it reaches are compared with the allocation bitmap.
+//
+// Bitmap extension blocks, found only through the root block, are the one
+// thing read a second time.
+
+enum adf_verify_problem_kind {
+    ADF_VERIFY_READ_ERROR,          // the device could not read the block
+    ADF_VERIFY_BAD_CHECKSUM,
+    ADF_VERIFY_BAD_TYPE,            // not the kind of block that points at it expects
+    ADF_VERIFY_BAD_HEADER_KEY,      // header key not the block itself (the file, for OFS data)
+    ADF_VERIFY_BAD_POINTER,         // a block number outside the volume
+    ADF_VERIFY_BAD_PARENT,          // parent not its directory, or its file for an extension block
+    ADF_VERIFY_BAD_HASH_CHAIN,      // entry in the hash chain of another name
+    ADF_VERIFY_BAD_BLOCK_LIST,      // a file's data blocks do not add up to its size
+    ADF_VERIFY_CROSS_LINKED,        // reached a second time, a loop or a shared block
+    ADF_VERIFY_USED_MARKED_FREE,    // in use but free in the bitmap
+    ADF_VERIFY_FREE_MARKED_USED,    // allocated in the bitmap but not in use
+    ADF_VERIFY_PROBLEM_KINDS
+};
+
+struct adf_verify_problem {
+    enum adf_verify_problem_kind kind;
+    ADF_SECTNUM sector;
+    ADF_SECTNUM referrer;           // the block that points at it, 0 if none
+};
+
+struct adf_verify_options {
+    uint32_t num_threads;           // block checkers besides the calling thread
+    uint32_t max_problems;          // problems listed in the report; 0 for 256
+};
+
+struct adf_verify_report {
+    uint32_t blocks;
+    uint32_t directories;
+    uint32_t files;
+    uint32_t links;
+    uint32_t used_blocks;           // reached from the root block, boot block included
+    uint32_t free_blocks;           // free in the bitmap
+    uint32_t problem_counts[ADF_VERIFY_PROBLEM_KINDS];
+    uint32_t total_problems;
+    struct adf_verify_problem* problems;   // the first max_problems of them
+    uint32_t num_problems;
+};
+
+// Problems found are in the report and are not errors; the return code is
+// for what stops the check (memory, not a DOS volume). Free the report with
+// adf_verify_report_free(). Options may be NULL: no extra threads.
+ADF_RETCODE adf_verify_volume(struct AdfVolume* vol, const struct adf_verify_options* options,
+                              struct adf_verify_report* report);
+
+void adf_verify_report_free(struct adf_verify_report* report);
+
+const char* adf_verify_problem_name(enum adf_verify_problem_kind kind);
+
+#endif /* ADF_VERIFY_H */
@@ -20,4 +20,19 @@
 
 #include "adf_swift_bridge_constants.h"
 #include "adf_swift_helpers.h"
+#include "adf_track_driver.h"
+#include "adf_mmap_driver.h"
+#include "adf_bitmap_index.h"
+#include "adf_bitmap_commit.h"
+#include "adf_dir_index.h"
+#include "adf_dir_list.h"
+#include "adf_dir_cache.h"
+#include "adf_dir_walk.h"
+#include "adf_extract.h"
+#include "adf_file_read.h"
+#include "adf_checksum.h"
+#include "adf_verify.h"
+#include "adf_bitmap_rebuild.h"
+#include "adf_salvage_index.h"
+#include "adf_sector_diff.h"
 #endif /* ADFBrowser_Bridging_Header_h */
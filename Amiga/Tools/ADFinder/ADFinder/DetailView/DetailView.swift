@@ -23,6 +23,7 @@ struct DetailView: View {
     @State var infoDialogConfig: InfoDialogConfig?
     @State var newAdfConfig: NewADFDialogConfig?
     @State var setPermissionsConfig: SetPermissionsDialogConfig?
+    @State var undeleteConfig: UndeleteDialogConfig?
     @State var forceFlag: Bool = false
     @State var showingAboutView = false
     @State var showingFileViewer = false
@@ -125,7 +126,21 @@ struct DetailView: View {
                 } else if let path = path {
                     showAlert(message: "Directory list saved to:\n\(path.path)")
                 }
-            }
+            },
+
+            rebuildDirCache: {
+                if let error = adfService.rebuildDirectoryCache() {
+                    showAlert(message: error)
+                } else {
+                    showAlert(message: "Directory cache rebuilt for \(adfService.volumeLabel).")
+                    loadDirectoryContents()
+                }
+            },
+
+            extractVolume: extractVolume,
+            verifyVolume: verifyVolume,
+            rebuildBitmap: rebuildBitmap,
+            undelete: undelete
         )
     }
     
@@ -163,6 +178,7 @@ struct DetailView: View {
         .infoDialogSheet(config: $infoDialogConfig)
         .newAdfDialogSheet(config: $newAdfConfig)
         .setPermissionsDialogSheet(config: $setPermissionsConfig)
+        .undeleteDialogSheet(config: $undeleteConfig)
         .sheet(isPresented: $showingFileViewer) {
             if let entry = selectedEntryForView, let data = fileContentData {
                 FileHexView(fileName: entry.name, data: data)
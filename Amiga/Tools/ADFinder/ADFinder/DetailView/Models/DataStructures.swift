@@ -35,6 +35,25 @@ struct AmigaEntry: Identifiable, Hashable {
     }
 }
 
+// An entry found in the salvage index: deleted, with its header block as id.
+struct DeletedEntry: Identifiable, Hashable {
+    let id: Int32
+    let parent: Int32
+    let name: String
+    let type: EntryType
+    let size: UInt32
+    let date: Date?
+    let status: DeletedEntryStatus
+}
+
+enum DeletedEntryStatus: String {
+    case recoverable = "Recoverable"
+    case parentDeleted = "Folder deleted too"
+    case parentGone = "Folder lost"
+    case blocksReused = "Overwritten"
+    case unsupported = "Hard link, not restorable"
+}
+
 enum EntryType: String {
     case file = "File"
     case directory = "Directory"
@@ -33,19 +33,63 @@ enum SectorState: Identifiable {
         case .destinationOnly: "Destination Only"
         }
     }
+    
+    init(_ state: adf_sector_state) {
+        switch state {
+        case ADF_SECTOR_IDENTICAL: self = .identical
+        case ADF_SECTOR_DIFFERENT: self = .different
+        case ADF_SECTOR_SOURCE_ONLY: self = .sourceOnly
+        default: self = .destinationOnly
+        }
+    }
+}
+
+/// A run of consecutive sectors in the same state.
+struct SectorRun {
+    let sectors: Range<Int>
+    let state: SectorState
 }
 
 /// A struct to hold the result of a full disk comparison.
 struct ComparisonResult {
-    let sectorStates: [SectorState]
+    let runs: [SectorRun]
+    let byteRuns: [Range<Int>]          // differing bytes, by offset; never across sectors
+    let byteRunsTruncated: Bool
     let totalSectors: Int
     let differentSectors: Int
+    let differentBytes: Int
     let sourceOnlySectors: Int
     let destinationOnlySectors: Int
     let sourceBootBlock: AdfBootBlock?
     let destBootBlock: AdfBootBlock?
     let sourceRootBlock: AdfRootBlock?
     let destRootBlock: AdfRootBlock?
+    
+    /// The state of one sector, looked up in the runs.
+    func state(ofSector sector: Int) -> SectorState {
+        var low = 0, high = runs.count
+        while low < high {
+            let mid = (low + high) / 2
+            if runs[mid].sectors.upperBound <= sector { low = mid + 1 } else { high = mid }
+        }
+        return low < runs.count ? runs[low].state : .identical
+    }
+    
+    /// The differing bytes of one sector, as offsets within it.
+    func differingBytes(inSector sector: Int, sectorSize: Int = 512) -> [Range<Int>] {
+        let start = sector * sectorSize
+        var low = 0, high = byteRuns.count
+        while low < high {
+            let mid = (low + high) / 2
+            if byteRuns[mid].lowerBound < start { low = mid + 1 } else { high = mid }
+        }
+        var ranges: [Range<Int>] = []
+        while low < byteRuns.count && byteRuns[low].lowerBound < start + sectorSize {
+            ranges.append((byteRuns[low].lowerBound - start)..<(byteRuns[low].upperBound - start))
+            low += 1
+        }
+        return ranges
+    }
 }
 
 
@@ -56,6 +100,8 @@ class ADFCompareService {
     var comparisonResult: ComparisonResult?
     
     private let sectorSize = 512
+    // Byte runs kept for the sector tooltips; the count of differing bytes is always complete.
+    private let maxByteRuns: UInt64 = 100_000
     
     /// Loads data from a URL for either the source or destination disk.
     func load(url: URL, for target: Target) -> Bool {
@@ -70,9 +116,10 @@ class ADFCompareService {
         }
         
         
+        // Mapped rather than read, so multi-GB hard disk images are only paged in as they are compared.
         let data: Data
         do {
-            data = try Data(contentsOf: url)
+            data = try Data(contentsOf: url, options: .alwaysMapped)
             print("ADFCompareService: Successfully loaded \(data.count) bytes.")
         } catch {
             print("ADFCompareService: FAILED to load data from URL. Error: \(error.localizedDescription)")
@@ -112,56 +159,47 @@ class ADFCompareService {
         let destBoot = parseBootBlock(from: destinationData)
         let destRoot = parseRootBlock(from: destinationData, bootBlock: destBoot)
         
-        let sourceSectors = sourceData.count / sectorSize
-        let destSectors = destinationData.count / sectorSize
-        let maxSectors = max(sourceSectors, destSectors)
-        
-        var states: [SectorState] = []
-        var diffCount = 0
-        var sourceOnlyCount = 0
-        var destOnlyCount = 0
-        
-        for i in 0..<maxSectors {
-            let sourceStart = i * sectorSize
-            let destStart = i * sectorSize
-            
-            let isSourceSectorValid = sourceStart + sectorSize <= sourceData.count
-            let isDestSectorValid = destStart + sectorSize <= destinationData.count
-            
-            if isSourceSectorValid && isDestSectorValid {
-                let sourceChunk = sourceData[sourceStart..<(sourceStart + sectorSize)]
-                let destChunk = destinationData[destStart..<(destStart + sectorSize)]
-                
-                if sourceChunk == destChunk {
-                    states.append(.identical)
-                } else {
-                    states.append(.different)
-                    diffCount += 1
-                }
-            } else if isSourceSectorValid {
-                states.append(.sourceOnly)
-                sourceOnlyCount += 1
-            } else {
-                states.append(.destinationOnly)
-                destOnlyCount += 1
+        var options = adf_sector_diff_options(byte_runs: true, max_byte_runs: maxByteRuns)
+        var report = adf_sector_diff_report()
+        let result = sourceData.withUnsafeBytes { source in
+            destinationData.withUnsafeBytes { dest in
+                adf_sector_diff(source.bindMemory(to: UInt8.self).baseAddress, UInt64(source.count),
+                                dest.bindMemory(to: UInt8.self).baseAddress, UInt64(dest.count),
+                                &options, &report)
             }
         }
+        defer { adf_sector_diff_report_free(&report) }
+        guard result == ADF_RC_OK else {
+            print("ADFCompareService.compare: Comparison failed, error \(result.rawValue).")
+            return
+        }
+        
+        let runs = UnsafeBufferPointer(start: report.runs, count: Int(report.num_runs)).map {
+            SectorRun(sectors: Int($0.first)..<Int($0.first + $0.count), state: SectorState($0.state))
+        }
+        let byteRuns = UnsafeBufferPointer(start: report.byte_runs, count: Int(report.num_byte_runs)).map {
+            Int($0.offset)..<Int($0.offset) + Int($0.length)
+        }
         
         self.comparisonResult = ComparisonResult(
-            sectorStates: states,
-            totalSectors: maxSectors,
-            differentSectors: diffCount,
-            sourceOnlySectors: sourceOnlyCount,
-            destinationOnlySectors: destOnlyCount,
+            runs: runs,
+            byteRuns: byteRuns,
+            byteRunsTruncated: report.byte_runs_truncated,
+            totalSectors: Int(max(report.source_sectors, report.dest_sectors)),
+            differentSectors: Int(report.different_sectors),
+            differentBytes: Int(report.different_bytes),
+            sourceOnlySectors: Int(report.source_only_sectors),
+            destinationOnlySectors: Int(report.dest_only_sectors),
             sourceBootBlock: sourceBoot,
             destBootBlock: destBoot,
             sourceRootBlock: sourceRoot,
             destRootBlock: destRoot
         )
-        print("ADFCompareService.compare: Comparison finished.")
+        print("ADFCompareService.compare: Comparison finished, \(runs.count) runs (\(String(cString: adf_sector_diff_kernel())) kernel).")
     }
     
     private func parseBootBlock(from data: Data) -> AdfBootBlock? {
+        guard data.count >= MemoryLayout<AdfBootBlock>.size else { return nil }
         var boot = AdfBootBlock()
         let result = data.withUnsafeBytes { ptr -> ADF_RETCODE in
             guard let baseAddress = ptr.baseAddress else { return ADF_RC_ERROR }
@@ -171,7 +209,7 @@ class ADFCompareService {
     }
     
     private func parseRootBlock(from data: Data, bootBlock: AdfBootBlock?) -> AdfRootBlock? {
-        guard let boot = bootBlock else { return nil }
+        guard let boot = bootBlock, (Int(boot.rootBlock) + 1) * sectorSize <= data.count else { return nil }
         var root = AdfRootBlock()
         let result = data.withUnsafeBytes { ptr -> ADF_RETCODE in
             guard let baseAddress = ptr.baseAddress else { return ADF_RC_ERROR }
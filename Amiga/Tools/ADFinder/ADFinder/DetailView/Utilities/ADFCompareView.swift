@@ -152,7 +152,7 @@ private struct ComparisonResultsView: View {
             // Legend and summary
             HStack(spacing: 15) {
                 LegendItem(color: .green, label: "Identical")
-                LegendItem(color: .red, label: "Different (\(result.differentSectors))")
+                LegendItem(color: .red, label: "Different (\(result.differentSectors) sectors, \(result.differentBytes)\(result.byteRunsTruncated ? "+" : "") bytes)")
                 LegendItem(color: .blue, label: "Source Only (\(result.sourceOnlySectors))")
                 LegendItem(color: .yellow, label: "Destination Only (\(result.destinationOnlySectors))")
                 Spacer()
@@ -164,7 +164,7 @@ private struct ComparisonResultsView: View {
             ScrollView {
                 
                 HStack(alignment: .top, spacing: 20) {
-                    let totalRows = (result.sectorStates.count + columns - 1) / columns
+                    let totalRows = (result.totalSectors + columns - 1) / columns
                     let midPoint = (totalRows + 1) / 2
                     
                     // Left Column
@@ -200,7 +200,8 @@ private struct SectorGridColumn: View {
     let spacing: CGFloat
 
     var body: some View {
-        VStack(alignment: .leading, spacing: spacing) {
+        // Lazy, so hard disk images with millions of sectors only build the rows on screen.
+        LazyVStack(alignment: .leading, spacing: spacing) {
             // Column headers
             HStack(spacing: spacing) {
                 Spacer().frame(width: 60)
@@ -220,11 +221,12 @@ private struct SectorGridColumn: View {
                     
                     ForEach(0..<columns, id: \.self) { col in
                         let index = row * columns + col
-                        if index < result.sectorStates.count {
+                        if index < result.totalSectors {
+                            let state = result.state(ofSector: index)
                             Rectangle()
-                                .fill(result.sectorStates[index].color)
+                                .fill(state.color)
                                 .frame(width: boxSize, height: boxSize)
-                                .help("Sector \(index): \(result.sectorStates[index].description)")
+                                .help(helpText(sector: index, state: state))
                         } else {
                             Spacer().frame(width: boxSize, height: boxSize)
                         }
@@ -233,6 +235,14 @@ private struct SectorGridColumn: View {
             }
         }
     }
+    
+    private func helpText(sector: Int, state: SectorState) -> String {
+        guard state == .different else { return "Sector \(sector): \(state.description)" }
+        let ranges = result.differingBytes(inSector: sector)
+        guard let first = ranges.first else { return "Sector \(sector): \(state.description)" }
+        let bytes = ranges.reduce(0) { $0 + $1.count }
+        return "Sector \(sector): \(state.description), \(bytes) bytes from offset \(first.lowerBound)"
+    }
 }
 
 
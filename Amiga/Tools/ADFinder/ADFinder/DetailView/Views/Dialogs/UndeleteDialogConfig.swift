@@ -0,0 +1,13 @@
+//
+//  UndeleteDialogConfig.swift
+//  ADFinder
+//
+
+import Foundation
+
+struct UndeleteDialogConfig: Identifiable {
+    let id = UUID()
+    let volumeName: String
+    let entries: [DeletedEntry]
+    let action: ([DeletedEntry]) -> Void // Restores the selected entries.
+}
@@ -0,0 +1,90 @@
+//
+//  UndeleteDialogView.swift
+//  ADFinder
+//
+
+import SwiftUI
+
+struct UndeleteDialogView: View {
+    let config: UndeleteDialogConfig
+    @Environment(\.dismiss) var dismiss
+
+    @State private var selection = Set<DeletedEntry.ID>()
+
+    // Entries inside a deleted folder can be picked along with the folder;
+    // the service restores the folder first.
+    private func isSelectable(_ entry: DeletedEntry) -> Bool {
+        entry.status == .recoverable || entry.status == .parentDeleted
+    }
+
+    var body: some View {
+        VStack(spacing: 20) {
+            Image(systemName: "arrow.uturn.backward.circle")
+                .resizable()
+                .scaledToFit()
+                .frame(width: 50, height: 50)
+                .foregroundColor(.accentColor)
+                .symbolRenderingMode(.hierarchical)
+
+            Text("Undelete")
+                .font(.headline)
+
+            if config.entries.isEmpty {
+                Text("No deleted entries found on \"\(config.volumeName)\".")
+                    .multilineTextAlignment(.center)
+                    .foregroundColor(.secondary)
+            } else {
+                Text("Select the entries to restore on \"\(config.volumeName)\".")
+                    .multilineTextAlignment(.center)
+                    .foregroundColor(.secondary)
+
+                Table(config.entries, selection: $selection) {
+                    TableColumn("Name") { entry in
+                        Label(entry.name, systemImage: entry.type == .directory ? "folder" : "doc")
+                            .foregroundColor(isSelectable(entry) ? .primary : .secondary)
+                    }
+                    TableColumn("Size") { entry in
+                        Text(entry.type == .directory ? "--" : "\(entry.size)")
+                    }
+                    .width(70)
+                    TableColumn("Date") { entry in
+                        Text(entry.date?.formatted(date: .abbreviated, time: .shortened) ?? "--")
+                    }
+                    .width(140)
+                    TableColumn("Status") { entry in
+                        Text(entry.status.rawValue)
+                            .foregroundColor(entry.status == .recoverable ? .green : .secondary)
+                    }
+                    .width(130)
+                }
+                .frame(height: 300)
+                .onChange(of: selection) { _, newSelection in
+                    let allowed = Set(config.entries.filter(isSelectable).map(\.id))
+                    if !newSelection.isSubset(of: allowed) {
+                        selection = newSelection.intersection(allowed)
+                    }
+                }
+            }
+
+            HStack(spacing: 12) {
+                Button(role: .cancel, action: { dismiss() }) {
+                    Text("Cancel")
+                        .frame(maxWidth: .infinity)
+                }
+                .keyboardShortcut(.cancelAction)
+
+                Button(action: {
+                    config.action(config.entries.filter { selection.contains($0.id) })
+                    dismiss()
+                }) {
+                    Text("Restore Selected")
+                        .frame(maxWidth: .infinity)
+                }
+                .keyboardShortcut(.defaultAction)
+                .disabled(selection.isEmpty)
+            }
+        }
+        .padding(30)
+        .frame(width: 640)
+    }
+}
@@ -136,11 +136,16 @@ extension DetailView {
         switch result {
         case .success(let urls):
             var errors: [String] = []
-            for url in urls {
-                if let errorMessage = adfService.addFile(from: url) {
-                    errors.append("Could not add \(url.lastPathComponent): \(errorMessage)")
+            let writeBackError = adfService.performBatch {
+                for url in urls {
+                    if let errorMessage = adfService.addFile(from: url) {
+                        errors.append("Could not add \(url.lastPathComponent): \(errorMessage)")
+                    }
                 }
             }
+            if let writeBackError = writeBackError {
+                errors.append(writeBackError)
+            }
             if !errors.isEmpty {
                 showAlert(message: errors.joined(separator: "\n"))
             }
@@ -287,6 +292,71 @@ extension DetailView {
         }
     }
     
+    // Reads the volume through ADFlib, which is not thread-safe, so it runs on
+    // the main thread like every other use of the mounted volume.
+    func extractVolume() {
+        let panel = NSOpenPanel()
+        panel.canChooseFiles = false
+        panel.canChooseDirectories = true
+        panel.allowsMultipleSelection = false
+        panel.title = "Choose destination for \"\(adfService.volumeLabel)\""
+        panel.message = "The whole volume will be extracted into a new folder inside the one you choose."
+        panel.prompt = "Extract Here"
+
+        panel.begin { response in
+            guard response == .OK, let destinationURL = panel.url else { return }
+            let (errorMessage, summary) = self.adfService.extractVolume(toDirectory: destinationURL)
+            if let errorMessage = errorMessage {
+                self.showAlert(message: "Extraction failed: \(errorMessage)")
+            } else if let summary = summary {
+                self.showAlert(message: summary)
+            }
+        }
+    }
+    
+    // Reads the mounted volume through ADFlib, so it stays on the main thread
+    // with the other calls into it.
+    func verifyVolume() {
+        let (errorMessage, summary) = adfService.verifyVolume()
+        if let errorMessage = errorMessage {
+            showAlert(message: "Verification failed: \(errorMessage)")
+        } else if let summary = summary {
+            showAlert(message: summary)
+        }
+    }
+    
+    // Changes the volume, so it runs on the main thread like every other
+    // write to it, rebuildDirCache included.
+    func rebuildBitmap() {
+        let (errorMessage, summary) = adfService.rebuildBitmap()
+        if let errorMessage = errorMessage {
+            showAlert(message: "Bitmap rebuild failed: \(errorMessage)")
+        } else if let summary = summary {
+            showAlert(message: summary)
+        }
+    }
+    
+    // Listing builds the service's salvage index and restoring writes the
+    // volume, so both stay on the main thread with the other writes.
+    func undelete() {
+        guard let entries = adfService.listDeletedEntries() else {
+            showAlert(message: "Could not scan the volume for deleted entries.")
+            return
+        }
+        undeleteConfig = UndeleteDialogConfig(volumeName: adfService.volumeLabel, entries: entries) { selected in
+            self.restoreDeletedEntries(selected)
+        }
+    }
+    
+    private func restoreDeletedEntries(_ entries: [DeletedEntry]) {
+        if let errorMessage = adfService.restoreDeletedEntries(entries) {
+            showAlert(message: "Undelete failed: \(errorMessage)")
+        } else {
+            showAlert(message: "Restored \(entries.count) entries on \(adfService.volumeLabel).")
+        }
+        loadDirectoryContents()
+    }
+    
     // MARK: - Alert & Dialog Presentation
     
     func showAlert(message: String) {
@@ -313,4 +313,12 @@ extension View {
             SetPermissionsDialogView(config: item)
         }
     }
+
+    func undeleteDialogSheet(
+        config: Binding<UndeleteDialogConfig?>
+    ) -> some View {
+        self.sheet(item: config) { item in
+            UndeleteDialogView(config: item)
+        }
+    }
 }
@@ -35,6 +35,11 @@ struct DetailToolbar: ToolbarContent {
         let diskDump: () -> Void
         
         let generateList: () -> Void
+        let rebuildDirCache: () -> Void
+        let extractVolume: () -> Void
+        let verifyVolume: () -> Void
+        let rebuildBitmap: () -> Void
+        let undelete: () -> Void
     }
     let actions: Actions
     
@@ -137,6 +142,31 @@ struct DetailToolbar: ToolbarContent {
                 }
                 .disabled(selectedFile == nil)
 
+                Button(action: actions.rebuildDirCache) {
+                    Label("Rebuild Directory Cache", systemImage: "arrow.triangle.2.circlepath")
+                }
+                .disabled(selectedFile == nil)
+
+                Button(action: actions.extractVolume) {
+                    Label("Extract Volume...", systemImage: "square.and.arrow.down.on.square")
+                }
+                .disabled(selectedFile == nil)
+
+                Button(action: actions.verifyVolume) {
+                    Label("Verify Volume", systemImage: "checkmark.shield")
+                }
+                .disabled(selectedFile == nil)
+
+                Button(action: actions.rebuildBitmap) {
+                    Label("Rebuild Bitmap", systemImage: "square.grid.3x3.fill")
+                }
+                .disabled(selectedFile == nil)
+
+                Button(action: actions.undelete) {
+                    Label("Undelete...", systemImage: "arrow.uturn.backward.circle")
+                }
+                .disabled(selectedFile == nil)
+
             } label: {
                 Label("Tools", systemImage: "wrench.and.screwdriver")
             }
@@ -0,0 +1,106 @@
+//
+//  bench_checksum.c
+//  ADFinder
+//
+
+#include "adflib.h"
+#include "adf_checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Throughput of ADFlib's checksum and endian-swap loops against the ADFinder
+// kernels, in MB/s, over a set of 512-byte blocks that fits in the cache and
+// one that does not. `make bench` runs it; the numbers are only comparable
+// on the same machine.
+
+#define CACHED_BLOCKS 256                 // 128 KB
+#define UNCACHED_BLOCKS (64 * 2048)       // 64 MB
+#define MIN_SECONDS 0.5
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// The sums go here so the loops cannot be thrown away.
+static volatile uint32_t sink;
+
+enum operation { NORMAL_SUM, BOOT_SUM, SWAP_FILE };
+
+static void run_adflib(enum operation op, uint8_t* blocks, uint32_t count) {
+    const uint32_t step = op == BOOT_SUM ? 2 : 1;
+    for (uint32_t i = 0; i + step <= count; i += step) {
+        uint8_t* block = blocks + (size_t)i * 512;
+        switch (op) {
+        case NORMAL_SUM: sink += adfNormalSum(block, 20, 512); break;
+        case BOOT_SUM: sink += adfBootSum(block); break;
+        case SWAP_FILE: adfSwapEndian(block, ADF_SWBL_FILE); break;
+        }
+    }
+}
+
+static void run_adfinder(enum operation op, uint8_t* blocks, uint32_t count) {
+    const uint32_t step = op == BOOT_SUM ? 2 : 1;
+    for (uint32_t i = 0; i + step <= count; i += step) {
+        uint8_t* block = blocks + (size_t)i * 512;
+        switch (op) {
+        case NORMAL_SUM: sink += adf_normal_sum(block, 20, 512); break;
+        case BOOT_SUM: sink += adf_boot_sum(block); break;
+        case SWAP_FILE: adf_swap_endian(block, ADF_SWBL_FILE); break;
+        }
+    }
+}
+
+// A boot sum covers two blocks of the set per call.
+static double measure(void (*run)(enum operation, uint8_t*, uint32_t), enum operation op,
+                      uint8_t* blocks, uint32_t count) {
+    const double bytes_per_pass = (double)count * 512;
+    run(op, blocks, count);
+    uint32_t passes = 0;
+    const double start = now();
+    double elapsed;
+    do {
+        run(op, blocks, count);
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_SECONDS);
+    return bytes_per_pass * passes / elapsed / 1e6;
+}
+
+int main(void) {
+    static const struct {
+        enum operation op;
+        const char* name;
+    } operations[] = {
+        { NORMAL_SUM, "normal sum" },
+        { BOOT_SUM, "boot sum" },
+        { SWAP_FILE, "swap (file)" },
+    };
+    static const uint32_t sets[] = { CACHED_BLOCKS, UNCACHED_BLOCKS };
+
+    uint8_t* blocks = malloc((size_t)UNCACHED_BLOCKS * 512);
+    if (!blocks) {
+        perror("malloc");
+        return 1;
+    }
+    srand(1);
+    for (size_t i = 0; i < (size_t)UNCACHED_BLOCKS * 512; i++) {
+        blocks[i] = (uint8_t)rand();
+    }
+
+    printf("ADFinder kernels: %s\n", adf_checksum_kernels());
+    printf("%-12s %10s %13s %13s %8s\n", "", "set", "ADFlib MB/s", "ADFinder MB/s", "speedup");
+    for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+        for (size_t o = 0; o < sizeof(operations) / sizeof(operations[0]); o++) {
+            const double before = measure(run_adflib, operations[o].op, blocks, sets[s]);
+            const double after = measure(run_adfinder, operations[o].op, blocks, sets[s]);
+            printf("%-12s %7u KB %13.0f %13.0f %7.1fx\n", operations[o].name, sets[s] / 2,
+                   before, after, after / before);
+        }
+    }
+    free(blocks);
+    return 0;
+}
@@ -0,0 +1,205 @@
+//
+//  test_bitmap_index.c
+//  ADFinder
+//
+
+#include "test_support.h"
+#include "adf_bitm.h"
+#include "adf_bitmap_index.h"
+
+#define BITS_PER_PAGE (ADF_BM_MAP_SIZE * 32)
+
+static uint32_t rng_state = 0x2545f491;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// A volume of num_blocks blocks with only its bitmap in memory, so sizes up
+// to a hardfile's can be checked without an image. Whole bitmap blocks are
+// used, free or mixed at random, and the bits past the end are set, as the
+// index has to ignore them.
+static struct AdfVolume* make_volume(uint32_t num_blocks) {
+    struct AdfVolume* vol = calloc(1, sizeof(*vol));
+    const uint32_t pages = (num_blocks - 2 + BITS_PER_PAGE - 1) / BITS_PER_PAGE;
+    vol->firstBlock = 0;
+    vol->lastBlock = (int32_t)num_blocks - 1;
+    vol->rootBlock = (ADF_SECTNUM)(num_blocks / 2);
+    vol->bitmap.size = pages;
+    vol->bitmap.blocks = calloc(pages, sizeof(*vol->bitmap.blocks));
+    vol->bitmap.table = calloc(pages, sizeof(*vol->bitmap.table));
+    vol->bitmap.blocksChg = calloc(pages, sizeof(*vol->bitmap.blocksChg));
+    for (uint32_t page = 0; page < pages; page++) {
+        struct AdfBitmapBlock* block = calloc(1, sizeof(*block));
+        const uint32_t mode = next_random() % 4;
+        for (int word = 0; word < ADF_BM_MAP_SIZE; word++) {
+            block->map[word] = mode == 0 ? 0 : mode == 1 ? UINT32_MAX
+                             : next_random() % 3 ? next_random() & next_random() : UINT32_MAX;
+        }
+        vol->bitmap.table[page] = block;
+    }
+    return vol;
+}
+
+static void free_volume(struct AdfVolume* vol) {
+    for (uint32_t page = 0; page < vol->bitmap.size; page++) {
+        free(vol->bitmap.table[page]);
+    }
+    free(vol->bitmap.table);
+    free(vol->bitmap.blocks);
+    free(vol->bitmap.blocksChg);
+    free(vol);
+}
+
+// The answers the index gives, worked out one adfIsBlockFree() at a time.
+
+static uint32_t ref_count_free(const struct AdfVolume* vol) {
+    uint32_t count = 0;
+    for (uint32_t block = 2; block < adfVolGetSizeInBlocks(vol); block++) {
+        count += adfIsBlockFree(vol, (ADF_SECTNUM)block);
+    }
+    return count;
+}
+
+static ADF_SECTNUM ref_find_free(const struct AdfVolume* vol, ADF_SECTNUM from) {
+    const uint32_t size = adfVolGetSizeInBlocks(vol);
+    const uint32_t start = from >= 2 && (uint32_t)from < size ? (uint32_t)from : 2;
+    for (uint32_t i = 0; i < size - 2; i++) {
+        const uint32_t block = 2 + (start - 2 + i) % (size - 2);
+        if (adfIsBlockFree(vol, (ADF_SECTNUM)block)) {
+            return (ADF_SECTNUM)block;
+        }
+    }
+    return -1;
+}
+
+static uint32_t ref_longest_run(const struct AdfVolume* vol) {
+    uint32_t longest = 0, run = 0;
+    for (uint32_t block = 2; block < adfVolGetSizeInBlocks(vol); block++) {
+        run = adfIsBlockFree(vol, (ADF_SECTNUM)block) ? run + 1 : 0;
+        longest = run > longest ? run : longest;
+    }
+    return longest;
+}
+
+// Mixed queries, allocations and frees, each checked against the scan. The
+// cursor the test keeps is where the index's next allocation has to start:
+// it moves with allocations only, and survives a rebuild.
+static void check_against_scan(uint32_t num_blocks, uint32_t num_ops) {
+    struct AdfVolume* vol = make_volume(num_blocks);
+    struct adf_bitmap_index* index = adf_bitmap_index_create(vol);
+    CHECK(index != NULL);
+    if (!index) {
+        free_volume(vol);
+        return;
+    }
+    const uint32_t check_every = num_blocks > 4000 ? 100 : 1;
+    ADF_SECTNUM cursor = vol->rootBlock;
+    uint32_t expected_free = ref_count_free(vol);
+    CHECK(adf_bitmap_index_free_blocks(index) == expected_free);
+
+    for (uint32_t op = 0; op < num_ops && failures == 0; op++) {
+        switch (next_random() % 8) {
+        case 0: {
+            const ADF_SECTNUM from = (ADF_SECTNUM)(next_random() % (num_blocks + 8));
+            CHECK(adf_bitmap_index_find_free(index, from) == ref_find_free(vol, from));
+            break;
+        }
+        case 1: {
+            const ADF_SECTNUM expected = ref_find_free(vol, cursor);
+            const ADF_SECTNUM block = adf_bitmap_index_alloc1(index);
+            CHECK(block == expected);
+            if (block > 0) {
+                CHECK(!adfIsBlockFree(vol, block));
+                cursor = block + 1;
+                expected_free--;
+            }
+            break;
+        }
+        case 2: {
+            const int count = next_random() % 16 == 0 ? (int)(expected_free + 1) : (int)(next_random() % 40);
+            ADF_SECTNUM* blocks = malloc(((size_t)count + 1) * sizeof(*blocks));
+            const bool fits = (uint32_t)count <= expected_free;
+            CHECK(adf_bitmap_index_alloc(index, count, blocks) == fits);
+            for (int i = 0; fits && i < count; i++) {
+                CHECK(blocks[i] >= 2 && !adfIsBlockFree(vol, blocks[i]));
+                cursor = blocks[i] + 1;
+            }
+            expected_free -= fits ? (uint32_t)count : 0;
+            free(blocks);
+            break;
+        }
+        case 3: {
+            const uint32_t max_blocks = 1 + next_random() % 64;
+            const enum adf_extent_policy policy = next_random() % 2 ? ADF_EXTENT_FIRST_FIT : ADF_EXTENT_BEST_FIT;
+            const uint32_t longest = ref_longest_run(vol);
+            struct adf_extent extent = { 0, 0 };
+            const bool got = adf_bitmap_index_alloc_extent(index, max_blocks, policy, &extent);
+            CHECK(got == (expected_free > 0));
+            if (got) {
+                CHECK(extent.length == (longest < max_blocks ? longest : max_blocks));
+                for (uint32_t i = 0; i < extent.length; i++) {
+                    CHECK(!adfIsBlockFree(vol, extent.start + (ADF_SECTNUM)i));
+                }
+                cursor = extent.start + (ADF_SECTNUM)extent.length;
+                expected_free -= extent.length;
+            }
+            break;
+        }
+        case 4:
+        case 5: {
+            const ADF_SECTNUM block = (ADF_SECTNUM)(next_random() % (num_blocks + 8));
+            const bool in_range = block >= 2 && (uint32_t)block < num_blocks;
+            const bool was_free = in_range && adfIsBlockFree(vol, block);
+            if (next_random() % 2) {
+                adf_bitmap_index_set_free(index, block);
+                expected_free += in_range && !was_free;
+                CHECK(!in_range || adfIsBlockFree(vol, block));
+            } else {
+                adf_bitmap_index_set_used(index, block);
+                expected_free -= was_free;
+                CHECK(!in_range || !adfIsBlockFree(vol, block));
+            }
+            break;
+        }
+        case 6:
+            // ADFlib changing the bitmap on its own, then the rebuild.
+            for (int i = 0; i < 20; i++) {
+                const ADF_SECTNUM block = (ADF_SECTNUM)(2 + next_random() % (num_blocks - 2));
+                if (next_random() % 2) {
+                    adfSetBlockFree(vol, block);
+                } else {
+                    adfSetBlockUsed(vol, block);
+                }
+            }
+            adf_bitmap_index_rebuild(index);
+            expected_free = ref_count_free(vol);
+            break;
+        default:
+            CHECK(adf_bitmap_count_free(vol) == expected_free);
+            break;
+        }
+        if (op % check_every == 0) {
+            CHECK(ref_count_free(vol) == expected_free);
+        }
+        CHECK(adf_bitmap_index_free_blocks(index) == expected_free);
+    }
+    CHECK(ref_count_free(vol) == expected_free);
+    adf_bitmap_index_free(index);
+    free_volume(vol);
+}
+
+int main(void) {
+    if (adfLibInit() != ADF_RC_OK) {
+        return 1;
+    }
+    check_against_scan(1760, 20000);       // DD floppy, one bitmap block
+    check_against_scan(3520, 20000);       // HD floppy
+    check_against_scan(20000, 20000);
+    check_against_scan(200000, 2000);      // 100 MB hardfile, 50 bitmap blocks
+    adfLibCleanUp();
+    return test_result("test_bitmap_index");
+}
@@ -0,0 +1,141 @@
+//
+//  test_bitmap_rebuild.c
+//  ADFinder
+//
+
+#include "test_support.h"
+#include "adf_bitm.h"
+#include "adf_bitmap_rebuild.h"
+#include <unistd.h>
+
+#define MAX_FILE_BLOCKS 16
+
+static char work_dir[] = "/tmp/adfinder-bitmap-XXXXXX";
+
+// The header and data blocks of a file small enough to need no extension
+// block; returns their count.
+static int file_blocks(struct AdfVolume* vol, ADF_SECTNUM header, ADF_SECTNUM* blocks) {
+    struct AdfEntryBlock entry;
+    struct AdfFileHeaderBlock fhdr;
+    if (adfReadEntryBlock(vol, header, &entry) != ADF_RC_OK) {
+        return 0;
+    }
+    memcpy(&fhdr, &entry, sizeof(fhdr));
+    int count = 0;
+    blocks[count++] = header;
+    for (int32_t i = 0; i < fhdr.highSeq && count < MAX_FILE_BLOCKS; i++) {
+        blocks[count++] = fhdr.dataBlocks[ADF_MAX_DATABLK - 1 - i];
+    }
+    return count;
+}
+
+static bool all_used(struct AdfVolume* vol, const ADF_SECTNUM* blocks, int count) {
+    for (int i = 0; i < count; i++) {
+        if (adfIsBlockFree(vol, blocks[i])) {
+            return false;
+        }
+    }
+    return count > 0;
+}
+
+static bool all_free(struct AdfVolume* vol, const ADF_SECTNUM* blocks, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!adfIsBlockFree(vol, blocks[i])) {
+            return false;
+        }
+    }
+    return count > 0;
+}
+
+// A file removed while the bitmap on disk kept its blocks, as after a crash.
+static int stale_deleted_file(struct AdfVolume* vol, ADF_SECTNUM parent, const char* name, ADF_SECTNUM* blocks) {
+    const ADF_SECTNUM header = test_write_file(vol, parent, name, 1500);
+    const int count = header > 0 ? file_blocks(vol, header, blocks) : 0;
+    if (count == 0 || adfRemoveEntry(vol, parent, name) != ADF_RC_OK) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        adfSetBlockUsed(vol, blocks[i]);
+    }
+    return count;
+}
+
+// With an intact tree the bitmap follows it both ways.
+static void test_stale_bitmap(void) {
+    char image[256];
+    snprintf(image, sizeof(image), "%s/stale.adf", work_dir);
+    struct AdfVolume* vol = test_create_floppy(image);
+    CHECK(vol != NULL);
+    if (!vol) {
+        return;
+    }
+    const ADF_SECTNUM root = vol->rootBlock;
+    ADF_SECTNUM kept[MAX_FILE_BLOCKS], gone[MAX_FILE_BLOCKS];
+    const int num_kept = file_blocks(vol, test_write_file(vol, root, "kept", 2000), kept);
+    const int num_gone = stale_deleted_file(vol, root, "gone", gone);
+    CHECK(num_kept > 1 && num_gone > 1);
+    adfSetBlockFree(vol, kept[num_kept - 1]);
+
+    struct adf_bitmap_rebuild_stats stats;
+    CHECK(adf_bitmap_rebuild(vol, &stats) == ADF_RC_OK);
+    CHECK(all_used(vol, kept, num_kept));
+    CHECK(all_free(vol, gone, num_gone));
+    CHECK(stats.allocated == 1 && stats.freed == (uint32_t)num_gone);
+    CHECK(stats.kept_unreached == 0);
+    test_close_floppy(vol);
+}
+
+// A directory block with a bad checksum cuts its subtree off the walk; the
+// healthy entries below it must stay allocated, while a file known to be
+// deleted elsewhere is still freed.
+static void test_damaged_directory(void) {
+    char image[256];
+    snprintf(image, sizeof(image), "%s/damaged.adf", work_dir);
+    struct AdfVolume* vol = test_create_floppy(image);
+    CHECK(vol != NULL);
+    if (!vol) {
+        return;
+    }
+    const ADF_SECTNUM root = vol->rootBlock;
+    ADF_SECTNUM child[MAX_FILE_BLOCKS], grandchild[MAX_FILE_BLOCKS], gone[MAX_FILE_BLOCKS];
+    const ADF_SECTNUM hurt = test_create_dir(vol, root, "Hurt");
+    const ADF_SECTNUM sub = hurt > 0 ? test_create_dir(vol, hurt, "Sub") : 0;
+    const int num_child = file_blocks(vol, test_write_file(vol, hurt, "child", 2000), child);
+    const int num_grandchild = file_blocks(vol, test_write_file(vol, sub, "grandchild", 700), grandchild);
+    const ADF_SECTNUM other = test_create_dir(vol, root, "Other");
+    const int num_gone = stale_deleted_file(vol, other, "gone", gone);
+    CHECK(hurt > 0 && sub > 0 && other > 0);
+    CHECK(num_child > 1 && num_grandchild > 1 && num_gone > 1);
+
+    uint8_t raw[ADF_LOGICAL_BLOCK_SIZE];
+    const uint32_t device_sector = (uint32_t)(vol->firstBlock + hurt);
+    CHECK(adfDevReadBlock(vol->dev, device_sector, sizeof(raw), raw) == ADF_RC_OK);
+    raw[0x1B1] ^= 0xFF; // in the name, so only the checksum gives it away
+    CHECK(adfDevWriteBlock(vol->dev, device_sector, sizeof(raw), raw) == ADF_RC_OK);
+
+    struct adf_bitmap_rebuild_stats stats;
+    CHECK(adf_bitmap_rebuild(vol, &stats) == ADF_RC_OK);
+    CHECK(!adfIsBlockFree(vol, hurt));
+    CHECK(!adfIsBlockFree(vol, sub));
+    CHECK(all_used(vol, child, num_child));
+    CHECK(all_used(vol, grandchild, num_grandchild));
+    CHECK(!adfIsBlockFree(vol, other));
+    CHECK(all_free(vol, gone, num_gone));
+    CHECK(stats.kept_unreached >= (uint32_t)(1 + num_child + num_grandchild));
+    CHECK(stats.freed == (uint32_t)num_gone);
+    test_close_floppy(vol);
+}
+
+int main(void) {
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_stale_bitmap();
+    test_damaged_directory();
+
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf '%s'", work_dir);
+    system(command);
+    return test_result("test_bitmap_rebuild");
+}
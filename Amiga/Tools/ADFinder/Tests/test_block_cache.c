@@ -0,0 +1,145 @@
+//
+//  test_block_cache.c
+//  ADFinder
+//
+
+#include "test_support.h"
+#include "adf_block_cache.h"
+
+#define DISK_BLOCKS 1760
+#define BLOCK_SIZE 512
+
+static uint32_t rng_state = 0x9e3779b9;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// The device behind the cache, and what a reader has to see: the last
+// write of every block.
+static uint8_t disk[DISK_BLOCKS][BLOCK_SIZE];
+static uint8_t reference[DISK_BLOCKS][BLOCK_SIZE];
+static bool writer_fails;
+static uint32_t writer_calls;
+
+static ADF_RETCODE write_disk(void* ctx, uint32_t block, uint32_t len_blocks, const uint8_t* buf) {
+    (void)ctx;
+    if (writer_fails) {
+        return ADF_RC_ERROR;
+    }
+    writer_calls++;
+    memcpy(disk[block], buf, (size_t)len_blocks * BLOCK_SIZE);
+    return ADF_RC_OK;
+}
+
+static void fill_block(uint8_t* buf, uint32_t stamp) {
+    for (int i = 0; i < BLOCK_SIZE; i += 4) {
+        memcpy(buf + i, &stamp, 4);
+        stamp = stamp * 1103515245u + 12345u;
+    }
+}
+
+// Drives the cache the way the track driver does: a miss is read from the
+// disk and filled in, a write goes to the cache and, with write-through,
+// to the disk as well. 200k mixed reads, writes and flushes.
+static void check_against_reference(uint32_t capacity, enum adf_cache_policy policy) {
+    memset(disk, 0, sizeof(disk));
+    memset(reference, 0, sizeof(reference));
+    writer_fails = false;
+    struct adf_block_cache* cache = adf_block_cache_create(capacity, policy, write_disk, NULL);
+    CHECK(cache != NULL);
+    if (!cache) {
+        return;
+    }
+    adf_block_cache_env_set_property(ADF_CACHE_PR_HITS, 0);
+    adf_block_cache_env_set_property(ADF_CACHE_PR_MISSES, 0);
+
+    uint64_t reads = 0;
+    uint8_t buf[BLOCK_SIZE];
+    for (uint32_t op = 0; op < 200000 && failures == 0; op++) {
+        // Mostly a small working set, as path lookups have, sometimes anywhere.
+        const uint32_t block = next_random() % 4 ? next_random() % 64 : next_random() % DISK_BLOCKS;
+        const uint32_t choice = next_random() % 1000;
+        if (choice < 550) {
+            reads++;
+            if (!adf_block_cache_read(cache, block, buf)) {
+                memcpy(buf, disk[block], BLOCK_SIZE);
+                CHECK(adf_block_cache_fill(cache, block, buf) == ADF_RC_OK);
+            }
+            CHECK(memcmp(buf, reference[block], BLOCK_SIZE) == 0);
+        } else if (choice < 997) {
+            fill_block(buf, op);
+            CHECK(adf_block_cache_write(cache, block, buf) == ADF_RC_OK);
+            if (policy == ADF_CACHE_WRITE_THROUGH) {
+                memcpy(disk[block], buf, BLOCK_SIZE);
+            }
+            memcpy(reference[block], buf, BLOCK_SIZE);
+        } else {
+            CHECK(adf_block_cache_flush(cache) == ADF_RC_OK);
+            CHECK(memcmp(disk, reference, sizeof(disk)) == 0);
+        }
+        CHECK(adf_block_cache_peek(cache, block, buf) ? memcmp(buf, reference[block], BLOCK_SIZE) == 0 : true);
+    }
+
+    struct adf_block_cache_stats stats;
+    adf_block_cache_get_stats(cache, &stats);
+    CHECK(stats.hits + stats.misses == reads);
+    CHECK(stats.cached_blocks <= capacity);
+    CHECK(policy == ADF_CACHE_WRITE_BACK || stats.dirty_blocks == 0);
+    CHECK((uint64_t)adf_block_cache_env_get_property(ADF_CACHE_PR_HITS) == stats.hits);
+    CHECK((uint64_t)adf_block_cache_env_get_property(ADF_CACHE_PR_MISSES) == stats.misses);
+
+    CHECK(adf_block_cache_flush(cache) == ADF_RC_OK);
+    CHECK(memcmp(disk, reference, sizeof(disk)) == 0);
+    adf_block_cache_destroy(cache);
+}
+
+// Dirty blocks go out sorted and merged; a failed flush keeps them dirty so
+// the next one writes them.
+static void test_write_back_runs(void) {
+    memset(disk, 0, sizeof(disk));
+    writer_fails = false;
+    struct adf_block_cache* cache = adf_block_cache_create(64, ADF_CACHE_WRITE_BACK, write_disk, NULL);
+    CHECK(cache != NULL);
+    if (!cache) {
+        return;
+    }
+    uint8_t buf[BLOCK_SIZE];
+    const uint32_t blocks[] = { 12, 10, 11, 40, 13, 41 };
+    for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++) {
+        fill_block(buf, blocks[i]);
+        CHECK(adf_block_cache_write(cache, blocks[i], buf) == ADF_RC_OK);
+    }
+    CHECK(disk[10][0] == 0 && disk[40][0] == 0);
+
+    writer_fails = true;
+    struct adf_block_cache_stats stats;
+    CHECK(adf_block_cache_flush(cache) != ADF_RC_OK);
+    adf_block_cache_get_stats(cache, &stats);
+    CHECK(stats.dirty_blocks == 6);
+
+    writer_fails = false;
+    writer_calls = 0;
+    CHECK(adf_block_cache_flush(cache) == ADF_RC_OK);
+    CHECK(writer_calls == 2); // 10-13 and 40-41
+    adf_block_cache_get_stats(cache, &stats);
+    CHECK(stats.dirty_blocks == 0);
+    for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++) {
+        fill_block(buf, blocks[i]);
+        CHECK(memcmp(disk[blocks[i]], buf, BLOCK_SIZE) == 0);
+    }
+    adf_block_cache_destroy(cache);
+}
+
+int main(void) {
+    const uint32_t capacities[] = { 1, 2, 7, 64, 512, 2048 };
+    for (size_t i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++) {
+        check_against_reference(capacities[i], ADF_CACHE_WRITE_THROUGH);
+        check_against_reference(capacities[i], ADF_CACHE_WRITE_BACK);
+    }
+    test_write_back_runs();
+    return test_result("test_block_cache");
+}
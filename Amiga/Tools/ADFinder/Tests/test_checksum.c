@@ -0,0 +1,62 @@
+//
+//  test_checksum.c
+//  ADFinder
+//
+
+#include "test_support.h"
+#include "adf_checksum.h"
+
+// adf_normal_sum(), adf_boot_sum() and adf_swap_endian() must give exactly
+// what ADFlib's loops give, for the kernel picked on this machine.
+
+#define ROUNDS 20000
+#define SWAP_TYPES 12
+
+static uint32_t rng_state = 2463534242u;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// Random bytes, and now and then all ones, where every carry is taken.
+static void fill_block(uint8_t* buf, size_t size, uint32_t round) {
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = (uint8_t)next_random();
+    }
+    if (round % 7 == 0) {
+        memset(buf, 0xFF, size);
+    }
+}
+
+int main(void) {
+    uint8_t buf[1024];
+    uint8_t ours[1024];     // the boot block, 1024 bytes, is the longest swap
+    uint8_t theirs[1024];
+    printf("checksum kernels: %s\n", adf_checksum_kernels());
+
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        fill_block(buf, sizeof(buf), round);
+
+        const int len = 4 * (int)(1 + next_random() % 256);
+        const int offset = 4 * (int)(next_random() % (uint32_t)(len / 4));
+        CHECK(adf_normal_sum(buf, offset, len) == adfNormalSum(buf, offset, len));
+        CHECK(adf_normal_sum(buf, 20, 512) == adfNormalSum(buf, 20, 512));
+        CHECK(adf_boot_sum(buf) == adfBootSum(buf));
+
+        const int type = (int)(round % SWAP_TYPES);
+        memcpy(ours, buf, sizeof(ours));
+        memcpy(theirs, buf, sizeof(theirs));
+        adf_swap_endian(ours, type);
+        adfSwapEndian(theirs, type);
+        CHECK(memcmp(ours, theirs, sizeof(ours)) == 0);
+        if (failures) {
+            fprintf(stderr, "first mismatch in round %u (len %d, offset %d, swap type %d)\n",
+                    round, len, offset, type);
+            break;
+        }
+    }
+    return test_result("test_checksum");
+}
@@ -0,0 +1,73 @@
+//
+//  test_dir_cache.c
+//  ADFinder
+//
+
+#include "test_support.h"
+#include "adf_dir_cache.h"
+#include <unistd.h>
+
+static char work_dir[] = "/tmp/adfinder-dir-cache-XXXXXX";
+
+// DIRCACHE hashes names the INTL way. On a DOS\1 volume "été" sits in the
+// chain of its ASCII-only hash, which an INTL lookup would not search, so
+// turning DIRCACHE on has to be refused.
+static void test_enable_refused_for_latin1_names(void) {
+    char image[256];
+    snprintf(image, sizeof(image), "%s/latin1.adf", work_dir);
+    struct AdfVolume* vol = test_create_floppy_fs(image, ADF_DOSFS_FFS);
+    CHECK(vol != NULL);
+    if (!vol) {
+        return;
+    }
+    const ADF_SECTNUM root = vol->rootBlock;
+    const ADF_SECTNUM file = test_write_file(vol, root, "\xe9t\xe9", 100);
+    CHECK(file > 0);
+
+    CHECK(!adf_dir_cache_can_enable(vol));
+    CHECK(adf_dir_cache_enable(vol, NULL) == ADF_RC_ERROR);
+    CHECK(!adfVolHasDIRCACHE(vol));
+    CHECK(adf_dir_cache_first_block(vol, root) == 0);
+    CHECK(adfGetEntryBlockNum(vol, root, "\xe9t\xe9") == file);
+    test_close_floppy(vol);
+}
+
+// With ASCII names only, both hashes agree and DIRCACHE goes on.
+static void test_enable_ascii_names(void) {
+    char image[256];
+    snprintf(image, sizeof(image), "%s/ascii.adf", work_dir);
+    struct AdfVolume* vol = test_create_floppy_fs(image, ADF_DOSFS_FFS);
+    CHECK(vol != NULL);
+    if (!vol) {
+        return;
+    }
+    const ADF_SECTNUM root = vol->rootBlock;
+    const ADF_SECTNUM dir = test_create_dir(vol, root, "Docs");
+    CHECK(dir > 0);
+    const ADF_SECTNUM file = test_write_file(vol, dir, "ReadMe", 700);
+    CHECK(file > 0);
+
+    CHECK(adf_dir_cache_can_enable(vol));
+    CHECK(adf_dir_cache_enable(vol, NULL) == ADF_RC_OK);
+    CHECK(adfUpdateBitmap(vol) == ADF_RC_OK);
+    CHECK(adfVolHasDIRCACHE(vol));
+    CHECK(adf_dir_cache_first_block(vol, root) > 0);
+    CHECK(adf_dir_cache_first_block(vol, dir) > 0);
+    CHECK(adfGetEntryBlockNum(vol, root, "docs") == dir);
+    CHECK(adfGetEntryBlockNum(vol, dir, "README") == file);
+    test_close_floppy(vol);
+}
+
+int main(void) {
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_enable_refused_for_latin1_names();
+    test_enable_ascii_names();
+
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf '%s'", work_dir);
+    system(command);
+    return test_result("test_dir_cache");
+}
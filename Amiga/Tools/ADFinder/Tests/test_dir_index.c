@@ -0,0 +1,56 @@
+//
+//  test_dir_index.c
+//  ADFinder
+//
+
+#include "test_support.h"
+#include "adf_dir_index.h"
+#include <unistd.h>
+
+static char work_dir[] = "/tmp/adfinder-dir-index-XXXXXX";
+
+// "été" and "ÉTÉ" in Latin-1: the same name on INTL and DIRCACHE volumes,
+// two different ones on the others.
+static const char latin1_lower[] = "\xe9t\xe9";
+static const char latin1_upper[] = "\xc9T\xc9";
+
+static void check_latin1_lookup(const char* image_name, uint8_t dos_type, bool folds) {
+    char image[256];
+    snprintf(image, sizeof(image), "%s/%s", work_dir, image_name);
+    struct AdfVolume* vol = test_create_floppy_fs(image, dos_type);
+    CHECK(vol != NULL);
+    if (!vol) {
+        return;
+    }
+    const ADF_SECTNUM root = vol->rootBlock;
+    const ADF_SECTNUM file = test_write_file(vol, root, latin1_lower, 100);
+    CHECK(file > 0);
+
+    struct adf_dir_index* index = adf_dir_index_create(vol);
+    CHECK(index != NULL);
+    if (index) {
+        int32_t type = 0;
+        CHECK(adf_dir_index_lookup(index, root, latin1_lower, &type) == file);
+        CHECK(type == ADF_ST_FILE);
+        CHECK(adf_dir_index_lookup(index, root, "\xc9t\xe9", NULL) == (folds ? file : -1));
+        CHECK(adf_dir_index_lookup(index, root, latin1_upper, NULL) == (folds ? file : -1));
+        CHECK(adf_dir_index_lookup(index, root, "ETE", NULL) == -1);
+        adf_dir_index_free(index);
+    }
+    test_close_floppy(vol);
+}
+
+int main(void) {
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    check_latin1_lookup("dos1.adf", ADF_DOSFS_FFS, false);
+    check_latin1_lookup("dos3.adf", ADF_DOSFS_FFS | ADF_DOSFS_INTL, true);
+    check_latin1_lookup("dos5.adf", ADF_DOSFS_FFS | ADF_DOSFS_DIRCACHE, true);
+
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf '%s'", work_dir);
+    system(command);
+    return test_result("test_dir_index");
+}
@@ -0,0 +1,163 @@
+//
+//  test_extract.c
+//  ADFinder
+//
+
+#include "test_support.h"
+#include "adf_extract.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char work_dir[] = "/tmp/adfinder-extract-XXXXXX";
+
+static bool host_exists(const char* relative) {
+    char path[256];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", work_dir, relative);
+    return stat(path, &st) == 0;
+}
+
+static mode_t host_mode(const char* relative) {
+    char path[256];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", work_dir, relative);
+    return stat(path, &st) == 0 ? st.st_mode & 0777 : (mode_t)-1;
+}
+
+static off_t host_size(const char* relative) {
+    char path[256];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", work_dir, relative);
+    return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+// Entries named "..", "." or with a '/' in their name must not be written
+// anywhere, least of all outside the extraction root.
+static void test_crafted_names(void) {
+    char image[256];
+    snprintf(image, sizeof(image), "%s/names.adf", work_dir);
+    struct AdfVolume* vol = test_create_floppy(image);
+    CHECK(vol != NULL);
+    if (!vol) {
+        return;
+    }
+    const ADF_SECTNUM root = vol->rootBlock;
+    const ADF_SECTNUM safe = test_create_dir(vol, root, "Safe");
+    CHECK(safe > 0 && test_write_file(vol, safe, "kept", 1000) > 0);
+
+    const ADF_SECTNUM up = test_create_dir(vol, root, "Up");
+    CHECK(up > 0 && test_write_file(vol, up, "payload", 600) > 0);
+    CHECK(test_rename_raw(vol, up, ".."));
+    const ADF_SECTNUM escaped = test_write_file(vol, root, "escaped", 300);
+    CHECK(escaped > 0 && test_rename_raw(vol, escaped, "../esc"));
+    const ADF_SECTNUM dot = test_write_file(vol, root, "dot", 100);
+    CHECK(dot > 0 && test_rename_raw(vol, dot, "."));
+
+    char host_dir[256];
+    snprintf(host_dir, sizeof(host_dir), "%s/out", work_dir);
+    const struct adf_extract_options options = { 2, 0, false, false, false };
+    struct adf_extract_stats stats;
+    CHECK(adf_extract_tree(vol, root, host_dir, &options, &stats) == ADF_RC_OK);
+    CHECK(stats.failed == 3);
+    CHECK(stats.files == 1);
+    CHECK(host_size("out/Safe/kept") == 1000);
+    CHECK(!host_exists("payload"));
+    CHECK(!host_exists("esc"));
+    CHECK(!host_exists("out/esc"));
+    test_close_floppy(vol);
+}
+
+// The Amiga R and W bits deny reading and writing; host bits grant them.
+static void test_permissions(void) {
+    char image[256];
+    snprintf(image, sizeof(image), "%s/modes.adf", work_dir);
+    struct AdfVolume* vol = test_create_floppy(image);
+    CHECK(vol != NULL);
+    if (!vol) {
+        return;
+    }
+    const ADF_SECTNUM root = vol->rootBlock;
+    CHECK(test_write_file(vol, root, "rw", 10) > 0);
+    CHECK(test_write_file(vol, root, "readonly", 10) > 0);
+    CHECK(test_write_file(vol, root, "writeonly", 10) > 0);
+    CHECK(test_write_file(vol, root, "none", 10) > 0);
+    CHECK(adfSetEntryAccess(vol, root, "readonly", ADF_ACCMASK_W) == ADF_RC_OK);
+    CHECK(adfSetEntryAccess(vol, root, "writeonly", ADF_ACCMASK_R) == ADF_RC_OK);
+    CHECK(adfSetEntryAccess(vol, root, "none", ADF_ACCMASK_R | ADF_ACCMASK_W) == ADF_RC_OK);
+
+    char host_dir[256];
+    snprintf(host_dir, sizeof(host_dir), "%s/modes", work_dir);
+    const struct adf_extract_options options = { 0, 0, false, true, false };
+    struct adf_extract_stats stats;
+    CHECK(adf_extract_tree(vol, root, host_dir, &options, &stats) == ADF_RC_OK);
+    CHECK(stats.files == 4 && stats.failed == 0);
+    CHECK(host_mode("modes/rw") == 0644);
+    CHECK(host_mode("modes/readonly") == 0444);
+    CHECK(host_mode("modes/writeonly") == 0200);
+    CHECK(host_mode("modes/none") == 0);
+    test_close_floppy(vol);
+}
+
+// A driver that fails every read covering one block and passes the rest on.
+static const struct AdfDeviceDriver* real_driver;
+static uint32_t bad_block;
+
+static ADF_RETCODE failing_read(const struct AdfDevice* const dev, const uint32_t block,
+                                const uint32_t len_blocks, uint8_t* const buf) {
+    if (bad_block >= block && bad_block < block + len_blocks) {
+        return ADF_RC_ERROR;
+    }
+    return real_driver->readSectors(dev, block, len_blocks, buf);
+}
+
+// A data block that cannot be read fails its file, not the extraction.
+static void test_read_error(void) {
+    char image[256];
+    snprintf(image, sizeof(image), "%s/bad.adf", work_dir);
+    struct AdfVolume* vol = test_create_floppy(image);
+    CHECK(vol != NULL);
+    if (!vol) {
+        return;
+    }
+    const ADF_SECTNUM root = vol->rootBlock;
+    CHECK(test_write_file(vol, root, "before", 2000) > 0);
+    const ADF_SECTNUM bad = test_write_file(vol, root, "bad", 2000);
+    CHECK(bad > 0);
+    CHECK(test_write_file(vol, root, "after", 2000) > 0);
+    struct AdfFileHeaderBlock fhdr;
+    CHECK(adfReadEntryBlock(vol, bad, (struct AdfEntryBlock*)&fhdr) == ADF_RC_OK);
+
+    struct AdfDeviceDriver driver = *vol->dev->drv;
+    driver.readSectors = failing_read;
+    real_driver = vol->dev->drv;
+    bad_block = (uint32_t)(vol->firstBlock + fhdr.dataBlocks[ADF_MAX_DATABLK - 2]);
+    vol->dev->drv = &driver;
+
+    char host_dir[256];
+    snprintf(host_dir, sizeof(host_dir), "%s/bad", work_dir);
+    const struct adf_extract_options options = { 1, 0, false, false, false };
+    struct adf_extract_stats stats;
+    CHECK(adf_extract_tree(vol, root, host_dir, &options, &stats) == ADF_RC_OK);
+    CHECK(stats.files == 2 && stats.failed == 1);
+    CHECK(host_size("bad/before") == 2000);
+    CHECK(host_size("bad/after") == 2000);
+    CHECK(!host_exists("bad/bad"));
+
+    vol->dev->drv = real_driver;
+    test_close_floppy(vol);
+}
+
+int main(void) {
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_crafted_names();
+    test_permissions();
+    test_read_error();
+
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf '%s'", work_dir);
+    system(command);
+    return test_result("test_extract");
+}
@@ -0,0 +1,87 @@
+//
+//  test_file_read.c
+//  ADFinder
+//
+
+#include "test_support.h"
+#include "adf_byteorder.h"
+#include "adf_checksum.h"
+#include "adf_file_read.h"
+#include <unistd.h>
+
+static char work_dir[] = "/tmp/adfinder-file-read-XXXXXX";
+
+// What test_write_file() writes.
+static bool has_pattern(const uint8_t* data, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        if (data[i] != (uint8_t)(i * 7 + 3)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Rewrites the third data block of file: its header key with another one
+// (checksum kept right), or a payload byte with the checksum left stale.
+static bool damage_data_block(struct AdfVolume* vol, ADF_SECTNUM file, bool wrong_key) {
+    struct AdfFileHeaderBlock fhdr;
+    if (adfReadEntryBlock(vol, file, (struct AdfEntryBlock*)&fhdr) != ADF_RC_OK) {
+        return false;
+    }
+    const ADF_SECTNUM sector = fhdr.dataBlocks[ADF_MAX_DATABLK - 3];
+    uint8_t block[512];
+    if (adfVolReadBlock(vol, (uint32_t)sector, block) != ADF_RC_OK) {
+        return false;
+    }
+    if (wrong_key) {
+        put_be32(block + 4, (uint32_t)vol->rootBlock);
+        put_be32(block + 20, adf_normal_sum(block, 20, 512));
+    } else {
+        block[100] ^= 0xff;
+    }
+    return adfVolWriteBlock(vol, (uint32_t)sector, block) == ADF_RC_OK;
+}
+
+// adf_file_read_all() on an OFS volume returns the data whole, and refuses
+// a file with a data block that fails adfFileRead()'s own checks.
+static void test_ofs_data_blocks_checked(void) {
+    char image[256];
+    snprintf(image, sizeof(image), "%s/ofs.adf", work_dir);
+    struct AdfVolume* vol = test_create_floppy(image);
+    CHECK(vol != NULL);
+    if (!vol) {
+        return;
+    }
+    const ADF_SECTNUM root = vol->rootBlock;
+    CHECK(test_write_file(vol, root, "good", 3000) > 0);
+    const ADF_SECTNUM foreign = test_write_file(vol, root, "foreign", 3000);
+    const ADF_SECTNUM stale = test_write_file(vol, root, "stale", 3000);
+    CHECK(foreign > 0 && stale > 0);
+    CHECK(damage_data_block(vol, foreign, true));
+    CHECK(damage_data_block(vol, stale, false));
+
+    uint8_t* data = NULL;
+    uint32_t size = 0;
+    CHECK(adf_file_read_all(vol, root, "good", &data, &size) == ADF_RC_OK);
+    CHECK(size == 3000 && data && has_pattern(data, size));
+    free(data);
+
+    CHECK(adf_file_read_all(vol, root, "foreign", &data, &size) == ADF_RC_ERROR);
+    CHECK(data == NULL && size == 0);
+    CHECK(adf_file_read_all(vol, root, "stale", &data, &size) == ADF_RC_ERROR);
+    CHECK(data == NULL && size == 0);
+    test_close_floppy(vol);
+}
+
+int main(void) {
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    test_ofs_data_blocks_checked();
+
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf '%s'", work_dir);
+    system(command);
+    return test_result("test_file_read");
+}
@@ -0,0 +1,112 @@
+//
+//  test_support.h
+//  ADFinder
+//
+
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include "adflib.h"
+#include "adf_dev_driver_dump.h"
+#include "adf_dir.h"
+#include "adf_file_block.h"
+#include "adf_extent_file.h"
+#include "adf_track_driver.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every test is a program that prints its failed checks and exits with
+// their count, so `make test` stops at the first one with a failure.
+
+static int failures;
+
+#define CHECK(cond)                                                                     \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);    \
+            failures++;                                                                 \
+        }                                                                               \
+    } while (0)
+
+static inline int test_result(const char* name) {
+    printf("%s: %s\n", name, failures ? "FAILED" : "ok");
+    return failures;
+}
+
+// A blank floppy image at path with the given ADF_DOSFS_* flags, opened
+// through the track driver as the app does when it cannot map a file, and
+// mounted read/write.
+static inline struct AdfVolume* test_create_floppy_fs(const char* path, uint8_t dos_type) {
+    if (adfLibInit() != ADF_RC_OK) {
+        return NULL;
+    }
+    adfAddDeviceDriver(&adfDeviceDriverDump);
+    register_track_driver_helper();
+    struct AdfDevice* dev = adfDevCreate(ADF_TRACK_DRIVER_NAME, path, 80, 2, 11);
+    if (!dev) {
+        return NULL;
+    }
+    if (adfCreateFlop(dev, "Test", dos_type) != ADF_RC_OK || adfDevMount(dev) != ADF_RC_OK) {
+        adfDevClose(dev);
+        return NULL;
+    }
+    return adfVolMount(dev, 0, ADF_ACCESS_MODE_READWRITE);
+}
+
+static inline struct AdfVolume* test_create_floppy(const char* path) {
+    return test_create_floppy_fs(path, ADF_DOSFS_OFS);
+}
+
+static inline void test_close_floppy(struct AdfVolume* vol) {
+    struct AdfDevice* dev = vol->dev;
+    adfVolUnMount(vol);
+    adf_track_device_flush(dev);
+    adfDevUnMount(dev);
+    adfDevClose(dev);
+    adfLibCleanUp();
+}
+
+// Writes size bytes of a repeating pattern to name in parent and returns its
+// header block, or 0.
+static inline ADF_SECTNUM test_write_file(struct AdfVolume* vol, ADF_SECTNUM parent, const char* name, uint32_t size) {
+    uint8_t* data = malloc(size ? size : 1);
+    if (!data) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * 7 + 3);
+    }
+    const ADF_RETCODE rc = adf_write_file_extents(vol, NULL, parent, name, data, size, ADF_EXTENT_FIRST_FIT);
+    free(data);
+    if (rc != ADF_RC_OK || adfUpdateBitmap(vol) != ADF_RC_OK) {
+        return 0;
+    }
+    return adfGetEntryBlockNum(vol, parent, name);
+}
+
+static inline ADF_SECTNUM test_create_dir(struct AdfVolume* vol, ADF_SECTNUM parent, const char* name) {
+    if (adfCreateDir(vol, parent, name) != ADF_RC_OK) {
+        return 0;
+    }
+    return adfGetEntryBlockNum(vol, parent, name);
+}
+
+// Renames an entry by rewriting its header block only, as a crafted image
+// would have it: no name checks, and it stays in the hash chain of its old name.
+static inline bool test_rename_raw(struct AdfVolume* vol, ADF_SECTNUM sector, const char* name) {
+    struct AdfEntryBlock entry;
+    if (adfReadEntryBlock(vol, sector, &entry) != ADF_RC_OK) {
+        return false;
+    }
+    memset(entry.name, 0, sizeof(entry.name));
+    entry.nameLen = (uint8_t)strlen(name);
+    memcpy(entry.name, name, entry.nameLen);
+    if (entry.secType == ADF_ST_DIR) {
+        return adfWriteDirBlock(vol, sector, (struct AdfDirBlock*)&entry) == ADF_RC_OK;
+    }
+    return adfWriteFileHdrBlock(vol, sector, (struct AdfFileHeaderBlock*)&entry) == ADF_RC_OK;
+}
+
+#endif /* TEST_SUPPORT_H */
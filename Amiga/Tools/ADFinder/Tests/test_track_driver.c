@@ -0,0 +1,128 @@
+//
+//  test_track_driver.c
+//  ADFinder
+//
+
+#include "test_support.h"
+#include "adf_track_driver.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define DISK_BLOCKS 1760
+#define BLOCK_SIZE 512
+#define MAX_RUN 40
+
+static char work_dir[] = "/tmp/adfinder-track-XXXXXX";
+
+static uint32_t rng_state = 0x6a09e667;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void fill_blocks(uint8_t* buf, uint32_t len_blocks, uint32_t stamp) {
+    for (uint32_t i = 0; i < len_blocks * BLOCK_SIZE; i += 4) {
+        memcpy(buf + i, &stamp, 4);
+        stamp = stamp * 1103515245u + 12345u;
+    }
+}
+
+// What the image file holds in blocks [first, first + count).
+static bool file_matches(int fd, const uint8_t* reference, uint32_t first, uint32_t count) {
+    static uint8_t file[DISK_BLOCKS * BLOCK_SIZE];
+    const size_t size = (size_t)count * BLOCK_SIZE;
+    return pread(fd, file, size, (off_t)first * BLOCK_SIZE) == (ssize_t)size &&
+           memcmp(file, reference + (size_t)first * BLOCK_SIZE, size) == 0;
+}
+
+// Mostly single blocks, as ADFlib asks for them, sometimes a run that may
+// cross tracks.
+static uint32_t random_length(void) {
+    return next_random() % 8 ? 1 : 1 + next_random() % MAX_RUN;
+}
+
+// 50k mixed reads, writes and flushes through the driver, checked against
+// a reference buffer; after a flush, and once the device is closed, the
+// image file has to hold the reference too.
+static void check_against_reference(const char* image, uint32_t cache_blocks, enum adf_cache_policy policy) {
+    adf_track_driver_set_cache(cache_blocks, policy);
+    struct AdfDevice* dev = adfDevCreate(ADF_TRACK_DRIVER_NAME, image, 80, 2, 11);
+    CHECK(dev != NULL);
+    if (!dev) {
+        return;
+    }
+    const int fd = open(image, O_RDONLY);
+    CHECK(fd >= 0);
+    uint8_t* reference = calloc(DISK_BLOCKS, BLOCK_SIZE);
+    uint8_t buf[MAX_RUN * BLOCK_SIZE];
+
+    for (uint32_t op = 0; op < 50000 && failures == 0; op++) {
+        const uint32_t len = random_length();
+        const uint32_t block = next_random() % (DISK_BLOCKS - len + 1);
+        const size_t offset = (size_t)block * BLOCK_SIZE;
+        const uint32_t choice = next_random() % 1000;
+        if (choice < 500) {
+            CHECK(adfDevReadBlock(dev, block, len * BLOCK_SIZE, buf) == ADF_RC_OK);
+            CHECK(memcmp(buf, reference + offset, (size_t)len * BLOCK_SIZE) == 0);
+        } else if (choice < 980) {
+            fill_blocks(buf, len, op);
+            CHECK(adfDevWriteBlock(dev, block, len * BLOCK_SIZE, buf) == ADF_RC_OK);
+            memcpy(reference + offset, buf, (size_t)len * BLOCK_SIZE);
+        } else if (choice < 995) {
+            CHECK(adf_track_device_flush(dev) == ADF_RC_OK);
+            const uint32_t first = next_random() % (DISK_BLOCKS - 64);
+            CHECK(file_matches(fd, reference, first, 64));
+        } else {
+            CHECK(adfDevReadBlock(dev, DISK_BLOCKS - 1, 2 * BLOCK_SIZE, buf) != ADF_RC_OK);
+        }
+    }
+    adfDevClose(dev);
+    CHECK(file_matches(fd, reference, 0, DISK_BLOCKS));
+
+    // And through a fresh read-only device, its cache starting empty.
+    dev = adfDevOpenWithDriver(ADF_TRACK_DRIVER_NAME, image, ADF_ACCESS_MODE_READONLY);
+    CHECK(dev != NULL);
+    for (uint32_t op = 0; dev && op < 5000 && failures == 0; op++) {
+        const uint32_t len = random_length();
+        const uint32_t block = next_random() % (DISK_BLOCKS - len + 1);
+        CHECK(adfDevReadBlock(dev, block, len * BLOCK_SIZE, buf) == ADF_RC_OK);
+        CHECK(memcmp(buf, reference + (size_t)block * BLOCK_SIZE, (size_t)len * BLOCK_SIZE) == 0);
+    }
+    if (dev) {
+        adfDevClose(dev);
+    }
+    free(reference);
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+int main(void) {
+    if (!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    if (adfLibInit() != ADF_RC_OK) {
+        return 1;
+    }
+    adfAddDeviceDriver(&adfDeviceDriverDump);
+    register_track_driver_helper();
+
+    char image[256];
+    snprintf(image, sizeof(image), "%s/track.adf", work_dir);
+    const uint32_t cache_sizes[] = { 1, 11, 64, ADF_TRACK_CACHE_DEFAULT_BLOCKS };
+    for (size_t i = 0; i < sizeof(cache_sizes) / sizeof(cache_sizes[0]); i++) {
+        check_against_reference(image, cache_sizes[i], ADF_CACHE_WRITE_THROUGH);
+        check_against_reference(image, cache_sizes[i], ADF_CACHE_WRITE_BACK);
+    }
+    adf_track_driver_set_cache(ADF_TRACK_CACHE_DEFAULT_BLOCKS, ADF_CACHE_WRITE_BACK);
+    adfLibCleanUp();
+
+    char command[300];
+    snprintf(command, sizeof(command), "rm -rf '%s'", work_dir);
+    system(command);
+    return test_result("test_track_driver");
+}
@@ -0,0 +1,1071 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// ANSI Color Codes
+#define ANSI_COLOR_CYAN    "\x1b[36m"
+#define ANSI_COLOR_RESET   "\x1b[0m"
+#define ANSI_COLOR_RED     "\x1b[31m"
+#define ANSI_COLOR_GREEN   "\x1b[32m"
+#define ANSI_COLOR_YELLOW  "\x1b[33m"
+
+// Global verbosity level
+int verbosity_level = 0;
+
+// Version information
+#define VERSION_MAJOR "0"
+#define VERSION_MINOR "1"
+
+/*
+ * Store layout.
+ *
+ * A store is a directory holding four files, each starting with a 16-byte
+ * header (8-byte magic, 8 bytes reserved). All integers are little-endian.
+ *
+ *   blocks     every distinct 512-byte sector, once, in the order first seen.
+ *              Block n is at HEADER_SIZE + n * 512.
+ *   hashes     the SHA-256 of each block, 32 bytes, in the same order. Only
+ *              read to rebuild the dedup table when a store is opened for add.
+ *   manifests  one uint32 block number per sector of every image, the images
+ *              one after another.
+ *   catalog    one 128-byte record per image: its name, its size, where its
+ *              manifest starts, and the block count of the store once it was
+ *              added.
+ *
+ * Sector s of an image is block manifests[manifest_start + s], so any sector
+ * of any image is two reads away, and two images in the same store hold the
+ * same data in a sector exactly when their manifests hold the same number
+ * there: they can be compared without reading a single block.
+ *
+ * Adding an image appends to blocks, hashes and manifests, syncs them, and
+ * only then appends the catalog record. The last record says how much of the
+ * other three files is in use; anything past that was left by an add that
+ * did not finish and is cut off the next time the store is opened for add.
+ * A store opened for add is locked (flock on blocks) until it is closed, so
+ * two adds to the same store run one after the other.
+ */
+#define SECTOR_SIZE     512
+#define HASH_SIZE       32
+#define HEADER_SIZE     16
+#define RECORD_SIZE     128
+#define NAME_SIZE       104         // including the terminating NUL
+#define CHUNK_SECTORS   2048        // sectors read, hashed and written at a time (1 MB)
+#define NO_BLOCK        UINT32_MAX
+
+enum store_file {
+    STORE_BLOCKS,
+    STORE_HASHES,
+    STORE_MANIFESTS,
+    STORE_CATALOG,
+    STORE_FILES
+};
+
+static const char *const store_file_names[STORE_FILES] = { "blocks", "hashes", "manifests", "catalog" };
+static const char store_magics[STORE_FILES][8] = {
+    { 'A', 'D', 'F', 'P', 'B', 'L', 'K', '1' },
+    { 'A', 'D', 'F', 'P', 'H', 'S', 'H', '1' },
+    { 'A', 'D', 'F', 'P', 'M', 'A', 'N', '1' },
+    { 'A', 'D', 'F', 'P', 'C', 'A', 'T', '1' },
+};
+
+// One image in the catalog.
+struct image_record {
+    char name[NAME_SIZE];
+    uint64_t size;              // bytes; the last sector is zero-padded in the store
+    uint64_t manifest_start;    // index of its first manifest entry
+    uint32_t new_blocks;        // blocks this image added to the store
+    uint32_t blocks_end;        // blocks in the store once it was added
+};
+
+struct store {
+    int fds[STORE_FILES];
+    bool writable;
+    struct image_record *images;
+    uint32_t num_images;
+    uint32_t images_capacity;
+    uint32_t num_blocks;
+    uint64_t num_entries;       // manifest entries in use
+
+    // Dedup table, only when writable: open addressing over block numbers,
+    // keyed by the hash kept for every block in hashes.
+    uint8_t *hashes;
+    uint32_t hashes_capacity;
+    uint32_t *table;            // block number + 1, 0 for an empty slot
+    uint32_t table_mask;
+};
+
+void debug_printf(int required_level, const char *format, ...) {
+    if (verbosity_level >= required_level) {
+        va_list args;
+        if (required_level == 1 && verbosity_level == 1) {
+            fprintf(stderr, ANSI_COLOR_YELLOW "[INFO]  " ANSI_COLOR_RESET);
+        } else if (verbosity_level >= 2) {
+             fprintf(stderr, ANSI_COLOR_YELLOW "[DEBUG] " ANSI_COLOR_RESET);
+        }
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+    }
+}
+
+static void error_printf(const char *format, ...) {
+    va_list args;
+    fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+char* get_build_date() {
+    static char build_date_str[9];
+    time_t t = time(NULL);
+    struct tm *tm_info = localtime(&t);
+    strftime(build_date_str, sizeof(build_date_str), "%Y%m%d", tm_info);
+    return build_date_str;
+}
+
+void print_usage(const char *prog_name) {
+    char* build_date = get_build_date();
+    printf(ANSI_COLOR_CYAN "Pack ADF Images by x.com/WINDRAGO. Version %s.%s build (%s)\n" ANSI_COLOR_RESET,
+           VERSION_MAJOR, VERSION_MINOR, build_date);
+    printf("Usage: %s [-v] add     <store> <image> [image ...]\n", prog_name);
+    printf("       %s [-v] extract <store> <name> [output]\n", prog_name);
+    printf("       %s [-v] read    <store> <name> <sector> [count]\n", prog_name);
+    printf("       %s [-v] diff    <store> <name1> <name2>\n", prog_name);
+    printf("       %s [-v] list    <store>\n", prog_name);
+    printf("Commands:\n");
+    printf("  add       Add disk images (ADF, HDF, any multiple of 512 bytes) to the store, creating it\n");
+    printf("            if needed. Each image is named after its file; each distinct sector is stored once.\n");
+    printf("  extract   Write an image back out, byte for byte (default output: its name).\n");
+    printf("  read      Write <count> sectors (default 1) of an image, from <sector> on, to stdout.\n");
+    printf("  diff      List the runs of identical and different sectors of two images in the store.\n");
+    printf("            Exit code 0 if they are identical, 1 if they differ.\n");
+    printf("  list      List the images in the store and how much space they share.\n");
+    printf("Options:\n");
+    printf("  -v, --verbose              Enable verbose messages. Use -vv for extensive debug.\n");
+    printf("  -h, --help                 Display this help message.\n");
+    printf("Example:\n");
+    printf("  %s add games.adfpack *.adf\n", prog_name);
+    printf("  %s diff games.adfpack Turrican.adf Turrican_cr.adf\n", prog_name);
+    printf("  %s extract games.adfpack Turrican.adf /tmp/Turrican.adf\n", prog_name);
+}
+
+// MARK: - Little-endian fields
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    return (uint64_t)get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+// MARK: - SHA-256
+
+struct sha256 {
+    uint32_t state[8];
+};
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress(struct sha256 *ctx, const uint8_t *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        const uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+    for (int i = 0; i < 64; i++) {
+        const uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        const uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+// Hash of one sector. The length is fixed, so the padding block is too.
+static void sha256_sector(const uint8_t *sector, uint8_t *digest) {
+    struct sha256 ctx = { { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 } };
+    for (int i = 0; i < SECTOR_SIZE; i += 64) {
+        sha256_compress(&ctx, sector + i);
+    }
+    uint8_t padding[64] = { 0x80 };
+    padding[62] = (uint8_t)((SECTOR_SIZE * 8) >> 8); // message length in bits, big-endian
+    padding[63] = (uint8_t)(SECTOR_SIZE * 8);
+    sha256_compress(&ctx, padding);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (uint8_t)(ctx.state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(ctx.state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(ctx.state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)ctx.state[i];
+    }
+}
+
+// MARK: - File I/O
+
+static bool pread_full(int fd, void *buf, size_t len, uint64_t offset) {
+    uint8_t *p = buf;
+    while (len > 0) {
+        const ssize_t n = pread(fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+static bool pwrite_full(int fd, const void *buf, size_t len, uint64_t offset) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        const ssize_t n = pwrite(fd, p, len, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return true;
+}
+
+// Reads up to len bytes; fewer only at end of file. Returns -1 on error.
+static ssize_t read_full(int fd, void *buf, size_t len) {
+    uint8_t *p = buf;
+    size_t done = 0;
+    while (done < len) {
+        const ssize_t n = read(fd, p + done, len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+static bool write_full(int fd, const void *buf, size_t len) {
+    const uint8_t *p = buf;
+    while (len > 0) {
+        const ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static uint64_t block_offset(uint32_t block) {
+    return HEADER_SIZE + (uint64_t)block * SECTOR_SIZE;
+}
+
+static uint64_t entry_offset(uint64_t entry) {
+    return HEADER_SIZE + entry * 4;
+}
+
+static uint64_t image_sectors(const struct image_record *image) {
+    return (image->size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+// Returns a malloc'd copy of the last path component (trailing slashes ignored).
+static char* get_basename(const char *path) {
+    size_t end = strlen(path);
+    while (end > 1 && path[end - 1] == '/') {
+        end--;
+    }
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+    char *result = strndup(path + start, end - start);
+    if (!result) {
+        perror("strndup failed for basename result");
+    }
+    return result;
+}
+
+// MARK: - Dedup table
+
+static uint32_t hash_slot(const struct store *s, const uint8_t *hash) {
+    uint32_t key;
+    memcpy(&key, hash, sizeof(key)); // SHA-256 bits are as good as any
+    return key & s->table_mask;
+}
+
+static uint32_t find_block(const struct store *s, const uint8_t *hash) {
+    for (uint32_t slot = hash_slot(s, hash); s->table[slot] != 0; slot = (slot + 1) & s->table_mask) {
+        const uint32_t block = s->table[slot] - 1;
+        if (memcmp(s->hashes + (size_t)block * HASH_SIZE, hash, HASH_SIZE) == 0) {
+            return block;
+        }
+    }
+    return NO_BLOCK;
+}
+
+static void insert_block(struct store *s, uint32_t block) {
+    uint32_t slot = hash_slot(s, s->hashes + (size_t)block * HASH_SIZE);
+    while (s->table[slot] != 0) {
+        slot = (slot + 1) & s->table_mask;
+    }
+    s->table[slot] = block + 1;
+}
+
+static bool reserve_hashes(struct store *s, uint32_t blocks) {
+    if (blocks <= s->hashes_capacity) {
+        return true;
+    }
+    uint32_t capacity = s->hashes_capacity ? s->hashes_capacity : 4096;
+    while (capacity < blocks) {
+        capacity = capacity > UINT32_MAX / 2 ? UINT32_MAX : capacity * 2;
+    }
+    uint8_t *hashes = realloc(s->hashes, (size_t)capacity * HASH_SIZE);
+    if (!hashes) return false;
+    s->hashes = hashes;
+    s->hashes_capacity = capacity;
+    return true;
+}
+
+// Keeps the table at most half full for the blocks to come; a new table is
+// filled with the blocks already in the store, so their hashes must be in.
+static bool reserve_table(struct store *s, uint32_t blocks) {
+    uint64_t size = s->table ? (uint64_t)s->table_mask + 1 : 8192;
+    if (s->table && (uint64_t)blocks * 2 <= size) {
+        return true;
+    }
+    while ((uint64_t)blocks * 2 > size) {
+        size *= 2;
+    }
+    if (size > ((uint64_t)1 << 32)) {
+        return false;
+    }
+    uint32_t *table = calloc((size_t)size, sizeof(*table));
+    if (!table) return false;
+    free(s->table);
+    s->table = table;
+    s->table_mask = (uint32_t)(size - 1);
+    for (uint32_t block = 0; block < s->num_blocks; block++) {
+        insert_block(s, block);
+    }
+    return true;
+}
+
+static bool reserve_blocks(struct store *s, uint32_t blocks) {
+    return blocks < NO_BLOCK && reserve_hashes(s, blocks) && reserve_table(s, blocks);
+}
+
+// MARK: - Store
+
+static void store_close(struct store *s) {
+    if (!s) return;
+    for (int i = 0; i < STORE_FILES; i++) {
+        if (s->fds[i] >= 0) close(s->fds[i]);
+    }
+    free(s->images);
+    free(s->hashes);
+    free(s->table);
+    free(s);
+}
+
+static void decode_record(const uint8_t *p, struct image_record *image) {
+    memcpy(image->name, p, NAME_SIZE);
+    image->name[NAME_SIZE - 1] = '\0';
+    image->size = get_le64(p + NAME_SIZE);
+    image->manifest_start = get_le64(p + NAME_SIZE + 8);
+    image->new_blocks = get_le32(p + NAME_SIZE + 16);
+    image->blocks_end = get_le32(p + NAME_SIZE + 20);
+}
+
+static void encode_record(const struct image_record *image, uint8_t *p) {
+    memset(p, 0, RECORD_SIZE);
+    memcpy(p, image->name, NAME_SIZE);
+    put_le64(p + NAME_SIZE, image->size);
+    put_le64(p + NAME_SIZE + 8, image->manifest_start);
+    put_le32(p + NAME_SIZE + 16, image->new_blocks);
+    put_le32(p + NAME_SIZE + 20, image->blocks_end);
+}
+
+static bool create_store_dir(const char *dir) {
+    if (mkdir(dir, 0755) == -1) {
+        error_printf("Cannot create store '%s': %s\n", dir, strerror(errno));
+        return false;
+    }
+    for (int i = 0; i < STORE_FILES; i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, store_file_names[i]);
+        const int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        uint8_t header[HEADER_SIZE] = { 0 };
+        memcpy(header, store_magics[i], sizeof(store_magics[i]));
+        const bool ok = fd >= 0 && write_full(fd, header, sizeof(header)) && fsync(fd) == 0;
+        if (fd >= 0) close(fd);
+        if (!ok) {
+            error_printf("Cannot create '%s': %s\n", path, strerror(errno));
+            return false;
+        }
+    }
+    debug_printf(1, "Created store %s\n", dir);
+    return true;
+}
+
+// Waits for any other add to the store to finish. Readers take no lock: an
+// add only appends, and cuts off nothing the catalog refers to.
+static bool lock_store(int fd, const char *dir) {
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) return true;
+    if (errno == EWOULDBLOCK) {
+        debug_printf(1, "Waiting for another add to %s to finish\n", dir);
+        if (flock(fd, LOCK_EX) == 0) return true;
+    }
+    error_printf("Cannot lock store '%s': %s\n", dir, strerror(errno));
+    return false;
+}
+
+// Reads the catalog. When opened for add, also cuts off what an unfinished
+// add left behind and loads the block hashes into the dedup table.
+static struct store *store_open(const char *dir, bool writable, bool create) {
+    struct stat dir_stat;
+    if (create && stat(dir, &dir_stat) == -1 && errno == ENOENT && !create_store_dir(dir)) {
+        return NULL;
+    }
+
+    struct store *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->writable = writable;
+    for (int i = 0; i < STORE_FILES; i++) {
+        s->fds[i] = -1;
+    }
+
+    uint64_t file_sizes[STORE_FILES];
+    for (int i = 0; i < STORE_FILES; i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, store_file_names[i]);
+        s->fds[i] = open(path, writable ? O_RDWR : O_RDONLY);
+        uint8_t header[HEADER_SIZE];
+        struct stat file_stat;
+        if (s->fds[i] < 0 || fstat(s->fds[i], &file_stat) == -1) {
+            error_printf("Cannot open '%s': %s\n", path, strerror(errno));
+            store_close(s);
+            return NULL;
+        }
+        // blocks is opened first; its lock covers the sizes read from here on.
+        if (writable && i == STORE_BLOCKS && (!lock_store(s->fds[i], dir) || fstat(s->fds[i], &file_stat) == -1)) {
+            store_close(s);
+            return NULL;
+        }
+        if (!pread_full(s->fds[i], header, sizeof(header), 0) ||
+            memcmp(header, store_magics[i], sizeof(store_magics[i])) != 0) {
+            error_printf("'%s' is not part of an adfpack store.\n", path);
+            store_close(s);
+            return NULL;
+        }
+        file_sizes[i] = (uint64_t)file_stat.st_size;
+    }
+
+    // A partial record at the end is an add that did not finish.
+    const uint64_t records = (file_sizes[STORE_CATALOG] - HEADER_SIZE) / RECORD_SIZE;
+    if (records > UINT32_MAX) {
+        error_printf("Catalog of '%s' is too large.\n", dir);
+        store_close(s);
+        return NULL;
+    }
+    s->num_images = (uint32_t)records;
+    s->images_capacity = s->num_images + 16;
+    s->images = calloc(s->images_capacity, sizeof(*s->images));
+    uint8_t *catalog = malloc((size_t)records * RECORD_SIZE + 1);
+    if (!s->images || !catalog || !pread_full(s->fds[STORE_CATALOG], catalog, (size_t)records * RECORD_SIZE, HEADER_SIZE)) {
+        error_printf("Cannot read the catalog of '%s'.\n", dir);
+        free(catalog);
+        store_close(s);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < s->num_images; i++) {
+        decode_record(catalog + (size_t)i * RECORD_SIZE, &s->images[i]);
+    }
+    free(catalog);
+
+    if (s->num_images > 0) {
+        const struct image_record *last = &s->images[s->num_images - 1];
+        s->num_blocks = last->blocks_end;
+        s->num_entries = last->manifest_start + image_sectors(last);
+    }
+    const uint64_t used_sizes[STORE_FILES] = {
+        block_offset(s->num_blocks),
+        HEADER_SIZE + (uint64_t)s->num_blocks * HASH_SIZE,
+        entry_offset(s->num_entries),
+        HEADER_SIZE + (uint64_t)s->num_images * RECORD_SIZE
+    };
+    for (int i = 0; i < STORE_FILES; i++) {
+        if (file_sizes[i] < used_sizes[i]) {
+            error_printf("Store '%s' is damaged: '%s' is shorter than its catalog says.\n", dir, store_file_names[i]);
+            store_close(s);
+            return NULL;
+        }
+        if (writable && file_sizes[i] > used_sizes[i]) {
+            debug_printf(1, "Dropping %llu bytes of an unfinished add from %s\n",
+                         (unsigned long long)(file_sizes[i] - used_sizes[i]), store_file_names[i]);
+            if (ftruncate(s->fds[i], (off_t)used_sizes[i]) == -1) {
+                error_printf("Cannot truncate '%s': %s\n", store_file_names[i], strerror(errno));
+                store_close(s);
+                return NULL;
+            }
+        }
+    }
+
+    if (writable) {
+        if (!reserve_hashes(s, s->num_blocks + CHUNK_SECTORS) ||
+            !pread_full(s->fds[STORE_HASHES], s->hashes, (size_t)s->num_blocks * HASH_SIZE, HEADER_SIZE) ||
+            !reserve_table(s, s->num_blocks + CHUNK_SECTORS)) {
+            error_printf("Cannot load the block hashes of '%s'.\n", dir);
+            store_close(s);
+            return NULL;
+        }
+    }
+    debug_printf(2, "Opened store %s: %u images, %u blocks, %llu manifest entries\n",
+                 dir, s->num_images, s->num_blocks, (unsigned long long)s->num_entries);
+    return s;
+}
+
+static const struct image_record *find_image(const struct store *s, const char *name) {
+    for (uint32_t i = 0; i < s->num_images; i++) {
+        if (strcmp(s->images[i].name, name) == 0) {
+            return &s->images[i];
+        }
+    }
+    return NULL;
+}
+
+// Reads count manifest entries of an image, from sector first on.
+static bool read_manifest(const struct store *s, const struct image_record *image, uint64_t first,
+                          uint32_t count, uint32_t *blocks) {
+    uint8_t raw[CHUNK_SECTORS * 4];
+    if (count > CHUNK_SECTORS ||
+        !pread_full(s->fds[STORE_MANIFESTS], raw, (size_t)count * 4, entry_offset(image->manifest_start + first))) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        blocks[i] = get_le32(raw + i * 4);
+        if (blocks[i] >= s->num_blocks) {
+            error_printf("Manifest of '%s' points past the end of the store.\n", image->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Reads count sectors of an image, from sector first on, into data. Blocks
+// stored next to each other are read with one call, which for an image added
+// to a store that had little in common with it is most of them.
+static bool read_sectors(const struct store *s, const struct image_record *image, uint64_t first,
+                         uint32_t count, uint8_t *data) {
+    uint32_t blocks[CHUNK_SECTORS];
+    if (!read_manifest(s, image, first, count, blocks)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; ) {
+        uint32_t run = 1;
+        while (i + run < count && blocks[i + run] == blocks[i] + run) {
+            run++;
+        }
+        if (!pread_full(s->fds[STORE_BLOCKS], data + (size_t)i * SECTOR_SIZE, (size_t)run * SECTOR_SIZE,
+                        block_offset(blocks[i]))) {
+            error_printf("Cannot read block %u: %s\n", blocks[i], strerror(errno));
+            return false;
+        }
+        i += run;
+    }
+    return true;
+}
+
+// Puts the in-memory state back as it was before a failed add; the files
+// are cut back here or, failing that, the next time the store is opened.
+static void rollback_add(struct store *s, uint32_t num_blocks) {
+    s->num_blocks = num_blocks;
+    memset(s->table, 0, ((size_t)s->table_mask + 1) * sizeof(*s->table));
+    for (uint32_t block = 0; block < s->num_blocks; block++) {
+        insert_block(s, block);
+    }
+    if (ftruncate(s->fds[STORE_BLOCKS], (off_t)block_offset(s->num_blocks)) == -1 ||
+        ftruncate(s->fds[STORE_HASHES], (off_t)(HEADER_SIZE + (uint64_t)s->num_blocks * HASH_SIZE)) == -1 ||
+        ftruncate(s->fds[STORE_MANIFESTS], (off_t)entry_offset(s->num_entries)) == -1 ||
+        ftruncate(s->fds[STORE_CATALOG], (off_t)(HEADER_SIZE + (uint64_t)s->num_images * RECORD_SIZE)) == -1) {
+        debug_printf(1, "Could not cut back the store after a failed add: %s\n", strerror(errno));
+    }
+}
+
+// MARK: - Commands
+
+// Hashes the image 2048 sectors at a time. Sectors the store already holds
+// only get a manifest entry; new ones are appended to blocks (and their
+// hashes to hashes) at the end of each chunk, in one write per file.
+static bool add_image(struct store *s, const char *path) {
+    char *name = get_basename(path);
+    if (!name) return false;
+    if (strlen(name) >= NAME_SIZE) {
+        error_printf("Image name '%s' is too long (at most %d characters).\n", name, NAME_SIZE - 1);
+        free(name);
+        return false;
+    }
+    if (find_image(s, name)) {
+        error_printf("The store already holds an image named '%s'.\n", name);
+        free(name);
+        return false;
+    }
+
+    const int fd = open(path, O_RDONLY);
+    struct stat image_stat;
+    if (fd < 0 || fstat(fd, &image_stat) == -1 || !S_ISREG(image_stat.st_mode)) {
+        error_printf("Cannot read image '%s': %s\n", path, fd < 0 ? strerror(errno) : "not a regular file");
+        if (fd >= 0) close(fd);
+        free(name);
+        return false;
+    }
+    if (image_stat.st_size % SECTOR_SIZE != 0) {
+        debug_printf(1, "%s is not a whole number of sectors; the last one is padded in the store\n", name);
+    }
+
+    uint8_t *data = malloc((size_t)CHUNK_SECTORS * SECTOR_SIZE);
+    uint8_t *new_data = malloc((size_t)CHUNK_SECTORS * SECTOR_SIZE);
+    uint8_t manifest[CHUNK_SECTORS * 4];
+    const uint32_t blocks_start = s->num_blocks;
+    uint64_t size = 0;
+    bool ok = data && new_data;
+
+    while (ok) {
+        const ssize_t got = read_full(fd, data, (size_t)CHUNK_SECTORS * SECTOR_SIZE);
+        if (got < 0) {
+            error_printf("Cannot read image '%s': %s\n", path, strerror(errno));
+            ok = false;
+            break;
+        }
+        if (got == 0) break;
+        const uint32_t sectors = (uint32_t)(((size_t)got + SECTOR_SIZE - 1) / SECTOR_SIZE);
+        memset(data + got, 0, (size_t)sectors * SECTOR_SIZE - (size_t)got);
+
+        if (!reserve_blocks(s, s->num_blocks + sectors)) {
+            error_printf("The store is full or out of memory.\n");
+            ok = false;
+            break;
+        }
+        const uint32_t chunk_start = s->num_blocks;
+        for (uint32_t i = 0; i < sectors; i++) {
+            const uint8_t *sector = data + (size_t)i * SECTOR_SIZE;
+            uint8_t *hash = s->hashes + (size_t)s->num_blocks * HASH_SIZE;
+            sha256_sector(sector, hash);
+            uint32_t block = find_block(s, hash);
+            if (block == NO_BLOCK) {
+                block = s->num_blocks++;
+                memcpy(new_data + (size_t)(block - chunk_start) * SECTOR_SIZE, sector, SECTOR_SIZE);
+                insert_block(s, block);
+            }
+            put_le32(manifest + i * 4, block);
+        }
+
+        const uint32_t added = s->num_blocks - chunk_start;
+        const uint64_t first_entry = s->num_entries + size / SECTOR_SIZE;
+        ok = pwrite_full(s->fds[STORE_BLOCKS], new_data, (size_t)added * SECTOR_SIZE, block_offset(chunk_start)) &&
+             pwrite_full(s->fds[STORE_HASHES], s->hashes + (size_t)chunk_start * HASH_SIZE, (size_t)added * HASH_SIZE,
+                         HEADER_SIZE + (uint64_t)chunk_start * HASH_SIZE) &&
+             pwrite_full(s->fds[STORE_MANIFESTS], manifest, (size_t)sectors * 4, entry_offset(first_entry));
+        if (!ok) {
+            error_printf("Cannot write to the store: %s\n", strerror(errno));
+        }
+        size += (uint64_t)got;
+        if ((size_t)got < (size_t)CHUNK_SECTORS * SECTOR_SIZE) break;
+    }
+    close(fd);
+    free(data);
+    free(new_data);
+
+    if (ok) {
+        ok = fsync(s->fds[STORE_BLOCKS]) == 0 && fsync(s->fds[STORE_HASHES]) == 0 && fsync(s->fds[STORE_MANIFESTS]) == 0;
+    }
+    // Room for the record first: once it is on disk the add cannot be undone.
+    if (ok && s->num_images == s->images_capacity) {
+        struct image_record *images = realloc(s->images, (size_t)s->images_capacity * 2 * sizeof(*images));
+        if (images) {
+            s->images = images;
+            s->images_capacity *= 2;
+        } else {
+            ok = false;
+            error_printf("Out of memory.\n");
+        }
+    }
+    struct image_record image;
+    if (ok) {
+        memset(&image, 0, sizeof(image));
+        strcpy(image.name, name);
+        image.size = size;
+        image.manifest_start = s->num_entries;
+        image.new_blocks = s->num_blocks - blocks_start;
+        image.blocks_end = s->num_blocks;
+
+        uint8_t record[RECORD_SIZE];
+        encode_record(&image, record);
+        ok = pwrite_full(s->fds[STORE_CATALOG], record, sizeof(record),
+                         HEADER_SIZE + (uint64_t)s->num_images * RECORD_SIZE) &&
+             fsync(s->fds[STORE_CATALOG]) == 0;
+        if (!ok) {
+            error_printf("Cannot write to the catalog: %s\n", strerror(errno));
+        }
+    }
+    if (!ok) {
+        rollback_add(s, blocks_start);
+        free(name);
+        return false;
+    }
+
+    s->images[s->num_images++] = image;
+    s->num_entries += image_sectors(&image);
+    const uint64_t sectors = image_sectors(&image);
+    printf("Added %s: %llu sectors, %u new (%.1f%% shared)\n", name, (unsigned long long)sectors, image.new_blocks,
+           sectors ? 100.0 * (double)(sectors - image.new_blocks) / (double)sectors : 100.0);
+    free(name);
+    return true;
+}
+
+struct named_path {
+    char *name;
+    int index;
+};
+
+static int compare_named_paths(const void *a, const void *b) {
+    const struct named_path *pa = a, *pb = b;
+    int order = strcmp(pa->name, pb->name);
+    return order ? order : pa->index - pb->index;
+}
+
+// Images are named after their file, so a/disk.adf and b/disk.adf cannot
+// both go into a store. Such an add is refused before anything is stored.
+static bool check_distinct_names(char **paths, int num_paths) {
+    struct named_path *names = calloc((size_t)num_paths, sizeof(*names));
+    bool ok = names != NULL;
+    if (!ok) error_printf("Out of memory.\n");
+    for (int i = 0; ok && i < num_paths; i++) {
+        names[i].index = i;
+        names[i].name = get_basename(paths[i]);
+        ok = names[i].name != NULL;
+    }
+    if (ok) {
+        qsort(names, (size_t)num_paths, sizeof(*names), compare_named_paths);
+        for (int i = 1; i < num_paths; i++) {
+            if (strcmp(names[i - 1].name, names[i].name) == 0) {
+                error_printf("'%s' and '%s' would both be named '%s' in the store.\n",
+                             paths[names[i - 1].index], paths[names[i].index], names[i].name);
+                ok = false;
+            }
+        }
+    }
+    for (int i = 0; names && i < num_paths; i++) {
+        free(names[i].name);
+    }
+    free(names);
+    return ok;
+}
+
+static int command_add(const char *store_dir, char **paths, int num_paths) {
+    if (!check_distinct_names(paths, num_paths)) return EXIT_FAILURE;
+    struct store *s = store_open(store_dir, true, true);
+    if (!s) return EXIT_FAILURE;
+    int failed = 0;
+    for (int i = 0; i < num_paths; i++) {
+        if (!add_image(s, paths[i])) {
+            failed++;
+        }
+    }
+    debug_printf(1, "Store now holds %u images in %u blocks\n", s->num_images, s->num_blocks);
+    store_close(s);
+    if (failed) {
+        fprintf(stderr, ANSI_COLOR_RED "%d of %d images could not be added." ANSI_COLOR_RESET "\n", failed, num_paths);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Copies an image out of the store, CHUNK_SECTORS at a time, to fd.
+static bool write_image(const struct store *s, const struct image_record *image, uint64_t first,
+                        uint64_t count, int fd) {
+    uint8_t *data = malloc((size_t)CHUNK_SECTORS * SECTOR_SIZE);
+    bool ok = data != NULL;
+    for (uint64_t sector = first; ok && sector < first + count; ) {
+        const uint32_t n = (uint32_t)(first + count - sector < CHUNK_SECTORS ? first + count - sector : CHUNK_SECTORS);
+        ok = read_sectors(s, image, sector, n, data);
+        if (ok) {
+            // The store pads the last sector; the image does not.
+            uint64_t bytes = (uint64_t)n * SECTOR_SIZE;
+            if ((sector + n) * SECTOR_SIZE > image->size) {
+                bytes = image->size - sector * SECTOR_SIZE;
+            }
+            ok = write_full(fd, data, (size_t)bytes);
+            if (!ok) {
+                error_printf("Cannot write: %s\n", strerror(errno));
+            }
+        }
+        sector += n;
+    }
+    free(data);
+    return ok;
+}
+
+static int command_extract(const char *store_dir, const char *name, const char *output) {
+    struct store *s = store_open(store_dir, false, false);
+    if (!s) return EXIT_FAILURE;
+    const struct image_record *image = find_image(s, name);
+    if (!image) {
+        error_printf("No image named '%s' in the store.\n", name);
+        store_close(s);
+        return EXIT_FAILURE;
+    }
+
+    // Written next to the output and renamed over it once complete.
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.adfpack-tmp", output);
+    const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error_printf("Cannot create '%s': %s\n", tmp_path, strerror(errno));
+        store_close(s);
+        return EXIT_FAILURE;
+    }
+    bool ok = write_image(s, image, 0, image_sectors(image), fd);
+    if (ok && fsync(fd) == -1) ok = false;
+    if (close(fd) == -1) ok = false;
+    if (ok && rename(tmp_path, output) == -1) {
+        error_printf("Cannot rename '%s' to '%s': %s\n", tmp_path, output, strerror(errno));
+        ok = false;
+    }
+    if (!ok) {
+        unlink(tmp_path);
+    } else {
+        debug_printf(1, "Extracted %s (%llu bytes) to %s\n", name, (unsigned long long)image->size, output);
+    }
+    store_close(s);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int command_read(const char *store_dir, const char *name, const char *first_arg, const char *count_arg) {
+    char *end;
+    const unsigned long long first = strtoull(first_arg, &end, 0);
+    if (*end != '\0') {
+        error_printf("Invalid sector '%s'.\n", first_arg);
+        return EXIT_FAILURE;
+    }
+    unsigned long long count = 1;
+    if (count_arg) {
+        count = strtoull(count_arg, &end, 0);
+        if (*end != '\0' || count == 0) {
+            error_printf("Invalid sector count '%s'.\n", count_arg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    struct store *s = store_open(store_dir, false, false);
+    if (!s) return EXIT_FAILURE;
+    const struct image_record *image = find_image(s, name);
+    if (!image) {
+        error_printf("No image named '%s' in the store.\n", name);
+        store_close(s);
+        return EXIT_FAILURE;
+    }
+    const uint64_t sectors = image_sectors(image);
+    if (first >= sectors || count > sectors - first) {
+        error_printf("'%s' has %llu sectors.\n", name, (unsigned long long)sectors);
+        store_close(s);
+        return EXIT_FAILURE;
+    }
+    const bool ok = write_image(s, image, first, count, STDOUT_FILENO);
+    store_close(s);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void print_run(const char *what, uint64_t start, uint64_t end) {
+    printf("%-9s %8llu-%-8llu (%llu sectors)\n", what, (unsigned long long)start,
+           (unsigned long long)(end - 1), (unsigned long long)(end - start));
+}
+
+// Compares two manifests. Equal block numbers are equal contents, so no
+// block is read; sectors past the end of the shorter image are listed as
+// only in the longer one.
+static int command_diff(const char *store_dir, const char *name1, const char *name2) {
+    struct store *s = store_open(store_dir, false, false);
+    if (!s) return 2;
+    const struct image_record *images[2] = { find_image(s, name1), find_image(s, name2) };
+    for (int i = 0; i < 2; i++) {
+        if (!images[i]) {
+            error_printf("No image named '%s' in the store.\n", i ? name2 : name1);
+            store_close(s);
+            return 2;
+        }
+    }
+
+    const uint64_t sectors1 = image_sectors(images[0]);
+    const uint64_t sectors2 = image_sectors(images[1]);
+    const uint64_t common = sectors1 < sectors2 ? sectors1 : sectors2;
+    uint32_t blocks1[CHUNK_SECTORS];
+    uint32_t blocks2[CHUNK_SECTORS];
+    uint64_t run_start = 0;
+    bool run_same = true;
+    uint64_t differing = 0;
+    uint64_t differing_runs = 0;
+
+    for (uint64_t sector = 0; sector < common; ) {
+        const uint32_t n = (uint32_t)(common - sector < CHUNK_SECTORS ? common - sector : CHUNK_SECTORS);
+        if (!read_manifest(s, images[0], sector, n, blocks1) || !read_manifest(s, images[1], sector, n, blocks2)) {
+            error_printf("Cannot read the manifests.\n");
+            store_close(s);
+            return 2;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            const bool same = blocks1[i] == blocks2[i];
+            if (same != run_same && sector + i > run_start) {
+                print_run(run_same ? "same" : "differ", run_start, sector + i);
+                differing_runs += run_same ? 0 : 1;
+                run_start = sector + i;
+            }
+            run_same = same;
+            differing += same ? 0 : 1;
+        }
+        sector += n;
+    }
+    if (common > run_start) {
+        print_run(run_same ? "same" : "differ", run_start, common);
+        differing_runs += run_same ? 0 : 1;
+    }
+    if (sectors1 != sectors2) {
+        print_run(sectors1 > sectors2 ? "only in 1" : "only in 2", common, sectors1 > sectors2 ? sectors1 : sectors2);
+    }
+
+    const bool identical = differing == 0 && sectors1 == sectors2 && images[0]->size == images[1]->size;
+    if (identical) {
+        printf(ANSI_COLOR_GREEN "%s and %s are identical." ANSI_COLOR_RESET "\n", name1, name2);
+    } else {
+        printf("%llu of %llu sectors differ, in %llu runs", (unsigned long long)differing,
+               (unsigned long long)common, (unsigned long long)differing_runs);
+        if (sectors1 != sectors2) {
+            printf(", %llu only in %s", (unsigned long long)(sectors1 > sectors2 ? sectors1 - sectors2 : sectors2 - sectors1),
+                   sectors1 > sectors2 ? name1 : name2);
+        }
+        printf(".\n");
+    }
+    store_close(s);
+    return identical ? 0 : 1;
+}
+
+static int command_list(const char *store_dir) {
+    struct store *s = store_open(store_dir, false, false);
+    if (!s) return EXIT_FAILURE;
+    uint64_t total_size = 0;
+    uint64_t total_sectors = 0;
+    printf("%-40s %12s %10s %10s\n", "Name", "Size", "Sectors", "New");
+    for (uint32_t i = 0; i < s->num_images; i++) {
+        const struct image_record *image = &s->images[i];
+        printf("%-40s %12llu %10llu %10u\n", image->name, (unsigned long long)image->size,
+               (unsigned long long)image_sectors(image), image->new_blocks);
+        total_size += image->size;
+        total_sectors += image_sectors(image);
+    }
+    const double stored_mb = (double)s->num_blocks * SECTOR_SIZE / (1024.0 * 1024.0);
+    printf("%u images, %llu sectors in %u distinct blocks: %.1f MB stored for %.1f MB of images",
+           s->num_images, (unsigned long long)total_sectors, s->num_blocks, stored_mb,
+           (double)total_size / (1024.0 * 1024.0));
+    if (s->num_blocks > 0) {
+        printf(" (%.1fx)", (double)total_sectors / (double)s->num_blocks);
+    }
+    printf("\n");
+    store_close(s);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    static struct option long_options[] = {
+        {"verbose", no_argument,       0, 'v'},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    // "+": options come before the command.
+    int option_index = 0;
+    while ((opt = getopt_long(argc, argv, "+vh", long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 'v': verbosity_level++; break;
+            case 'h': print_usage(argv[0]); return EXIT_SUCCESS;
+            default: print_usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    const int args = argc - optind;
+    if (args < 2) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *command = argv[optind];
+    const char *store_dir = argv[optind + 1];
+    char **rest = argv + optind + 2;
+    const int num_rest = args - 2;
+
+    if (strcmp(command, "add") == 0 && num_rest >= 1) {
+        return command_add(store_dir, rest, num_rest);
+    }
+    if (strcmp(command, "extract") == 0 && (num_rest == 1 || num_rest == 2)) {
+        return command_extract(store_dir, rest[0], num_rest == 2 ? rest[1] : rest[0]);
+    }
+    if (strcmp(command, "read") == 0 && (num_rest == 2 || num_rest == 3)) {
+        return command_read(store_dir, rest[0], rest[1], num_rest == 3 ? rest[2] : NULL);
+    }
+    if (strcmp(command, "diff") == 0 && num_rest == 2) {
+        return command_diff(store_dir, rest[0], rest[1]);
+    }
+    if (strcmp(command, "list") == 0 && num_rest == 0) {
+        return command_list(store_dir);
+    }
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+}
@@ -5,7 +5,12 @@
 #include <errno.h>
 #include <time.h>
 #include <stdarg.h>
-#include <libgen.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <stdint.h>
+#include <sys/mman.h>
 
 // For directory handling and stat
 #include <sys/stat.h>
@@ -29,6 +34,15 @@
 #include "adf_dev_drivers.h"
 #include "adf_dev_driver_dump.h"
 #include "adf_dir.h"
+#include "adf_dev_type.h"
+#include "adf_bitm.h"
+#include "adf_cache.h"
+#include "adf_file_block.h"
+#include "adf_file_util.h"
+#include "adf_raw.h"
+#include "adf_dev_hd.h"
+#include "adf_dev_hdfile.h"
+#include "adf_byteorder.h"
 
 // ANSI Color Codes
 #define ANSI_COLOR_CYAN    "\x1b[36m"
@@ -40,9 +54,75 @@
 // Global verbosity level
 int verbosity_level = 0;
 
+// Assemble images in RAM and write each one out with a single write (-m)
+bool build_in_memory = false;
+
+// Plan the whole layout before writing, contiguous and in load order (-P)
+bool plan_layout = false;
+const char *load_order_path = NULL;
+
+// Bring an existing image up to date instead of rebuilding it (-u)
+bool update_existing = false;
+
+// Kind of image to build (-t)
+enum image_type {
+    IMAGE_ADF,   // 880 KB floppy
+    IMAGE_HDF,   // hardfile: a single volume, no RDB
+    IMAGE_RDB,   // hard disk with a Rigid Disk Block and one or more partitions
+};
+enum image_type image_type = IMAGE_ADF;
+
+// File system (-F): ADF_DOSFS_OFS or ADF_DOSFS_FFS, -1 for the image type's default
+int filesystem_type = -1;
+
+// Size of each hard-disk volume in MB (-s), 0 to fit the inputs
+unsigned volume_size_mb = 0;
+
+// Additional partitions of an RDB image (-p <volname>:<dir>)
+#define MAX_EXTRA_PARTITIONS 15
+struct partition_spec {
+    const char *volume_name;
+    const char *host_dir;
+};
+struct partition_spec extra_partitions[MAX_EXTRA_PARTITIONS];
+int num_extra_partitions = 0;
+
+// ADFlib is not thread-safe: it has no per-device locking and stamps new
+// entries with localtime(), which shares one buffer across threads. Batch
+// workers hold this lock while they use ADFlib and drop it for host-side work
+// such as listing partition directories and writing out in-memory images.
+pthread_mutex_t adflib_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Hard-disk geometry. Hardfiles use 32 sectors per track like UAE; RDB images
+// use 4 heads so partitions are sized in 64 KB cylinders. adfCreateHd() keeps
+// the RDB itself in the first two cylinders.
+#define HDF_HEADS               1
+#define HDF_SECTORS             32
+#define RDB_HEADS               4
+#define RDB_SECTORS             32
+#define RDB_RESERVED_CYLINDERS  2
+
 // Version information
 #define VERSION_MAJOR "0"
-#define VERSION_MINOR "5" 
+#define VERSION_MINOR "7" 
+
+// One output image: where it goes, its volume name and the host items it holds.
+// In batch mode the worker that builds it fills in success and elapsed_ms.
+struct build_job {
+    const char *output_filename;
+    const char *volume_name;
+    char **inputs;
+    int num_inputs;
+    bool success;
+    double elapsed_ms;
+};
+
+// One volume of an image and the host items that go into its root directory.
+struct volume_spec {
+    const char *volume_name;
+    char **inputs;
+    int num_inputs;
+};
 
 // Forward declarations
 static bool add_host_file_to_adf(struct AdfVolume *vol, const char *host_filepath, const char *amiga_filename);
@@ -75,32 +155,401 @@ void print_usage(const char *prog_name) {
     char* build_date = get_build_date();
     printf(ANSI_COLOR_CYAN "Create ADF Images by x.com/WINDRAGO. Version %s.%s build (%s)\n" ANSI_COLOR_RESET,
            VERSION_MAJOR, VERSION_MINOR, build_date);
-    printf("Usage: %s -o <output.adf> -N <volname> [-v] <file_or_dir1> [file_or_dir2 ...]\n", prog_name);
+    printf("Usage: %s -o <output.adf> -N <volname> [-t adf|hdf|rdb] [-F ofs|ffs] [-s <MB>] [-p <volname>:<dir> ...]\n", prog_name);
+    printf("       %*s [-m] [-u | -P [-O <list>]] [-v] <file_or_dir1> [file_or_dir2 ...]\n", (int)strlen(prog_name), "");
+    printf("       %s -b <manifest> [-j <jobs>] [-t adf|hdf] [-F ofs|ffs] [-s <MB>] [-m] [-u | -P [-O <list>]] [-v]\n", prog_name);
     printf("Options:\n");
     printf("  -o, --output  <filename>   Specify the output ADF filename (required).\n");
     printf("  -N, --volname <name>       Specify the volume name for the ADF (required).\n");
+    printf("  -t, --type    <type>       Image type: adf (880 KB floppy, default), hdf (hardfile, one volume)\n");
+    printf("                             or rdb (hard disk with a Rigid Disk Block and partitions).\n");
+    printf("  -F, --fs      <ofs|ffs>    File system (default: ofs for adf, ffs for hdf and rdb).\n");
+    printf("  -s, --size    <MB>         Size of each hdf/rdb volume (default: just big enough for the inputs).\n");
+    printf("  -p, --partition <volname>:<dir>\n");
+    printf("                             With -t rdb, add a partition holding the contents of <dir>. Repeatable.\n");
+    printf("  -b, --batch   <manifest>   Build every image listed in the manifest, one per line:\n");
+    printf("                             <output.adf><TAB><volname><TAB><input>[<TAB><input> ...]\n");
+    printf("  -j, --jobs    <count>      Worker threads for --batch (default: number of CPUs).\n");
+    printf("  -m, --in-memory            Assemble the image in RAM and write it out once, atomically.\n");
+    printf("  -u, --update               Update an existing image in place: only changed files are rewritten.\n");
+    printf("  -P, --plan                 Plan the whole layout first: each file contiguous, sorted names,\n");
+    printf("                             dates from the host files, reproducible output.\n");
+    printf("  -O, --order   <list>       With --plan, lay out the Amiga paths in <list> first, in that order.\n");
     printf("  -v, --verbose              Enable verbose messages. Use -vv for extensive debug.\n");
     printf("  -h, --help                 Display this help message.\n");
     printf("If a directory is provided as input, its contents will be added recursively.\n");
     printf("Example:\n");
     printf("  %s -o mydisk.adf -N MyVolume -vv fileA.txt my_project_dir\n", prog_name);
+    printf("  %s -o boot.adf -N Workbench -P -O load_order.txt c s libs devs\n", prog_name);
+    printf("  %s -o mydisk.adf -N MyVolume -u my_project_dir\n", prog_name);
+    printf("  %s -o work.hdf -N Work -t hdf my_big_project\n", prog_name);
+    printf("  %s -o system.hdf -N System -t rdb -p Work:work_dir -p Games:games_dir system_dir/*\n", prog_name);
+    printf("  %s -b release_disks.txt -j 8\n", prog_name);
 }
 
+// Returns a malloc'd copy of the last path component (trailing slashes ignored).
+// Done by hand because basename() may use static storage, which batch workers
+// cannot share.
 char* get_amiga_basename(const char *path) {
-    char *path_copy = strdup(path);
-    if (!path_copy) {
-        perror("strdup failed in get_amiga_basename");
-        return NULL;
+    size_t end = strlen(path);
+    while (end > 1 && path[end - 1] == '/') {
+        end--;
     }
-    char *bname = basename(path_copy);
-    char *result = strdup(bname); 
-    free(path_copy);
+    size_t start = end;
+    while (start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+    char *result = strndup(path + start, end - start);
     if(!result){
-        perror("strdup failed for basename result");
+        perror("strndup failed for basename result");
     }
     return result; 
 }
 
+/*
+ * In-memory device driver used by --in-memory.
+ *
+ * The whole image lives in one heap buffer; ADFlib's block reads and writes
+ * become memcpy calls and the file is only touched once, by
+ * write_image_atomically(), after the volume has been unmounted. With
+ * --update the existing image is read in whole first.
+ * ADFlib's own ramdisk driver keeps its buffer private, so it would have to be
+ * copied back out sector by sector; owning the buffer avoids that and keeps
+ * every batch worker on a separate image.
+ */
+#define MEM_DEVICE_DRIVER_NAME "send2adf-mem"
+
+struct mem_device {
+    uint8_t *image;
+    size_t size;
+};
+
+static const struct AdfDeviceDriver mem_device_driver;
+static ADF_RETCODE mem_device_close(struct AdfDevice * const dev);
+
+static struct AdfDevice *mem_device_create(const char * const name, const uint32_t cylinders,
+                                           const uint32_t heads, const uint32_t sectors) {
+    struct AdfDevice *dev = calloc(1, sizeof(*dev));
+    struct mem_device *mem = calloc(1, sizeof(*mem));
+    if (!dev || !mem) {
+        free(dev);
+        free(mem);
+        return NULL;
+    }
+
+    dev->sizeBlocks = cylinders * heads * sectors;
+    mem->size = (size_t)dev->sizeBlocks * ADF_DEV_BLOCK_SIZE;
+    mem->image = calloc(1, mem->size); // zero-filled, like a fresh dump file
+    dev->name = strdup(name);
+    if (!mem->image || !dev->name) {
+        free(mem->image);
+        free(dev->name);
+        free(mem);
+        free(dev);
+        return NULL;
+    }
+
+    dev->geometry.cylinders = cylinders;
+    dev->geometry.heads = heads;
+    dev->geometry.sectors = sectors;
+    dev->geometry.blockSize = ADF_DEV_BLOCK_SIZE;
+    dev->type = adfDevGetTypeByGeometry(&dev->geometry);
+    dev->class = adfDevGetClassBySizeBlocks(dev->sizeBlocks);
+    dev->readOnly = false;
+    dev->mounted = false;
+    dev->drv = &mem_device_driver;
+    dev->drvData = mem;
+    return dev;
+}
+
+// Loads an existing image into RAM, for --update.
+static struct AdfDevice *mem_device_open(const char * const name, const AdfAccessMode mode) {
+    FILE *image_file = fopen(name, "rb");
+    if (!image_file) {
+        return NULL;
+    }
+    struct stat image_stat;
+    if (fstat(fileno(image_file), &image_stat) == -1 || image_stat.st_size <= 0 ||
+        image_stat.st_size % ADF_DEV_BLOCK_SIZE != 0) {
+        fclose(image_file);
+        return NULL;
+    }
+
+    const uint32_t size_blocks = (uint32_t)(image_stat.st_size / ADF_DEV_BLOCK_SIZE);
+    struct AdfDevGeometry geometry = adfDevTypeGetGeometry(adfDevGetTypeBySizeBlocks(size_blocks));
+    if (geometry.cylinders * geometry.heads * geometry.sectors != size_blocks) {
+        geometry.cylinders = size_blocks; // unknown type: one track per block, like ADFlib does
+        geometry.heads = 1;
+        geometry.sectors = 1;
+    }
+    struct AdfDevice *dev = mem_device_create(name, geometry.cylinders, geometry.heads, geometry.sectors);
+    if (!dev) {
+        fclose(image_file);
+        return NULL;
+    }
+    struct mem_device *mem = dev->drvData;
+    if (fread(mem->image, 1, mem->size, image_file) != mem->size) {
+        fclose(image_file);
+        mem_device_close(dev);
+        return NULL;
+    }
+    fclose(image_file);
+    dev->readOnly = (mode != ADF_ACCESS_MODE_READWRITE);
+    return dev;
+}
+
+static ADF_RETCODE mem_device_close(struct AdfDevice * const dev) {
+    struct mem_device *mem = dev->drvData;
+    if (mem) {
+        free(mem->image);
+        free(mem);
+    }
+    free(dev->name);
+    free(dev);
+    return ADF_RC_OK;
+}
+
+static ADF_RETCODE mem_device_read_sectors(const struct AdfDevice * const dev, const uint32_t block,
+                                           const uint32_t len_blocks, uint8_t * const buf) {
+    const struct mem_device *mem = dev->drvData;
+    if ((uint64_t)block + len_blocks > dev->sizeBlocks) {
+        return ADF_RC_BLOCKOUTOFRANGE;
+    }
+    memcpy(buf, mem->image + (size_t)block * ADF_DEV_BLOCK_SIZE, (size_t)len_blocks * ADF_DEV_BLOCK_SIZE);
+    return ADF_RC_OK;
+}
+
+static ADF_RETCODE mem_device_write_sectors(const struct AdfDevice * const dev, const uint32_t block,
+                                            const uint32_t len_blocks, const uint8_t * const buf) {
+    struct mem_device *mem = dev->drvData;
+    if ((uint64_t)block + len_blocks > dev->sizeBlocks) {
+        return ADF_RC_BLOCKOUTOFRANGE;
+    }
+    memcpy(mem->image + (size_t)block * ADF_DEV_BLOCK_SIZE, buf, (size_t)len_blocks * ADF_DEV_BLOCK_SIZE);
+    return ADF_RC_OK;
+}
+
+static bool mem_device_is_native(void) {
+    return false;
+}
+
+static bool mem_device_is_device(const char * const name) {
+    (void)name;
+    return false; // only ever selected by name through adfDevCreate
+}
+
+static const struct AdfDeviceDriver mem_device_driver = {
+    .name         = MEM_DEVICE_DRIVER_NAME,
+    .data         = NULL,
+    .createDev    = mem_device_create,
+    .openDev      = mem_device_open,
+    .closeDev     = mem_device_close,
+    .readSectors  = mem_device_read_sectors,
+    .writeSectors = mem_device_write_sectors,
+    .isNative     = mem_device_is_native,
+    .isDevice     = mem_device_is_device
+};
+
+// Creates a fresh temporary file next to path. open() applies the umask to a
+// new file itself, so the mode never has to be read with umask(), which would
+// change it for every thread of the process. Returns the descriptor, or -1.
+static int create_temporary_image(const char *path, char **tmp_path_out) {
+    size_t tmp_len = strlen(path) + 32;
+    char *tmp_path = malloc(tmp_len);
+    if (!tmp_path) {
+        perror("malloc failed in create_temporary_image");
+        return -1;
+    }
+    int fd = -1;
+    for (unsigned attempt = 0; attempt < 100; attempt++) {
+        snprintf(tmp_path, tmp_len, "%s.%ld.%u", path, (long)getpid(), attempt);
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd != -1 || errno != EEXIST) break;
+    }
+    if (fd == -1) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not create temporary file for '%s': %s\n", path, strerror(errno));
+        free(tmp_path);
+        return -1;
+    }
+    *tmp_path_out = tmp_path;
+    return fd;
+}
+
+// Syncs the directory holding path, so a rename into it survives a crash.
+static bool sync_parent_directory(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash == path ? 1 : (size_t)(slash - path)) : strdup(".");
+    if (!dir) {
+        perror("malloc failed in sync_parent_directory");
+        return false;
+    }
+    bool ok = true;
+    int fd = open(dir, O_RDONLY);
+    // Some file systems cannot sync a directory at all and say so with EINVAL.
+    if (fd == -1 || (fsync(fd) == -1 && errno != EINVAL)) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not sync directory '%s': %s\n", dir, strerror(errno));
+        ok = false;
+    }
+    if (fd != -1) close(fd);
+    free(dir);
+    return ok;
+}
+
+// Writes the image next to its destination, fsyncs it and renames it into
+// place, so readers never see a half-written ADF.
+static bool write_image_atomically(const char *path, const uint8_t *data, size_t size) {
+    char *tmp_path = NULL;
+    int fd = create_temporary_image(path, &tmp_path);
+    if (fd == -1) {
+        return false;
+    }
+
+    bool ok = true;
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(fd, data + written, size - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        written += (size_t)n;
+    }
+    // A replaced image keeps its mode; a new one has the umask's.
+    struct stat st;
+    if (ok && stat(path, &st) == 0 && fchmod(fd, st.st_mode & 07777) == -1) ok = false;
+    if (ok && fsync(fd) == -1) ok = false;
+    if (ok) {
+        debug_printf(2, "Wrote %zu bytes to '%s' in one pass, renaming into place.\n", size, tmp_path);
+    } else {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not write image '%s': %s\n", tmp_path, strerror(errno));
+    }
+    if (close(fd) == -1) ok = false;
+    if (ok && rename(tmp_path, path) == -1) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not rename '%s' to '%s': %s\n", tmp_path, path, strerror(errno));
+        ok = false;
+    }
+    if (!ok) {
+        unlink(tmp_path);
+    } else if (!sync_parent_directory(path)) {
+        ok = false;
+    }
+    free(tmp_path);
+    return ok;
+}
+
+// Seconds between the Unix epoch and the AmigaDOS epoch (1978-01-01).
+#define AMIGA_EPOCH_OFFSET 252460800
+
+// Converts a host timestamp to AmigaDOS days/minutes/ticks. UTC is used so the
+// result does not depend on the build machine's time zone.
+static void host_time_to_amiga(time_t t, int32_t *days, int32_t *mins, int32_t *ticks) {
+    long long secs = (long long)t - AMIGA_EPOCH_OFFSET;
+    if (secs < 0) secs = 0;
+    *days = (int32_t)(secs / 86400);
+    *mins = (int32_t)((secs % 86400) / 60);
+    *ticks = (int32_t)(secs % 60) * 50;
+}
+
+// A read-only view of a whole host file. The file is mmap'd when possible so
+// data-block payloads are copied out of the page cache exactly once; files
+// that cannot be mapped are read into a heap buffer instead.
+struct host_file_view {
+    const uint8_t *data;
+    size_t size;
+    time_t mtime;
+    bool mapped;
+};
+
+static bool open_host_file_view(const char *path, struct host_file_view *view) {
+    memset(view, 0, sizeof(*view));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not open host input file '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == -1) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not stat host input file '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    if (file_stat.st_size > INT32_MAX) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "File is too large for an Amiga volume: '%s'\n", path);
+        close(fd);
+        return false;
+    }
+    view->size = (size_t)file_stat.st_size;
+    view->mtime = file_stat.st_mtime;
+    if (view->size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void *mapping = mmap(NULL, view->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+#ifdef POSIX_MADV_SEQUENTIAL
+        posix_madvise(mapping, view->size, POSIX_MADV_SEQUENTIAL);
+#endif
+        view->data = mapping;
+        view->mapped = true;
+        close(fd);
+        return true;
+    }
+
+    debug_printf(2, "mmap of '%s' failed (%s), reading it instead.\n", path, strerror(errno));
+    uint8_t *buffer = malloc(view->size);
+    size_t done = 0;
+    while (buffer && done < view->size) {
+        ssize_t n = read(fd, buffer + done, view->size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    close(fd);
+    if (!buffer || done != view->size) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not read host input file '%s'\n", path);
+        free(buffer);
+        return false;
+    }
+    view->data = buffer;
+    return true;
+}
+
+static void close_host_file_view(struct host_file_view *view) {
+    if (view->mapped) {
+        munmap((void *)view->data, view->size);
+    } else {
+        free((void *)view->data);
+    }
+    memset(view, 0, sizeof(*view));
+}
+
+// Gives a file the host file's modification time, which is what --update
+// compares against. ADFlib stamps new files with the current time.
+static bool set_file_date(struct AdfVolume *vol, ADF_SECTNUM header_sector, time_t mtime) {
+    struct AdfEntryBlock header;
+    if (adfReadEntryBlock(vol, header_sector, &header) != ADF_RC_OK) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to read file header block %d. ADFLib error occurred.\n" ANSI_COLOR_RESET, (int)header_sector);
+        return false;
+    }
+    host_time_to_amiga(mtime, &header.days, &header.mins, &header.ticks);
+    if (adfWriteFileHdrBlock(vol, header_sector, (struct AdfFileHeaderBlock *)&header) != ADF_RC_OK) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to write file header block %d. ADFLib error occurred.\n" ANSI_COLOR_RESET, (int)header_sector);
+        return false;
+    }
+    // DIRCACHE volumes keep a copy of the date in the parent's cache record.
+    if (adfVolHasDIRCACHE(vol)) {
+        struct AdfEntryBlock parent;
+        if (adfReadEntryBlock(vol, header.parent, &parent) != ADF_RC_OK ||
+            adfUpdateCache(vol, &parent, &header, false) != ADF_RC_OK) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to update the directory cache entry of block %d.\n" ANSI_COLOR_RESET, (int)header_sector);
+            return false;
+        }
+    }
+    return true;
+}
+
 // amiga_filename is the simple name of the file, to be created in the current ADF directory
 static bool add_host_file_to_adf(struct AdfVolume *vol, const char *host_filepath, const char *amiga_filename) {
     // Construct full conceptual amiga path for logging
@@ -111,49 +560,45 @@ static bool add_host_file_to_adf(struct AdfVolume *vol, const char *host_filepat
     // If adfGetCurrentPath(vol, path_buffer, size) existed, it would be useful here.
     debug_printf(1, "Processing host file: '%s' -> ADF as '%s' (in current ADF dir)\n", host_filepath, amiga_filename);
 
-    debug_printf(2, "Opening host file '%s' for reading...\n", host_filepath);
-    FILE *host_file_ptr = fopen(host_filepath, "rb");
-    if (!host_file_ptr) {
-        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not open host input file '%s': %s\n", host_filepath, strerror(errno));
+    debug_printf(2, "Mapping host file '%s'...\n", host_filepath);
+    struct host_file_view host_view;
+    if (!open_host_file_view(host_filepath, &host_view)) {
         return false;
     }
-    debug_printf(2, "Host file '%s' opened.\n", host_filepath);
+    debug_printf(2, "Host file '%s' mapped (%zu bytes, %s).\n", host_filepath, host_view.size, host_view.mapped ? "mmap" : "read");
 
     debug_printf(2, "Opening Amiga file '%s' in current ADF volume directory for writing...\n", amiga_filename);
     struct AdfFile *amiga_file_ptr = adfFileOpen(vol, amiga_filename, ADF_FILE_MODE_WRITE);
     if (!amiga_file_ptr) {
         fprintf(stderr, ANSI_COLOR_RED "Error: Could not create/open Amiga file '%s' in current ADF directory. ADFLib error occurred.\n" ANSI_COLOR_RESET, amiga_filename);
-        fclose(host_file_ptr);
+        close_host_file_view(&host_view);
         return false;
     }
     debug_printf(2, "Amiga file '%s' opened in current ADF volume directory.\n", amiga_filename);
 
-    unsigned char buffer[1024 * 4];
-    size_t bytes_read;
-    uint32_t bytes_written_total = 0;
+    // One call for the whole file: ADFlib fills each data block straight from
+    // the mapping, with no intermediate copy on our side.
     bool success = true;
-
+    uint32_t bytes_written_total = 0;
     debug_printf(2, "Copying '%s' to ADF as '%s'...\n", host_filepath, amiga_filename);
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), host_file_ptr)) > 0) {
-        uint32_t current_bytes_written = adfFileWrite(amiga_file_ptr, (uint32_t)bytes_read, buffer);
-        bytes_written_total += current_bytes_written;
-        if (current_bytes_written != (uint32_t)bytes_read) {
+    if (host_view.size > 0) {
+        bytes_written_total = adfFileWrite(amiga_file_ptr, (uint32_t)host_view.size, host_view.data);
+        if (bytes_written_total != (uint32_t)host_view.size) {
             fprintf(stderr, ANSI_COLOR_RED "Warning: Failed to write all %zu bytes to Amiga file '%s' (wrote %u). Disk full? ADFLib error occurred.\n" ANSI_COLOR_RESET,
-                    bytes_read, amiga_filename, current_bytes_written);
+                    host_view.size, amiga_filename, bytes_written_total);
             success = false;
-            break;
         }
     }
-    if (ferror(host_file_ptr)) {
-        fprintf(stderr, ANSI_COLOR_RED "Warning: Error reading host file '%s'\n" ANSI_COLOR_RESET, host_filepath);
-        success = false;
-    }
     debug_printf(2, "Finished copying data. Total bytes written: %u\n", bytes_written_total);
 
     debug_printf(2, "Closing Amiga file '%s'...\n", amiga_filename);
+    const ADF_SECTNUM header_sector = amiga_file_ptr->fileHdr->headerKey;
     adfFileClose(amiga_file_ptr); 
-    debug_printf(2, "Closing host file '%s'...\n", host_filepath);
-    fclose(host_file_ptr);
+    if (!set_file_date(vol, header_sector, host_view.mtime)) {
+        success = false;
+    }
+    debug_printf(2, "Unmapping host file '%s'...\n", host_filepath);
+    close_host_file_view(&host_view);
 
     if (success) {
         debug_printf(1, "Successfully added '%s' to ADF as '%s' (in current ADF dir).\n", host_filepath, amiga_filename);
@@ -241,116 +686,11 @@ static bool add_host_directory_to_adf_recursive(struct AdfVolume *vol, const cha
 }
 
 
-int main(int argc, char *argv[]) {
-    char *output_filename = NULL;
-    char *volume_name_arg = NULL; 
-    int opt;
-
-    static struct option long_options[] = {
-        {"output",  required_argument, 0, 'o'},
-        {"volname", required_argument, 0, 'N'},
-        {"verbose", no_argument,       0, 'v'},
-        {"help",    no_argument,       0, 'h'},
-        {0, 0, 0, 0}
-    };
-
-    int option_index = 0;
-    while ((opt = getopt_long(argc, argv, "o:N:vh", long_options, &option_index)) != -1) {
-        switch (opt) {
-            case 'o': output_filename = optarg; break;
-            case 'N': volume_name_arg = optarg; break;
-            case 'v': verbosity_level++; break;
-            case 'h': print_usage(argv[0]); return EXIT_SUCCESS;
-            default: print_usage(argv[0]); return EXIT_FAILURE;
-        }
-    }
-
-    if (!output_filename || !volume_name_arg || optind >= argc) {
-        if (!output_filename) fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Output ADF filename missing.\n");
-        if (!volume_name_arg) fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Volume name missing.\n");
-        if (optind >= argc) fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "No input files or directories specified.\n");
-        print_usage(argv[0]);
-        return EXIT_FAILURE;
-    }
-
-    if (verbosity_level == 1) {
-      debug_printf(1, "Verbose mode enabled.\n");
-    } else if (verbosity_level >= 2) {
-      debug_printf(2, "Extensive debug mode enabled (level %d).\n", verbosity_level);
-    }
-    
-    if (argc - optind > 0) { 
-        debug_printf(2, "First input item: %s%s\n", argv[optind], (argc - optind > 1) ? " (and others)" : "");
-    }
-    debug_printf(2, "Output ADF: %s\n", output_filename);
-    debug_printf(2, "Volume name: %s\n", volume_name_arg);
-
-    struct AdfDevice *device = NULL;
-    struct AdfVolume *volume = NULL;
-    bool adflib_initialized = false;
-
-    debug_printf(2, "Initializing ADFlib with adfLibInit()...\n");
-    if (adfLibInit() != ADF_RC_OK) {
-        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to initialize ADFLib.\n" ANSI_COLOR_RESET);
-        return EXIT_FAILURE;
-    }
-    adflib_initialized = true;
-    debug_printf(2, "ADFlib initialized.\n");
-
-    debug_printf(2, "Explicitly adding dump device driver...\n");
-    if (adfAddDeviceDriver(&adfDeviceDriverDump) != ADF_RC_OK) {
-        fprintf(stderr, ANSI_COLOR_YELLOW "Warning: Failed to explicitly add dump device driver. Continuing anyway...\n" ANSI_COLOR_RESET);
-    } else {
-        debug_printf(2, "Dump device driver explicitly added successfully.\n");
-    }
-
-    debug_printf(2, "Attempting to create device with adfDevCreate(\"dump\", \"%s\", 80, 2, 11)\n", output_filename);
-    device = adfDevCreate("dump", output_filename, 80, 2, 11); 
-    if (!device) {
-        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to create ADF device '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, output_filename);
-        if (adflib_initialized) adfLibCleanUp();
-        return EXIT_FAILURE;
-    }
-    debug_printf(2, "Device '%s' created successfully.\n", output_filename);
-
-    debug_printf(2, "Creating floppy volume '%s' on device with adfCreateFlop()...\n", volume_name_arg);
-    if (adfCreateFlop(device, volume_name_arg, ADF_DOSFS_OFS) != ADF_RC_OK) {
-        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to create/format floppy volume '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, volume_name_arg);
-        if (device) adfDevClose(device);
-        if (adflib_initialized) adfLibCleanUp();
-        return EXIT_FAILURE;
-    }
-    debug_printf(2, "Floppy volume '%s' created/formatted successfully by adfCreateFlop.\n", volume_name_arg);
-
-    debug_printf(2, "Mounting device '%s' with adfDevMount()...\n", output_filename);
-    if (adfDevMount(device) != ADF_RC_OK) {
-        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to mount device '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, output_filename);
-        if (device) adfDevClose(device);
-        if (adflib_initialized) adfLibCleanUp();
-        return EXIT_FAILURE;
-    }
-    debug_printf(2, "Device '%s' mounted successfully via adfDevMount.\n", output_filename);
-    
-    debug_printf(2, "Attempting to mount volume 0 from device '%s' with adfVolMount()...\n", output_filename);
-    volume = adfVolMount(device, 0, ADF_ACCESS_MODE_READWRITE);
-    if (!volume) {
-        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to mount volume 0 from device '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, output_filename);
-        if (device) adfDevUnMount(device); 
-        if (device) adfDevClose(device);
-        if (adflib_initialized) adfLibCleanUp();
-        return EXIT_FAILURE;
-    }
-    const char *current_vol_name_display = volume->volName ? volume->volName : volume_name_arg;
-    debug_printf(2, "Volume '%s' (from partition 0) mounted successfully via adfVolMount.\n", current_vol_name_display);
-    if (volume->mounted) {
-         debug_printf(2, "Volume '%s' reports itself as MOUNTED (volume->mounted is true) after adfVolMount.\n", current_vol_name_display);
-    } else {
-         debug_printf(2, ANSI_COLOR_RED "CRITICAL WARNING - Volume '%s' reports itself as NOT MOUNTED even after successful adfVolMount call.\n" ANSI_COLOR_RESET, current_vol_name_display);
-    }
-
+// Adds every top-level host item to the root directory of a mounted volume.
+static bool add_host_items_to_adf(struct AdfVolume *volume, char **items, int num_items) {
     bool all_items_success = true;
-    for (int i = optind; i < argc; i++) {
-        const char *host_item_path = argv[i];
+    for (int i = 0; i < num_items; i++) {
+        const char *host_item_path = items[i];
         struct stat item_stat;
 
         debug_printf(2, "Processing top-level host item: '%s'\n", host_item_path);
@@ -358,7 +698,7 @@ int main(int argc, char *argv[]) {
         if (adfToRootDir(volume) != ADF_RC_OK) {
             fprintf(stderr, ANSI_COLOR_RED "Error: Failed to set ADF current directory to root before processing '%s'.\n" ANSI_COLOR_RESET, host_item_path);
             all_items_success = false;
-            continue; 
+            continue;
         }
         debug_printf(2, "ADF current directory set to root (sector %u).\n", (unsigned int)volume->curDirPtr);
 
@@ -370,7 +710,7 @@ int main(int argc, char *argv[]) {
         }
 
         char *amiga_item_basename = get_amiga_basename(host_item_path);
-        if (!amiga_item_basename) { 
+        if (!amiga_item_basename) {
             all_items_success = false;
             continue;
         }
@@ -408,25 +748,1653 @@ int main(int argc, char *argv[]) {
         } else {
             fprintf(stderr, ANSI_COLOR_YELLOW "Warning: " ANSI_COLOR_RESET "Skipping unsupported file type: '%s'\n", host_item_path);
         }
-        free(amiga_item_basename); 
+        free(amiga_item_basename);
     }
+    return all_items_success;
+}
 
-    debug_printf(2, "Unmounting volume '%s'...\n", current_vol_name_display);
-    if (volume) adfVolUnMount(volume);
-    debug_printf(2, "Unmounting device '%s'...\n", output_filename);
-    if (device) adfDevUnMount(device); 
-    debug_printf(2, "Closing device '%s'...\n", output_filename);
-    if (device) adfDevClose(device);
+/*
+ * Planned layout (-P).
+ *
+ * Pass one stats the whole input tree and sorts every directory by name, so
+ * the image no longer depends on the order readdir() returns entries. Pass
+ * two creates the directories, then reserves each file's header, extension
+ * and data blocks (adfFileSize2Blocks) as one run, in load order, before any
+ * file data is written. Within a run the blocks follow the order AmigaDOS
+ * reads them: header, data 1-72, extension 1, data 73-144, extension 2, ...
+ * Dates come from the host files rather than the clock, so building the same
+ * tree twice gives the same image.
+ */
+struct plan_entry {
+    char *host_path;
+    char *amiga_path;          // path inside the volume, matched against --order
+    const char *name;          // last component of amiga_path
+    bool is_dir;
+    uint32_t size;
+    time_t mtime;
+    int parent;                // index into layout_plan.entries, -1 for the root
+    ADF_SECTNUM sector;        // directory block or file header block, 0 if not created
+    ADF_SECTNUM *data_blocks;
+    ADF_SECTNUM *ext_blocks;
+    unsigned num_data_blocks;
+    unsigned num_ext_blocks;
+    bool queued;               // already in the load order
+};
 
-    debug_printf(2, "Cleaning up ADFlib environment...\n");
-    if (adflib_initialized) adfLibCleanUp();
+struct layout_plan {
+    struct plan_entry *entries;
+    int num_entries;
+    int capacity;
+    time_t newest_mtime;
+};
 
-    if (all_items_success) {
-        printf(ANSI_COLOR_GREEN "ADF file '%s' processed successfully with disk name '%s'.\n" ANSI_COLOR_RESET, output_filename, volume_name_arg);
-        printf(ANSI_COLOR_GREEN "Processed %d input item(s).\n" ANSI_COLOR_RESET, argc - optind);
-    } else {
-        fprintf(stderr, ANSI_COLOR_RED "ADF creation completed with errors processing some items.\n" ANSI_COLOR_RESET);
-        return EXIT_FAILURE; 
+static void free_layout_plan(struct layout_plan *plan) {
+    for (int i = 0; i < plan->num_entries; i++) {
+        free(plan->entries[i].host_path);
+        free(plan->entries[i].amiga_path);
+        free(plan->entries[i].data_blocks);
+        free(plan->entries[i].ext_blocks);
+    }
+    free(plan->entries);
+    memset(plan, 0, sizeof(*plan));
+}
+
+// Appends one entry and returns its index, or -1 on error.
+static int plan_add_entry(struct layout_plan *plan, const char *host_path, const char *amiga_path,
+                          int parent, const struct stat *st) {
+    const char *name = strrchr(amiga_path, '/');
+    name = name ? name + 1 : amiga_path;
+    if (strlen(name) > ADF_MAX_NAME_LEN) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Name '%s' is longer than %d characters: '%s'\n", name, ADF_MAX_NAME_LEN, host_path);
+        return -1;
+    }
+    if (S_ISREG(st->st_mode) && st->st_size > INT32_MAX) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "File is too large for an Amiga volume: '%s'\n", host_path);
+        return -1;
+    }
+
+    if (plan->num_entries == plan->capacity) {
+        int capacity = plan->capacity ? plan->capacity * 2 : 256;
+        struct plan_entry *grown = realloc(plan->entries, (size_t)capacity * sizeof(*grown));
+        if (!grown) {
+            perror("realloc failed in plan_add_entry");
+            return -1;
+        }
+        plan->entries = grown;
+        plan->capacity = capacity;
+    }
+
+    struct plan_entry *e = &plan->entries[plan->num_entries];
+    memset(e, 0, sizeof(*e));
+    e->host_path = strdup(host_path);
+    e->amiga_path = strdup(amiga_path);
+    if (!e->host_path || !e->amiga_path) {
+        perror("strdup failed in plan_add_entry");
+        free(e->host_path);
+        free(e->amiga_path);
+        return -1;
+    }
+    e->name = e->amiga_path + (name - amiga_path);
+    e->is_dir = S_ISDIR(st->st_mode);
+    e->size = e->is_dir ? 0 : (uint32_t)st->st_size;
+    e->mtime = st->st_mtime;
+    e->parent = parent;
+    if (e->mtime > plan->newest_mtime) {
+        plan->newest_mtime = e->mtime;
+    }
+    return plan->num_entries++;
+}
+
+// Case-insensitive, like AmigaDOS, with a case-sensitive tie break so the
+// order is fully defined.
+static int compare_entry_names(const void *a, const void *b) {
+    const char *name_a = *(const char * const *)a;
+    const char *name_b = *(const char * const *)b;
+    int rc = strcasecmp(name_a, name_b);
+    return rc ? rc : strcmp(name_a, name_b);
+}
+
+static bool plan_scan_directory(struct layout_plan *plan, const char *host_dirpath,
+                                const char *amiga_dirpath, int dir_index) {
+    DIR *dir = opendir(host_dirpath);
+    if (!dir) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not open host directory '%s': %s\n", host_dirpath, strerror(errno));
+        return false;
+    }
+
+    char **names = NULL;
+    size_t num_names = 0, capacity = 0;
+    bool all_success = true;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (num_names == capacity) {
+            capacity = capacity ? capacity * 2 : 32;
+            char **grown = realloc(names, capacity * sizeof(*names));
+            if (!grown) {
+                perror("realloc failed in plan_scan_directory");
+                all_success = false;
+                break;
+            }
+            names = grown;
+        }
+        if (!(names[num_names] = strdup(entry->d_name))) {
+            perror("strdup failed in plan_scan_directory");
+            all_success = false;
+            break;
+        }
+        num_names++;
+    }
+    closedir(dir);
+    qsort(names, num_names, sizeof(*names), compare_entry_names);
+
+    for (size_t i = 0; i < num_names; i++) {
+        char host_entry_path[FILENAME_MAX];
+        char amiga_entry_path[FILENAME_MAX];
+        snprintf(host_entry_path, sizeof(host_entry_path), "%s/%s", host_dirpath, names[i]);
+        snprintf(amiga_entry_path, sizeof(amiga_entry_path), "%s/%s", amiga_dirpath, names[i]);
+
+        struct stat entry_stat;
+        if (stat(host_entry_path, &entry_stat) == -1) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not stat host path '%s': %s\n", host_entry_path, strerror(errno));
+            all_success = false;
+            continue;
+        }
+        if (!S_ISDIR(entry_stat.st_mode) && !S_ISREG(entry_stat.st_mode)) {
+            debug_printf(1, "Skipping non-regular file/directory: '%s'\n", host_entry_path);
+            continue;
+        }
+        int index = plan_add_entry(plan, host_entry_path, amiga_entry_path, dir_index, &entry_stat);
+        if (index < 0) {
+            all_success = false;
+        } else if (S_ISDIR(entry_stat.st_mode) &&
+                   !plan_scan_directory(plan, host_entry_path, amiga_entry_path, index)) {
+            all_success = false;
+        }
+    }
+
+    for (size_t i = 0; i < num_names; i++) {
+        free(names[i]);
+    }
+    free(names);
+    return all_success;
+}
+
+// Pass one: stat every input. Top-level items keep their command-line order,
+// everything below them is sorted by name.
+static bool plan_scan_inputs(struct layout_plan *plan, char **items, int num_items) {
+    bool all_success = true;
+    for (int i = 0; i < num_items; i++) {
+        struct stat item_stat;
+        if (stat(items[i], &item_stat) == -1) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not stat host path '%s': %s\n", items[i], strerror(errno));
+            all_success = false;
+            continue;
+        }
+        if (!S_ISDIR(item_stat.st_mode) && !S_ISREG(item_stat.st_mode)) {
+            fprintf(stderr, ANSI_COLOR_YELLOW "Warning: " ANSI_COLOR_RESET "Skipping unsupported file type: '%s'\n", items[i]);
+            continue;
+        }
+        char *amiga_item_basename = get_amiga_basename(items[i]);
+        if (!amiga_item_basename) {
+            all_success = false;
+            continue;
+        }
+        int index = plan_add_entry(plan, items[i], amiga_item_basename, -1, &item_stat);
+        if (index < 0) {
+            all_success = false;
+        } else if (S_ISDIR(item_stat.st_mode) &&
+                   !plan_scan_directory(plan, items[i], amiga_item_basename, index)) {
+            all_success = false;
+        }
+        free(amiga_item_basename);
+    }
+    return all_success;
+}
+
+// Returns the files in the order they should be laid out: everything named in
+// the load-order list first, in list order, then the rest in tree order.
+// Returns the number of files, or -1 on error.
+static int plan_load_order(struct layout_plan *plan, const char *order_path, int **order_out) {
+    int *order = malloc((size_t)(plan->num_entries ? plan->num_entries : 1) * sizeof(*order));
+    if (!order) {
+        perror("malloc failed in plan_load_order");
+        return -1;
+    }
+    int num_files = 0;
+
+    if (order_path) {
+        FILE *order_file = fopen(order_path, "r");
+        if (!order_file) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not open load-order list '%s': %s\n", order_path, strerror(errno));
+            free(order);
+            return -1;
+        }
+        char *line = NULL;
+        size_t line_capacity = 0;
+        while (getline(&line, &line_capacity, order_file) != -1) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0' || line[0] == '#') {
+                continue;
+            }
+            bool found = false;
+            for (int i = 0; i < plan->num_entries; i++) {
+                struct plan_entry *e = &plan->entries[i];
+                if (!e->is_dir && strcasecmp(e->amiga_path, line) == 0) {
+                    found = true;
+                    if (!e->queued) {
+                        e->queued = true;
+                        order[num_files++] = i;
+                    }
+                    break;
+                }
+            }
+            if (!found) {
+                fprintf(stderr, ANSI_COLOR_YELLOW "Warning: " ANSI_COLOR_RESET "'%s' from the load-order list is not among the inputs.\n", line);
+            }
+        }
+        free(line);
+        fclose(order_file);
+    }
+
+    for (int i = 0; i < plan->num_entries; i++) {
+        struct plan_entry *e = &plan->entries[i];
+        if (!e->is_dir && !e->queued) {
+            e->queued = true;
+            order[num_files++] = i;
+        }
+    }
+    *order_out = order;
+    return num_files;
+}
+
+// The planner scans the volume bitmap a 32-bit word at a time: full and empty
+// words are skipped or counted whole, so placing a file stays cheap on
+// multi-GB hardfiles. ADFlib's own allocator tests one bit per call and
+// restarts from the root block every time.
+//
+// Returns the bitmap word that covers block, block + 1, ... (block - 2 must be
+// a multiple of 32). A set bit means the block is free.
+static uint32_t bitmap_word(const struct AdfVolume *vol, ADF_SECTNUM block) {
+    const uint32_t index = (uint32_t)(block - 2);
+    return vol->bitmap.table[index / (ADF_BM_MAP_SIZE * 32)]->map[(index / 32) % ADF_BM_MAP_SIZE];
+}
+
+static bool bitmap_block_is_free(const struct AdfVolume *vol, ADF_SECTNUM block) {
+    const uint32_t bit = (uint32_t)(block - 2) % 32;
+    return (bitmap_word(vol, block - (ADF_SECTNUM)bit) >> bit) & 1;
+}
+
+// True when block starts a bitmap word that lies entirely within [block, stop].
+static bool at_whole_word(ADF_SECTNUM block, ADF_SECTNUM stop) {
+    return ((block - 2) & 31) == 0 && block + 31 <= stop;
+}
+
+// Looks for count free blocks in a row, starting at cursor and wrapping round
+// to the start of the volume once. Returns the first block of the run, or -1.
+static ADF_SECTNUM find_free_run(const struct AdfVolume *vol, ADF_SECTNUM cursor, unsigned count) {
+    const ADF_SECTNUM first = 2;
+    const ADF_SECTNUM last = (ADF_SECTNUM)adfVolGetSizeInBlocks(vol) - 1;
+    for (int pass = 0; pass < 2; pass++) {
+        ADF_SECTNUM start = pass == 0 ? cursor : first;
+        ADF_SECTNUM stop = pass == 0 ? last : cursor + (ADF_SECTNUM)count - 1;
+        if (stop > last) stop = last;
+        unsigned run = 0;
+        ADF_SECTNUM block = start;
+        while (block <= stop) {
+            if (at_whole_word(block, stop)) {
+                uint32_t word = bitmap_word(vol, block);
+                if (word == 0) {
+                    run = 0;
+                    block += 32;
+                    continue;
+                }
+                if (word == UINT32_MAX) {
+                    if (run + 32 >= count) {
+                        return block - (ADF_SECTNUM)run;
+                    }
+                    run += 32;
+                    block += 32;
+                    continue;
+                }
+            }
+            if (!bitmap_block_is_free(vol, block)) {
+                run = 0;
+            } else if (++run == count) {
+                return block - (ADF_SECTNUM)count + 1;
+            }
+            block++;
+        }
+    }
+    return -1;
+}
+
+// Fallback when no run is long enough: the next count free blocks from cursor.
+static bool gather_free_blocks(const struct AdfVolume *vol, ADF_SECTNUM cursor, unsigned count, ADF_SECTNUM *blocks) {
+    const ADF_SECTNUM first = 2;
+    const ADF_SECTNUM last = (ADF_SECTNUM)adfVolGetSizeInBlocks(vol) - 1;
+    unsigned found = 0;
+    for (int pass = 0; pass < 2 && found < count; pass++) {
+        ADF_SECTNUM block = pass == 0 ? cursor : first;
+        ADF_SECTNUM stop = pass == 0 ? last : cursor - 1;
+        while (block <= stop && found < count) {
+            if (at_whole_word(block, stop) && bitmap_word(vol, block) == 0) {
+                block += 32;
+                continue;
+            }
+            if (bitmap_block_is_free(vol, block)) {
+                blocks[found++] = block;
+            }
+            block++;
+        }
+    }
+    return found == count;
+}
+
+// Reserves the header, extension and data blocks of one file and advances the
+// allocation cursor past them.
+static bool plan_place_file(struct AdfVolume *vol, struct plan_entry *e, ADF_SECTNUM *cursor) {
+    const unsigned total = adfFileSize2Blocks(e->size, vol->datablockSize);
+    e->num_data_blocks = adfFileSize2Datablocks(e->size, vol->datablockSize);
+    e->num_ext_blocks = adfFileDatablocks2Extblocks(e->num_data_blocks);
+
+    ADF_SECTNUM *run = malloc(total * sizeof(*run));
+    e->data_blocks = malloc((e->num_data_blocks + 1) * sizeof(*e->data_blocks));
+    e->ext_blocks = malloc((e->num_ext_blocks + 1) * sizeof(*e->ext_blocks));
+    if (!run || !e->data_blocks || !e->ext_blocks) {
+        perror("malloc failed in plan_place_file");
+        free(run);
+        return false;
+    }
+
+    ADF_SECTNUM start = find_free_run(vol, *cursor, total);
+    if (start >= 0) {
+        for (unsigned i = 0; i < total; i++) {
+            run[i] = start + (ADF_SECTNUM)i;
+        }
+    } else if (gather_free_blocks(vol, *cursor, total, run)) {
+        debug_printf(1, "No free run of %u blocks left for '%s', placing it fragmented.\n", total, e->amiga_path);
+    } else {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Not enough free blocks for '%s' (%u needed). Disk full?\n", e->amiga_path, total);
+        free(run);
+        return false;
+    }
+
+    for (unsigned i = 0; i < total; i++) {
+        adfSetBlockUsed(vol, run[i]);
+    }
+    unsigned pos = 0;
+    e->sector = run[pos++];
+    for (unsigned i = 0; i < e->num_data_blocks; i++) {
+        if (i > 0 && i % ADF_MAX_DATABLK == 0) {
+            e->ext_blocks[i / ADF_MAX_DATABLK - 1] = run[pos++];
+        }
+        e->data_blocks[i] = run[pos++];
+    }
+
+    *cursor = run[total - 1] + 1;
+    if (*cursor >= (ADF_SECTNUM)adfVolGetSizeInBlocks(vol)) {
+        *cursor = 2;
+    }
+    debug_printf(2, "Planned '%s': %u block(s) from %d%s.\n", e->amiga_path, total, (int)run[0], start >= 0 ? "" : " (fragmented)");
+    free(run);
+    return true;
+}
+
+static void plan_release_file(struct AdfVolume *vol, struct plan_entry *e) {
+    adfSetBlockFree(vol, e->sector);
+    for (unsigned i = 0; i < e->num_ext_blocks; i++) {
+        adfSetBlockFree(vol, e->ext_blocks[i]);
+    }
+    for (unsigned i = 0; i < e->num_data_blocks; i++) {
+        adfSetBlockFree(vol, e->data_blocks[i]);
+    }
+    e->sector = 0;
+}
+
+static ADF_SECTNUM plan_parent_sector(const struct AdfVolume *vol, const struct layout_plan *plan,
+                                      const struct plan_entry *e) {
+    return e->parent < 0 ? vol->rootBlock : plan->entries[e->parent].sector;
+}
+
+// Builds data block i of a placed file, on-disk format, from its payload.
+static void assemble_data_block(const struct AdfVolume *vol, const struct plan_entry *e, unsigned i,
+                                const uint8_t *payload, uint32_t length, uint8_t *out) {
+    memset(out, 0, ADF_LOGICAL_BLOCK_SIZE);
+    if (!adfVolIsOFS(vol)) {
+        memcpy(out, payload, length);
+        return;
+    }
+    put_be32(out + 0x00, ADF_T_DATA);
+    put_be32(out + 0x04, (uint32_t)e->sector);
+    put_be32(out + 0x08, i + 1);
+    put_be32(out + 0x0c, length);
+    put_be32(out + 0x10, i + 1 < e->num_data_blocks ? (uint32_t)e->data_blocks[i + 1] : 0);
+    memcpy(out + 0x18, payload, length);
+    put_be32(out + 0x14, adfNormalSum(out, 0x14, ADF_LOGICAL_BLOCK_SIZE));
+}
+
+// Writes the data blocks of a placed file from its host bytes. Blocks that
+// sit next to each other on the volume go out in one adfDevWriteBlock call;
+// on FFS, where a data block is just file bytes, full blocks are written
+// straight from the mapping. staging holds ADF_MAX_DATABLK blocks.
+static bool plan_write_data_blocks(struct AdfVolume *vol, const struct plan_entry *e,
+                                   const uint8_t *data, uint8_t *staging) {
+    const uint32_t payload = vol->datablockSize;
+    unsigned i = 0;
+    while (i < e->num_data_blocks) {
+        unsigned run = 1;
+        while (i + run < e->num_data_blocks && run < ADF_MAX_DATABLK &&
+               e->data_blocks[i + run] == e->data_blocks[i] + (ADF_SECTNUM)run) {
+            run++;
+        }
+
+        const uint8_t *blocks = staging;
+        if (!adfVolIsOFS(vol) && (size_t)(i + run) * payload <= e->size) {
+            blocks = data + (size_t)i * payload;
+        } else {
+            for (unsigned j = 0; j < run; j++) {
+                size_t offset = (size_t)(i + j) * payload;
+                uint32_t length = e->size - offset < payload ? (uint32_t)(e->size - offset) : payload;
+                assemble_data_block(vol, e, i + j, data + offset, length, staging + (size_t)j * ADF_LOGICAL_BLOCK_SIZE);
+            }
+        }
+        if (adfDevWriteBlock(vol->dev, (uint32_t)(vol->firstBlock + e->data_blocks[i]),
+                             run * ADF_LOGICAL_BLOCK_SIZE, blocks) != ADF_RC_OK) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to write data blocks %d-%d of '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET,
+                    (int)e->data_blocks[i], (int)e->data_blocks[i] + (int)run - 1, e->amiga_path);
+            return false;
+        }
+        debug_printf(2, "Wrote %u data block(s) of '%s' from block %d.\n", run, e->amiga_path, (int)e->data_blocks[i]);
+        i += run;
+    }
+    return true;
+}
+
+// Writes the data, extension and header blocks of a placed file, then links
+// the header into its parent directory. The entry only becomes visible once
+// all of its blocks are on the volume; linked is set from then on, and the
+// blocks must be kept even if the directory cache cannot be updated.
+static bool plan_write_file(struct AdfVolume *vol, const struct layout_plan *plan, struct plan_entry *e,
+                            uint8_t *staging, bool *linked) {
+    const ADF_SECTNUM parent_sector = plan_parent_sector(vol, plan, e);
+    debug_printf(1, "Processing host file: '%s' -> ADF as '%s' (header block %d)\n", e->host_path, e->amiga_path, (int)e->sector);
+
+    struct host_file_view host_view;
+    if (!open_host_file_view(e->host_path, &host_view)) {
+        return false;
+    }
+    bool success = host_view.size == e->size;
+    if (!success) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "'%s' changed size while the image was being built.\n", e->host_path);
+    } else {
+        success = plan_write_data_blocks(vol, e, host_view.data, staging);
+    }
+    close_host_file_view(&host_view);
+
+    for (unsigned k = 0; k < e->num_ext_blocks && success; k++) {
+        struct AdfFileExtBlock fext;
+        memset(&fext, 0, sizeof(fext));
+        const unsigned first = (k + 1) * ADF_MAX_DATABLK;
+        const unsigned count = e->num_data_blocks - first < ADF_MAX_DATABLK ? e->num_data_blocks - first : ADF_MAX_DATABLK;
+        fext.type = ADF_T_LIST;
+        fext.headerKey = e->ext_blocks[k];
+        fext.highSeq = (int32_t)count;
+        for (unsigned j = 0; j < count; j++) {
+            fext.dataBlocks[ADF_MAX_DATABLK - 1 - j] = e->data_blocks[first + j];
+        }
+        fext.parent = e->sector;
+        fext.extension = k + 1 < e->num_ext_blocks ? e->ext_blocks[k + 1] : 0;
+        fext.secType = ADF_ST_FILE;
+        if (adfWriteFileExtBlock(vol, e->ext_blocks[k], &fext) != ADF_RC_OK) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to write extension block %d of '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, (int)e->ext_blocks[k], e->amiga_path);
+            success = false;
+        }
+    }
+    if (!success) {
+        return false;
+    }
+
+    struct AdfFileHeaderBlock fhdr;
+    memset(&fhdr, 0, sizeof(fhdr));
+    const unsigned in_header = e->num_data_blocks < ADF_MAX_DATABLK ? e->num_data_blocks : ADF_MAX_DATABLK;
+    fhdr.type = ADF_T_HEADER;
+    fhdr.headerKey = e->sector;
+    fhdr.highSeq = (int32_t)in_header;
+    fhdr.firstData = e->num_data_blocks ? e->data_blocks[0] : 0;
+    for (unsigned j = 0; j < in_header; j++) {
+        fhdr.dataBlocks[ADF_MAX_DATABLK - 1 - j] = e->data_blocks[j];
+    }
+    fhdr.byteSize = e->size;
+    host_time_to_amiga(e->mtime, &fhdr.days, &fhdr.mins, &fhdr.ticks);
+    fhdr.nameLen = (uint8_t)strlen(e->name);
+    memcpy(fhdr.fileName, e->name, fhdr.nameLen);
+    fhdr.parent = parent_sector;
+    fhdr.extension = e->num_ext_blocks ? e->ext_blocks[0] : 0;
+    fhdr.secType = ADF_ST_FILE;
+    if (adfWriteFileHdrBlock(vol, e->sector, &fhdr) != ADF_RC_OK) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to write header block of '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, e->amiga_path);
+        return false;
+    }
+
+    struct AdfEntryBlock parent_block;
+    if (adfReadEntryBlock(vol, parent_sector, &parent_block) != ADF_RC_OK ||
+        adfCreateEntry(vol, &parent_block, e->name, e->sector) != e->sector) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to link '%s' into its directory (duplicate name?). ADFLib error occurred.\n" ANSI_COLOR_RESET, e->amiga_path);
+        return false;
+    }
+    *linked = true;
+    if (adfVolHasDIRCACHE(vol) &&
+        adfAddInCache(vol, &parent_block, (struct AdfEntryBlock *)&fhdr) != ADF_RC_OK) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to add '%s' to the directory cache; the file is on the volume, but the cache is missing it.\n" ANSI_COLOR_RESET, e->amiga_path);
+        return false;
+    }
+
+    debug_printf(1, "Successfully added '%s' to ADF as '%s'.\n", e->host_path, e->amiga_path);
+    return true;
+}
+
+// adfCreateDir() and adfCreateEntry() stamp directories and the root with the
+// current time; replace those with the host directories' dates, and the root
+// with SOURCE_DATE_EPOCH or, failing that, the newest input.
+static bool plan_stamp_dates(struct AdfVolume *vol, const struct layout_plan *plan) {
+    bool success = true;
+    for (int i = 0; i < plan->num_entries; i++) {
+        const struct plan_entry *e = &plan->entries[i];
+        if (!e->is_dir || e->sector <= 0) {
+            continue;
+        }
+        struct AdfEntryBlock dir_block;
+        if (adfReadEntryBlock(vol, e->sector, &dir_block) != ADF_RC_OK) {
+            success = false;
+            continue;
+        }
+        host_time_to_amiga(e->mtime, &dir_block.days, &dir_block.mins, &dir_block.ticks);
+        if (adfWriteDirBlock(vol, e->sector, (struct AdfDirBlock *)&dir_block) != ADF_RC_OK) {
+            success = false;
+        }
+    }
+
+    time_t volume_time = plan->newest_mtime;
+    const char *source_date_epoch = getenv("SOURCE_DATE_EPOCH");
+    if (source_date_epoch && *source_date_epoch) {
+        volume_time = (time_t)strtoll(source_date_epoch, NULL, 10);
+    }
+    struct AdfRootBlock root;
+    if (adfReadRootBlock(vol, (uint32_t)vol->rootBlock, &root) != ADF_RC_OK) {
+        return false;
+    }
+    host_time_to_amiga(volume_time, &root.days, &root.mins, &root.ticks);
+    host_time_to_amiga(volume_time, &root.cDays, &root.cMins, &root.cTicks);
+    host_time_to_amiga(volume_time, &root.coDays, &root.coMins, &root.coTicks);
+    if (adfWriteRootBlock(vol, (uint32_t)vol->rootBlock, &root) != ADF_RC_OK) {
+        success = false;
+    }
+    if (!success) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to set directory and volume dates. ADFLib error occurred.\n" ANSI_COLOR_RESET);
+    }
+    return success;
+}
+
+// -P counterpart of add_host_items_to_adf().
+static bool add_host_items_planned(struct AdfVolume *volume, char **items, int num_items) {
+    struct layout_plan plan;
+    memset(&plan, 0, sizeof(plan));
+    bool all_success = plan_scan_inputs(&plan, items, num_items);
+
+    // Directories first, in tree order: their blocks end up next to the root.
+    for (int i = 0; i < plan.num_entries; i++) {
+        struct plan_entry *e = &plan.entries[i];
+        if (!e->is_dir) {
+            continue;
+        }
+        ADF_SECTNUM parent_sector = plan_parent_sector(volume, &plan, e);
+        if (parent_sector <= 0) {
+            continue; // parent failed, already reported
+        }
+        if (adfCreateDir(volume, parent_sector, e->name) != ADF_RC_OK ||
+            (e->sector = adfGetEntryBlockNum(volume, parent_sector, e->name)) <= 0) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to create Amiga directory '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, e->amiga_path);
+            e->sector = 0;
+            all_success = false;
+            continue;
+        }
+        debug_printf(2, "Created Amiga directory '%s' at block %d.\n", e->amiga_path, (int)e->sector);
+    }
+
+    int *order = NULL;
+    int num_files = plan_load_order(&plan, load_order_path, &order);
+    uint8_t *staging = malloc((size_t)ADF_MAX_DATABLK * ADF_LOGICAL_BLOCK_SIZE);
+    if (num_files < 0 || !staging) {
+        if (!staging) perror("malloc failed in add_host_items_planned");
+        free(staging);
+        free(order);
+        free_layout_plan(&plan);
+        return false;
+    }
+
+    // Reserve every file's blocks before writing any of them, so a tree that
+    // does not fit is reported up front.
+    ADF_SECTNUM cursor = volume->rootBlock;
+    for (int n = 0; n < num_files; n++) {
+        struct plan_entry *e = &plan.entries[order[n]];
+        if (plan_parent_sector(volume, &plan, e) <= 0 || !plan_place_file(volume, e, &cursor)) {
+            e->sector = 0;
+            all_success = false;
+        }
+    }
+
+    for (int n = 0; n < num_files; n++) {
+        struct plan_entry *e = &plan.entries[order[n]];
+        bool linked = false;
+        if (e->sector > 0 && !plan_write_file(volume, &plan, e, staging, &linked)) {
+            if (!linked) {
+                plan_release_file(volume, e);
+            }
+            all_success = false;
+        }
+    }
+    free(staging);
+    free(order);
+
+    if (adfUpdateBitmap(volume) != ADF_RC_OK) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to write the volume bitmap. ADFLib error occurred.\n" ANSI_COLOR_RESET);
+        all_success = false;
+    }
+    if (!plan_stamp_dates(volume, &plan)) {
+        all_success = false;
+    }
+    free_layout_plan(&plan);
+    return all_success;
+}
+
+/*
+ * Update mode (-u).
+ *
+ * Mounts an existing image and brings it in line with the host tree instead
+ * of reformatting it. A file whose size and date match its header block is
+ * left alone. If only the date differs, the data is compared with the host
+ * file and, when it is the same, only the header date is refreshed. Anything
+ * else is removed and written again. Entries that are no longer on the host
+ * side are removed, so the result matches a full rebuild.
+ */
+struct update_stats {
+    int unchanged;
+    int redated;
+    int rewritten;
+    int added;
+    int removed;
+};
+
+// Removes an entry, emptying it first if it is a directory.
+static bool remove_entry_tree(struct AdfVolume *vol, ADF_SECTNUM parent_sector, const char *name,
+                              ADF_SECTNUM sector, bool is_dir) {
+    bool success = true;
+    if (is_dir) {
+        struct AdfList *list = adfGetDirEnt(vol, sector);
+        for (struct AdfList *cell = list; cell; cell = cell->next) {
+            const struct AdfEntry *child = cell->content;
+            if (!remove_entry_tree(vol, sector, child->name, child->sector, child->type == ADF_ST_DIR)) {
+                success = false;
+            }
+        }
+        adfFreeDirList(list);
+    }
+    if (success && adfRemoveEntry(vol, parent_sector, name) != ADF_RC_OK) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to remove '%s' from the ADF. ADFLib error occurred.\n" ANSI_COLOR_RESET, name);
+        return false;
+    }
+    return success;
+}
+
+// True if the file in the current ADF directory holds exactly the host bytes.
+static bool adf_file_matches(struct AdfVolume *vol, const char *name, const struct host_file_view *host_view) {
+    struct AdfFile *amiga_file_ptr = adfFileOpen(vol, name, ADF_FILE_MODE_READ);
+    if (!amiga_file_ptr) {
+        return false;
+    }
+    uint8_t buffer[1024 * 4];
+    size_t offset = 0;
+    bool same = adfFileGetSize(amiga_file_ptr) == host_view->size;
+    while (same && offset < host_view->size) {
+        uint32_t want = host_view->size - offset < sizeof(buffer) ? (uint32_t)(host_view->size - offset) : (uint32_t)sizeof(buffer);
+        uint32_t got = adfFileRead(amiga_file_ptr, want, buffer);
+        same = got == want && memcmp(buffer, host_view->data + offset, got) == 0;
+        offset += got;
+    }
+    adfFileClose(amiga_file_ptr);
+    return same;
+}
+
+static bool update_file(struct AdfVolume *vol, ADF_SECTNUM parent_sector, const struct plan_entry *e,
+                        ADF_SECTNUM existing, struct update_stats *stats) {
+    // adfFileOpen() works on the current directory.
+    vol->curDirPtr = parent_sector;
+
+    if (existing > 0) {
+        struct AdfEntryBlock header;
+        if (adfReadEntryBlock(vol, existing, &header) != ADF_RC_OK) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to read the ADF entry for '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, e->amiga_path);
+            return false;
+        }
+        if (header.secType == ADF_ST_FILE && header.byteSize == e->size) {
+            int32_t days, mins, ticks;
+            host_time_to_amiga(e->mtime, &days, &mins, &ticks);
+            if (header.days == days && header.mins == mins && header.ticks == ticks) {
+                debug_printf(2, "Unchanged: '%s'\n", e->amiga_path);
+                stats->unchanged++;
+                return true;
+            }
+            struct host_file_view host_view;
+            if (!open_host_file_view(e->host_path, &host_view)) {
+                return false;
+            }
+            bool same = adf_file_matches(vol, e->name, &host_view);
+            close_host_file_view(&host_view);
+            if (same) {
+                debug_printf(1, "Same content, new date: '%s'\n", e->amiga_path);
+                stats->redated++;
+                return set_file_date(vol, existing, e->mtime);
+            }
+        }
+        debug_printf(1, "Changed: '%s'\n", e->amiga_path);
+        if (!remove_entry_tree(vol, parent_sector, e->name, existing, header.secType == ADF_ST_DIR)) {
+            return false;
+        }
+        stats->rewritten++;
+    } else {
+        debug_printf(1, "New: '%s'\n", e->amiga_path);
+        stats->added++;
+    }
+    return add_host_file_to_adf(vol, e->host_path, e->name);
+}
+
+// A plan entry that exists on the volume, as its parent's plan index and its
+// own block. prune_directory() looks ADF entries up in a sorted array of these
+// instead of scanning the whole plan for every entry.
+struct wanted_entry {
+    int parent;
+    ADF_SECTNUM sector;
+};
+
+static int compare_wanted_entries(const void *a, const void *b) {
+    const struct wanted_entry *wa = a, *wb = b;
+    if (wa->parent != wb->parent) return wa->parent < wb->parent ? -1 : 1;
+    if (wa->sector != wb->sector) return wa->sector < wb->sector ? -1 : 1;
+    return 0;
+}
+
+// Removes the entries of one ADF directory that have no counterpart on the
+// host. dir_index is the plan entry of the directory, -1 for the root; wanted
+// is sorted with compare_wanted_entries().
+static bool prune_directory(struct AdfVolume *vol, const struct wanted_entry *wanted, int num_wanted,
+                            int dir_index, ADF_SECTNUM dir_sector, struct update_stats *stats) {
+    bool success = true;
+    struct AdfList *list = adfGetDirEnt(vol, dir_sector);
+    for (struct AdfList *cell = list; cell; cell = cell->next) {
+        const struct AdfEntry *entry = cell->content;
+        struct wanted_entry key = { dir_index, entry->sector };
+        if (num_wanted == 0 || !bsearch(&key, wanted, (size_t)num_wanted, sizeof(*wanted), compare_wanted_entries)) {
+            debug_printf(1, "Removed from host: '%s'\n", entry->name);
+            if (remove_entry_tree(vol, dir_sector, entry->name, entry->sector, entry->type == ADF_ST_DIR)) {
+                stats->removed++;
+            } else {
+                success = false;
+            }
+        }
+    }
+    adfFreeDirList(list);
+    return success;
+}
+
+static bool set_volume_name(struct AdfVolume *vol, const char *volume_name) {
+    struct AdfRootBlock root;
+    if (adfReadRootBlock(vol, (uint32_t)vol->rootBlock, &root) != ADF_RC_OK) {
+        return false;
+    }
+    size_t length = strlen(volume_name);
+    if (length > ADF_MAX_NAME_LEN) length = ADF_MAX_NAME_LEN;
+    if (root.nameLen == length && strncmp(root.diskName, volume_name, length) == 0) {
+        return true;
+    }
+    debug_printf(1, "Renaming volume to '%s'.\n", volume_name);
+    memset(root.diskName, 0, sizeof(root.diskName));
+    memcpy(root.diskName, volume_name, length);
+    root.nameLen = (uint8_t)length;
+    return adfWriteRootBlock(vol, (uint32_t)vol->rootBlock, &root) == ADF_RC_OK;
+}
+
+// -u counterpart of add_host_items_to_adf(), for a volume that already has content.
+static bool update_host_items_in_adf(struct AdfVolume *volume, const struct volume_spec *spec) {
+    struct layout_plan plan;
+    memset(&plan, 0, sizeof(plan));
+    struct update_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    bool all_success = plan_scan_inputs(&plan, spec->inputs, spec->num_inputs);
+
+    // Entries come parent first, so every directory exists before its children.
+    for (int i = 0; i < plan.num_entries; i++) {
+        struct plan_entry *e = &plan.entries[i];
+        ADF_SECTNUM parent_sector = plan_parent_sector(volume, &plan, e);
+        if (parent_sector <= 0) {
+            continue; // parent failed, already reported
+        }
+        ADF_SECTNUM existing = adfGetEntryBlockNum(volume, parent_sector, e->name);
+
+        if (!e->is_dir) {
+            if (update_file(volume, parent_sector, e, existing, &stats)) {
+                e->sector = adfGetEntryBlockNum(volume, parent_sector, e->name);
+            } else {
+                all_success = false;
+            }
+            continue;
+        }
+
+        if (existing > 0) {
+            struct AdfEntryBlock entry_block;
+            if (adfReadEntryBlock(volume, existing, &entry_block) == ADF_RC_OK && entry_block.secType == ADF_ST_DIR) {
+                e->sector = existing;
+                continue;
+            }
+            if (!remove_entry_tree(volume, parent_sector, e->name, existing, false)) {
+                all_success = false;
+                continue;
+            }
+        }
+        if (adfCreateDir(volume, parent_sector, e->name) != ADF_RC_OK ||
+            (e->sector = adfGetEntryBlockNum(volume, parent_sector, e->name)) <= 0) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to create Amiga directory '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, e->amiga_path);
+            e->sector = 0;
+            all_success = false;
+        }
+    }
+
+    // Prune only where the host side was read completely.
+    struct wanted_entry *wanted = NULL;
+    if (all_success && plan.num_entries > 0 &&
+        !(wanted = malloc((size_t)plan.num_entries * sizeof(*wanted)))) {
+        perror("malloc failed in update_host_items_in_adf");
+        all_success = false;
+    }
+    if (all_success) {
+        int num_wanted = 0;
+        for (int i = 0; i < plan.num_entries; i++) {
+            if (plan.entries[i].sector > 0) {
+                wanted[num_wanted++] = (struct wanted_entry){ plan.entries[i].parent, plan.entries[i].sector };
+            }
+        }
+        if (num_wanted > 0) {
+            qsort(wanted, (size_t)num_wanted, sizeof(*wanted), compare_wanted_entries);
+        }
+        all_success = prune_directory(volume, wanted, num_wanted, -1, volume->rootBlock, &stats);
+        for (int i = 0; i < plan.num_entries; i++) {
+            if (plan.entries[i].is_dir && plan.entries[i].sector > 0 &&
+                !prune_directory(volume, wanted, num_wanted, i, plan.entries[i].sector, &stats)) {
+                all_success = false;
+            }
+        }
+    }
+    free(wanted);
+    if (!set_volume_name(volume, spec->volume_name)) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to rename volume to '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, spec->volume_name);
+        all_success = false;
+    }
+
+    debug_printf(1, "Update of '%s': %d unchanged, %d re-dated, %d rewritten, %d added, %d removed.\n",
+                 spec->volume_name, stats.unchanged, stats.redated, stats.rewritten, stats.added, stats.removed);
+    volume->curDirPtr = volume->rootBlock;
+    free_layout_plan(&plan);
+    return all_success;
+}
+
+// Lists a directory's entries, sorted, as host paths. Used for the contents
+// of an RDB partition (-p), which go into the partition's root directory.
+// Returns the number of entries, or -1 on error.
+static int list_directory_inputs(const char *host_dirpath, char ***inputs_out) {
+    DIR *dir = opendir(host_dirpath);
+    if (!dir) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not open host directory '%s': %s\n", host_dirpath, strerror(errno));
+        return -1;
+    }
+    char **inputs = NULL;
+    int num_inputs = 0, capacity = 0;
+    bool ok = true;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (num_inputs == capacity) {
+            capacity = capacity ? capacity * 2 : 32;
+            char **grown = realloc(inputs, (size_t)capacity * sizeof(*inputs));
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            inputs = grown;
+        }
+        size_t length = strlen(host_dirpath) + strlen(entry->d_name) + 2;
+        if (!(inputs[num_inputs] = malloc(length))) {
+            ok = false;
+            break;
+        }
+        snprintf(inputs[num_inputs++], length, "%s/%s", host_dirpath, entry->d_name);
+    }
+    closedir(dir);
+    if (!ok) {
+        perror("allocation failed in list_directory_inputs");
+        for (int i = 0; i < num_inputs; i++) free(inputs[i]);
+        free(inputs);
+        return -1;
+    }
+    qsort(inputs, (size_t)num_inputs, sizeof(*inputs), compare_entry_names);
+    *inputs_out = inputs;
+    return num_inputs;
+}
+
+// Frees the directory listings built for the -p partitions (specs 1 and up).
+static void free_partition_inputs(struct volume_spec *specs, int num_specs) {
+    for (int i = 1; i < num_specs; i++) {
+        for (int j = 0; j < specs[i].num_inputs; j++) {
+            free(specs[i].inputs[j]);
+        }
+        free(specs[i].inputs);
+    }
+}
+
+static uint8_t volume_dos_type(void) {
+    if (filesystem_type >= 0) {
+        return (uint8_t)filesystem_type;
+    }
+    return image_type == IMAGE_ADF ? ADF_DOSFS_OFS : ADF_DOSFS_FFS;
+}
+
+// Blocks a volume needs for the given inputs: boot blocks, root, one block per
+// directory, adfFileSize2Blocks() per file and the bitmap, plus 5% headroom
+// so small updates still fit. This walks the whole input tree, so it is only
+// used to size hard-disk volumes. Returns 0 on error.
+static uint32_t estimate_volume_blocks(char **inputs, int num_inputs) {
+    const unsigned datablock_size = adfDosFsIsFFS(volume_dos_type()) ? 512 : 488;
+    struct layout_plan plan;
+    memset(&plan, 0, sizeof(plan));
+    bool ok = plan_scan_inputs(&plan, inputs, num_inputs);
+
+    uint64_t blocks = 3;
+    for (int i = 0; ok && i < plan.num_entries; i++) {
+        blocks += plan.entries[i].is_dir ? 1 : adfFileSize2Blocks(plan.entries[i].size, datablock_size);
+    }
+    free_layout_plan(&plan);
+
+    blocks += blocks / 20 + 64;
+    const uint64_t bitmap_blocks = (blocks + ADF_BM_MAP_SIZE * 32 - 1) / (ADF_BM_MAP_SIZE * 32);
+    const uint64_t bitmap_ext_blocks = bitmap_blocks > ADF_BM_PAGES_ROOT_SIZE ?
+        (bitmap_blocks - ADF_BM_PAGES_ROOT_SIZE + ADF_BM_MAP_SIZE - 1) / ADF_BM_MAP_SIZE : 0;
+    blocks += bitmap_blocks + bitmap_ext_blocks;
+    if (!ok || blocks > INT32_MAX) {
+        return 0;
+    }
+    return (uint32_t)blocks;
+}
+
+// Size of one hard-disk volume in blocks: -s if given, otherwise what the
+// inputs need. Returns 0 on error.
+static uint32_t hard_disk_volume_blocks(const struct volume_spec *spec) {
+    uint32_t needed = estimate_volume_blocks(spec->inputs, spec->num_inputs);
+    if (needed == 0) {
+        return 0;
+    }
+    if (volume_size_mb == 0) {
+        return needed;
+    }
+    uint32_t requested = volume_size_mb * (1024 * 1024 / ADF_DEV_BLOCK_SIZE);
+    if (requested < needed) {
+        fprintf(stderr, ANSI_COLOR_YELLOW "Warning: " ANSI_COLOR_RESET "Volume '%s' is %u MB but its inputs need about %u MB.\n",
+                spec->volume_name, volume_size_mb, (needed + 2047) / 2048);
+    }
+    return requested;
+}
+
+// Creates the device for a new image and formats its volumes.
+static struct AdfDevice *create_image(const char *driver_name, const char *output_filename,
+                                      const struct volume_spec *specs, int num_specs) {
+    const uint8_t dos_type = volume_dos_type();
+    struct AdfDevice *device = NULL;
+
+    if (image_type == IMAGE_ADF) {
+        debug_printf(2, "Attempting to create device with adfDevCreate(\"%s\", \"%s\", 80, 2, 11)\n", driver_name, output_filename);
+        device = adfDevCreate(driver_name, output_filename, 80, 2, 11);
+        if (!device) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to create ADF device '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, output_filename);
+            return NULL;
+        }
+        debug_printf(2, "Creating floppy volume '%s' on device with adfCreateFlop()...\n", specs[0].volume_name);
+        if (adfCreateFlop(device, specs[0].volume_name, dos_type) != ADF_RC_OK) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to create/format floppy volume '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, specs[0].volume_name);
+            adfDevClose(device);
+            return NULL;
+        }
+        return device;
+    }
+
+    if (image_type == IMAGE_HDF) {
+        uint32_t blocks = hard_disk_volume_blocks(&specs[0]);
+        if (blocks == 0) {
+            return NULL;
+        }
+        uint32_t cylinders = (blocks + HDF_HEADS * HDF_SECTORS - 1) / (HDF_HEADS * HDF_SECTORS);
+        debug_printf(1, "Creating %u KB hardfile '%s'.\n", cylinders * HDF_HEADS * HDF_SECTORS / 2, output_filename);
+        device = adfDevCreate(driver_name, output_filename, cylinders, HDF_HEADS, HDF_SECTORS);
+        if (!device) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to create hardfile device '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, output_filename);
+            return NULL;
+        }
+        if (adfCreateHdFile(device, specs[0].volume_name, dos_type) != ADF_RC_OK) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to create/format hardfile volume '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, specs[0].volume_name);
+            adfDevClose(device);
+            return NULL;
+        }
+        return device;
+    }
+
+    struct AdfPartition partitions[1 + MAX_EXTRA_PARTITIONS];
+    const struct AdfPartition *partition_list[1 + MAX_EXTRA_PARTITIONS];
+    uint32_t cylinders = RDB_RESERVED_CYLINDERS;
+    for (int i = 0; i < num_specs; i++) {
+        uint32_t blocks = hard_disk_volume_blocks(&specs[i]);
+        if (blocks == 0) {
+            return NULL;
+        }
+        partitions[i].startCyl = (int32_t)cylinders;
+        partitions[i].lenCyl = (int32_t)((blocks + RDB_HEADS * RDB_SECTORS - 1) / (RDB_HEADS * RDB_SECTORS));
+        partitions[i].volName = (char *)specs[i].volume_name;
+        partitions[i].volType = dos_type;
+        partition_list[i] = &partitions[i];
+        cylinders += (uint32_t)partitions[i].lenCyl;
+        debug_printf(1, "Partition %d '%s': cylinders %d-%d (%u KB).\n", i, specs[i].volume_name, partitions[i].startCyl,
+                     partitions[i].startCyl + partitions[i].lenCyl - 1, (uint32_t)partitions[i].lenCyl * RDB_HEADS * RDB_SECTORS / 2);
+    }
+    device = adfDevCreate(driver_name, output_filename, cylinders, RDB_HEADS, RDB_SECTORS);
+    if (!device) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to create hard disk device '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, output_filename);
+        return NULL;
+    }
+    if (adfCreateHd(device, (unsigned)num_specs, partition_list) != ADF_RC_OK) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to partition/format hard disk '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, output_filename);
+        adfDevClose(device);
+        return NULL;
+    }
+    return device;
+}
+
+// Creates, formats and fills one image, or with --update brings an existing
+// one up to date. ADFlib must already be initialized and the dump driver
+// registered. Batch workers may call this concurrently for different output
+// files (run_batch rejects duplicates); all ADFlib calls run under adflib_lock.
+static bool build_adf_image(const struct build_job *job) {
+    const char *output_filename = job->output_filename;
+    struct AdfDevice *device = NULL;
+    bool all_items_success = true;
+
+    debug_printf(2, "Output ADF: %s\n", output_filename);
+    debug_printf(2, "Volume name: %s\n", job->volume_name);
+
+    // Volume 0 takes the job's inputs; on RDB images every -p adds one more.
+    struct volume_spec specs[1 + MAX_EXTRA_PARTITIONS];
+    int num_specs = 1;
+    specs[0] = (struct volume_spec){ job->volume_name, job->inputs, job->num_inputs };
+    for (int i = 0; image_type == IMAGE_RDB && i < num_extra_partitions; i++, num_specs++) {
+        specs[num_specs].volume_name = extra_partitions[i].volume_name;
+        specs[num_specs].num_inputs = list_directory_inputs(extra_partitions[i].host_dir, &specs[num_specs].inputs);
+        if (specs[num_specs].num_inputs < 0) {
+            all_items_success = false;
+            break;
+        }
+    }
+
+    const char *driver_name = build_in_memory ? MEM_DEVICE_DRIVER_NAME : "dump";
+    const bool updating = update_existing && access(output_filename, F_OK) == 0;
+    if (update_existing && !updating) {
+        debug_printf(1, "'%s' does not exist yet, building it from scratch.\n", output_filename);
+    }
+
+    pthread_mutex_lock(&adflib_lock);
+    if (!all_items_success) {
+        // a partition directory could not be read, already reported
+    } else if (updating) {
+        debug_printf(2, "Opening existing ADF with adfDevOpenWithDriver(\"%s\", \"%s\")\n", driver_name, output_filename);
+        device = adfDevOpenWithDriver(driver_name, output_filename, ADF_ACCESS_MODE_READWRITE);
+        if (!device) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to open existing ADF '%s' for update. ADFLib error occurred.\n" ANSI_COLOR_RESET, output_filename);
+        }
+    } else {
+        device = create_image(driver_name, output_filename, specs, num_specs);
+    }
+    if (!device) {
+        pthread_mutex_unlock(&adflib_lock);
+        free_partition_inputs(specs, num_specs);
+        return false;
+    }
+    debug_printf(2, "Device '%s' ready.\n", output_filename);
+
+    debug_printf(2, "Mounting device '%s' with adfDevMount()...\n", output_filename);
+    if (adfDevMount(device) != ADF_RC_OK) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to mount device '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, output_filename);
+        adfDevClose(device);
+        pthread_mutex_unlock(&adflib_lock);
+        free_partition_inputs(specs, num_specs);
+        return false;
+    }
+    debug_printf(2, "Device '%s' mounted successfully via adfDevMount (%d volume(s)).\n", output_filename, device->nVol);
+    int num_volumes = num_specs;
+    if (device->nVol < num_specs) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "'%s' has %d volume(s), %d expected.\n", output_filename, device->nVol, num_specs);
+        all_items_success = false;
+        num_volumes = 0;
+    }
+
+    for (int i = 0; i < num_volumes; i++) {
+        debug_printf(2, "Attempting to mount volume %d from device '%s' with adfVolMount()...\n", i, output_filename);
+        struct AdfVolume *volume = adfVolMount(device, i, ADF_ACCESS_MODE_READWRITE);
+        if (!volume) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to mount volume %d from device '%s'. ADFLib error occurred.\n" ANSI_COLOR_RESET, i, output_filename);
+            all_items_success = false;
+            continue;
+        }
+        const char *current_vol_name_display = volume->volName ? volume->volName : specs[i].volume_name;
+        debug_printf(2, "Volume '%s' (from partition %d) mounted successfully via adfVolMount.\n", current_vol_name_display, i);
+
+        bool volume_success;
+        if (updating) {
+            volume_success = update_host_items_in_adf(volume, &specs[i]);
+        } else if (plan_layout || image_type != IMAGE_ADF) {
+            volume_success = add_host_items_planned(volume, specs[i].inputs, specs[i].num_inputs);
+        } else {
+            volume_success = add_host_items_to_adf(volume, specs[i].inputs, specs[i].num_inputs);
+        }
+        if (!volume_success) {
+            all_items_success = false;
+            // A floppy has a fixed size, so failures there are usually a full disk.
+            if (image_type == IMAGE_ADF) {
+                fprintf(stderr, ANSI_COLOR_YELLOW "Warning: " ANSI_COLOR_RESET "'%s' has %u KB left; if the inputs did not fit, consider -t hdf.\n",
+                        output_filename, adfCountFreeBlocks(volume) / 2);
+            }
+        }
+
+        debug_printf(2, "Unmounting volume '%s'...\n", current_vol_name_display);
+        adfVolUnMount(volume);
+    }
+    free_partition_inputs(specs, num_specs);
+
+    debug_printf(2, "Unmounting device '%s'...\n", output_filename);
+    adfDevUnMount(device);
+    pthread_mutex_unlock(&adflib_lock);
+    if (build_in_memory) {
+        // The unmounted image is only ours now, so it is written out unlocked.
+        const struct mem_device *mem = device->drvData;
+        debug_printf(2, "Flushing in-memory image to '%s'...\n", output_filename);
+        if (!write_image_atomically(output_filename, mem->image, mem->size)) {
+            all_items_success = false;
+        }
+    }
+    debug_printf(2, "Closing device '%s'...\n", output_filename);
+    pthread_mutex_lock(&adflib_lock);
+    adfDevClose(device);
+    pthread_mutex_unlock(&adflib_lock);
+
+    return all_items_success;
+}
+
+static double elapsed_ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1000.0 +
+           (double)(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static void free_batch_jobs(struct build_job *jobs, int num_jobs) {
+    for (int i = 0; i < num_jobs; i++) {
+        free((char *)jobs[i].output_filename);
+        free((char *)jobs[i].volume_name);
+        for (int j = 0; j < jobs[i].num_inputs; j++) {
+            free(jobs[i].inputs[j]);
+        }
+        free(jobs[i].inputs);
+    }
+    free(jobs);
+}
+
+// Splits one manifest line on tabs: <output.adf> <volname> <input> [<input> ...]
+static bool parse_manifest_line(char *line, struct build_job *job) {
+    char *fields[3 + 256];
+    int num_fields = 0;
+    memset(job, 0, sizeof(*job));
+    char *cursor = line;
+    while (cursor && num_fields < (int)(sizeof(fields) / sizeof(fields[0]))) {
+        char *tab = strchr(cursor, '\t');
+        if (tab) *tab = '\0';
+        if (*cursor != '\0') fields[num_fields++] = cursor;
+        cursor = tab ? tab + 1 : NULL;
+    }
+    if (cursor) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Too many inputs on a single manifest line.\n");
+        return false;
+    }
+    if (num_fields < 3) {
+        return false;
+    }
+
+    job->output_filename = strdup(fields[0]);
+    job->volume_name = strdup(fields[1]);
+    job->num_inputs = num_fields - 2;
+    job->inputs = calloc((size_t)job->num_inputs, sizeof(char *));
+    if (!job->output_filename || !job->volume_name || !job->inputs) {
+        return false;
+    }
+    for (int i = 0; i < job->num_inputs; i++) {
+        job->inputs[i] = strdup(fields[i + 2]);
+        if (!job->inputs[i]) return false;
+    }
+    return true;
+}
+
+// Reads a batch manifest. Blank lines and lines starting with '#' are ignored.
+// Returns the number of jobs loaded, or -1 on error.
+static int load_batch_manifest(const char *manifest_path, struct build_job **jobs_out) {
+    FILE *manifest = fopen(manifest_path, "r");
+    if (!manifest) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Could not open batch manifest '%s': %s\n", manifest_path, strerror(errno));
+        return -1;
+    }
+
+    struct build_job *jobs = NULL;
+    int num_jobs = 0, capacity = 0, line_number = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    bool ok = true;
+
+    while (getline(&line, &line_capacity, manifest) != -1) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if (num_jobs == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct build_job *grown = realloc(jobs, (size_t)capacity * sizeof(*jobs));
+            if (!grown) {
+                perror("realloc failed in load_batch_manifest");
+                ok = false;
+                break;
+            }
+            jobs = grown;
+        }
+        if (!parse_manifest_line(line, &jobs[num_jobs])) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "%s:%d: expected <output.adf>\\t<volname>\\t<input>[\\t<input> ...]\n",
+                    manifest_path, line_number);
+            num_jobs++; // let free_batch_jobs release the partially parsed entry
+            ok = false;
+            break;
+        }
+        num_jobs++;
+    }
+    free(line);
+    fclose(manifest);
+
+    if (!ok) {
+        free_batch_jobs(jobs, num_jobs);
+        return -1;
+    }
+    *jobs_out = jobs;
+    return num_jobs;
+}
+
+// Identifies the file an output path names, so "disk.adf" and "./disk.adf"
+// compare equal: the real path of its directory followed by its file name.
+// Falls back to the path as written when the directory cannot be resolved.
+static char *output_image_key(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    char *dir = slash ? strndup(path, slash == path ? 1 : (size_t)(slash - path)) : strdup(".");
+    char *real_dir = dir ? realpath(dir, NULL) : NULL;
+    free(dir);
+    if (!real_dir) {
+        return strdup(path);
+    }
+    size_t key_len = strlen(real_dir) + strlen(name) + 2;
+    char *key = malloc(key_len);
+    if (key) {
+        snprintf(key, key_len, "%s/%s", real_dir, name);
+    }
+    free(real_dir);
+    return key;
+}
+
+struct output_key {
+    char *key;
+    int job;
+};
+
+static int compare_output_keys(const void *a, const void *b) {
+    const struct output_key *ka = a, *kb = b;
+    int order = strcmp(ka->key, kb->key);
+    return order ? order : ka->job - kb->job;
+}
+
+// Two workers writing the same image would clobber each other, so every
+// output of a batch has to be a different file.
+static bool check_batch_outputs(const char *manifest_path, const struct build_job *jobs, int num_jobs) {
+    struct output_key *keys = calloc((size_t)num_jobs, sizeof(*keys));
+    if (!keys) {
+        perror("calloc failed in check_batch_outputs");
+        return false;
+    }
+    bool ok = true;
+    for (int i = 0; i < num_jobs && ok; i++) {
+        keys[i].job = i;
+        keys[i].key = output_image_key(jobs[i].output_filename);
+        if (!keys[i].key) {
+            perror("malloc failed in check_batch_outputs");
+            ok = false;
+        }
+    }
+    if (ok) {
+        qsort(keys, (size_t)num_jobs, sizeof(*keys), compare_output_keys);
+        for (int i = 1; i < num_jobs; i++) {
+            if (strcmp(keys[i - 1].key, keys[i].key) == 0) {
+                fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "%s: '%s' and '%s' are the same output image.\n",
+                        manifest_path, jobs[keys[i - 1].job].output_filename, jobs[keys[i].job].output_filename);
+                ok = false;
+            }
+        }
+    }
+    for (int i = 0; i < num_jobs; i++) {
+        free(keys[i].key);
+    }
+    free(keys);
+    return ok;
+}
+
+struct batch_queue {
+    struct build_job *jobs;
+    int num_jobs;
+    int next_job;
+    pthread_mutex_t lock;
+};
+
+static void *batch_worker(void *arg) {
+    struct batch_queue *queue = arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        int index = queue->next_job < queue->num_jobs ? queue->next_job++ : -1;
+        pthread_mutex_unlock(&queue->lock);
+        if (index < 0) {
+            break;
+        }
+
+        struct build_job *job = &queue->jobs[index];
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        job->success = build_adf_image(job);
+        job->elapsed_ms = elapsed_ms_since(&start);
+        debug_printf(1, "Finished '%s' in %.1f ms (%s).\n", job->output_filename, job->elapsed_ms, job->success ? "ok" : "failed");
+    }
+    return NULL;
+}
+
+// Builds every image listed in the manifest on a pool of worker threads and
+// prints per-image timings followed by a summary. Returns the exit code.
+static int run_batch(const char *manifest_path, int num_workers) {
+    struct build_job *jobs = NULL;
+    int num_jobs = load_batch_manifest(manifest_path, &jobs);
+    if (num_jobs < 0) {
+        return EXIT_FAILURE;
+    }
+    if (num_jobs == 0) {
+        fprintf(stderr, ANSI_COLOR_YELLOW "Warning: " ANSI_COLOR_RESET "Batch manifest '%s' lists no images.\n", manifest_path);
+        free(jobs);
+        return EXIT_SUCCESS;
+    }
+    if (!check_batch_outputs(manifest_path, jobs, num_jobs)) {
+        free_batch_jobs(jobs, num_jobs);
+        return EXIT_FAILURE;
+    }
+    if (num_workers > num_jobs) {
+        num_workers = num_jobs;
+    }
+    debug_printf(1, "Building %d image(s) from '%s' with %d worker(s).\n", num_jobs, manifest_path, num_workers);
+
+    struct batch_queue queue = { .jobs = jobs, .num_jobs = num_jobs, .next_job = 0 };
+    pthread_mutex_init(&queue.lock, NULL);
+
+    pthread_t *workers = calloc((size_t)num_workers, sizeof(pthread_t));
+    if (!workers) {
+        perror("calloc failed in run_batch");
+        pthread_mutex_destroy(&queue.lock);
+        free_batch_jobs(jobs, num_jobs);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec batch_start;
+    clock_gettime(CLOCK_MONOTONIC, &batch_start);
+
+    int started = 0;
+    for (; started < num_workers; started++) {
+        if (pthread_create(&workers[started], NULL, batch_worker, &queue) != 0) {
+            fprintf(stderr, ANSI_COLOR_YELLOW "Warning: " ANSI_COLOR_RESET "Could only start %d worker thread(s).\n", started);
+            break;
+        }
+    }
+    if (started == 0) {
+        // No threads available: drain the queue on the calling thread.
+        batch_worker(&queue);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    double wall_ms = elapsed_ms_since(&batch_start);
+    free(workers);
+    pthread_mutex_destroy(&queue.lock);
+
+    int num_failed = 0;
+    double total_ms = 0.0;
+    for (int i = 0; i < num_jobs; i++) {
+        total_ms += jobs[i].elapsed_ms;
+        if (jobs[i].success) {
+            printf(ANSI_COLOR_GREEN "[ OK ]" ANSI_COLOR_RESET " %s (%s) %9.1f ms\n", jobs[i].output_filename, jobs[i].volume_name, jobs[i].elapsed_ms);
+        } else {
+            num_failed++;
+            printf(ANSI_COLOR_RED "[FAIL]" ANSI_COLOR_RESET " %s (%s) %9.1f ms\n", jobs[i].output_filename, jobs[i].volume_name, jobs[i].elapsed_ms);
+        }
+    }
+    printf("%s" "Batch: %d image(s), %d ok, %d failed in %.1f ms wall (%.1f ms summed, %d worker(s), %.1f images/s).\n" ANSI_COLOR_RESET,
+           num_failed ? ANSI_COLOR_RED : ANSI_COLOR_GREEN,
+           num_jobs, num_jobs - num_failed, num_failed, wall_ms, total_ms, started ? started : 1,
+           wall_ms > 0.0 ? num_jobs * 1000.0 / wall_ms : 0.0);
+
+    free_batch_jobs(jobs, num_jobs);
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[]) {
+    char *output_filename = NULL;
+    char *volume_name_arg = NULL;
+    char *batch_manifest = NULL;
+    int num_workers = 0;
+    int opt;
+
+    static struct option long_options[] = {
+        {"output",  required_argument, 0, 'o'},
+        {"volname", required_argument, 0, 'N'},
+        {"batch",   required_argument, 0, 'b'},
+        {"jobs",    required_argument, 0, 'j'},
+        {"type",    required_argument, 0, 't'},
+        {"fs",      required_argument, 0, 'F'},
+        {"size",    required_argument, 0, 's'},
+        {"partition", required_argument, 0, 'p'},
+        {"in-memory", no_argument,     0, 'm'},
+        {"update",  no_argument,       0, 'u'},
+        {"plan",    no_argument,       0, 'P'},
+        {"order",   required_argument, 0, 'O'},
+        {"verbose", no_argument,       0, 'v'},
+        {"help",    no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int option_index = 0;
+    while ((opt = getopt_long(argc, argv, "o:N:t:F:s:p:b:j:muPO:vh", long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 'o': output_filename = optarg; break;
+            case 'N': volume_name_arg = optarg; break;
+            case 't':
+                if (strcmp(optarg, "adf") == 0) image_type = IMAGE_ADF;
+                else if (strcmp(optarg, "hdf") == 0) image_type = IMAGE_HDF;
+                else if (strcmp(optarg, "rdb") == 0) image_type = IMAGE_RDB;
+                else {
+                    fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Unknown image type '%s' (adf, hdf or rdb).\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'F':
+                if (strcmp(optarg, "ofs") == 0) filesystem_type = ADF_DOSFS_OFS;
+                else if (strcmp(optarg, "ffs") == 0) filesystem_type = ADF_DOSFS_FFS;
+                else {
+                    fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Unknown file system '%s' (ofs or ffs).\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                if (atoi(optarg) <= 0 || atoi(optarg) > 1024 * 1024) {
+                    fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Invalid volume size '%s' (MB).\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                volume_size_mb = (unsigned)atoi(optarg);
+                break;
+            case 'p': {
+                char *separator = strchr(optarg, ':');
+                if (!separator || separator == optarg || separator[1] == '\0') {
+                    fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Expected -p <volname>:<dir>, got '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                if (num_extra_partitions == MAX_EXTRA_PARTITIONS) {
+                    fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "At most %d extra partitions are supported.\n", MAX_EXTRA_PARTITIONS);
+                    return EXIT_FAILURE;
+                }
+                *separator = '\0';
+                extra_partitions[num_extra_partitions].volume_name = optarg;
+                extra_partitions[num_extra_partitions].host_dir = separator + 1;
+                num_extra_partitions++;
+                break;
+            }
+            case 'b': batch_manifest = optarg; break;
+            case 'j': num_workers = atoi(optarg); break;
+            case 'm': build_in_memory = true; break;
+            case 'u': update_existing = true; break;
+            case 'P': plan_layout = true; break;
+            case 'O': load_order_path = optarg; break;
+            case 'v': verbosity_level++; break;
+            case 'h': print_usage(argv[0]); return EXIT_SUCCESS;
+            default: print_usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if (num_extra_partitions > 0 && (image_type != IMAGE_RDB || batch_manifest)) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "--partition needs -t rdb and cannot be used with --batch.\n");
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (batch_manifest) {
+        if (output_filename || volume_name_arg || optind < argc) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "--batch takes outputs, volume names and inputs from the manifest only.\n");
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    } else if (!output_filename || !volume_name_arg || optind >= argc) {
+        if (!output_filename) fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Output ADF filename missing.\n");
+        if (!volume_name_arg) fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "Volume name missing.\n");
+        if (optind >= argc) fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "No input files or directories specified.\n");
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (update_existing && plan_layout) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "--update and --plan cannot be combined; --plan needs an empty volume.\n");
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (load_order_path && !plan_layout && image_type == IMAGE_ADF) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: " ANSI_COLOR_RESET "--order only applies to --plan (always on for hdf and rdb).\n");
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (num_workers <= 0) {
+        long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = online_cpus > 0 ? (int)online_cpus : 1;
+    }
+
+    if (verbosity_level == 1) {
+      debug_printf(1, "Verbose mode enabled.\n");
+    } else if (verbosity_level >= 2) {
+      debug_printf(2, "Extensive debug mode enabled (level %d).\n", verbosity_level);
+    }
+
+    if (argc - optind > 0) {
+        debug_printf(2, "First input item: %s%s\n", argv[optind], (argc - optind > 1) ? " (and others)" : "");
+    }
+
+    // ADFlib setup happens once per process; batch workers share it.
+    debug_printf(2, "Initializing ADFlib with adfLibInit()...\n");
+    if (adfLibInit() != ADF_RC_OK) {
+        fprintf(stderr, ANSI_COLOR_RED "Error: Failed to initialize ADFLib.\n" ANSI_COLOR_RESET);
+        return EXIT_FAILURE;
+    }
+    debug_printf(2, "ADFlib initialized.\n");
+
+    debug_printf(2, "Explicitly adding dump device driver...\n");
+    if (adfAddDeviceDriver(&adfDeviceDriverDump) != ADF_RC_OK) {
+        fprintf(stderr, ANSI_COLOR_YELLOW "Warning: Failed to explicitly add dump device driver. Continuing anyway...\n" ANSI_COLOR_RESET);
+    } else {
+        debug_printf(2, "Dump device driver explicitly added successfully.\n");
+    }
+
+    if (build_in_memory) {
+        debug_printf(2, "Adding in-memory device driver...\n");
+        if (adfAddDeviceDriver(&mem_device_driver) != ADF_RC_OK) {
+            fprintf(stderr, ANSI_COLOR_RED "Error: Failed to add the in-memory device driver.\n" ANSI_COLOR_RESET);
+            adfLibCleanUp();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (batch_manifest) {
+        int rc = run_batch(batch_manifest, num_workers);
+        debug_printf(2, "Cleaning up ADFlib environment...\n");
+        adfLibCleanUp();
+        return rc;
+    }
+
+    struct build_job job = {
+        .output_filename = output_filename,
+        .volume_name = volume_name_arg,
+        .inputs = &argv[optind],
+        .num_inputs = argc - optind,
+    };
+    bool all_items_success = build_adf_image(&job);
+
+    debug_printf(2, "Cleaning up ADFlib environment...\n");
+    adfLibCleanUp();
+
+    if (all_items_success) {
+        printf(ANSI_COLOR_GREEN "ADF file '%s' processed successfully with disk name '%s'.\n" ANSI_COLOR_RESET, output_filename, volume_name_arg);
+        printf(ANSI_COLOR_GREEN "Processed %d input item(s).\n" ANSI_COLOR_RESET, argc - optind);
+    } else {
+        fprintf(stderr, ANSI_COLOR_RED "ADF creation completed with errors processing some items.\n" ANSI_COLOR_RESET);
+        return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;